@@ -1,27 +1,282 @@
 #include "bg_analytics.h"
+#ifndef AMALGAMATION
+  #include "hash.h"
+#endif
+
+size_t hash_pointer(const void *ptr)
+{
+  return ((size_t)ptr >> 3) * 2654435761u;
+}
+
+size_t hash_bytes(const char *s, size_t len)
+{
+  size_t rtn = 2166136261u;
+  size_t i = 0;
+
+  for(i = 0; i < len; i++)
+  {
+    rtn ^= (unsigned char)s[i];
+    rtn *= 16777619u;
+  }
+
+  return rtn;
+}
+
+void **hash_slot(struct hash_table *table, size_t hash, const void *key,
+  hash_match_fn match)
+{
+  size_t mask = table->capacity - 1;
+  size_t i = hash & mask;
+
+  while(table->slots[i] && !match(table->slots[i], key))
+  {
+    i = (i + 1) & mask;
+  }
+
+  return &table->slots[i];
+}
+
+size_t hash_grow(struct hash_table *table, size_t min)
+{
+  size_t rtn = table->capacity * 2;
+
+  if((table->count + 1) * 2 <= table->capacity)
+  {
+    return 0;
+  }
+
+  if(rtn < min)
+  {
+    rtn = min;
+  }
+
+  return rtn;
+}
+
+void **hash_rehash(struct hash_table *table, void **slots, size_t capacity,
+  hash_entry_fn hash)
+{
+  void **old = table->slots;
+  size_t oldCapacity = table->capacity;
+  size_t mask = capacity - 1;
+  size_t i = 0;
+
+  table->slots = slots;
+  table->capacity = capacity;
+
+  /* Entries are distinct so the first empty slot will do */
+  for(i = 0; i < oldCapacity; i++)
+  {
+    size_t j = 0;
+
+    if(!old[i])
+    {
+      continue;
+    }
+
+    j = hash(old[i]) & mask;
+
+    while(slots[j])
+    {
+      j = (j + 1) & mask;
+    }
+
+    slots[j] = old[i];
+  }
+
+  return old;
+}
+
 #ifndef AMALGAMATION
   #include "palloc.h"
+  #include "hash.h"
 #endif
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 
 static int registered;
 
+/*
+ * Statistics. Type strings are hashed by address into a fixed table, the
+ * index is kept with each allocation so frees are attributed in O(1). Types
+ * beyond the table's capacity share the last entry.
+ */
+#define PALLOC_TAGS 64
+#define PALLOC_TAG_OTHER PALLOC_TAGS
+
+static struct palloc_tag pallocTags[PALLOC_TAGS + 1];
+static struct palloc_stats pallocStats;
+
+static size_t palloc_tag(const char *type)
+{
+  size_t i = hash_pointer(type) & (PALLOC_TAGS - 1);
+  size_t n = 0;
+
+  for(n = 0; n < PALLOC_TAGS; n++)
+  {
+    if(pallocTags[i].type == type)
+    {
+      return i;
+    }
+
+    if(!pallocTags[i].type)
+    {
+      pallocTags[i].type = type;
+      return i;
+    }
+
+    i = (i + 1) & (PALLOC_TAGS - 1);
+  }
+
+  pallocTags[PALLOC_TAG_OTHER].type = "(other)";
+
+  return PALLOC_TAG_OTHER;
+}
+
+static void palloc_count_alloc(size_t tag, size_t size)
+{
+  pallocStats.liveBytes += size;
+  pallocStats.liveObjects++;
+  pallocStats.allocs++;
+
+  if(pallocStats.liveBytes > pallocStats.peakBytes)
+  {
+    pallocStats.peakBytes = pallocStats.liveBytes;
+  }
+
+  pallocTags[tag].count++;
+  pallocTags[tag].bytes += size;
+}
+
+static void palloc_count_free(size_t tag, size_t size)
+{
+  pallocStats.liveBytes -= size;
+  pallocStats.liveObjects--;
+  pallocStats.frees++;
+
+  pallocTags[tag].count--;
+  pallocTags[tag].bytes -= size;
+}
+
+static void palloc_count_hold(size_t size)
+{
+  pallocStats.heldBytes += size;
+
+  if(pallocStats.heldBytes > pallocStats.peakHeldBytes)
+  {
+    pallocStats.peakHeldBytes = pallocStats.heldBytes;
+  }
+}
+
+static void palloc_count_release(size_t size)
+{
+  pallocStats.heldBytes -= size;
+}
+
+void *palloc_buffer(void *ptr, size_t old, size_t size, const char *type)
+{
+  size_t tag = palloc_tag(type);
+  void *rtn = NULL;
+
+  if(size == 0)
+  {
+    if(ptr)
+    {
+      free(ptr);
+      palloc_count_free(tag, old);
+      palloc_count_release(old);
+    }
+
+    return NULL;
+  }
+
+  rtn = realloc(ptr, size);
+
+  if(!rtn)
+  {
+    return NULL;
+  }
+
+  if(ptr)
+  {
+    palloc_count_free(tag, old);
+    palloc_count_release(old);
+  }
+
+  palloc_count_alloc(tag, size);
+  palloc_count_hold(size);
+
+  return rtn;
+}
+
+void palloc_stats(struct palloc_stats *out)
+{
+  *out = pallocStats;
+}
+
+size_t palloc_tags(struct palloc_tag *out, size_t max)
+{
+  size_t rtn = 0;
+  size_t i = 0;
+
+  for(i = 0; i <= PALLOC_TAG_OTHER; i++)
+  {
+    if(pallocTags[i].count == 0)
+    {
+      continue;
+    }
+
+    if(rtn < max)
+    {
+      out[rtn] = pallocTags[i];
+    }
+
+    rtn++;
+  }
+
+  return rtn;
+}
+
+/*
+ * Debug pool. Entries are found by pointer through an open addressed index
+ * and freed entries wait for reuse in a bucket per (type, size), so both
+ * palloc and pfree are O(1) however many allocations have been made.
+ */
+#define POOL_MIN_CAPACITY 256
+#define POOL_BUCKETS 256
+
+struct PoolBucket
+{
+  char *type;
+  size_t size;
+  size_t hash;
+  struct PoolEntry *free;
+  struct PoolBucket *next;
+};
+
 struct PoolEntry
 {
   void *ptr;
   size_t size;
   char *type;
+  size_t tag;
   int used;
+  struct PoolBucket *bucket;
+  struct PoolEntry *nextFree;
   struct PoolEntry *next;
 };
 
 struct PoolEntry *poolHead;
 
+static struct hash_table poolIndex;
+static struct PoolBucket *poolBuckets[POOL_BUCKETS];
+
 void pool_cleanup()
 {
   struct PoolEntry *curr = poolHead;
+  size_t i = 0;
 
   printf("[palloc]Evaluating memory...\n");
 
@@ -38,7 +293,6 @@ void pool_cleanup()
     }
     else
     {
-      size_t i = 0;
       char *ptr = (char*)curr->ptr;
       int dirty = 0;
 
@@ -62,1580 +316,5532 @@ void pool_cleanup()
 
     curr = curr->next;
 
+    palloc_count_release(sizeof(*tmp) + tmp->size);
     free(tmp->ptr);
-    free(tmp->type);
     free(tmp);
   }
 
   poolHead = NULL;
-}
-
-#ifdef PALLOC_ACTIVE
-void pfree(void *ptr)
-{
-  struct PoolEntry *entry = poolHead;
 
-  while(entry)
+  for(i = 0; i < POOL_BUCKETS; i++)
   {
-    if(entry->ptr == ptr)
+    while(poolBuckets[i])
     {
-      if(!entry->used)
-      {
-        printf("Error: Memory already freed\n");
-      }
+      struct PoolBucket *tmp = poolBuckets[i];
 
-#ifdef PALLOC_DEBUG
-      printf("Freeing: %s\n", entry->type);
-#endif
-      memset(entry->ptr, PALLOC_SENTINEL, entry->size);
-      entry->used = 0;
-      return;
+      poolBuckets[i] = tmp->next;
+      free(tmp->type);
+      free(tmp);
     }
-
-    entry = entry->next;
   }
 
-  printf("Error: Memory not managed by pool\n");
+  free(poolIndex.slots);
+  poolIndex.slots = NULL;
+  poolIndex.capacity = 0;
+  poolIndex.count = 0;
 }
-#else
-void pfree(void *ptr)
+
+#ifndef PALLOC_ACTIVE
+#define PALLOC_LARGE 0xff
+#define PALLOC_CLASS_MASK 0xff
+#define PALLOC_TAG_SHIFT 8
+
+union PallocHeader
+{
+  size_t cls;
+  void *next;
+  double align;
+};
+
+/* Large blocks carry their size in front of the class header */
+static void *palloc_large(size_t size, const char *type)
+{
+  union PallocHeader *header = NULL;
+  size_t tag = palloc_tag(type);
+
+  header = (union PallocHeader *)malloc(sizeof(*header) * 2 + size);
+  if(!header) return NULL;
+
+  header[0].cls = size;
+  header[1].cls = PALLOC_LARGE | tag << PALLOC_TAG_SHIFT;
+  palloc_count_alloc(tag, size);
+  palloc_count_hold(sizeof(*header) * 2 + size);
+
+  return header + 2;
+}
+
+static void palloc_large_free(union PallocHeader *header)
 {
-  free(ptr);
+  header--;
+  palloc_count_free(header[1].cls >> PALLOC_TAG_SHIFT, header[0].cls);
+  palloc_count_release(sizeof(*header) * 2 + header[0].cls);
+  free(header);
 }
 #endif
 
 #ifdef PALLOC_ACTIVE
-void *_palloc(size_t size, const char *type)
+static int pool_match(const void *entry, const void *ptr)
 {
-  struct PoolEntry *entry = poolHead;
+  return ((const struct PoolEntry *)entry)->ptr == ptr;
+}
 
-  if(!registered)
+static size_t pool_entry_hash(const void *entry)
+{
+  return hash_pointer(((const struct PoolEntry *)entry)->ptr);
+}
+
+static struct PoolEntry *pool_find(const void *ptr)
+{
+  if(poolIndex.count == 0)
   {
-    printf("[palloc]Registering hook...\n");
-    registered = 1;
-    atexit(pool_cleanup);
+    return NULL;
   }
 
-  while(entry)
+  return (struct PoolEntry *)*hash_slot(&poolIndex, hash_pointer(ptr), ptr,
+    pool_match);
+}
+
+static int pool_index(struct PoolEntry *entry)
+{
+  /* The index itself can not come from the pool */
+  size_t capacity = hash_grow(&poolIndex, POOL_MIN_CAPACITY);
+
+  if(capacity)
   {
-    if(!entry->used && strcmp(type, entry->type) == 0)
+    void **slots = (void **)calloc(capacity, sizeof(void *));
+
+    if(!slots)
     {
-      char *ptr = (char *)entry->ptr;
-      size_t i = 0;
-      int dirty = 0;
+      printf("Error: Failed to allocate\n");
+      return 0;
+    }
 
-#ifdef PALLOC_DEBUG
-      printf("Reusing: %s\n", type);
-#endif
+    free(hash_rehash(&poolIndex, slots, capacity, pool_entry_hash));
+  }
 
-      for(i = 0; i < entry->size; i++)
-      {
-        if(*ptr != PALLOC_SENTINEL)
-        {
-          dirty = 1;
-          break;
-        }
+  *hash_slot(&poolIndex, hash_pointer(entry->ptr), entry->ptr, pool_match) =
+    entry;
+  poolIndex.count++;
 
-        ptr++;
-      }
+  return 1;
+}
 
-      if(dirty)
-      {
-        printf("[palloc]Use after free\n");
-        printf("  Type: %s\n", entry->type);
-        printf("  Size: %i\n", (int)entry->size);
-      }
+static struct PoolBucket *pool_bucket(const char *type, size_t size)
+{
+  struct PoolBucket *rtn = NULL;
+  size_t hash = 2166136261u;
+  const char *c = type;
 
-      entry->used = 1;
+  for(c = type; *c; c++)
+  {
+    hash ^= (unsigned char)*c;
+    hash *= 16777619u;
+  }
 
-      if(PALLOC_SENTINEL != 0)
-      {
-        memset(entry->ptr, 0, entry->size);
-      }
+  hash ^= size;
 
-      return entry->ptr;
+  for(rtn = poolBuckets[hash % POOL_BUCKETS]; rtn; rtn = rtn->next)
+  {
+    if(rtn->hash == hash && rtn->size == size && strcmp(rtn->type, type) == 0)
+    {
+      return rtn;
     }
-
-    entry = entry->next;
   }
 
-#ifdef PALLOC_DEBUG
-  printf("Allocating: %s\n", type);
-#endif
-  entry = (struct PoolEntry *)calloc(1, sizeof(*entry));
-  if(!entry) return NULL;
+  rtn = (struct PoolBucket *)calloc(1, sizeof(*rtn));
+  if(!rtn) return NULL;
 
-  entry->ptr = calloc(1, size);
+  rtn->type = (char *)calloc(strlen(type) + 1, sizeof(char));
 
-  if(!entry->ptr)
+  if(!rtn->type)
   {
-    free(entry);
+    free(rtn);
     return NULL;
   }
 
-  entry->size = size;
-  entry->type = (char *)calloc(strlen(type) + 1, sizeof(char));
-  strcpy(entry->type, type);
-  entry->used = 1;
-
-  entry->next = poolHead;
-  poolHead = entry;
+  strcpy(rtn->type, type);
+  rtn->size = size;
+  rtn->hash = hash;
+  rtn->next = poolBuckets[hash % POOL_BUCKETS];
+  poolBuckets[hash % POOL_BUCKETS] = rtn;
 
-  return entry->ptr;
+  return rtn;
 }
-#else
-void *_palloc(size_t size, const char *type)
+
+void pfree(void *ptr)
 {
-  void *rtn = NULL;
+  struct PoolEntry *entry = pool_find(ptr);
 
-  rtn = calloc(1, size);
+  if(!entry)
+  {
+    printf("Error: Memory not managed by pool\n");
+    return;
+  }
 
-  return rtn;
-}
-#endif
+  if(!entry->used)
+  {
+    printf("Error: Memory already freed\n");
+    return;
+  }
 
-#ifndef AMALGAMATION
-  #include "vector.h"
-  #include "palloc.h"
+#ifdef PALLOC_DEBUG
+  printf("Freeing: %s\n", entry->type);
 #endif
+  palloc_count_free(entry->tag, entry->size);
 
-#include <string.h>
+  memset(entry->ptr, PALLOC_SENTINEL, entry->size);
+  entry->used = 0;
 
-void *_VectorNew(size_t size, const char *type)
-{
-  struct _Vector *rtn = NULL;
-  char typeStr[256] = {0};
+  entry->nextFree = entry->bucket->free;
+  entry->bucket->free = entry;
+}
+#elif defined(PALLOC_SLAB)
+/*
+ * Size class allocator. Every block is preceded by a header holding its class
+ * and statistics tag so pfree can push it back onto the matching free list in
+ * O(1). Each class carves its blocks out of its own pages. Blocks larger than
+ * the biggest class go straight to malloc with their size in a second header.
+ */
+#define PALLOC_PAGE_SIZE 65536
+#define PALLOC_CLASSES 12
+#define PALLOC_GRANULE 16
+#define PALLOC_MAX_SMALL 1024
 
-  strcpy(typeStr, "vector(");
-  strcat(typeStr, type);
-  strcat(typeStr, ")");
-  rtn = (struct _Vector *)_palloc(sizeof(*rtn), typeStr);
+static const size_t pallocClassSize[PALLOC_CLASSES] =
+{
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
 
-  strcpy(typeStr, "vector_header(");
-  strcat(typeStr, type);
-  strcat(typeStr, ")");
-  rtn->vh = (struct _VectorHeader *)_palloc(sizeof(*rtn->vh), typeStr);
-  rtn->vh->entrySize = size;
+/* Class for each size rounded up to the granule, indexed by size / granule */
+static const unsigned char pallocClassIndex[] =
+{
+  0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7,
+  7, 8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9,
+  9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+  10, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+  11
+};
 
-  return rtn;
-}
+static void *pallocFree[PALLOC_CLASSES];
+static char *pallocCursor[PALLOC_CLASSES];
+static char *pallocEnd[PALLOC_CLASSES];
+static union PallocHeader *pallocPages;
+static size_t pallocLive;
 
-int _VectorOobAssert(void *_vh, size_t idx)
+static int palloc_new_page(size_t cls)
 {
-  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+  union PallocHeader *page = NULL;
 
-  if(vh->size <= idx)
+  page = (union PallocHeader *)malloc(PALLOC_PAGE_SIZE);
+
+  if(!page)
   {
-    printf("Error: Index out of bounds\n");
-    return 1;
+    return 0;
   }
 
-  return 0;
+  page->next = pallocPages;
+  pallocPages = page;
+  palloc_count_hold(PALLOC_PAGE_SIZE);
+
+  pallocCursor[cls] = (char *)(page + 1);
+  pallocEnd[cls] = (char *)page + PALLOC_PAGE_SIZE;
+
+  return 1;
 }
 
-void _VectorErase(void *_vh, void *_v, size_t idx)
+void pfree(void *ptr)
 {
-  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
-  struct _Vector *v = (struct _Vector *)_v;
-  size_t restSize = (vh->size - (idx + 1)) * vh->entrySize;
+  union PallocHeader *header = NULL;
+  size_t cls = 0;
 
-  _VectorOobAssert(_vh, idx);
+  if(!ptr) return;
 
-  if(restSize > 0)
+  header = (union PallocHeader *)ptr - 1;
+  cls = header->cls & PALLOC_CLASS_MASK;
+
+  if(cls == PALLOC_LARGE)
   {
-    char *element = (char *)v->data + idx * vh->entrySize;
-    char *rest = element + vh->entrySize;
-    memmove(element, rest, restSize);
+    palloc_large_free(header);
+    return;
   }
 
-  vh->size --;
+  palloc_count_free(header->cls >> PALLOC_TAG_SHIFT, pallocClassSize[cls]);
+
+  /* The link lives in the user part, the header keeps the class */
+  *(void **)ptr = pallocFree[cls];
+  pallocFree[cls] = ptr;
+  pallocLive--;
 }
 
-void _VectorResize(void *_vh, void *_v, size_t size)
+/* Release every page, only possible once no small block is in use */
+void palloc_trim()
 {
-  struct _Vector *v = (struct _Vector *)_v;
-  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+  if(pallocLive > 0) return;
 
-  if(vh->size == size)
+  while(pallocPages)
   {
-    return;
+    union PallocHeader *tmp = pallocPages;
+
+    pallocPages = (union PallocHeader *)pallocPages->next;
+    free(tmp);
+    palloc_count_release(PALLOC_PAGE_SIZE);
   }
-  else if(size == 0)
+
+  memset(pallocFree, 0, sizeof(pallocFree));
+  memset(pallocCursor, 0, sizeof(pallocCursor));
+  memset(pallocEnd, 0, sizeof(pallocEnd));
+}
+#else
+void pfree(void *ptr)
+{
+  if(!ptr) return;
+
+  palloc_large_free((union PallocHeader *)ptr - 1);
+}
+
+void palloc_trim()
+{
+}
+#endif
+
+#ifdef PALLOC_ACTIVE
+void *_palloc(size_t size, const char *type)
+{
+  struct PoolBucket *bucket = NULL;
+  struct PoolEntry *entry = NULL;
+
+  if(!registered)
   {
-    if(v->data)
-    {
-      free(v->data);
-      v->data = NULL;
-    }
+    printf("[palloc]Registering hook...\n");
+    registered = 1;
+    atexit(pool_cleanup);
   }
-  else if(vh->size > size)
+
+  bucket = pool_bucket(type, size);
+  if(!bucket) return NULL;
+
+  entry = bucket->free;
+
+  if(entry)
   {
-    v->data = realloc(v->data, size * vh->entrySize);
+    char *ptr = (char *)entry->ptr;
+    size_t i = 0;
+    int dirty = 0;
+
+#ifdef PALLOC_DEBUG
+    printf("Reusing: %s\n", type);
+#endif
 
-    if(!v->data)
+    for(i = 0; i < entry->size; i++)
     {
-      /* TODO: Should cache and revert */
-      printf("Error: Failed to reallocate\n");
-    }
-  }
-  else if(vh->size < size)
-  {
-    char *cur = NULL;
-    char *last = NULL;
+      if(*ptr != PALLOC_SENTINEL)
+      {
+        dirty = 1;
+        break;
+      }
 
-    v->data = realloc(v->data, size * vh->entrySize);
+      ptr++;
+    }
 
-    if(!v->data)
+    if(dirty)
     {
-      /* TODO: Should cache and revert */
-      printf("Error: Failed to reallocate\n");
+      printf("[palloc]Use after free\n");
+      printf("  Type: %s\n", entry->type);
+      printf("  Size: %i\n", (int)entry->size);
     }
 
-    cur = (char *)v->data;
-    cur += vh->size * vh->entrySize;
-    last = (char *)v->data;
-    last += size * vh->entrySize;
+    bucket->free = entry->nextFree;
+    entry->nextFree = NULL;
+    entry->used = 1;
+    entry->tag = palloc_tag(type);
+    palloc_count_alloc(entry->tag, size);
 
-    while(cur != last)
+    if(PALLOC_SENTINEL != 0)
     {
-      *cur = 0;
-      cur++;
+      memset(entry->ptr, 0, entry->size);
     }
+
+    return entry->ptr;
   }
 
-  vh->size = size;
+#ifdef PALLOC_DEBUG
+  printf("Allocating: %s\n", type);
+#endif
+  entry = (struct PoolEntry *)calloc(1, sizeof(*entry));
+  if(!entry) return NULL;
+
+  entry->ptr = calloc(1, size);
+
+  if(!entry->ptr)
+  {
+    free(entry);
+    return NULL;
+  }
+
+  if(!pool_index(entry))
+  {
+    free(entry->ptr);
+    free(entry);
+    return NULL;
+  }
+
+  entry->size = size;
+  entry->bucket = bucket;
+  entry->type = bucket->type;
+  entry->used = 1;
+  entry->tag = palloc_tag(type);
+  palloc_count_alloc(entry->tag, size);
+  palloc_count_hold(sizeof(*entry) + size);
+
+  entry->next = poolHead;
+  poolHead = entry;
+
+  return entry->ptr;
 }
 
-size_t _VectorSize(void *_vh)
+void *_palloc_uninit(size_t size, const char *type)
 {
-  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
-
-  return vh->size;
+  return _palloc(size, type);
 }
 
-void _VectorDelete(void *_vh, void *_v)
+void palloc_trim()
 {
-  struct _Vector *v = (struct _Vector *)_v;
-  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+}
+#elif defined(PALLOC_SLAB)
+void *_palloc_uninit(size_t size, const char *type)
+{
+  union PallocHeader *header = NULL;
+  size_t cls = 0;
+  size_t tag = 0;
+  size_t stride = 0;
 
-  if(v->vh != vh)
+  if(size > PALLOC_MAX_SMALL)
   {
-    printf("Error: Invalid vector\n");
+    return palloc_large(size, type);
   }
 
-  if(v->data)
+  cls = pallocClassIndex[(size + PALLOC_GRANULE - 1) / PALLOC_GRANULE];
+  tag = palloc_tag(type);
+
+  if(pallocFree[cls])
   {
-    free(v->data);
+    void *rtn = pallocFree[cls];
+
+    pallocFree[cls] = *(void **)rtn;
+    ((union PallocHeader *)rtn - 1)->cls = cls | tag << PALLOC_TAG_SHIFT;
+    palloc_count_alloc(tag, pallocClassSize[cls]);
+    pallocLive++;
+
+    return rtn;
   }
 
-  pfree(vh);
-  pfree(v);
-}
+  stride = sizeof(*header) + pallocClassSize[cls];
 
+  if(pallocEnd[cls] - pallocCursor[cls] < (ptrdiff_t)stride)
+  {
+    if(!palloc_new_page(cls)) return NULL;
+  }
 
-#ifndef AMALGAMATION
-  #include "sstream.h"
-  #include "palloc.h"
-#endif
+  header = (union PallocHeader *)pallocCursor[cls];
+  pallocCursor[cls] += stride;
+  header->cls = cls | tag << PALLOC_TAG_SHIFT;
+  palloc_count_alloc(tag, pallocClassSize[cls]);
+  pallocLive++;
 
-#include <string.h>
-#include <stdio.h>
+  return header + 1;
+}
 
-struct sstream *sstream_new()
+void *_palloc(size_t size, const char *type)
 {
-  struct sstream *rtn = NULL;
+  void *rtn = _palloc_uninit(size, type);
 
-  rtn = palloc(struct sstream);
+  if(rtn)
+  {
+    memset(rtn, 0, size);
+  }
 
   return rtn;
 }
-
-void sstream_clear(struct sstream *ctx)
+#else
+void *_palloc(size_t size, const char *type)
 {
-  struct Chunk *curr = ctx->first;
+  void *rtn = palloc_large(size, type);
 
-  while(curr)
+  if(rtn)
   {
-    struct Chunk *tmp = curr;
-
-    curr = curr->next;
-    if(tmp->s) free(tmp->s);
-    pfree(tmp);
+    memset(rtn, 0, size);
   }
 
-  ctx->first = NULL;
+  return rtn;
 }
 
-void sstream_delete(struct sstream *ctx)
+void *_palloc_uninit(size_t size, const char *type)
 {
-  sstream_clear(ctx);
-  pfree(ctx);
+  return palloc_large(size, type);
 }
+#endif
 
-void sstream_push_int(struct sstream *ctx, int val)
-{
-  char buffer[128] = {0};
-
-  sprintf(buffer, "%i", val);
-  sstream_push_cstr(ctx, buffer);
-}
+#ifndef AMALGAMATION
+  #include "number.h"
+#endif
 
-void sstream_push_float(struct sstream *ctx, float val)
-{
-  char buffer[128] = {0};
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
 
-  sprintf(buffer, "%f", val);
-  sstream_push_cstr(ctx, buffer);
-}
+#define NUMBER_U64(H, L) \
+  (((uint64_t)(H) << 32) | (uint64_t)(L))
 
-void sstream_push_double(struct sstream *ctx, double val)
+/*
+ * Floating point value f * 2^e with a full 64 bit significand. This is the
+ * "do it yourself floating point" type the Grisu algorithm is built on.
+ */
+struct NumberFp
 {
-  char buffer[128] = {0};
-
-  sprintf(buffer, "%f", val);
-  sstream_push_cstr(ctx, buffer);
-}
+  uint64_t f;
+  int e;
+};
 
-void sstream_push_char(struct sstream *ctx, char val)
+/* Normalized powers of ten 10^-348, 10^-340, ..., 10^340 */
+static const uint64_t numberPowersF[] =
 {
-/*
-  char buffer[2] = {0};
-
-  buffer[0] = val;
-  sstream_push_cstr(ctx, buffer);
-*/
-
-  struct Chunk *nc = NULL;
-  struct Chunk *curr = NULL;
+  NUMBER_U64(0xfa8fd5a0, 0x081c0288), NUMBER_U64(0xbaaee17f, 0xa23ebf76), NUMBER_U64(0x8b16fb20, 0x3055ac76),
+  NUMBER_U64(0xcf42894a, 0x5dce35ea), NUMBER_U64(0x9a6bb0aa, 0x55653b2d), NUMBER_U64(0xe61acf03, 0x3d1a45df),
+  NUMBER_U64(0xab70fe17, 0xc79ac6ca), NUMBER_U64(0xff77b1fc, 0xbebcdc4f), NUMBER_U64(0xbe5691ef, 0x416bd60c),
+  NUMBER_U64(0x8dd01fad, 0x907ffc3c), NUMBER_U64(0xd3515c28, 0x31559a83), NUMBER_U64(0x9d71ac8f, 0xada6c9b5),
+  NUMBER_U64(0xea9c2277, 0x23ee8bcb), NUMBER_U64(0xaecc4991, 0x4078536d), NUMBER_U64(0x823c1279, 0x5db6ce57),
+  NUMBER_U64(0xc2109436, 0x4dfb5637), NUMBER_U64(0x9096ea6f, 0x3848984f), NUMBER_U64(0xd77485cb, 0x25823ac7),
+  NUMBER_U64(0xa086cfcd, 0x97bf97f4), NUMBER_U64(0xef340a98, 0x172aace5), NUMBER_U64(0xb23867fb, 0x2a35b28e),
+  NUMBER_U64(0x84c8d4df, 0xd2c63f3b), NUMBER_U64(0xc5dd4427, 0x1ad3cdba), NUMBER_U64(0x936b9fce, 0xbb25c996),
+  NUMBER_U64(0xdbac6c24, 0x7d62a584), NUMBER_U64(0xa3ab6658, 0x0d5fdaf6), NUMBER_U64(0xf3e2f893, 0xdec3f126),
+  NUMBER_U64(0xb5b5ada8, 0xaaff80b8), NUMBER_U64(0x87625f05, 0x6c7c4a8b), NUMBER_U64(0xc9bcff60, 0x34c13053),
+  NUMBER_U64(0x964e858c, 0x91ba2655), NUMBER_U64(0xdff97724, 0x70297ebd), NUMBER_U64(0xa6dfbd9f, 0xb8e5b88f),
+  NUMBER_U64(0xf8a95fcf, 0x88747d94), NUMBER_U64(0xb9447093, 0x8fa89bcf), NUMBER_U64(0x8a08f0f8, 0xbf0f156b),
+  NUMBER_U64(0xcdb02555, 0x653131b6), NUMBER_U64(0x993fe2c6, 0xd07b7fac), NUMBER_U64(0xe45c10c4, 0x2a2b3b06),
+  NUMBER_U64(0xaa242499, 0x697392d3), NUMBER_U64(0xfd87b5f2, 0x8300ca0e), NUMBER_U64(0xbce50864, 0x92111aeb),
+  NUMBER_U64(0x8cbccc09, 0x6f5088cc), NUMBER_U64(0xd1b71758, 0xe219652c), NUMBER_U64(0x9c400000, 0x00000000),
+  NUMBER_U64(0xe8d4a510, 0x00000000), NUMBER_U64(0xad78ebc5, 0xac620000), NUMBER_U64(0x813f3978, 0xf8940984),
+  NUMBER_U64(0xc097ce7b, 0xc90715b3), NUMBER_U64(0x8f7e32ce, 0x7bea5c70), NUMBER_U64(0xd5d238a4, 0xabe98068),
+  NUMBER_U64(0x9f4f2726, 0x179a2245), NUMBER_U64(0xed63a231, 0xd4c4fb27), NUMBER_U64(0xb0de6538, 0x8cc8ada8),
+  NUMBER_U64(0x83c7088e, 0x1aab65db), NUMBER_U64(0xc45d1df9, 0x42711d9a), NUMBER_U64(0x924d692c, 0xa61be758),
+  NUMBER_U64(0xda01ee64, 0x1a708dea), NUMBER_U64(0xa26da399, 0x9aef774a), NUMBER_U64(0xf209787b, 0xb47d6b85),
+  NUMBER_U64(0xb454e4a1, 0x79dd1877), NUMBER_U64(0x865b8692, 0x5b9bc5c2), NUMBER_U64(0xc83553c5, 0xc8965d3d),
+  NUMBER_U64(0x952ab45c, 0xfa97a0b3), NUMBER_U64(0xde469fbd, 0x99a05fe3), NUMBER_U64(0xa59bc234, 0xdb398c25),
+  NUMBER_U64(0xf6c69a72, 0xa3989f5c), NUMBER_U64(0xb7dcbf53, 0x54e9bece), NUMBER_U64(0x88fcf317, 0xf22241e2),
+  NUMBER_U64(0xcc20ce9b, 0xd35c78a5), NUMBER_U64(0x98165af3, 0x7b2153df), NUMBER_U64(0xe2a0b5dc, 0x971f303a),
+  NUMBER_U64(0xa8d9d153, 0x5ce3b396), NUMBER_U64(0xfb9b7cd9, 0xa4a7443c), NUMBER_U64(0xbb764c4c, 0xa7a44410),
+  NUMBER_U64(0x8bab8eef, 0xb6409c1a), NUMBER_U64(0xd01fef10, 0xa657842c), NUMBER_U64(0x9b10a4e5, 0xe9913129),
+  NUMBER_U64(0xe7109bfb, 0xa19c0c9d), NUMBER_U64(0xac2820d9, 0x623bf429), NUMBER_U64(0x80444b5e, 0x7aa7cf85),
+  NUMBER_U64(0xbf21e440, 0x03acdd2d), NUMBER_U64(0x8e679c2f, 0x5e44ff8f), NUMBER_U64(0xd433179d, 0x9c8cb841),
+  NUMBER_U64(0x9e19db92, 0xb4e31ba9), NUMBER_U64(0xeb96bf6e, 0xbadf77d9), NUMBER_U64(0xaf87023b, 0x9bf0ee6b)
+};
 
-  nc = palloc(struct Chunk);
-  nc->c = val;
-  nc->len = 1;
+static const short numberPowersE[] =
+{
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066
+};
 
-  if(!ctx->first)
-  {
-    ctx->first = nc;
-    return;
-  }
+static const uint32_t numberPow10[] =
+{
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
 
-  curr = ctx->first;
+static const char numberDigits[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static struct NumberFp number_fp_normalize(struct NumberFp v)
+{
+#ifdef __GNUC__
+  int shift = __builtin_clzll(v.f);
 
-  while(curr->next)
+  v.f <<= shift;
+  v.e -= shift;
+#else
+  while(!(v.f & NUMBER_U64(0x80000000, 0x00000000)))
   {
-    curr = curr->next;
+    v.f <<= 1;
+    v.e--;
   }
+#endif
 
-  curr->next = nc;
+  return v;
 }
 
-void sstream_push_cstr(struct sstream *ctx, const char *s)
+/* Product of two values, rounded to the upper 64 bits of the significand */
+static struct NumberFp number_fp_multiply(struct NumberFp x, struct NumberFp y)
 {
-  struct Chunk *nc = NULL;
-  struct Chunk *curr = NULL;
-  size_t len = strlen(s);
+  struct NumberFp rtn = {0};
+  uint64_t m32 = 0xFFFFFFFF;
+  uint64_t a = x.f >> 32;
+  uint64_t b = x.f & m32;
+  uint64_t c = y.f >> 32;
+  uint64_t d = y.f & m32;
+  uint64_t ac = a * c;
+  uint64_t bc = b * c;
+  uint64_t ad = a * d;
+  uint64_t bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+
+  tmp += (uint64_t)1 << 31;
+  rtn.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  rtn.e = x.e + y.e + 64;
 
-  if(len < 1) return;
+  return rtn;
+}
 
-  nc = palloc(struct Chunk);
-  nc->s = (char *)malloc(sizeof(char) * (len + 1));
-  strcpy(nc->s, s);
-  nc->len = len;
+/* Cached power of ten c so that c * 2^e has its exponent in [-60, -32] */
+static struct NumberFp number_cached_power(int e, int *K)
+{
+  struct NumberFp rtn = {0};
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int k = (int)dk;
+  int index = 0;
 
-  if(!ctx->first)
+  if(dk - k > 0.0)
   {
-    ctx->first = nc;
-    return;
+    k++;
   }
 
-  curr = ctx->first;
+  index = (k >> 3) + 1;
+  *K = -(-348 + index * 8);
 
-  while(curr->next)
-  {
-    curr = curr->next;
-  }
+  rtn.f = numberPowersF[index];
+  rtn.e = numberPowersE[index];
 
-  curr->next = nc;
+  return rtn;
 }
 
-void sstream_collate(struct sstream *ctx)
+static int number_count_digits(uint32_t n)
 {
-  size_t allocSize = 0;
-  struct Chunk *curr = ctx->first;
-  char *ns = NULL;
+  int rtn = 1;
 
-  if(!curr) return;
-
-  if(curr->s)
+  while(rtn < 10 && n >= numberPow10[rtn])
   {
-    if(!curr->next) return;
+    rtn++;
   }
 
-  while(curr)
+  return rtn;
+}
+
+static void number_grisu_round(char *buf, int len, uint64_t delta,
+  uint64_t rest, uint64_t tenKappa, uint64_t wpw)
+{
+  while(rest < wpw && delta - rest >= tenKappa &&
+    (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw))
   {
-    allocSize += curr->len;
-    curr = curr->next;
+    buf[len - 1]--;
+    rest += tenKappa;
   }
+}
 
-  allocSize++;
-  ns = (char *)malloc(allocSize * sizeof(char));
-  ns[0] = '\0';
-  curr = ctx->first;
-
-  while(curr)
+static void number_digit_gen(struct NumberFp W, struct NumberFp Mp,
+  uint64_t delta, char *buf, int *len, int *K)
+{
+  struct NumberFp one = {0};
+  uint64_t wpw = Mp.f - W.f;
+  uint32_t p1 = 0;
+  uint64_t p2 = 0;
+  int kappa = 0;
+
+  one.f = (uint64_t)1 << -Mp.e;
+  one.e = Mp.e;
+  p1 = (uint32_t)(Mp.f >> -one.e);
+  p2 = Mp.f & (one.f - 1);
+  kappa = number_count_digits(p1);
+  *len = 0;
+
+  /* Integral part */
+  while(kappa > 0)
   {
-    struct Chunk *tmp = curr;
+    uint32_t d = p1 / numberPow10[kappa - 1];
+    uint64_t rest = 0;
 
-    if(!curr->s)
-    {
-      char cs[2] = {0};
+    p1 %= numberPow10[kappa - 1];
 
-      cs[0] = curr->c;
-      strcat(ns, cs);
-    }
-    else
+    if(d || *len)
     {
-      strcat(ns, curr->s);
+      buf[(*len)++] = (char)('0' + d);
     }
 
-    curr = curr->next;
-    if(tmp->s) free(tmp->s);
-    pfree(tmp);
-  }
+    kappa--;
+    rest = ((uint64_t)p1 << -one.e) + p2;
 
-  ctx->first = palloc(struct Chunk);
-  ctx->first->s = ns;
-  ctx->first->len = allocSize - 1;
-}
+    if(rest <= delta)
+    {
+      *K += kappa;
+      number_grisu_round(buf, *len, delta, rest,
+        (uint64_t)numberPow10[kappa] << -one.e, wpw);
 
-char *sstream_cstr(struct sstream *ctx)
-{
-  sstream_collate(ctx);
+      return;
+    }
+  }
 
-  /* TODO */
-  if(!ctx->first) return (char *)"";
+  /* Fractional part */
+  for(;;)
+  {
+    char d = 0;
+    int index = 0;
 
-  return ctx->first->s;
-}
+    p2 *= 10;
+    delta *= 10;
+    d = (char)(p2 >> -one.e);
 
-size_t sstream_length(struct sstream *ctx)
-{
-  sstream_collate(ctx);
+    if(d || *len)
+    {
+      buf[(*len)++] = (char)('0' + d);
+    }
 
-  if(!ctx->first) return 0;
+    p2 &= one.f - 1;
+    kappa--;
+
+    if(p2 < delta)
+    {
+      *K += kappa;
+      index = -kappa;
+      number_grisu_round(buf, *len, delta, p2, one.f,
+        wpw * (index < 10 ? numberPow10[index] : 0));
 
-  return ctx->first->len;
+      return;
+    }
+  }
 }
 
-int sstream_int(struct sstream *ctx)
+/*
+ * Round-trip digits for the positive value f * 2^e, usually but not always
+ * the shortest, where closer is set if the lower neighbour is half as far
+ * away as the upper one (f is a power of two).
+ * The result is digits[0..len) * 10^K.
+ */
+static void number_grisu2(uint64_t f, int e, int closer, char *digits,
+  int *len, int *K)
 {
-  sstream_collate(ctx);
+  struct NumberFp v = {0};
+  struct NumberFp mp = {0};
+  struct NumberFp mm = {0};
+  struct NumberFp c = {0};
+  struct NumberFp W = {0};
+  struct NumberFp Wp = {0};
+  struct NumberFp Wm = {0};
+
+  v.f = f;
+  v.e = e;
+
+  mp.f = (f << 1) + 1;
+  mp.e = e - 1;
+  mp = number_fp_normalize(mp);
+
+  if(closer)
+  {
+    mm.f = (f << 2) - 1;
+    mm.e = e - 2;
+  }
+  else
+  {
+    mm.f = (f << 1) - 1;
+    mm.e = e - 1;
+  }
+
+  mm.f <<= mm.e - mp.e;
+  mm.e = mp.e;
 
-  if(!ctx->first) return 0;
+  c = number_cached_power(mp.e, K);
+  W = number_fp_multiply(number_fp_normalize(v), c);
+  Wp = number_fp_multiply(mp, c);
+  Wm = number_fp_multiply(mm, c);
+  Wm.f++;
+  Wp.f--;
 
-  return atoi(ctx->first->s);
+  number_digit_gen(W, Wp, Wp.f - Wm.f, digits, len, K);
 }
 
-char sstream_at(struct sstream *ctx, size_t i)
+static size_t number_write_u32(char *buf, uint32_t val)
 {
-  sstream_collate(ctx);
+  char tmp[10] = {0};
+  char *p = tmp + sizeof(tmp);
+  size_t len = 0;
 
-  if(!ctx->first)
+  while(val >= 100)
   {
-    printf("Error: Stream is empty\n");
-    abort();
-  }
+    size_t i = (val % 100) * 2;
 
-  if(i >= ctx->first->len)
-  {
-    printf("Error: Index out of bounds\n");
-    abort();
+    val /= 100;
+    *--p = numberDigits[i + 1];
+    *--p = numberDigits[i];
   }
 
-  return ctx->first->s[i];
-}
+  if(val >= 10)
+  {
+    size_t i = val * 2;
 
-void sstream_push_chars(struct sstream *ctx, char *values, size_t count)
-{
-  char *tmp = NULL;
+    *--p = numberDigits[i + 1];
+    *--p = numberDigits[i];
+  }
+  else
+  {
+    *--p = (char)('0' + val);
+  }
 
-  tmp = (char *)malloc(sizeof(char) * (count + 1));
-  tmp[count] = 0;
-  memcpy(tmp, values, sizeof(char) * count);
-  sstream_push_cstr(ctx, tmp);
+  len = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, len);
+  buf[len] = '\0';
 
-  free(tmp);
+  return len;
 }
 
-void sstream_split(struct sstream *ctx, char token,
-  vector(struct sstream*) *out)
+/*
+ * Lay out digits[0..len) * 10^K in the same style as JavaScript, plain
+ * notation for decimal exponents in [-6, 21) and exponent notation outside.
+ */
+static size_t number_prettify(char *buf, const char *digits, int len, int K)
 {
-  size_t i = 0;
-  struct sstream *curr = NULL;
-
-  curr = sstream_new();
+  char *p = buf;
+  int kk = len + K;
+  int i = 0;
 
-  for(i = 0; i < sstream_length(ctx); i++)
+  if(K >= 0 && kk <= 21)
   {
-    if(sstream_at(ctx, i) == token)
+    memcpy(p, digits, len);
+    p += len;
+
+    for(i = len; i < kk; i++)
     {
-      vector_push_back(out, curr);
-      curr = sstream_new();
+      *p++ = '0';
     }
-    else
+  }
+  else if(kk > 0 && kk <= 21)
+  {
+    memcpy(p, digits, kk);
+    p += kk;
+    *p++ = '.';
+    memcpy(p, digits + kk, len - kk);
+    p += len - kk;
+  }
+  else if(kk > -6 && kk <= 0)
+  {
+    *p++ = '0';
+    *p++ = '.';
+
+    for(i = kk; i < 0; i++)
     {
-      sstream_push_char(curr, sstream_at(ctx, i));
+      *p++ = '0';
     }
-  }
 
-  if(sstream_length(curr) > 0)
-  {
-    vector_push_back(out, curr);
+    memcpy(p, digits, len);
+    p += len;
   }
   else
   {
-    sstream_delete(curr);
-  }
-}
+    int exp = kk - 1;
 
-#ifndef AMALGAMATION
-  #include "http.h"
+    *p++ = digits[0];
 
-  #include <palloc/palloc.h>
-  #include <palloc/vector.h>
-  #include <palloc/sstream.h>
-#endif
+    if(len > 1)
+    {
+      *p++ = '.';
+      memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
 
-#ifdef _WIN32
-  #define USE_WINSOCK
-  #define USE_WINAPI
-#else
-  #define USE_POSIX
-#endif
+    *p++ = 'e';
 
-#ifdef USE_WINSOCK
-  #define WIN32_LEAN_AND_MEAN
-  #include <windows.h>
-  #include <winsock2.h>
-  #include <ws2tcpip.h>
-#endif
+    if(exp < 0)
+    {
+      *p++ = '-';
+      exp = -exp;
+    }
+    else
+    {
+      *p++ = '+';
+    }
 
-#ifdef USE_POSIX
-  #include <sys/socket.h>
-  #include <sys/types.h>
-  #include <netinet/in.h>
-  #include <arpa/inet.h>
-  #include <netdb.h>
-  #include <fcntl.h>
-  #include <errno.h>
-  #include <unistd.h>
+    return (p - buf) + number_write_u32(p, (uint32_t)exp);
+  }
+
+  *p = '\0';
+
+  return p - buf;
+}
+
+static size_t number_special(char *buf, int negative, int nan)
+{
+  if(nan)
+  {
+    strcpy(buf, "nan");
+  }
+  else if(negative)
+  {
+    strcpy(buf, "-inf");
+  }
+  else
+  {
+    strcpy(buf, "inf");
+  }
+
+  return strlen(buf);
+}
+
+size_t number_format_uint(char *buf, unsigned int val)
+{
+  return number_write_u32(buf, (uint32_t)val);
+}
+
+size_t number_format_int(char *buf, int val)
+{
+  if(val < 0)
+  {
+    buf[0] = '-';
+
+    return 1 + number_write_u32(buf + 1, (uint32_t)0 - (uint32_t)val);
+  }
+
+  return number_write_u32(buf, (uint32_t)val);
+}
+
+size_t number_format_double(char *buf, double val)
+{
+  uint64_t bits = 0;
+  uint64_t significand = 0;
+  int biased = 0;
+  char digits[20] = {0};
+  int len = 0;
+  int K = 0;
+  char *p = buf;
+
+  memcpy(&bits, &val, sizeof(bits));
+  biased = (int)((bits >> 52) & 0x7FF);
+  significand = bits & NUMBER_U64(0x000FFFFF, 0xFFFFFFFF);
+
+  if(biased == 0x7FF)
+  {
+    return number_special(buf, (int)(bits >> 63), significand != 0);
+  }
+
+  if(bits >> 63)
+  {
+    *p++ = '-';
+  }
+
+  if(biased == 0 && significand == 0)
+  {
+    *p++ = '0';
+    *p = '\0';
+
+    return p - buf;
+  }
+
+  if(biased != 0)
+  {
+    number_grisu2(significand | NUMBER_U64(0x00100000, 0x00000000),
+      biased - 1075, significand == 0 && biased > 1, digits, &len, &K);
+  }
+  else
+  {
+    number_grisu2(significand, -1074, 0, digits, &len, &K);
+  }
+
+  return (p - buf) + number_prettify(p, digits, len, K);
+}
+
+size_t number_format_float(char *buf, float val)
+{
+  uint32_t bits = 0;
+  uint32_t significand = 0;
+  int biased = 0;
+  char digits[20] = {0};
+  int len = 0;
+  int K = 0;
+  char *p = buf;
+
+  memcpy(&bits, &val, sizeof(bits));
+  biased = (int)((bits >> 23) & 0xFF);
+  significand = bits & 0x007FFFFF;
+
+  if(biased == 0xFF)
+  {
+    return number_special(buf, (int)(bits >> 31), significand != 0);
+  }
+
+  if(bits >> 31)
+  {
+    *p++ = '-';
+  }
+
+  if(biased == 0 && significand == 0)
+  {
+    *p++ = '0';
+    *p = '\0';
+
+    return p - buf;
+  }
+
+  if(biased != 0)
+  {
+    number_grisu2(significand | 0x00800000, biased - 150,
+      significand == 0 && biased > 1, digits, &len, &K);
+  }
+  else
+  {
+    number_grisu2(significand, -149, 0, digits, &len, &K);
+  }
+
+  return (p - buf) + number_prettify(p, digits, len, K);
+}
+
+size_t number_format_json(char *buf, double val)
+{
+  /* NaN and the infinities have no JSON form */
+  if(val != val || val - val != 0)
+  {
+    strcpy(buf, "null");
+
+    return 4;
+  }
+
+  /* Checked against the range first, converting anything outside of it to
+   * int is undefined.
+   */
+  if(val >= INT_MIN && val <= INT_MAX && val == (double)(int)val)
+  {
+    return number_format_int(buf, (int)val);
+  }
+
+  return number_format_double(buf, val);
+}
+
+#ifndef AMALGAMATION
+  #include "vector.h"
+  #include "palloc.h"
 #endif
 
-#include <stdio.h>
-#include <string.h>
+#include <string.h>
+
+/* The type strings are literals built by vector_new, palloc keys its
+ * statistics on their addresses.
+ */
+void *_VectorNew(size_t size, const char *type, const char *headerType)
+{
+  struct _Vector *rtn = NULL;
+
+  rtn = (struct _Vector *)_palloc(sizeof(*rtn), type);
+  rtn->vh = (struct _VectorHeader *)_palloc(sizeof(*rtn->vh), headerType);
+  rtn->vh->entrySize = size;
+
+  return rtn;
+}
+
+int _VectorOobAssert(void *_vh, size_t idx)
+{
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  if(vh->size <= idx)
+  {
+    printf("Error: Index out of bounds\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+void _VectorErase(void *_vh, void *_v, size_t idx)
+{
+  _VectorOobAssert(_vh, idx);
+  _VectorEraseRange(_vh, _v, idx, 1);
+}
+
+void _VectorEraseRange(void *_vh, void *_v, size_t idx, size_t count)
+{
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+  struct _Vector *v = (struct _Vector *)_v;
+  size_t restSize = 0;
+
+  if(idx > vh->size || count > vh->size - idx)
+  {
+    printf("Error: Index out of bounds\n");
+    return;
+  }
+
+  restSize = (vh->size - (idx + count)) * vh->entrySize;
+
+  if(restSize > 0)
+  {
+    char *element = (char *)v->data + idx * vh->entrySize;
+    char *rest = element + count * vh->entrySize;
+    memmove(element, rest, restSize);
+  }
+
+  vh->size -= count;
+}
+
+#define VECTOR_MIN_CAPACITY 4
+
+/* Reallocate storage to exactly capacity entries */
+static int _VectorRealloc(struct _VectorHeader *vh, struct _Vector *v,
+  size_t capacity)
+{
+  void *data = NULL;
+
+  data = palloc_buffer(v->data, vh->capacity * vh->entrySize,
+    capacity * vh->entrySize, "vector data");
+
+  if(capacity == 0)
+  {
+    v->data = NULL;
+    vh->capacity = 0;
+
+    return 1;
+  }
+
+  if(!data)
+  {
+    printf("Error: Failed to reallocate\n");
+    return 0;
+  }
+
+  v->data = data;
+  vh->capacity = capacity;
+
+  return 1;
+}
+
+/* Make room for size entries, at least doubling the capacity if it grows */
+static int _VectorGrow(struct _VectorHeader *vh, struct _Vector *v,
+  size_t size)
+{
+  size_t capacity = vh->capacity * 2;
+
+  if(size <= vh->capacity)
+  {
+    return 1;
+  }
+
+  if(capacity < VECTOR_MIN_CAPACITY)
+  {
+    capacity = VECTOR_MIN_CAPACITY;
+  }
+
+  if(capacity < size)
+  {
+    capacity = size;
+  }
+
+  return _VectorRealloc(vh, v, capacity);
+}
+
+/*
+ * Shrinking only adjusts the size so the storage can be reused by the next
+ * batch. Growing past the capacity at least doubles it which keeps
+ * vector_push_back amortized O(1). New entries are zeroed.
+ */
+void _VectorResize(void *_vh, void *_v, size_t size)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  if(!_VectorGrow(vh, v, size))
+  {
+    return;
+  }
+
+  if(size > vh->size)
+  {
+    memset((char *)v->data + vh->size * vh->entrySize, 0,
+      (size - vh->size) * vh->entrySize);
+  }
+
+  vh->size = size;
+}
+
+void _VectorInsertRange(void *_vh, void *_v, size_t idx, const void *src,
+  size_t count)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+  char *element = NULL;
+
+  if(idx > vh->size)
+  {
+    printf("Error: Index out of bounds\n");
+    return;
+  }
+
+  if(count == 0 || !_VectorGrow(vh, v, vh->size + count))
+  {
+    return;
+  }
+
+  element = (char *)v->data + idx * vh->entrySize;
+
+  if(idx < vh->size)
+  {
+    memmove(element + count * vh->entrySize, element,
+      (vh->size - idx) * vh->entrySize);
+  }
+
+  memcpy(element, src, count * vh->entrySize);
+  vh->size += count;
+}
+
+void _VectorReserve(void *_vh, void *_v, size_t capacity)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  if(capacity <= vh->capacity)
+  {
+    return;
+  }
+
+  _VectorRealloc(vh, v, capacity);
+}
+
+void _VectorShrinkToFit(void *_vh, void *_v)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  if(vh->capacity == vh->size)
+  {
+    return;
+  }
+
+  _VectorRealloc(vh, v, vh->size);
+}
+
+size_t _VectorCapacity(void *_vh)
+{
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  return vh->capacity;
+}
+
+size_t _VectorSize(void *_vh)
+{
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  return vh->size;
+}
+
+void _VectorDelete(void *_vh, void *_v)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  if(v->vh != vh)
+  {
+    printf("Error: Invalid vector\n");
+  }
+
+  palloc_buffer(v->data, vh->capacity * vh->entrySize, 0, "vector data");
+
+  pfree(vh);
+  pfree(v);
+}
+
+
+#ifndef AMALGAMATION
+  #include "ring.h"
+  #include "palloc.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+/* The type strings are literals built by ring_new, palloc keys its
+ * statistics on their addresses.
+ */
+void *_RingNew(size_t size, size_t capacity, const char *type,
+  const char *headerType)
+{
+  struct _Ring *rtn = NULL;
+  size_t actual = 1;
+
+  while(actual < capacity)
+  {
+    actual *= 2;
+  }
+
+  rtn = (struct _Ring *)_palloc(sizeof(*rtn), type);
+  rtn->rh = (struct _RingHeader *)_palloc(sizeof(*rtn->rh), headerType);
+  rtn->rh->entrySize = size;
+  rtn->rh->mask = actual - 1;
+
+  rtn->data = _palloc(actual * size, "ring data");
+
+  if(!rtn->data)
+  {
+    printf("Error: Failed to allocate\n");
+  }
+
+  return rtn;
+}
+
+size_t _RingPeekBatch(void *_rh, void *_r, void *out, size_t max)
+{
+  struct _RingHeader *rh = (struct _RingHeader *)_rh;
+  struct _Ring *r = (struct _Ring *)_r;
+  size_t count = rh->tail - rh->head;
+  size_t start = rh->head & rh->mask;
+  size_t first = 0;
+
+  if(count > max)
+  {
+    count = max;
+  }
+
+  /* The batch may wrap around the end of the storage */
+  first = rh->mask + 1 - start;
+
+  if(first > count)
+  {
+    first = count;
+  }
+
+  memcpy(out, (char *)r->data + start * rh->entrySize,
+    first * rh->entrySize);
+
+  memcpy((char *)out + first * rh->entrySize, r->data,
+    (count - first) * rh->entrySize);
+
+  return count;
+}
+
+void _RingDiscard(void *_rh, size_t count)
+{
+  struct _RingHeader *rh = (struct _RingHeader *)_rh;
+
+  if(count > rh->tail - rh->head)
+  {
+    printf("Error: Index out of bounds\n");
+    count = rh->tail - rh->head;
+  }
+
+  rh->head += count;
+}
+
+void _RingDelete(void *_rh, void *_r)
+{
+  struct _Ring *r = (struct _Ring *)_r;
+  struct _RingHeader *rh = (struct _RingHeader *)_rh;
+
+  if(r->rh != rh)
+  {
+    printf("Error: Invalid ring\n");
+  }
+
+  if(r->data)
+  {
+    pfree(r->data);
+  }
+
+  pfree(rh);
+  pfree(r);
+}
+
+#ifndef AMALGAMATION
+  #include "intern.h"
+  #include "hash.h"
+  #include "palloc.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#define INTERN_MIN_CAPACITY 64
+#define INTERN_BLOCK_SIZE 4096
+
+/* Stored right in front of the characters of each string */
+struct InternEntry
+{
+  size_t hash;
+  size_t len;
+};
+
+/* What a string is looked up by */
+struct InternKey
+{
+  size_t hash;
+  size_t len;
+  const char *s;
+};
+
+/*
+ * Strings are packed into blocks that are never moved or freed before
+ * intern_clear() so their addresses are stable while the table rehashes.
+ */
+struct InternBlock
+{
+  struct InternBlock *next;
+  size_t used;
+  size_t size;
+};
+
+static struct hash_table internTable;
+static struct InternBlock *internBlocks;
+
+static int intern_match(const void *entry, const void *key)
+{
+  const struct InternEntry *e = (const struct InternEntry *)entry;
+  const struct InternKey *k = (const struct InternKey *)key;
+
+  return e->hash == k->hash && e->len == k->len &&
+    memcmp(e + 1, k->s, k->len) == 0;
+}
+
+static size_t intern_entry_hash(const void *entry)
+{
+  return ((const struct InternEntry *)entry)->hash;
+}
+
+static int intern_rehash(size_t capacity)
+{
+  void **slots = (void **)_palloc(capacity * sizeof(void *), "intern table");
+  void **old = NULL;
+
+  if(!slots)
+  {
+    printf("Error: Failed to allocate\n");
+    return 0;
+  }
+
+  old = hash_rehash(&internTable, slots, capacity, intern_entry_hash);
+
+  if(old)
+  {
+    pfree(old);
+  }
+
+  return 1;
+}
+
+static struct InternEntry *intern_store(const struct InternKey *key)
+{
+  struct InternBlock *block = internBlocks;
+  struct InternEntry *rtn = NULL;
+
+  /* Entries stay aligned for their header */
+  size_t size = sizeof(*rtn) + key->len + 1;
+  size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+
+  if(!block || block->size - block->used < size)
+  {
+    size_t blockSize = INTERN_BLOCK_SIZE;
+
+    if(blockSize < size)
+    {
+      blockSize = size;
+    }
+
+    block = (struct InternBlock *)_palloc_uninit(sizeof(*block) + blockSize,
+      "intern block");
+
+    if(!block)
+    {
+      printf("Error: Failed to allocate\n");
+      return NULL;
+    }
+
+    block->used = 0;
+    block->size = blockSize;
+    block->next = internBlocks;
+    internBlocks = block;
+  }
+
+  rtn = (struct InternEntry *)((char *)(block + 1) + block->used);
+  rtn->hash = key->hash;
+  rtn->len = key->len;
+  memcpy(rtn + 1, key->s, key->len);
+  ((char *)(rtn + 1))[key->len] = '\0';
+  block->used += size;
+
+  return rtn;
+}
+
+const char *intern_chars(const char *s, size_t len)
+{
+  struct InternKey key = {0};
+  void **slot = NULL;
+  size_t capacity = hash_grow(&internTable, INTERN_MIN_CAPACITY);
+
+  if(capacity && !intern_rehash(capacity))
+  {
+    return NULL;
+  }
+
+  key.hash = hash_bytes(s, len);
+  key.len = len;
+  key.s = s;
+  slot = hash_slot(&internTable, key.hash, &key, intern_match);
+
+  if(!*slot)
+  {
+    *slot = intern_store(&key);
+
+    if(!*slot)
+    {
+      return NULL;
+    }
+
+    internTable.count++;
+  }
+
+  return (const char *)((struct InternEntry *)*slot + 1);
+}
+
+const char *intern_cstr(const char *s)
+{
+  return intern_chars(s, strlen(s));
+}
+
+const char *intern_find(const char *s)
+{
+  struct InternKey key = {0};
+  void *entry = NULL;
+
+  if(internTable.count == 0)
+  {
+    return NULL;
+  }
+
+  key.len = strlen(s);
+  key.hash = hash_bytes(s, key.len);
+  key.s = s;
+  entry = *hash_slot(&internTable, key.hash, &key, intern_match);
+
+  if(!entry)
+  {
+    return NULL;
+  }
+
+  return (const char *)((struct InternEntry *)entry + 1);
+}
+
+size_t intern_count()
+{
+  return internTable.count;
+}
+
+void intern_clear()
+{
+  while(internBlocks)
+  {
+    struct InternBlock *tmp = internBlocks;
+
+    internBlocks = internBlocks->next;
+    pfree(tmp);
+  }
+
+  if(internTable.slots)
+  {
+    pfree(internTable.slots);
+  }
+
+  internTable.slots = NULL;
+  internTable.capacity = 0;
+  internTable.count = 0;
+}
+
+#ifndef AMALGAMATION
+  #include "arena.h"
+  #include "palloc.h"
+#endif
+
+#include <stdio.h>
+
+/* Size of a pooled block including its header */
+#define ARENA_BLOCK_SIZE 1024
+#define ARENA_POOL_MAX 1024
+
+union ArenaAlign
+{
+  double d;
+  void *p;
+  size_t s;
+};
+
+#define ARENA_ALIGN(S) \
+  (((S) + sizeof(union ArenaAlign) - 1) & ~(sizeof(union ArenaAlign) - 1))
+
+/*
+ * Blocks bigger than ARENA_BLOCK_SIZE hold a single oversized allocation and
+ * are handed straight back to palloc when released.
+ */
+struct ArenaBlock
+{
+  struct ArenaBlock *next;
+  size_t size;
+  union ArenaAlign align;
+};
+
+#define ARENA_HEADER_SIZE ARENA_ALIGN(sizeof(struct ArenaBlock))
+
+static struct ArenaBlock *arenaPool;
+static size_t arenaPoolCount;
+
+static struct ArenaBlock *arena_block(size_t size)
+{
+  struct ArenaBlock *rtn = NULL;
+
+  if(size == ARENA_BLOCK_SIZE && arenaPool)
+  {
+    rtn = arenaPool;
+    arenaPool = rtn->next;
+    arenaPoolCount--;
+
+    return rtn;
+  }
+
+  rtn = (struct ArenaBlock *)_palloc_uninit(size, "arena_block");
+
+  if(!rtn)
+  {
+    printf("Error: Failed to allocate\n");
+    return NULL;
+  }
+
+  rtn->size = size;
+
+  return rtn;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+  struct ArenaBlock *block = NULL;
+  void *rtn = NULL;
+
+  size = ARENA_ALIGN(size);
+
+  if(size <= a->remaining)
+  {
+    rtn = a->cursor;
+    a->cursor += size;
+    a->remaining -= size;
+
+    return rtn;
+  }
+
+  /* Oversized requests get their own block behind the current one so the
+   * space left in it is not lost.
+   */
+  if(size > ARENA_BLOCK_SIZE - ARENA_HEADER_SIZE)
+  {
+    block = arena_block(ARENA_HEADER_SIZE + size);
+
+    if(!block)
+    {
+      return NULL;
+    }
+
+    a->size += block->size;
+
+    if(a->blocks)
+    {
+      block->next = a->blocks->next;
+      a->blocks->next = block;
+    }
+    else
+    {
+      block->next = NULL;
+      a->blocks = block;
+    }
+
+    return (char *)block + ARENA_HEADER_SIZE;
+  }
+
+  block = arena_block(ARENA_BLOCK_SIZE);
+
+  if(!block)
+  {
+    return NULL;
+  }
+
+  block->next = a->blocks;
+  a->blocks = block;
+  a->size += block->size;
+
+  rtn = (char *)block + ARENA_HEADER_SIZE;
+  a->cursor = (char *)rtn + size;
+  a->remaining = ARENA_BLOCK_SIZE - ARENA_HEADER_SIZE - size;
+
+  return rtn;
+}
+
+void arena_reset(struct arena *a)
+{
+  struct ArenaBlock *block = a->blocks;
+
+  while(block)
+  {
+    struct ArenaBlock *next = block->next;
+
+    if(block->size == ARENA_BLOCK_SIZE && arenaPoolCount < ARENA_POOL_MAX)
+    {
+      block->next = arenaPool;
+      arenaPool = block;
+      arenaPoolCount++;
+    }
+    else
+    {
+      pfree(block);
+    }
+
+    block = next;
+  }
+
+  a->blocks = NULL;
+  a->cursor = NULL;
+  a->remaining = 0;
+  a->size = 0;
+}
+
+void arena_trim()
+{
+  while(arenaPool)
+  {
+    struct ArenaBlock *next = arenaPool->next;
+
+    pfree(arenaPool);
+    arenaPool = next;
+  }
+
+  arenaPoolCount = 0;
+}
+
+#ifndef AMALGAMATION
+  #include "sstream.h"
+  #include "number.h"
+  #include "palloc.h"
+#endif
+
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * Ensure there is room for extra characters plus the null terminator. The
+ * capacity is doubled until it fits so repeated appends stay linear overall.
+ */
+static void sstream_grow(struct sstream *ctx, size_t extra)
+{
+  size_t needed = ctx->length + extra + 1;
+  size_t capacity = ctx->capacity;
+  char *data = NULL;
+
+  if(needed <= capacity) return;
+
+  while(capacity < needed)
+  {
+    capacity *= 2;
+  }
+
+  if(ctx->data == ctx->local)
+  {
+    data = (char *)palloc_buffer(NULL, 0, capacity, "sstream data");
+
+    if(data)
+    {
+      memcpy(data, ctx->local, ctx->length + 1);
+    }
+  }
+  else
+  {
+    data = (char *)palloc_buffer(ctx->data, ctx->capacity, capacity,
+      "sstream data");
+  }
+
+  if(!data)
+  {
+    printf("Error: Failed to reallocate\n");
+    abort();
+  }
+
+  ctx->data = data;
+  ctx->capacity = capacity;
+}
+
+struct sstream *sstream_new()
+{
+  struct sstream *rtn = NULL;
+
+  rtn = palloc_uninit(struct sstream);
+  rtn->data = rtn->local;
+  rtn->length = 0;
+  rtn->capacity = SSTREAM_LOCAL_SIZE;
+  rtn->local[0] = '\0';
+
+  return rtn;
+}
+
+void sstream_clear(struct sstream *ctx)
+{
+  /* Keep the buffer around, streams are usually refilled */
+  ctx->length = 0;
+  ctx->data[0] = '\0';
+}
+
+void sstream_truncate(struct sstream *ctx, size_t length)
+{
+  if(length < ctx->length)
+  {
+    ctx->length = length;
+    ctx->data[length] = '\0';
+  }
+}
+
+void sstream_delete(struct sstream *ctx)
+{
+  if(ctx->data != ctx->local)
+  {
+    palloc_buffer(ctx->data, ctx->capacity, 0, "sstream data");
+  }
+
+  pfree(ctx);
+}
+
+void sstream_push_int(struct sstream *ctx, int val)
+{
+  size_t len = 0;
+
+  sstream_grow(ctx, NUMBER_BUFFER_SIZE);
+  len = number_format_int(ctx->data + ctx->length, val);
+  ctx->length += len;
+}
+
+void sstream_push_float(struct sstream *ctx, float val)
+{
+  size_t len = 0;
+
+  sstream_grow(ctx, NUMBER_BUFFER_SIZE);
+  len = number_format_float(ctx->data + ctx->length, val);
+  ctx->length += len;
+}
+
+void sstream_push_double(struct sstream *ctx, double val)
+{
+  size_t len = 0;
+
+  sstream_grow(ctx, NUMBER_BUFFER_SIZE);
+  len = number_format_double(ctx->data + ctx->length, val);
+  ctx->length += len;
+}
+
+void sstream_push_char(struct sstream *ctx, char val)
+{
+  sstream_grow(ctx, 1);
+  ctx->data[ctx->length] = val;
+  ctx->length++;
+  ctx->data[ctx->length] = '\0';
+}
+
+void sstream_push_cstr(struct sstream *ctx, const char *s)
+{
+  size_t len = strlen(s);
+
+  if(len < 1) return;
+
+  sstream_grow(ctx, len);
+  memcpy(ctx->data + ctx->length, s, len + 1);
+  ctx->length += len;
+}
+
+char *sstream_cstr(struct sstream *ctx)
+{
+  return ctx->data;
+}
+
+size_t sstream_length(struct sstream *ctx)
+{
+  return ctx->length;
+}
+
+size_t sstream_capacity(struct sstream *ctx)
+{
+  return ctx->capacity - 1;
+}
+
+void sstream_reserve(struct sstream *ctx, size_t capacity)
+{
+  if(capacity <= ctx->length) return;
+
+  sstream_grow(ctx, capacity - ctx->length);
+}
+
+struct sstream_builder sstream_builder_begin(struct sstream *ctx, size_t count)
+{
+  struct sstream_builder rtn = {0};
+
+  sstream_grow(ctx, count);
+  ctx->data[ctx->length] = '\0';
+
+  rtn.ctx = ctx;
+  rtn.tail = ctx->data + ctx->length;
+  rtn.remaining = ctx->capacity - ctx->length;
+
+  return rtn;
+}
+
+void sstream_builder_commit(struct sstream_builder *builder, size_t count)
+{
+  struct sstream *ctx = builder->ctx;
+
+  if(count >= builder->remaining)
+  {
+    printf("Error: Builder overflow\n");
+    abort();
+  }
+
+  ctx->length += count;
+  ctx->data[ctx->length] = '\0';
+
+  builder->tail = ctx->data + ctx->length;
+  builder->remaining -= count;
+}
+
+int sstream_int(struct sstream *ctx)
+{
+  return atoi(ctx->data);
+}
+
+char sstream_at(struct sstream *ctx, size_t i)
+{
+  if(ctx->length == 0)
+  {
+    printf("Error: Stream is empty\n");
+    abort();
+  }
+
+  if(i >= ctx->length)
+  {
+    printf("Error: Index out of bounds\n");
+    abort();
+  }
+
+  return ctx->data[i];
+}
+
+void sstream_push_chars(struct sstream *ctx, char *values, size_t count)
+{
+  if(count < 1) return;
+
+  sstream_grow(ctx, count);
+  memcpy(ctx->data + ctx->length, values, count);
+  ctx->length += count;
+  ctx->data[ctx->length] = '\0';
+}
+
+void sstream_split(struct sstream *ctx, char token,
+  vector(struct sstream*) *out)
+{
+  struct sstrview rest = sstream_view(ctx);
+  struct sstrview part = {0};
+
+  while(sstrview_next(&rest, token, &part))
+  {
+    struct sstream *curr = sstream_new();
+
+    sstream_push_chars(curr, (char *)part.s, part.len);
+    vector_push_back(out, curr);
+  }
+}
+
+struct sstrview sstream_view(struct sstream *ctx)
+{
+  struct sstrview rtn = {0};
+
+  rtn.s = sstream_cstr(ctx);
+  rtn.len = ctx->length;
+
+  return rtn;
+}
+
+struct sstrview sstrview_cstr(const char *s)
+{
+  struct sstrview rtn = {0};
+
+  rtn.s = s;
+  rtn.len = strlen(s);
+
+  return rtn;
+}
+
+/*
+ * Take the next token off the front of rest. Follows the same rules as
+ * sstream_split, empty tokens between separators are kept but a trailing
+ * empty token is not. Returns 0 once rest is exhausted.
+ */
+int sstrview_next(struct sstrview *rest, char token, struct sstrview *out)
+{
+  const char *found = NULL;
+
+  if(rest->len == 0) return 0;
+
+  found = (const char *)memchr(rest->s, token, rest->len);
+  out->s = rest->s;
+
+  if(!found)
+  {
+    out->len = rest->len;
+    rest->s += rest->len;
+    rest->len = 0;
+
+    return 1;
+  }
+
+  out->len = found - rest->s;
+  rest->len -= out->len + 1;
+  rest->s = found + 1;
+
+  return 1;
+}
+
+/*
+ * Fill out with up to max tokens of src. The return value is the total number
+ * of tokens which may be larger than max, in which case the remaining tokens
+ * were counted but not stored.
+ */
+size_t sstrview_split(struct sstrview src, char token,
+  struct sstrview *out, size_t max)
+{
+  struct sstrview part = {0};
+  size_t rtn = 0;
+
+  while(sstrview_next(&src, token, &part))
+  {
+    if(rtn < max)
+    {
+      out[rtn] = part;
+    }
+
+    rtn++;
+  }
+
+  return rtn;
+}
+
+int sstrview_equals(struct sstrview view, const char *s)
+{
+  size_t len = strlen(s);
+
+  if(len != view.len) return 0;
+
+  return memcmp(view.s, s, len) == 0;
+}
+
+int sstrview_int(struct sstrview view)
+{
+  size_t i = 0;
+  int negative = 0;
+  int rtn = 0;
+
+  while(i < view.len && (view.s[i] == ' ' || view.s[i] == '\t'))
+  {
+    i++;
+  }
+
+  if(i < view.len && (view.s[i] == '-' || view.s[i] == '+'))
+  {
+    negative = view.s[i] == '-';
+    i++;
+  }
+
+  for(; i < view.len && view.s[i] >= '0' && view.s[i] <= '9'; i++)
+  {
+    rtn = rtn * 10 + (view.s[i] - '0');
+  }
+
+  return negative ? -rtn : rtn;
+}
+
+#ifndef AMALGAMATION
+  #include "http.h"
+
+  #include <palloc/palloc.h>
+  #include <palloc/vector.h>
+  #include <palloc/sstream.h>
+#endif
+
+#ifdef _WIN32
+  #define USE_WINSOCK
+  #define USE_WINAPI
+#else
+  #define USE_POSIX
+#endif
+
+#ifdef USE_WINSOCK
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+#endif
+
+#ifdef USE_POSIX
+  #include <sys/socket.h>
+  #include <sys/types.h>
+  #include <netinet/in.h>
+  #include <arpa/inet.h>
+  #include <netdb.h>
+  #include <fcntl.h>
+  #include <errno.h>
+  #include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#define HTTP_CONNECTING 1
+#define HTTP_RECEIVING 2
+#define HTTP_COMPLETE 3
+
+#define BUFFER_SIZE 1024
+
+#ifdef USE_POSIX
+  #define NULL_SOCKET -1
+#endif
+#ifdef USE_WINSOCK
+  #define NULL_SOCKET INVALID_SOCKET
+#endif
+
+static int winsockInitialized;
+
+struct CustomHeader
+{
+  sstream *variable;
+  sstream *value;
+};
+
+struct Http
+{
+  sstream *host;
+  sstream *path;
+  sstream *query;
+  sstream *post;
+  vector(char) *raw;
+  vector(int) *socks;
+  sstream *rawHeaders;
+  sstream *rawContent;
+  vector(struct CustomHeader) *customHeaders;
+  int sock;
+  int status;
+};
+
+void HttpAddCustomHeader(struct Http *ctx, const char *variable, const char *value)
+{
+  struct CustomHeader ch = {0};
+
+  ch.variable = sstream_new();
+  sstream_push_cstr(ch.variable, variable);
+  ch.value = sstream_new();
+  sstream_push_cstr(ch.value, value);
+  vector_push_back(ctx->customHeaders, ch);
+}
+
+void _HttpClearSocks(struct Http *ctx)
+{
+  size_t i = 0;
+
+  for(i = 0; i < vector_size(ctx->socks); i++)
+  {
+#ifdef USE_POSIX
+    close(vector_at(ctx->socks, i));
+#endif
+#ifdef USE_WINSOCK
+    shutdown(vector_at(ctx->socks, i), SD_BOTH);
+    closesocket(vector_at(ctx->socks, i));
+#endif
+  }
+
+  vector_clear(ctx->socks);
+}
+
+int HttpState(struct Http *ctx)
+{
+  if(vector_size(ctx->socks) > 0)
+  {
+    return HTTP_CONNECTING;
+  }
+  else if(ctx->sock != NULL_SOCKET)
+  {
+    return HTTP_RECEIVING;
+  }
+
+  return HTTP_COMPLETE;
+}
+
+#ifdef USE_WINSOCK
+void _HttpShutdownWinsock()
+{
+  WSACleanup();
+}
+#endif
+
+struct Http *HttpCreate()
+{
+  struct Http *rtn = NULL;
+#ifdef USE_WINSOCK
+  if(!winsockInitialized)
+  {
+    WSADATA wsaData = {0};
+    int result = 0;
+
+    result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+
+    if(result != 0)
+    {
+      printf("WSAStartup failed with error: %d\n", result);
+      return NULL;
+    }
+
+    winsockInitialized = 1;
+    atexit(_HttpShutdownWinsock);
+  }
+#endif
+
+  rtn = palloc(struct Http);
+  rtn->raw = vector_new(char);
+  rtn->rawContent = sstream_new();
+  rtn->rawHeaders = sstream_new();
+  rtn->socks = vector_new(int);
+  rtn->customHeaders = vector_new(struct CustomHeader);
+  rtn->sock = NULL_SOCKET;
+  rtn->host = sstream_new();
+  rtn->path = sstream_new();
+  rtn->query = sstream_new();
+  rtn->post = sstream_new();
+
+  return rtn;
+}
+
+void HttpDestroy(struct Http *ctx)
+{
+  size_t i = 0;
+
+  _HttpClearSocks(ctx);
+  vector_delete(ctx->socks);
+  sstream_delete(ctx->rawHeaders);
+  sstream_delete(ctx->rawContent);
+  vector_delete(ctx->raw);
+  sstream_delete(ctx->host);
+  sstream_delete(ctx->path);
+  sstream_delete(ctx->query);
+  sstream_delete(ctx->post);
+
+  for(i = 0; i < vector_size(ctx->customHeaders); i++)
+  {
+    sstream_delete(vector_at(ctx->customHeaders, i).variable);
+    sstream_delete(vector_at(ctx->customHeaders, i).value);
+  }
+
+  vector_delete(ctx->customHeaders);
+
+  pfree(ctx);
+}
+
+void _HttpPollConnect(struct Http *ctx)
+{
+  size_t i = 0;
+  sstream *content = NULL;
+  struct CustomHeader *header = NULL;
+
+  //printf("polling connect\n");
+
+  for(i = 0; i < vector_size(ctx->socks); i++)
+  {
+    fd_set write_fds = {0};
+    struct timeval tv = {0};
+    int err = 0;
+    int sock = vector_at(ctx->socks, i);
+
+    FD_SET(sock, &write_fds);
+    err = select(sock + 1, NULL, &write_fds, NULL, &tv);
+
+    if(err == 0)
+    {
+      continue;
+    }
+    else if(err == -1)
+    {
+#ifdef USE_POSIX
+      close(sock);
+#endif
+#ifdef USE_WINSOCK
+      shutdown(sock, SD_BOTH);
+      closesocket(sock);
+#endif
+      vector_erase(ctx->socks, i);
+      i--;
+      continue;
+    }
+    else
+    {
+      int optval = 0;
+      int optlen = sizeof(optval);
+#ifdef USE_POSIX
+      if(getsockopt(sock, SOL_SOCKET, SO_ERROR, &optval, (socklen_t *)&optlen) == -1)
+#endif
+#ifdef USE_WINSOCK
+      if(getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&optval, &optlen) == -1)
+#endif
+      {
+#ifdef USE_POSIX
+        close(sock);
+#endif
+#ifdef USE_WINSOCK
+        shutdown(sock, SD_BOTH);
+        closesocket(sock);
+#endif
+        vector_erase(ctx->socks, i);
+        i--;
+        continue;
+      }
+
+      if(optval != 0)
+      {
+#ifdef USE_POSIX
+        close(sock);
+#endif
+#ifdef USE_WINSOCK
+        shutdown(sock, SD_BOTH);
+        closesocket(sock);
+#endif
+        vector_erase(ctx->socks, i);
+        i--;
+        continue;
+      }
+    }
+
+    ctx->sock = sock;
+    vector_erase(ctx->socks, i);
+    _HttpClearSocks(ctx);
+    break;
+  }
+
+  if(ctx->sock == NULL_SOCKET && vector_size(ctx->socks) < 1)
+  {
+    ctx->status = -1;
+    return;
+  }
+
+  if(ctx->sock == NULL_SOCKET)
+  {
+    return;
+  }
+
+  content = sstream_new();
+
+  if(sstream_length(ctx->post) > 0)
+  {
+    sstream_push_cstr(content, "POST ");
+  }
+  else
+  {
+    sstream_push_cstr(content, "GET ");
+  }
+
+  sstream_push_cstr(content, sstream_cstr(ctx->path));
+
+  if(sstream_length(ctx->query) > 0)
+  {
+    sstream_push_char(content, '?');
+    sstream_push_cstr(content, sstream_cstr(ctx->query));
+  }
+
+  sstream_push_cstr(content, " HTTP/1.0\r\n");
+  sstream_push_cstr(content, "Host: ");
+  sstream_push_cstr(content, sstream_cstr(ctx->host));
+  sstream_push_cstr(content, "\r\n");
+
+  vector_foreach(header, ctx->customHeaders)
+  {
+    sstream_push_cstr(content, sstream_cstr(header->variable));
+    sstream_push_cstr(content, ": ");
+    sstream_push_cstr(content, sstream_cstr(header->value));
+    sstream_push_cstr(content, "\r\n");
+  }
+
+  if(sstream_length(ctx->post) > 0)
+  {
+    sstream_push_cstr(content, "Content-Length: ");
+    sstream_push_int(content, sstream_length(ctx->post));
+    sstream_push_cstr(content, "\r\n");
+  }
+
+  sstream_push_cstr(content, "\r\n");
+
+  if(sstream_length(ctx->post) > 0)
+  {
+    sstream_push_cstr(content, sstream_cstr(ctx->post));
+  }
+
+#ifdef USE_POSIX
+  send(ctx->sock, sstream_cstr(content), sstream_length(content), MSG_NOSIGNAL);
+#endif
+#ifdef USE_WINSOCK
+  send(ctx->sock, sstream_cstr(content), sstream_length(content), 0);
+#endif
+
+  sstream_delete(content);
+}
+
+void _HttpProcessHeaders(struct Http *ctx)
+{
+  struct sstrview rest = sstream_view(ctx->rawHeaders);
+  struct sstrview line = {0};
+  struct sstrview parts[2] = {{0}};
+
+  while(sstrview_next(&rest, '\n', &line))
+  {
+    if(sstrview_split(line, ' ', parts, 2) >= 2)
+    {
+      if(sstrview_equals(parts[0], "HTTP/1.1") ||
+        sstrview_equals(parts[0], "HTTP/1.0"))
+      {
+        ctx->status = sstrview_int(parts[1]);
+      }
+    }
+  }
+}
+
+void _HttpProcessRaw(struct Http *ctx)
+{
+  if(sstream_length(ctx->rawHeaders) == 0)
+  {
+    size_t i = 0;
+    char last[5] = {0};
+
+    for(i = 0; i < vector_size(ctx->raw); i++)
+    {
+      last[0] = last[1];
+      last[1] = last[2];
+      last[2] = last[3];
+      last[3] = vector_at(ctx->raw, i);
+
+      if(strcmp(last, "\r\n\r\n") == 0)
+      {
+        sstream_push_chars(ctx->rawHeaders, vector_raw(ctx->raw), i - 3);
+        _HttpProcessHeaders(ctx);
+        break;
+      }
+    }
+  }
+
+  if(sstream_length(ctx->rawHeaders) == 0) return;
+
+  if(ctx->sock == NULL_SOCKET)
+  {
+    size_t offset = sstream_length(ctx->rawHeaders) + 4;
+
+    sstream_push_chars(ctx->rawContent, vector_raw(ctx->raw) + offset,
+      vector_size(ctx->raw) - offset);
+
+    //printf("Content: %s\n", sstream_cstr(ctx->rawContent));
+  }
+}
+
+void _HttpPollReceive(struct Http *ctx)
+{
+  fd_set read_fds = {0};
+  struct timeval tv = {0};
+  int err = 0;
+
+  //printf("polling receive\n");
+
+  FD_SET(ctx->sock, &read_fds);
+  err = select(ctx->sock + 1, &read_fds, NULL, NULL, &tv);
+
+  if(err == 0)
+  {
+    return;
+  }
+  else if(err == -1)
+  {
+    ctx->status = -1;
+#ifdef USE_POSIX
+    close(ctx->sock);
+#endif
+#ifdef USE_WINSOCK
+    shutdown(ctx->sock, SD_BOTH);
+    closesocket(ctx->sock);
+#endif
+    ctx->sock = NULL_SOCKET;
+    return;
+  }
+  else
+  {
+    char buff[BUFFER_SIZE] = {0};
+#ifdef USE_POSIX
+    ssize_t n = 0;
+
+    n = read(ctx->sock, buff, BUFFER_SIZE - 1);
+
+    if(n > 0)
+#endif
+#ifdef USE_WINSOCK
+    int n = 0;
+    n = recv(ctx->sock, buff, BUFFER_SIZE - 1, 0);
+
+    if(n != SOCKET_ERROR && n != 0)
+#endif
+    {
+      vector_append(ctx->raw, buff, n);
+
+      //printf("Data waiting: %s\n", buff);
+    }
+    else
+    {
+#ifdef USE_POSIX
+      close(ctx->sock);
+#endif
+#ifdef USE_WINSOCK
+      shutdown(ctx->sock, SD_BOTH);
+      closesocket(ctx->sock);
+#endif
+      ctx->sock = NULL_SOCKET;
+    }
+
+    _HttpProcessRaw(ctx);
+  }
+}
+
+void _HttpPoll(struct Http *ctx)
+{
+  if(HttpState(ctx) == HTTP_CONNECTING)
+  {
+    _HttpPollConnect(ctx);
+  }
+  else if(HttpState(ctx) == HTTP_RECEIVING)
+  {
+    _HttpPollReceive(ctx);
+  }
+}
+
+void _HttpParseRequest(struct Http *ctx, char *url)
+{
+  size_t i = 0;
+  size_t len = 0;
+
+  sstream_clear(ctx->host);
+  sstream_clear(ctx->path);
+  sstream_clear(ctx->query);
+
+  len = strlen(url);
+
+  for(; i < len - 1; i++)
+  {
+    if(url[i] == '/' && url[i+1] == '/')
+    {
+      i+=2;
+      break;
+    }
+  }
+
+  for(; i < len; i++)
+  {
+    if(url[i] == '/')
+    {
+      break;
+    }
+
+    sstream_push_char(ctx->host, url[i]);
+  }
+
+  for(; i < len; i++)
+  {
+    if(url[i] == '?')
+    {
+      i++;
+      break;
+    }
+
+    sstream_push_char(ctx->path, url[i]);
+  }
+
+  for(; i < len; i++)
+  {
+    sstream_push_char(ctx->query, url[i]);
+  }
+
+  //printf("Host: %s\n", sstream_cstr(ctx->host));
+  //printf("Path: %s\n", sstream_cstr(ctx->path));
+  //printf("Query: %s\n", sstream_cstr(ctx->query));
+}
+
+void HttpRequest(struct Http *ctx, char *url, char *post)
+{
+  struct addrinfo hints = {0};
+  struct addrinfo *res = NULL;
+  struct addrinfo *ent = NULL;
+  int err = 0;
+  int flags = 0;
+
+  if(HttpState(ctx) != HTTP_COMPLETE) return;
+
+  sstream_clear(ctx->post);
+
+  if(post)
+  {
+    sstream_push_cstr(ctx->post, post);
+  }
+
+  _HttpParseRequest(ctx, url);
+
+  sstream_clear(ctx->rawHeaders);
+  sstream_clear(ctx->rawContent);
+  vector_clear(ctx->raw);
+  ctx->status = 0;
+
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  err = getaddrinfo(sstream_cstr(ctx->host), "80", &hints, &res);
+
+  if(err)
+  {
+    ctx->status = -1;
+    return;
+  }
+
+  for(ent = res; ent != NULL; ent = ent->ai_next)
+  {
+    int sock = NULL_SOCKET;
+
+    if(ent->ai_family != AF_INET && ent->ai_family != AF_INET6)
+    {
+      continue;
+    }
+
+    sock = socket(ent->ai_family, ent->ai_socktype, 0);
+
+    if(sock == NULL_SOCKET)
+    {
+      continue;
+    }
+
+#ifdef USE_POSIX
+    flags = fcntl(sock, F_GETFL);
+
+    if(fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+
+      close(sock);
+      continue;
+    }
+#endif
+#ifdef USE_WINSOCK
+    {
+    unsigned long nonblocking = 1;
+    ioctlsocket(sock, FIONBIO, &nonblocking);
+    }
+#endif
+
+    err = connect(sock, (struct sockaddr *)ent->ai_addr, ent->ai_addrlen);
+
+#ifdef USE_POSIX
+    if(err == -1)
+#endif
+#ifdef USE_WINSOCK
+    if(err == SOCKET_ERROR)
+#endif
+    {
+#ifdef USE_POSIX
+      if(errno == EINPROGRESS)
+#endif
+#ifdef USE_WINSOCK
+      if(WSAGetLastError() == WSAEWOULDBLOCK)
+#endif
+      {
+        vector_push_back(ctx->socks, sock);
+      }
+      else
+      {
+#ifdef USE_POSIX
+        close(sock);
+#endif
+#ifdef USE_WINSOCK
+        shutdown(sock, SD_BOTH);
+        closesocket(sock);
+#endif
+      }
+
+      continue;
+    }
+
+    ctx->sock = sock;
+    _HttpClearSocks(ctx);
+  }
+
+  if(ctx->sock == NULL_SOCKET && vector_size(ctx->socks) < 1)
+  {
+    ctx->status = -1;
+  }
+
+  freeaddrinfo(res);
+}
+
+int HttpRequestComplete(struct Http *ctx)
+{
+  _HttpPoll(ctx);
+
+  if(HttpState(ctx) == HTTP_COMPLETE)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+int HttpResponseStatus(struct Http *ctx)
+{
+  return ctx->status;
+}
+
+char *HttpResponseContent(struct Http *ctx)
+{
+  return sstream_cstr(ctx->rawContent);
+}
+
+#ifndef AMALGAMATION
+  #include "config.h"
+  #include "Collection.h"
+  #include "Document.h"
+  #include "Schema.h"
+  #include "State.h"
+  #include "http/http.h"
+
+  #include "palloc/hash.h"
+  #include "palloc/palloc.h"
+  #include "palloc/intern.h"
+#endif
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <unistd.h>
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BG_INDEX_MIN_CAPACITY 16
+
+void bgUpdate();
+
+static int bgCollectionMatch(const void *entry, const void *name)
+{
+  return ((const struct bgCollection *)entry)->name == name;
+}
+
+static size_t bgCollectionHash(const void *entry)
+{
+  return hash_pointer(((const struct bgCollection *)entry)->name);
+}
+
+/* Slot holding the collection named name, or the empty one it would go in */
+static struct bgCollection **bgCollectionSlot(const char *name)
+{
+  return (struct bgCollection **)hash_slot(&bg->collectionIndex,
+    hash_pointer(name), name, bgCollectionMatch);
+}
+
+static int bgCollectionIndex(struct bgCollection *c)
+{
+  /* Collections are only removed all at once by bgCleanup, so only growth
+   * needs handling.
+   */
+  size_t capacity = hash_grow(&bg->collectionIndex, BG_INDEX_MIN_CAPACITY);
+
+  if(capacity)
+  {
+    void **slots = (void **)_palloc(capacity * sizeof(void *),
+      "bgCollection index");
+    void **old = NULL;
+
+    if(!slots)
+    {
+      printf("Error: Failed to allocate\n");
+      return 0;
+    }
+
+    old = hash_rehash(&bg->collectionIndex, slots, capacity, bgCollectionHash);
+
+    if(old)
+    {
+      pfree(old);
+    }
+  }
+
+  *bgCollectionSlot(c->name) = c;
+  bg->collectionIndex.count++;
+
+  return 1;
+}
+
+bgCollectionHandle bgCollectionCreate(const char *cln)
+{
+  struct bgCollection* newCln = bgCollectionGet(cln);
+
+  if(newCln)
+  {
+    printf("Error: Collection already exists\n");
+    return newCln;
+  }
+
+  newCln = palloc(struct bgCollection);
+
+  newCln->name = intern_cstr(cln);
+
+  if(!bgCollectionIndex(newCln))
+  {
+    pfree(newCln);
+    return NULL;
+  }
+
+  newCln->documents = ring_new(struct bgDocument*, BG_QUEUE_CAPACITY);
+  newCln->policy = BG_DROP_NEWEST;
+  newCln->sampleInterval = 1;
+  vector_push_back(bg->collections, newCln);
+
+  /* Pick up documents spilled by a previous run */
+  bgCollectionSpillCheck(newCln);
+
+  newCln->http = HttpCreate();
+  HttpAddCustomHeader(newCln->http, "AuthAccessKey", sstream_cstr(bg->guid));
+  HttpAddCustomHeader(newCln->http, "AuthAccessSecret", sstream_cstr(bg->key));
+  HttpAddCustomHeader(newCln->http, "Content-Type", "application/json;charset=utf-8");
+
+  bgUpdate();
+
+  return newCln;
+}
+
+bgCollectionHandle bgCollectionCreateWithSchema(const char *cln,
+  struct bgSchema *schema)
+{
+  struct bgCollection *col = bgCollectionCreate(cln);
+
+  if(col && !col->columns)
+  {
+    col->columns = bgColumnsCreate(schema);
+  }
+
+  return col;
+}
+
+/* Path of the spill file of c, a spill directory must be set. Anything in the
+ * name but letters, digits, '-' and '_' is written as %XX so the file always
+ * stays in the directory and two names never share it.
+ */
+static void bgCollectionSpillPath(struct bgCollection *c, struct sstream *out)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  const unsigned char *it = NULL;
+
+  sstream_push_cstr(out, sstream_cstr(bg->spillDir));
+  sstream_push_char(out, '/');
+
+  for(it = (const unsigned char *)c->name; *it; it++)
+  {
+    if((*it >= 'a' && *it <= 'z') || (*it >= 'A' && *it <= 'Z') ||
+      (*it >= '0' && *it <= '9') || *it == '-' || *it == '_')
+    {
+      sstream_push_char(out, *it);
+    }
+    else
+    {
+      sstream_push_char(out, '%');
+      sstream_push_char(out, hex[*it >> 4]);
+      sstream_push_char(out, hex[*it & 15]);
+    }
+  }
+
+  sstream_push_cstr(out, ".spill");
+}
+
+void bgCollectionSpillCheck(struct bgCollection *c)
+{
+  sstream *path = NULL;
+  FILE *f = NULL;
+
+  if(!bg->spillDir || c->spillPending)
+  {
+    return;
+  }
+
+  path = sstream_new();
+  bgCollectionSpillPath(c, path);
+  f = fopen(sstream_cstr(path), "rb");
+
+  if(f)
+  {
+    c->spillPending = 1;
+    fclose(f);
+  }
+
+  sstream_delete(path);
+}
+
+/* Appends doc to the spill file as a line of JSON, returns 0 on failure */
+static int bgCollectionSpill(struct bgCollection *c, struct bgDocument *doc)
+{
+  sstream *line = NULL;
+  int rtn = 0;
+
+  if(!bg->spillDir)
+  {
+    return 0;
+  }
+
+  line = sstream_new();
+
+  if(!c->spill)
+  {
+    bgCollectionSpillPath(c, line);
+    c->spill = fopen(sstream_cstr(line), "ab");
+    sstream_clear(line);
+  }
+
+  if(c->spill && bgDocumentSerialize(doc, line))
+  {
+    sstream_push_char(line, '\n');
+
+    rtn = fwrite(sstream_cstr(line), 1, sstream_length(line), c->spill) ==
+      sstream_length(line);
+  }
+
+  sstream_delete(line);
+
+  if(rtn)
+  {
+    c->spillPending = 1;
+    c->counters.spilled++;
+  }
+
+  return rtn;
+}
+
+/* Appends about BG_SPILL_CHUNK bytes of spilled documents to an upload body
+ * holding written documents. Returns the new number of documents written.
+ */
+static size_t bgCollectionUnspill(struct bgCollection *c, struct sstream *ser,
+  size_t written)
+{
+  sstream *path = NULL;
+  sstream *line = NULL;
+  FILE *f = NULL;
+  char buff[256] = {0};
+  size_t consumed = 0;
+
+  if(!c->spillPending)
+  {
+    return written;
+  }
+
+  /* Flushes what has been appended so far */
+  if(c->spill)
+  {
+    fclose(c->spill);
+    c->spill = NULL;
+  }
+
+  path = sstream_new();
+  line = sstream_new();
+  bgCollectionSpillPath(c, path);
+  f = fopen(sstream_cstr(path), "rb");
+
+  if(f && fseek(f, c->spillOffset, SEEK_SET) == 0)
+  {
+    /* The limit is checked between lines, a single line may exceed it */
+    while((consumed < BG_SPILL_CHUNK || sstream_length(line) > 0) &&
+      fgets(buff, sizeof(buff), f))
+    {
+      size_t len = strlen(buff);
+
+      if(len == 0)
+      {
+        break;
+      }
+
+      consumed += len;
+
+      if(buff[len - 1] != '\n')
+      {
+        sstream_push_chars(line, buff, len);
+        continue;
+      }
+
+      sstream_push_chars(line, buff, len - 1);
+
+      if(written > 0)
+      {
+        sstream_push_char(ser, ',');
+      }
+
+      sstream_push_chars(ser, sstream_cstr(line), sstream_length(line));
+      sstream_clear(line);
+      c->spillOffset = ftell(f);
+      c->counters.unspilled++;
+      written++;
+    }
+
+    /* Fully read, a partly written last line is given up */
+    if(!fgets(buff, sizeof(buff), f))
+    {
+      fclose(f);
+      f = NULL;
+      remove(sstream_cstr(path));
+      c->spillOffset = 0;
+      c->spillPending = 0;
+    }
+  }
+  else
+  {
+    c->spillOffset = 0;
+    c->spillPending = 0;
+  }
+
+  if(f)
+  {
+    fclose(f);
+  }
+
+  sstream_delete(line);
+  sstream_delete(path);
+
+  return written;
+}
+
+static int bgCollectionFits(struct bgCollection *c, size_t bytes)
+{
+  size_t maxDocuments = ring_capacity(c->documents);
+
+  if(c->maxDocuments > 0 && c->maxDocuments < maxDocuments)
+  {
+    maxDocuments = c->maxDocuments;
+  }
+
+  /* Rows count as documents */
+  if(c->counters.queuedDocuments + 1 > maxDocuments)
+  {
+    return 0;
+  }
+
+  if(c->maxBytes > 0 && c->counters.queuedBytes + bytes > c->maxBytes)
+  {
+    return 0;
+  }
+
+  if(bg->maxDocuments > 0 && bg->queuedDocuments + 1 > bg->maxDocuments)
+  {
+    return 0;
+  }
+
+  if(bg->maxBytes > 0 && bg->queuedBytes + bytes > bg->maxBytes)
+  {
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Destroys a document that has been taken off the queue */
+static void bgCollectionRelease(struct bgCollection *c, struct bgDocument *doc)
+{
+  size_t bytes = bgDocumentSize(doc);
+
+  c->counters.queuedDocuments--;
+  c->counters.queuedBytes -= bytes;
+  c->counters.encodedBytes -= bgDocumentEncodedSize(doc) + 1;
+  bg->queuedDocuments--;
+  bg->queuedBytes -= bytes;
+
+  bgDocumentDestroy(doc);
+}
+
+/* Drops every other queued document, oldest kept, and halves the rate new
+ * documents are accepted at.
+ */
+static void bgCollectionSampleDown(struct bgCollection *c)
+{
+  struct bgDocument *doc = NULL;
+  size_t count = ring_size(c->documents);
+  size_t i = 0;
+
+  for(i = 0; i < count; i++)
+  {
+    ring_pop(c->documents, doc);
+
+    if(i % 2 == 0)
+    {
+      ring_push(c->documents, doc);
+    }
+    else
+    {
+      bgCollectionRelease(c, doc);
+      c->counters.sampledOut++;
+    }
+  }
+
+  c->sampleInterval *= 2;
+  c->sampleCount = 0;
+}
+
+void bgCollectionAdd(const char *cln, struct bgDocument *doc)
+{
+  struct bgCollection *col = bgCollectionGet(cln);
+
+  if(!col)
+  {
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(cln, BG_ERROR_UNKNOWN_COLLECTION);
+    }
+
+    bgDocumentDestroy(doc);
+    return;
+  }
+
+  bgCollectionAddH(col, doc);
+}
+
+void bgCollectionAddH(bgCollectionHandle col, struct bgDocument *doc)
+{
+  const char *cln = col->name;
+  struct bgDocument *oldest = NULL;
+  size_t bytes = 0;
+
+  if(col->sampleInterval > 1 && col->sampleCount++ % col->sampleInterval != 0)
+  {
+    col->counters.sampledOut++;
+    bgDocumentDestroy(doc);
+    bgUpdate();
+    return;
+  }
+
+  /* A queued template is counted as it is now, it must stay that way */
+  if(doc->isTemplate)
+  {
+    bgDocumentLock(doc);
+  }
+
+  /* Budgets then see the text rather than the document as it was built */
+  if(col->eager)
+  {
+    doc = bgDocumentFreeze(doc, col->scratch);
+  }
+
+  bytes = bgDocumentSize(doc);
+
+  if(!bgCollectionFits(col, bytes))
+  {
+    switch(col->policy)
+    {
+      case BG_DROP_OLDEST:
+        while(!bgCollectionFits(col, bytes) && ring_pop(col->documents, oldest))
+        {
+          bgCollectionRelease(col, oldest);
+          col->counters.droppedOldest++;
+
+          if(bg->errorFunc != NULL)
+          {
+            bg->errorFunc(cln, BG_ERROR_QUEUE_FULL);
+          }
+        }
+        break;
+
+      case BG_SAMPLE_DOWN:
+        bgCollectionSampleDown(col);
+        break;
+
+      case BG_SPILL_TO_DISK:
+        if(bgCollectionSpill(col, doc))
+        {
+          bgDocumentDestroy(doc);
+          bgUpdate();
+          return;
+        }
+        break;
+    }
+  }
+
+  if(!bgCollectionFits(col, bytes) || !ring_push(col->documents, doc))
+  {
+    col->counters.droppedNewest++;
+
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(cln, BG_ERROR_QUEUE_FULL);
+    }
+
+    bgDocumentDestroy(doc);
+    bgUpdate();
+    return;
+  }
+
+  col->counters.queuedDocuments++;
+  col->counters.queuedBytes += bytes;
+  col->counters.encodedBytes += bgDocumentEncodedSize(doc) + 1;
+  bg->queuedDocuments++;
+  bg->queuedBytes += bytes;
+
+  bgUpdate();
+}
+
+/* Adds a row to a collection with a schema */
+static void bgCollectionAddRowV(struct bgCollection *col, va_list values)
+{
+  size_t bytes = 0;
+  size_t encoded = 0;
+
+  if(!bgColumnsAdd(col->columns, values, &bytes, &encoded))
+  {
+    bgUpdate();
+    return;
+  }
+
+  /* Checked once the row is written, its strings are only measured then */
+  col->counters.queuedBytes += bytes;
+  bg->queuedBytes += bytes;
+
+  if(!bgCollectionFits(col, 0))
+  {
+    bgColumnsPop(col->columns, bytes, encoded);
+    col->counters.queuedBytes -= bytes;
+    bg->queuedBytes -= bytes;
+    col->counters.droppedNewest++;
+
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(col->name, BG_ERROR_QUEUE_FULL);
+    }
+
+    bgUpdate();
+    return;
+  }
+
+  col->counters.queuedDocuments++;
+  col->counters.encodedBytes += encoded;
+  bg->queuedDocuments++;
+
+  bgUpdate();
+}
+
+void bgCollectionAddRow(const char *cln, ...)
+{
+  struct bgCollection *col = bgCollectionGet(cln);
+  va_list values;
+
+  if(!col || !col->columns)
+  {
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(cln, BG_ERROR_UNKNOWN_COLLECTION);
+    }
+
+    return;
+  }
+
+  va_start(values, cln);
+  bgCollectionAddRowV(col, values);
+  va_end(values);
+}
+
+void bgCollectionAddRowH(bgCollectionHandle col, ...)
+{
+  va_list values;
+
+  if(!col->columns)
+  {
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(col->name, BG_ERROR_UNKNOWN_COLLECTION);
+    }
+
+    return;
+  }
+
+  va_start(values, col);
+  bgCollectionAddRowV(col, values);
+  va_end(values);
+}
+
+void bgCollectionBudget(const char *cln, size_t maxDocuments, size_t maxBytes,
+  int policy)
+{
+  struct bgCollection *col = bgCollectionGet(cln);
+
+  if(!col)
+  {
+    printf("Error: Collection does not exist\n");
+    return;
+  }
+
+  bgCollectionBudgetH(col, maxDocuments, maxBytes, policy);
+}
+
+void bgCollectionBudgetH(bgCollectionHandle col, size_t maxDocuments,
+  size_t maxBytes, int policy)
+{
+  col->maxDocuments = maxDocuments;
+  col->maxBytes = maxBytes;
+  col->policy = policy;
+}
+
+void bgCollectionEager(const char *cln, int enabled)
+{
+  struct bgCollection *col = bgCollectionGet(cln);
+
+  if(!col)
+  {
+    printf("Error: Collection does not exist\n");
+    return;
+  }
+
+  bgCollectionEagerH(col, enabled);
+}
+
+void bgCollectionEagerH(bgCollectionHandle col, int enabled)
+{
+  col->eager = enabled;
+
+  if(enabled && !col->scratch)
+  {
+    col->scratch = sstream_new();
+  }
+}
+
+void bgCollectionCounters(const char *cln, struct bgCounters *counters)
+{
+  struct bgCollection **it = NULL;
+  struct bgCollection *col = NULL;
+
+  memset(counters, 0, sizeof(*counters));
+
+  if(cln)
+  {
+    col = bgCollectionGet(cln);
+
+    if(col)
+    {
+      *counters = col->counters;
+    }
+
+    return;
+  }
+
+  vector_foreach(it, bg->collections)
+  {
+    counters->queuedDocuments += (*it)->counters.queuedDocuments;
+    counters->queuedBytes += (*it)->counters.queuedBytes;
+    counters->encodedBytes += (*it)->counters.encodedBytes;
+    counters->droppedNewest += (*it)->counters.droppedNewest;
+    counters->droppedOldest += (*it)->counters.droppedOldest;
+    counters->sampledOut += (*it)->counters.sampledOut;
+    counters->spilled += (*it)->counters.spilled;
+    counters->unspilled += (*it)->counters.unspilled;
+  }
+}
+
+void bgCollectionCountersH(bgCollectionHandle col, struct bgCounters *counters)
+{
+  *counters = col->counters;
+}
+
+void bgCollectionUpload(const char *cln)
+{
+  /* For Serializing data */
+  sstream *ser = NULL;
+  sstream *url = NULL;
+  struct bgCollection* c = bgCollectionGet(cln);
+  size_t count = 0;
+  int responseCode = 0;
+
+  if(!c)
+  {
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(cln, BG_ERROR_UNKNOWN_COLLECTION);
+    }
+
+    return;
+  }
+
+  ser = sstream_new();
+  url = sstream_new();
+
+  count = bgCollectionSerialize(c, ser);
+
+  /* Sending request to server */
+  sstream_push_cstr(url, sstream_cstr(bg->fullUrl));
+  sstream_push_cstr(url, c->name);
+  sstream_push_cstr(url, "/documents");
+  HttpRequest(c->http, sstream_cstr(url), sstream_cstr(ser));
+
+  /* The request holds its own copy of the body. Draining now keeps the
+   * budget policies run by callbacks from touching the sent documents.
+   */
+  bgCollectionDrain(c, count);
+
+  /* blocking while request pushes through */
+  while(!HttpRequestComplete(c->http))
+  {
+#ifdef _WIN32
+    Sleep(10);
+#else
+    usleep(1000);
+#endif
+  }
+
+  /* Handle response */
+  responseCode = HttpResponseStatus(c->http);
+
+  if(responseCode != 200)
+  {
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(c->name, responseCode);
+    }
+  }
+  else
+  {
+    if(bg->successFunc != NULL)
+    {
+      bg->successFunc(c->name, count);
+    }
+  }
+
+  /* Cleanup */
+  sstream_delete(ser);
+  sstream_delete(url);
+}
+
+/* Appends the upload body of all pending documents to ser. Each document is
+ * serialized straight into the stream rather than through a temporary string.
+ * Returns the number of documents sent, queued, rows and spilled, to be passed
+ * on to bgCollectionDrain once they are no longer needed.
+ */
+size_t bgCollectionSerialize(struct bgCollection *c, struct sstream *ser)
+{
+  size_t count = ring_size(c->documents);
+  size_t written = 0;
+  size_t unspilled = 0;
+  size_t i = 0;
+
+  /* Sized up front, the documents never make the stream grow */
+  sstream_reserve(ser, sstream_length(ser) + c->counters.encodedBytes + 32);
+  sstream_push_cstr(ser, "{\"documents\":[");
+
+  for(i = 0; i < count; i++)
+  {
+    size_t length = sstream_length(ser);
+
+    if(written > 0)
+    {
+      sstream_push_char(ser, ',');
+    }
+
+    if(bgDocumentSerialize(ring_at(c->documents, i), ser))
+    {
+      written++;
+    }
+    else
+    {
+      /* Take the separator back */
+      sstream_truncate(ser, length);
+    }
+  }
+
+  if(c->columns)
+  {
+    written = bgColumnsSerialize(c->columns, ser, written);
+    count += c->columns->rows;
+  }
+
+  /* Spilled documents ride along, they are already serialized */
+  unspilled = bgCollectionUnspill(c, ser, written) - written;
+  count += unspilled;
+
+  sstream_push_cstr(ser, "]}");
+
+  return count;
+}
+
+/* Destroys the count oldest documents and removes them from the queue. Each
+ * document is released as a whole, its values are never walked. A count past
+ * the queued documents covers the rows, anything beyond that was read back
+ * from the spill file and is already gone.
+ */
+void bgCollectionDrain(struct bgCollection *c, size_t count)
+{
+  struct bgDocument *batch[64] = {0};
+  size_t documents = ring_size(c->documents);
+
+  /* Rows follow the documents and are always serialized together */
+  if(count > documents && c->columns)
+  {
+    c->counters.queuedDocuments -= c->columns->rows;
+    c->counters.queuedBytes -= c->columns->bytes;
+    c->counters.encodedBytes -= c->columns->encoded;
+    bg->queuedDocuments -= c->columns->rows;
+    bg->queuedBytes -= c->columns->bytes;
+    bgColumnsClear(c->columns);
+  }
+
+  if(count > documents)
+  {
+    count = documents;
+  }
+
+  while(count > 0)
+  {
+    size_t n = ring_peek_batch(c->documents, batch,
+      count < 64 ? count : 64);
+    size_t i = 0;
+
+    for(i = 0; i < n; i++)
+    {
+      bgCollectionRelease(c, batch[i]);
+    }
+
+    ring_discard(c->documents, n);
+    count -= n;
+  }
+
+  /* The queue has been uploaded, stop sampling */
+  c->sampleInterval = 1;
+  c->sampleCount = 0;
+}
+
+/* Destroys collection and containing documents w/o upload, spilled documents
+ * stay on disk for the next run.
+ */
+void bgCollectionDestroy(struct bgCollection *cln)
+{
+  if(cln->documents != NULL)
+  {
+    bgCollectionDrain(cln, ring_size(cln->documents) +
+      (cln->columns ? cln->columns->rows : 0));
+    ring_delete(cln->documents);
+  }
+
+  if(cln->columns)
+  {
+    bgColumnsDestroy(cln->columns);
+  }
+
+  if(cln->scratch)
+  {
+    sstream_delete(cln->scratch);
+  }
+
+  if(cln->spill)
+  {
+    fclose(cln->spill);
+  }
+
+  HttpDestroy(cln->http);
+
+  pfree(cln);
+}
+
+/*  Helper function to get the collection from the state by name
+ *  returns NULL if no collection by cln exists
+ */
+struct bgCollection *bgCollectionGet(const char *cln)
+{
+  /* Names are interned so the index is keyed by pointer. A name that was
+   * never interned can not be a collection.
+   */
+  const char *name = intern_find(cln);
+
+  if(!name || bg->collectionIndex.count == 0)
+  {
+    return NULL;
+  }
+
+  return *bgCollectionSlot(name);
+}
+
+
+#ifndef AMALGAMATION
+  #include "config.h"
+  #include "Memory.h"
+  #include "parson.h"
+
+  #include <bg/analytics.h>
+  #include <palloc/arena.h>
+  #include <palloc/intern.h>
+  #include <palloc/palloc.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Enough for every palloc tag */
+#define BG_MEMORY_TYPES 65
+
+/* Every block records its class just in front of the memory handed out */
+union bgMemoryHeader
+{
+  size_t cls;
+  double align;
+};
+
+static struct bgMemory *bgMemoryCurrent;
+static struct bgMemoryCounters bgMemoryCount;
+
+/* Totals at the previous bgMemoryStats call, to derive the rates */
+static struct palloc_stats bgMemoryLast;
+static struct bgMemoryCounters bgMemoryLastCount;
+static time_t bgMemoryLastTime;
+static struct bgMemoryType bgMemoryTypes[BG_MEMORY_TYPES];
+
+#ifdef BG_DOCUMENT_TREE
+/* Node sizes are filled in by bgMemoryInit */
+static size_t bgMemorySize[BG_MEMORY_LARGE] = {0, 0, 0, 16, 32, 64, 128};
+
+static size_t bgMemoryClassOf(size_t size)
+{
+  size_t rtn = 0;
+
+  for(rtn = BG_MEMORY_VALUE; rtn <= BG_MEMORY_ARRAY; rtn++)
+  {
+    if(size == bgMemorySize[rtn])
+    {
+      return rtn;
+    }
+  }
+
+  for(rtn = BG_MEMORY_SMALL16; rtn < BG_MEMORY_LARGE; rtn++)
+  {
+    if(size <= bgMemorySize[rtn])
+    {
+      return rtn;
+    }
+  }
+
+  return BG_MEMORY_LARGE;
+}
+
+static void *bgMemoryMalloc(size_t size)
+{
+  union bgMemoryHeader *header = NULL;
+  size_t cls = bgMemoryClassOf(size);
+  void *rtn = NULL;
+
+  /* Anyone else using parson gets ordinary heap memory */
+  if(!bgMemoryCurrent)
+  {
+    return malloc(size);
+  }
+
+  if(cls != BG_MEMORY_LARGE)
+  {
+    rtn = bgMemoryCurrent->free[cls];
+
+    if(rtn)
+    {
+      bgMemoryCurrent->free[cls] = *(void **)rtn;
+      bgMemoryCount.hits[cls]++;
+
+      return rtn;
+    }
+
+    size = bgMemorySize[cls];
+  }
+
+  header = (union bgMemoryHeader *)arena_alloc(&bgMemoryCurrent->arena,
+    sizeof(union bgMemoryHeader) + size);
+
+  if(!header)
+  {
+    return NULL;
+  }
+
+  header->cls = cls;
+  bgMemoryCount.misses[cls]++;
+
+  return header + 1;
+}
+
+static void bgMemoryFree(void *ptr)
+{
+  union bgMemoryHeader *header = NULL;
+
+  /* Documents only free between bgMemoryBegin and bgMemoryEnd, anything
+   * freed outside of one came from malloc.
+   */
+  if(!bgMemoryCurrent)
+  {
+    free(ptr);
+    return;
+  }
+
+  if(!ptr)
+  {
+    return;
+  }
+
+  header = (union bgMemoryHeader *)ptr - 1;
+
+  if(header->cls == BG_MEMORY_LARGE)
+  {
+    return;
+  }
+
+  *(void **)ptr = bgMemoryCurrent->free[header->cls];
+  bgMemoryCurrent->free[header->cls] = ptr;
+}
+#endif
+
+void bgMemoryInit()
+{
+#ifdef BG_DOCUMENT_TREE
+  json_node_sizes(&bgMemorySize[BG_MEMORY_VALUE],
+    &bgMemorySize[BG_MEMORY_OBJECT], &bgMemorySize[BG_MEMORY_ARRAY]);
+
+  json_set_allocation_functions(bgMemoryMalloc, bgMemoryFree);
+#endif
+
+  palloc_stats(&bgMemoryLast);
+  bgMemoryLastCount = bgMemoryCount;
+  bgMemoryLastTime = time(NULL);
+}
+
+void bgMemoryShutdown()
+{
+#ifdef BG_DOCUMENT_TREE
+  json_set_allocation_functions(malloc, free);
+#endif
+
+  bgMemoryEnd();
+}
+
+void bgMemoryBegin(struct bgMemory *m)
+{
+  bgMemoryCurrent = m;
+
+  /* Document keys share the table with collection names, keys parsed by
+   * anyone else stay their own.
+   */
+  json_set_key_intern_function(intern_chars);
+}
+
+void bgMemoryEnd()
+{
+  bgMemoryCurrent = NULL;
+  json_set_key_intern_function(NULL);
+}
+
+void bgMemoryStats(struct bgMemoryStats *stats)
+{
+  struct palloc_stats now = {0};
+  struct palloc_tag tags[BG_MEMORY_TYPES];
+  size_t tagCount = palloc_tags(tags, BG_MEMORY_TYPES);
+  time_t tNow = time(NULL);
+  double elapsed = difftime(tNow, bgMemoryLastTime);
+  size_t i = 0;
+
+  palloc_stats(&now);
+
+  stats->liveBytes = now.liveBytes;
+  stats->liveObjects = now.liveObjects;
+  stats->peakBytes = now.peakBytes;
+  stats->heldBytes = now.heldBytes;
+  stats->peakHeldBytes = now.peakHeldBytes;
+  stats->allocs = now.allocs - bgMemoryLast.allocs;
+  stats->frees = now.frees - bgMemoryLast.frees;
+  stats->allocsPerSecond = 0;
+  stats->freesPerSecond = 0;
+
+  if(elapsed >= 1)
+  {
+    stats->allocsPerSecond = stats->allocs / elapsed;
+    stats->freesPerSecond = stats->frees / elapsed;
+  }
+
+  stats->documentHits = 0;
+  stats->documentMisses = 0;
+
+  for(i = 0; i < BG_MEMORY_CLASSES; i++)
+  {
+    stats->documentHits += bgMemoryCount.hits[i] - bgMemoryLastCount.hits[i];
+    stats->documentMisses += bgMemoryCount.misses[i] -
+      bgMemoryLastCount.misses[i];
+  }
+
+  bgMemoryLast = now;
+  bgMemoryLastCount = bgMemoryCount;
+  bgMemoryLastTime = tNow;
+
+  /* Identical type names from different translation units are separate tags,
+   * fold them together.
+   */
+  stats->typeCount = 0;
+
+  if(tagCount > BG_MEMORY_TYPES)
+  {
+    tagCount = BG_MEMORY_TYPES;
+  }
+
+  for(i = 0; i < tagCount; i++)
+  {
+    struct bgMemoryType *type = NULL;
+    size_t j = 0;
+
+    for(j = 0; j < stats->typeCount; j++)
+    {
+      if(strcmp(bgMemoryTypes[j].type, tags[i].type) == 0)
+      {
+        type = &bgMemoryTypes[j];
+        break;
+      }
+    }
+
+    if(!type)
+    {
+      type = &bgMemoryTypes[stats->typeCount];
+      type->type = tags[i].type;
+      type->count = 0;
+      type->bytes = 0;
+      stats->typeCount++;
+    }
+
+    type->count += tags[i].count;
+    type->bytes += tags[i].bytes;
+  }
+
+  stats->types = bgMemoryTypes;
+}
+
+#ifndef AMALGAMATION
+  #include "config.h"
+  #include "Document.h"
+  #include "Field.h"
+  #include "State.h"
+  #include "Memory.h"
+  #include "parson.h"
+
+  #include <bg/analytics.h>
+  #include <palloc/arena.h>
+  #include <palloc/intern.h>
+  #include <palloc/number.h>
+  #include <palloc/palloc.h>
+  #include <palloc/sstream.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+void bgUpdate();
+
+/* Splits path into interned keys, returns how many or 0 if it is too deep.
+ * Keys of the leading segments path has in common with prev are taken from
+ * keys as left by splitting prev, so a run of paths under the same object
+ * interns the object's key once. shared receives how many were reused.
+ */
+static size_t bgDocumentKeys(const char *path, const char *prev,
+  const char **keys, size_t *shared)
+{
+  struct sstrview rest = {0};
+  struct sstrview key = {0};
+  size_t rtn = 0;
+  size_t from = 0;
+  size_t i = 0;
+
+  for(i = 0; prev && path[i] && path[i] == prev[i]; i++)
+  {
+    if(path[i] == '.')
+    {
+      rtn++;
+      from = i + 1;
+    }
+  }
+
+  if(shared)
+  {
+    *shared = rtn;
+  }
+
+  rest = sstrview_cstr(path + from);
+
+  while(sstrview_next(&rest, '.', &key))
+  {
+    if(rtn == BG_PATH_MAX_DEPTH)
+    {
+      printf("Error: Path is too deep\n");
+      return 0;
+    }
+
+    keys[rtn++] = intern_chars(key.s, key.len);
+  }
+
+  /* An empty path is a single empty key, a trailing dot ends in one as it
+   * does with parson's dotted setters.
+   */
+  if(rtn == 0 || path[strlen(path) - 1] == '.')
+  {
+    if(rtn == BG_PATH_MAX_DEPTH)
+    {
+      printf("Error: Path is too deep\n");
+      return 0;
+    }
+
+    keys[rtn++] = intern_chars(path, 0);
+  }
+
+  return rtn;
+}
+
+int bgDocumentWriteString(struct sstream *out, const char *s)
+{
+  size_t size = json_string_serialization_size(s);
+  struct sstream_builder b = {0};
+
+  if(size == 0)
+  {
+    return 0;
+  }
+
+  b = sstream_builder_begin(out, size);
+  json_serialize_string_to_buffer(s, b.tail, b.remaining);
+  sstream_builder_commit(&b, size - 1);
+
+  return 1;
+}
+
+#ifdef BG_DOCUMENT_TREE
+struct bgDocument *bgDocumentCreate()
+{
+  struct bgMemory memory = {0};
+  struct bgDocument *rtn = NULL;
+
+  /* The document lives in its own arena alongside its values */
+  rtn = (struct bgDocument *)arena_alloc(&memory.arena, sizeof(struct bgDocument));
+
+  if(!rtn)
+  {
+    return NULL;
+  }
+
+  rtn->memory = memory;
+  rtn->rootArr = NULL;
+  rtn->isTemplate = 0;
+  rtn->locked = 0;
+  rtn->text = NULL;
+  rtn->textLength = 0;
+
+  bgMemoryBegin(&rtn->memory);
+  rtn->rootVal = json_value_init_object();
+  rtn->rootObj = json_value_get_object(rtn->rootVal);
+  //rtn->rootArr = json_value_get_array(rtn->rootVal);
+  bgMemoryEnd();
+
+  return rtn;
+}
+
+void bgDocumentDestroy(struct bgDocument *doc)
+{
+  /* The arena is stored in memory it owns */
+  struct arena arena = doc->memory.arena;
+
+  if(doc->isTemplate)
+  {
+    return;
+  }
+
+  if(doc->text)
+  {
+    pfree(doc);
+    return;
+  }
+
+  arena_reset(&arena);
+}
+
+struct bgDocument *bgDocumentTemplateCreate()
+{
+  struct bgDocument *rtn = bgDocumentCreate();
+
+  rtn->isTemplate = 1;
+  vector_push_back(bg->templates, rtn);
+
+  return rtn;
+}
+
+void bgDocumentLock(struct bgDocument *tmpl)
+{
+  tmpl->locked = 1;
+}
+
+/* Setters refuse a template once it has been used */
+static int bgDocumentLocked(struct bgDocument *doc)
+{
+  if(doc->locked)
+  {
+    printf("Error: Template has already been used\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Trees can not share values, the template is copied */
+struct bgDocument *bgDocumentCreateFromTemplate(struct bgDocument *tmpl)
+{
+  struct bgDocument *rtn = NULL;
+
+  if(!tmpl->isTemplate)
+  {
+    printf("Error: Document is not a template\n");
+    return NULL;
+  }
+
+  bgDocumentLock(tmpl);
+
+  rtn = bgDocumentCreate();
+  bgMemoryBegin(&rtn->memory);
+  json_value_free(rtn->rootVal);
+  rtn->rootVal = json_value_deep_copy(tmpl->rootVal);
+  rtn->rootObj = json_value_get_object(rtn->rootVal);
+  bgMemoryEnd();
+
+  return rtn;
+}
+
+void bgDocumentTemplateDestroy(struct bgDocument *tmpl)
+{
+  tmpl->isTemplate = 0;
+  bgDocumentDestroy(tmpl);
+}
+
+size_t bgDocumentSize(struct bgDocument *doc)
+{
+  if(doc->text)
+  {
+    return sizeof(*doc) + doc->textLength + 1;
+  }
+
+  return doc->memory.arena.size;
+}
+
+/* parson keeps no running size, this is a dry run */
+size_t bgDocumentEncodedSize(struct bgDocument *doc)
+{
+  size_t size = 0;
+
+  if(doc->text)
+  {
+    return doc->textLength;
+  }
+
+  size = json_serialization_size(doc->rootVal);
+
+  return size > 0 ? size - 1 : 0;
+}
+
+int bgDocumentSerialize(struct bgDocument *doc, struct sstream *out)
+{
+  size_t size = 0;
+  struct sstream_builder b = {0};
+
+  if(doc->text)
+  {
+    sstream_push_chars(out, doc->text, doc->textLength);
+    return 1;
+  }
+
+  size = json_serialization_size(doc->rootVal);
+
+  if(size == 0)
+  {
+    return 0;
+  }
+
+  /* size includes the null terminator written by parson */
+  b = sstream_builder_begin(out, size);
+  json_serialize_to_buffer(doc->rootVal, b.tail, b.remaining);
+  sstream_builder_commit(&b, size - 1);
+
+  return 1;
+}
+
+struct bgDocument *bgDocumentFreeze(struct bgDocument *doc,
+  struct sstream *scratch)
+{
+  struct bgDocument *rtn = NULL;
+  size_t length = 0;
+
+  if(doc->isTemplate || doc->text)
+  {
+    return doc;
+  }
+
+  sstream_clear(scratch);
+
+  if(!bgDocumentSerialize(doc, scratch))
+  {
+    return doc;
+  }
+
+  /* Arena blocks would be mostly empty, the text sits right behind the
+   * document in a single allocation instead.
+   */
+  length = sstream_length(scratch);
+  rtn = (struct bgDocument *)_palloc(sizeof(struct bgDocument) + length + 1,
+    "struct bgDocument");
+
+  if(!rtn)
+  {
+    printf("Error: Failed to allocate\n");
+    return doc;
+  }
+
+  rtn->text = (char *)(rtn + 1);
+  rtn->textLength = length;
+  memcpy(rtn->text, sstream_cstr(scratch), length + 1);
+
+  bgDocumentDestroy(doc);
+
+  return rtn;
+}
+
+/* Number of segments in a dotted path, an empty path has none and is set
+ * directly rather than through the dotted setters.
+ */
+static size_t bgDocumentPathDepth(const char *path)
+{
+  return sstrview_split(sstrview_cstr(path), '.', NULL, 0);
+}
+
+void bgDocumentAddCStr(struct bgDocument *doc, const char *path, const char *val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+
+  if(bgDocumentPathDepth(path) == 0)
+  {
+    json_object_set_string(doc->rootObj, path, val);
+  }
+  else
+  {
+    json_object_dotset_string(doc->rootObj, path, val);
+  }
+
+  bgMemoryEnd();
+  bgUpdate();
+}
+
+void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+
+  if(bgDocumentPathDepth(path) == 0)
+  {
+    json_object_set_number(doc->rootObj, path, val);
+  }
+  else
+  {
+    json_object_dotset_number(doc->rootObj, path, val);
+  }
+
+  bgMemoryEnd();
+  bgUpdate();
+}
+
+void bgDocumentAddDouble(struct bgDocument *doc, const char *path, double val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+
+  if(bgDocumentPathDepth(path) == 0)
+  {
+    json_object_set_number(doc->rootObj, path, val);
+  }
+  else
+  {
+    json_object_dotset_number(doc->rootObj, path, val);
+  }
+
+  bgMemoryEnd();
+  bgUpdate();
+}
+
+void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+
+  if(bgDocumentPathDepth(path) == 0)
+  {
+    json_object_set_boolean(doc->rootObj, path, val);
+  }
+  else
+  {
+    json_object_dotset_boolean(doc->rootObj, path, val);
+  }
+
+  bgMemoryEnd();
+  bgUpdate();
+}
+
+void bgDocumentAddMany(struct bgDocument *doc, const struct bgValue *values,
+  size_t count)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+  const char *prev = NULL;
+  JSON_Object *parent = NULL;
+  JSON_Value *val = NULL;
+  size_t prevDepth = 0;
+  size_t depth = 0;
+  size_t shared = 0;
+  size_t i = 0;
+  size_t k = 0;
+
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+
+  for(i = 0; i < count; i++)
+  {
+    depth = bgDocumentKeys(values[i].path, prev, keys, &shared);
+    prev = depth > 0 ? values[i].path : NULL;
+
+    switch(values[i].type)
+    {
+      case BG_TYPE_CSTR:
+        val = json_value_init_string(values[i].cstr);
+        break;
+
+      case BG_TYPE_INT:
+        val = json_value_init_number((int)values[i].number);
+        break;
+
+      case BG_TYPE_DOUBLE:
+        val = json_value_init_number(values[i].number);
+        break;
+
+      case BG_TYPE_BOOL:
+        val = json_value_init_boolean(values[i].number != 0);
+        break;
+
+      default:
+        printf("Error: Unknown field type\n");
+        val = NULL;
+    }
 
-#define HTTP_CONNECTING 1
-#define HTTP_RECEIVING 2
-#define HTTP_COMPLETE 3
+    if(depth == 0 || !val)
+    {
+      json_value_free(val);
+      parent = NULL;
+      continue;
+    }
 
-#define BUFFER_SIZE 1024
+    /* A sibling of the previous value goes straight into the same object */
+    if(parent && depth == prevDepth && shared + 1 >= depth)
+    {
+      if(json_object_keyset_value(parent, keys + depth - 1, 1, val) ==
+        JSONFailure)
+      {
+        json_value_free(val);
+      }
 
-#ifdef USE_POSIX
-  #define NULL_SOCKET -1
-#endif
-#ifdef USE_WINSOCK
-  #define NULL_SOCKET INVALID_SOCKET
-#endif
+      continue;
+    }
 
-static int winsockInitialized;
+    if(json_object_keyset_value(doc->rootObj, keys, depth, val) == JSONFailure)
+    {
+      json_value_free(val);
+      parent = NULL;
+      continue;
+    }
 
-struct CustomHeader
-{
-  sstream *variable;
-  sstream *value;
-};
+    parent = doc->rootObj;
+    prevDepth = depth;
 
-struct Http
+    for(k = 0; parent && k + 1 < depth; k++)
+    {
+      parent = json_object_get_object(parent, keys[k]);
+    }
+  }
+
+  bgMemoryEnd();
+  bgUpdate();
+}
+
+/* Takes ownership of val */
+static void bgDocumentSetField(struct bgDocument *doc, struct bgField *field,
+  JSON_Value *val)
 {
-  sstream *host;
-  sstream *path;
-  sstream *query;
-  sstream *post;
-  vector(char) *raw;
-  vector(int) *socks;
-  sstream *rawHeaders;
-  sstream *rawContent;
-  vector(struct CustomHeader) *customHeaders;
-  int sock;
-  int status;
-};
+  if(json_object_keyset_value(doc->rootObj, field->keys, field->depth, val)
+    == JSONFailure)
+  {
+    json_value_free(val);
+  }
+}
 
-void HttpAddCustomHeader(struct Http *ctx, const char *variable, const char *value)
+void bgDocumentSetCStrByField(struct bgDocument *doc, struct bgField *field,
+  const char *val)
 {
-  struct CustomHeader ch = {0};
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
 
-  ch.variable = sstream_new();
-  sstream_push_cstr(ch.variable, variable);
-  ch.value = sstream_new();
-  sstream_push_cstr(ch.value, value);
-  vector_push_back(ctx->customHeaders, ch);
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_string(val));
+  bgMemoryEnd();
+
+  bgUpdate();
 }
 
-void _HttpClearSocks(struct Http *ctx)
+void bgDocumentSetIntByField(struct bgDocument *doc, struct bgField *field,
+  int val)
 {
-  size_t i = 0;
-
-  for(i = 0; i < vector_size(ctx->socks); i++)
+  if(bgDocumentLocked(doc))
   {
-#ifdef USE_POSIX
-    close(vector_at(ctx->socks, i));
-#endif
-#ifdef USE_WINSOCK
-    shutdown(vector_at(ctx->socks, i), SD_BOTH);
-    closesocket(vector_at(ctx->socks, i));
-#endif
+    return;
   }
 
-  vector_clear(ctx->socks);
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_number(val));
+  bgMemoryEnd();
+
+  bgUpdate();
 }
 
-int HttpState(struct Http *ctx)
+void bgDocumentSetDoubleByField(struct bgDocument *doc, struct bgField *field,
+  double val)
 {
-  if(vector_size(ctx->socks) > 0)
+  if(bgDocumentLocked(doc))
   {
-    return HTTP_CONNECTING;
+    return;
   }
-  else if(ctx->sock != NULL_SOCKET)
+
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_number(val));
+  bgMemoryEnd();
+
+  bgUpdate();
+}
+
+void bgDocumentSetBoolByField(struct bgDocument *doc, struct bgField *field,
+  int val)
+{
+  if(bgDocumentLocked(doc))
   {
-    return HTTP_RECEIVING;
+    return;
   }
 
-  return HTTP_COMPLETE;
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_boolean(val));
+  bgMemoryEnd();
+
+  bgUpdate();
 }
+#else
+/*
+ * A document is a buffer of records, one per value set. Each record is
+ * followed by the interned keys of its path and the value already in its JSON
+ * form. Setting a path again, or a parent of it, marks the older records dead
+ * so the live records always describe a tree; setting a path below a value
+ * fails like it does in parson. Serializing groups the live records by their
+ * keys, members appear in the order they were first set.
+ */
+struct bgRecord
+{
+  size_t size;
+  size_t valueLength;
+  unsigned short depth;
+  unsigned char dead;
+  unsigned char visited;
+};
 
-#ifdef USE_WINSOCK
-void _HttpShutdownWinsock()
+union bgRecordAlign
 {
-  WSACleanup();
+  size_t s;
+  void *p;
+};
+
+#define BG_RECORD_ALIGN(S) \
+  (((S) + sizeof(union bgRecordAlign) - 1) & ~(sizeof(union bgRecordAlign) - 1))
+
+#define BG_RECORD_KEYS(R) \
+  ((const char **)((R) + 1))
+
+#define BG_RECORD_VALUE(R) \
+  ((char *)(BG_RECORD_KEYS(R) + (R)->depth))
+
+#define BG_DOCUMENT_MIN_CAPACITY 128
+
+/* Typical record with a two key path and a short value */
+#define BG_RECORD_ESTIMATE \
+  (sizeof(struct bgRecord) + 2 * sizeof(const char *) + 16)
+
+struct bgDocument *bgDocumentCreate()
+{
+  /* Records are allocated by the first setter */
+  return palloc(struct bgDocument);
 }
-#endif
 
-struct Http *HttpCreate()
+void bgDocumentDestroy(struct bgDocument *doc)
 {
-  struct Http *rtn = NULL;
-#ifdef USE_WINSOCK
-  if(!winsockInitialized)
+  if(doc->isTemplate)
   {
-    WSADATA wsaData = {0};
-    int result = 0;
-
-    result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-
-    if(result != 0)
-    {
-      printf("WSAStartup failed with error: %d\n", result);
-      return NULL;
-    }
+    return;
+  }
 
-    winsockInitialized = 1;
-    atexit(_HttpShutdownWinsock);
+  if(doc->records)
+  {
+    pfree(doc->records);
   }
-#endif
 
-  rtn = palloc(struct Http);
-  rtn->raw = vector_new(char);
-  rtn->rawContent = sstream_new();
-  rtn->rawHeaders = sstream_new();
-  rtn->socks = vector_new(int);
-  rtn->customHeaders = vector_new(struct CustomHeader);
-  rtn->sock = NULL_SOCKET;
-  rtn->host = sstream_new();
-  rtn->path = sstream_new();
-  rtn->query = sstream_new();
-  rtn->post = sstream_new();
+  if(doc->text)
+  {
+    pfree(doc->text);
+  }
 
-  return rtn;
+  pfree(doc);
 }
 
-void HttpDestroy(struct Http *ctx)
+struct bgDocument *bgDocumentTemplateCreate()
 {
-  size_t i = 0;
+  struct bgDocument *rtn = bgDocumentCreate();
 
-  _HttpClearSocks(ctx);
-  vector_delete(ctx->socks);
-  sstream_delete(ctx->rawHeaders);
-  sstream_delete(ctx->rawContent);
-  vector_delete(ctx->raw);
-  sstream_delete(ctx->host);
-  sstream_delete(ctx->path);
-  sstream_delete(ctx->query);
-  sstream_delete(ctx->post);
+  rtn->isTemplate = 1;
+  vector_push_back(bg->templates, rtn);
 
-  for(i = 0; i < vector_size(ctx->customHeaders); i++)
+  return rtn;
+}
+
+void bgDocumentTemplateDestroy(struct bgDocument *tmpl)
+{
+  if(tmpl->shared)
   {
-    sstream_delete(vector_at(ctx->customHeaders, i).variable);
-    sstream_delete(vector_at(ctx->customHeaders, i).value);
+    sstream_delete(tmpl->shared);
   }
 
-  vector_delete(ctx->customHeaders);
-
-  pfree(ctx);
+  tmpl->isTemplate = 0;
+  bgDocumentDestroy(tmpl);
 }
 
-void _HttpPollConnect(struct Http *ctx)
+size_t bgDocumentSize(struct bgDocument *doc)
 {
-  size_t i = 0;
-  sstream *content = NULL;
+  if(doc->text)
+  {
+    return sizeof(*doc) + doc->textLength + 1;
+  }
 
-  //printf("polling connect\n");
+  return sizeof(*doc) + doc->capacity;
+}
 
-  for(i = 0; i < vector_size(ctx->socks); i++)
+size_t bgDocumentEncodedSize(struct bgDocument *doc)
+{
+  if(doc->text)
   {
-    fd_set write_fds = {0};
-    struct timeval tv = {0};
-    int err = 0;
-    int sock = vector_at(ctx->socks, i);
+    return doc->textLength;
+  }
 
-    FD_SET(sock, &write_fds);
-    err = select(sock + 1, NULL, &write_fds, NULL, &tv);
+  /* Records count a comma each, one more than needed. The shared text has
+   * the opening brace.
+   */
+  if(doc->base)
+  {
+    return sstream_length(doc->base->shared) + doc->encoded + 1;
+  }
 
-    if(err == 0)
-    {
-      continue;
-    }
-    else if(err == -1)
-    {
-#ifdef USE_POSIX
-      close(sock);
-#endif
-#ifdef USE_WINSOCK
-      shutdown(sock, SD_BOTH);
-      closesocket(sock);
-#endif
-      vector_erase(ctx->socks, i);
-      i--;
-      continue;
-    }
-    else
-    {
-      int optval = 0;
-      int optlen = sizeof(optval);
-#ifdef USE_POSIX
-      if(getsockopt(sock, SOL_SOCKET, SO_ERROR, &optval, (socklen_t *)&optlen) == -1)
-#endif
-#ifdef USE_WINSOCK
-      if(getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&optval, &optlen) == -1)
-#endif
-      {
-#ifdef USE_POSIX
-        close(sock);
-#endif
-#ifdef USE_WINSOCK
-        shutdown(sock, SD_BOTH);
-        closesocket(sock);
-#endif
-        vector_erase(ctx->socks, i);
-        i--;
-        continue;
-      }
+  return doc->encoded + 2;
+}
 
-      if(optval != 0)
-      {
-#ifdef USE_POSIX
-        close(sock);
-#endif
-#ifdef USE_WINSOCK
-        shutdown(sock, SD_BOTH);
-        closesocket(sock);
-#endif
-        vector_erase(ctx->socks, i);
-        i--;
-        continue;
-      }
-    }
+/* Makes sure size more bytes fit, growing the records geometrically */
+static int bgDocumentReserve(struct bgDocument *doc, size_t size)
+{
+  size_t capacity = doc->capacity * 2;
+  char *records = NULL;
 
-    ctx->sock = sock;
-    vector_erase(ctx->socks, i);
-    _HttpClearSocks(ctx);
-    break;
+  if(doc->capacity - doc->length >= size)
+  {
+    return 1;
   }
 
-  if(ctx->sock == NULL_SOCKET && vector_size(ctx->socks) < 1)
+  if(capacity < BG_DOCUMENT_MIN_CAPACITY)
   {
-    ctx->status = -1;
-    return;
+    capacity = BG_DOCUMENT_MIN_CAPACITY;
   }
 
-  if(ctx->sock == NULL_SOCKET)
+  while(capacity - doc->length < size)
   {
-    return;
+    capacity *= 2;
   }
 
-  content = sstream_new();
+  records = (char *)_palloc_uninit(capacity, "struct bgRecord");
 
-  if(sstream_length(ctx->post) > 0)
+  if(!records)
   {
-    sstream_push_cstr(content, "POST ");
+    printf("Error: Failed to allocate\n");
+    return 0;
   }
-  else
+
+  if(doc->records)
   {
-    sstream_push_cstr(content, "GET ");
+    memcpy(records, doc->records, doc->length);
+    pfree(doc->records);
   }
 
-  sstream_push_cstr(content, sstream_cstr(ctx->path));
+  doc->records = records;
+  doc->capacity = capacity;
 
-  if(sstream_length(ctx->query) > 0)
+  return 1;
+}
+
+/* Appends size bytes to the records */
+static char *bgDocumentGrow(struct bgDocument *doc, size_t size)
+{
+  char *rtn = NULL;
+
+  if(!bgDocumentReserve(doc, size))
   {
-    sstream_push_char(content, '?');
-    sstream_push_cstr(content, sstream_cstr(ctx->query));
+    return NULL;
   }
 
-  sstream_push_cstr(content, " HTTP/1.0\r\n");
-  sstream_push_cstr(content, "Host: ");
-  sstream_push_cstr(content, sstream_cstr(ctx->host));
-  sstream_push_cstr(content, "\r\n");
+  rtn = doc->records + doc->length;
+  doc->length += size;
 
-  for(i = 0; i < vector_size(ctx->customHeaders); i++)
+  return rtn;
+}
+
+static int bgRecordPrefix(struct bgRecord *rec, const char * const *keys,
+  size_t count)
+{
+  const char **recKeys = BG_RECORD_KEYS(rec);
+  size_t i = 0;
+
+  for(i = 0; i < count; i++)
   {
-    sstream_push_cstr(content,
-      sstream_cstr(vector_at(ctx->customHeaders, i).variable));
+    if(recKeys[i] != keys[i])
+    {
+      return 0;
+    }
+  }
 
-    sstream_push_cstr(content, ": ");
+  return 1;
+}
 
-    sstream_push_cstr(content,
-      sstream_cstr(vector_at(ctx->customHeaders, i).value));
+/* Bytes the record adds to the serialized document. Parent objects are
+ * counted for every record under them, so this overestimates documents with
+ * nested members.
+ */
+static size_t bgRecordEncoded(struct bgRecord *rec)
+{
+  const char **keys = BG_RECORD_KEYS(rec);
+  size_t rtn = rec->valueLength + 1;
+  size_t i = 0;
 
-    sstream_push_cstr(content, "\r\n");
+  /* Quotes and colon per key, braces per parent */
+  for(i = 0; i < rec->depth; i++)
+  {
+    rtn += strlen(keys[i]) + 3;
   }
 
-  if(sstream_length(ctx->post) > 0)
+  return rtn + 2 * (rec->depth - 1);
+}
+
+/* Takes a copy of the template's records, ahead of the document's own, so
+ * members shared with the template can be changed.
+ */
+static int bgDocumentUnshare(struct bgDocument *doc)
+{
+  struct bgDocument *base = doc->base;
+  char *records = doc->records;
+  size_t length = doc->length;
+  char *dst = NULL;
+
+  doc->records = NULL;
+  doc->length = 0;
+  doc->capacity = 0;
+  dst = bgDocumentGrow(doc, base->length + length);
+
+  if(!dst)
   {
-    sstream_push_cstr(content, "Content-Length: ");
-    sstream_push_int(content, sstream_length(ctx->post));
-    sstream_push_cstr(content, "\r\n");
+    doc->records = records;
+    doc->length = length;
+    return 0;
   }
 
-  sstream_push_cstr(content, "\r\n");
+  if(base->length > 0)
+  {
+    memcpy(dst, base->records, base->length);
+  }
 
-  if(sstream_length(ctx->post) > 0)
+  if(records)
   {
-    sstream_push_cstr(content, sstream_cstr(ctx->post));
+    memcpy(dst + base->length, records, length);
+    pfree(records);
   }
 
-#ifdef USE_POSIX
-  send(ctx->sock, sstream_cstr(content), sstream_length(content), MSG_NOSIGNAL);
-#endif
-#ifdef USE_WINSOCK
-  send(ctx->sock, sstream_cstr(content), sstream_length(content), 0);
-#endif
+  doc->encoded += base->encoded;
+  doc->base = NULL;
 
-  sstream_delete(content);
+  return 1;
 }
 
-void _HttpProcessHeaders(struct Http *ctx)
+/* Whether the template has a member named key */
+static int bgDocumentShares(struct bgDocument *base, const char *key)
 {
-  vector(sstream *) *lines = NULL;
-  vector(sstream *) *line = NULL;
-  size_t i = 0;
-  size_t j = 0;
-
-  lines = vector_new(sstream *);
-  line = vector_new(sstream *);
-  sstream_split(ctx->rawHeaders, '\n', lines);
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
 
-  for(i = 0; i < vector_size(lines); i++)
+  for(offset = 0; offset < base->length; offset += rec->size)
   {
-    sstream_split(vector_at(lines, i), ' ', line);
+    rec = (struct bgRecord *)(base->records + offset);
 
-    if(vector_size(line) >= 2)
+    if(!rec->dead && BG_RECORD_KEYS(rec)[0] == key)
     {
-      if(strcmp(sstream_cstr(vector_at(line, 0)), "HTTP/1.1") == 0 ||
-        strcmp(sstream_cstr(vector_at(line, 0)), "HTTP/1.0") == 0)
-      {
-        //printf("Status: %s\n", sstream_cstr(vector_at(line, 1)));
-        ctx->status = atoi(sstream_cstr(vector_at(line, 1)));
-      }
+      return 1;
     }
+  }
 
-    for(j = 0; j < vector_size(line); j++)
-    {
-      sstream_delete(vector_at(line, j));
-    }
+  return 0;
+}
 
-    vector_clear(line);
-  }
+/* Makes room for a value of valueLength bytes, plus a null terminator, at
+ * the path keys. Returns NULL if the path can not be set.
+ */
+static char *bgDocumentRecord(struct bgDocument *doc, const char * const *keys,
+  size_t depth, size_t valueLength)
+{
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
+  size_t size = 0;
 
-  //printf("%i %s\n", (int)vector_size(lines), sstream_cstr(ctx->rawHeaders));
+  if(depth == 0)
+  {
+    return NULL;
+  }
 
-  for(i = 0; i < vector_size(lines); i++)
+  if(doc->shared)
   {
-    sstream_delete(vector_at(lines, i));
+    printf("Error: Template has already been used\n");
+    return NULL;
   }
 
-  vector_delete(lines);
-  vector_delete(line);
-}
+  if(doc->base && bgDocumentShares(doc->base, keys[0]) &&
+    !bgDocumentUnshare(doc))
+  {
+    return NULL;
+  }
 
-void _HttpProcessRaw(struct Http *ctx)
-{
-  if(sstream_length(ctx->rawHeaders) == 0)
+  /* Nothing can be set below a value */
+  for(offset = 0; offset < doc->length; offset += rec->size)
   {
-    size_t i = 0;
-    char last[5] = {0};
+    rec = (struct bgRecord *)(doc->records + offset);
 
-    for(i = 0; i < vector_size(ctx->raw); i++)
+    if(!rec->dead && rec->depth < depth && bgRecordPrefix(rec, keys, rec->depth))
     {
-      last[0] = last[1];
-      last[1] = last[2];
-      last[2] = last[3];
-      last[3] = vector_at(ctx->raw, i);
+      return NULL;
+    }
+  }
 
-      if(strcmp(last, "\r\n\r\n") == 0)
-      {
-        size_t c = 0;
+  /* Replace the path and anything below it, a value of the same path is
+   * overwritten in place if it fits.
+   */
+  for(offset = 0; offset < doc->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(doc->records + offset);
 
-        for(c = 0; c < i-3; c++)
-        {
-          sstream_push_char(ctx->rawHeaders, vector_at(ctx->raw, c));
-        }
+    if(rec->dead || rec->depth < depth || !bgRecordPrefix(rec, keys, depth))
+    {
+      continue;
+    }
 
-        _HttpProcessHeaders(ctx);
-        break;
-      }
+    if(rec->depth == depth && BG_RECORD_VALUE(rec) + valueLength <
+      (char *)rec + rec->size)
+    {
+      doc->encoded += valueLength;
+      doc->encoded -= rec->valueLength;
+      rec->valueLength = valueLength;
+
+      return BG_RECORD_VALUE(rec);
     }
+
+    rec->dead = 1;
+    doc->encoded -= bgRecordEncoded(rec);
   }
 
-  if(sstream_length(ctx->rawHeaders) == 0) return;
+  size = BG_RECORD_ALIGN(sizeof(*rec) + depth * sizeof(const char *) +
+    valueLength + 1);
+  rec = (struct bgRecord *)bgDocumentGrow(doc, size);
 
-  if(ctx->sock == NULL_SOCKET)
+  if(!rec)
   {
-    size_t i = 0;
+    return NULL;
+  }
 
-    for(i = sstream_length(ctx->rawHeaders) + 4; i < vector_size(ctx->raw); i++)
-    {
-      sstream_push_char(ctx->rawContent, vector_at(ctx->raw, i));
-    }
+  rec->size = size;
+  rec->valueLength = valueLength;
+  rec->depth = (unsigned short)depth;
+  rec->dead = 0;
+  rec->visited = 0;
+  memcpy(BG_RECORD_KEYS(rec), keys, depth * sizeof(const char *));
+  doc->encoded += bgRecordEncoded(rec);
 
-    //printf("Content: %s\n", sstream_cstr(ctx->rawContent));
+  return BG_RECORD_VALUE(rec);
+}
+
+static void bgDocumentPutCStr(struct bgDocument *doc, const char * const *keys,
+  size_t depth, const char *val)
+{
+  /* Invalid strings are refused, as parson does */
+  size_t size = json_string_serialization_size(val);
+  char *value = NULL;
+
+  if(size == 0)
+  {
+    return;
+  }
+
+  value = bgDocumentRecord(doc, keys, depth, size - 1);
+
+  if(value)
+  {
+    json_serialize_string_to_buffer(val, value, size);
   }
 }
 
-void _HttpPollReceive(struct Http *ctx)
+static void bgDocumentPutNumber(struct bgDocument *doc,
+  const char * const *keys, size_t depth, double val)
 {
-  fd_set read_fds = {0};
-  struct timeval tv = {0};
-  int err = 0;
+  char buff[NUMBER_BUFFER_SIZE] = {0};
+  size_t len = 0;
+  char *value = NULL;
 
-  //printf("polling receive\n");
+  /* Same form as parson gives numbers */
+  len = number_format_json(buff, val);
 
-  FD_SET(ctx->sock, &read_fds);
-  err = select(ctx->sock + 1, &read_fds, NULL, NULL, &tv);
+  value = bgDocumentRecord(doc, keys, depth, len);
 
-  if(err == 0)
+  if(value)
   {
-    return;
+    memcpy(value, buff, len + 1);
   }
-  else if(err == -1)
+}
+
+static void bgDocumentPutBool(struct bgDocument *doc, const char * const *keys,
+  size_t depth, int val)
+{
+  const char *literal = val ? "true" : "false";
+  size_t len = strlen(literal);
+  char *value = bgDocumentRecord(doc, keys, depth, len);
+
+  if(value)
   {
-    ctx->status = -1;
-#ifdef USE_POSIX
-    close(ctx->sock);
-#endif
-#ifdef USE_WINSOCK
-    shutdown(ctx->sock, SD_BOTH);
-    closesocket(ctx->sock);
-#endif
-    ctx->sock = NULL_SOCKET;
-    return;
+    memcpy(value, literal, len + 1);
   }
-  else
+}
+
+static void bgDocumentWriteObject(struct bgDocument *doc, struct sstream *out,
+  size_t from, size_t depth);
+
+/* Writes the members whose paths start with the first depth keys of the
+ * record at from, separated by commas and with one in front unless first is
+ * set. Every record written is marked visited so later records of an object
+ * already written are skipped.
+ */
+static void bgDocumentWriteMembers(struct bgDocument *doc, struct sstream *out,
+  size_t from, size_t depth, int first)
+{
+  const char **prefix = NULL;
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
+
+  if(depth > 0)
   {
-    char buff[BUFFER_SIZE] = {0};
-    size_t i = 0;
-#ifdef USE_POSIX
-    ssize_t n = 0;
+    prefix = BG_RECORD_KEYS((struct bgRecord *)(doc->records + from));
+  }
 
-    n = read(ctx->sock, buff, BUFFER_SIZE - 1);
+  for(offset = from; offset < doc->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(doc->records + offset);
 
-    if(n > 0)
-#endif
-#ifdef USE_WINSOCK
-    int n = 0;
-    n = recv(ctx->sock, buff, BUFFER_SIZE - 1, 0);
+    if(rec->dead || rec->visited || !bgRecordPrefix(rec, prefix, depth))
+    {
+      continue;
+    }
 
-    if(n != SOCKET_ERROR && n != 0)
-#endif
+    if(!first)
     {
-      for(i = 0; i < n; i++)
-      {
-        vector_push_back(ctx->raw, buff[i]);
-      }
+      sstream_push_char(out, ',');
+    }
 
-      //printf("Data waiting: %s\n", buff);
+    first = 0;
+    if(!bgDocumentWriteString(out, BG_RECORD_KEYS(rec)[depth]))
+    {
+      sstream_push_cstr(out, "\"\"");
+    }
+    sstream_push_char(out, ':');
+
+    if(rec->depth == depth + 1)
+    {
+      sstream_push_chars(out, BG_RECORD_VALUE(rec), rec->valueLength);
+      rec->visited = 1;
     }
     else
     {
-#ifdef USE_POSIX
-      close(ctx->sock);
-#endif
-#ifdef USE_WINSOCK
-      shutdown(ctx->sock, SD_BOTH);
-      closesocket(ctx->sock);
-#endif
-      ctx->sock = NULL_SOCKET;
+      bgDocumentWriteObject(doc, out, offset, depth + 1);
     }
+  }
+}
 
-    _HttpProcessRaw(ctx);
+static void bgDocumentWriteObject(struct bgDocument *doc, struct sstream *out,
+  size_t from, size_t depth)
+{
+  sstream_push_char(out, '{');
+  bgDocumentWriteMembers(doc, out, from, depth, 1);
+  sstream_push_char(out, '}');
+}
+
+static void bgDocumentClearVisited(struct bgDocument *doc)
+{
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
+
+  for(offset = 0; offset < doc->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(doc->records + offset);
+    rec->visited = 0;
   }
 }
 
-void _HttpPoll(struct Http *ctx)
+int bgDocumentSerialize(struct bgDocument *doc, struct sstream *out)
 {
-  if(HttpState(ctx) == HTTP_CONNECTING)
+  struct sstream *shared = NULL;
+
+  if(doc->text)
   {
-    _HttpPollConnect(ctx);
+    sstream_push_chars(out, doc->text, doc->textLength);
+    return 1;
   }
-  else if(HttpState(ctx) == HTTP_RECEIVING)
+
+  if(doc->base)
   {
-    _HttpPollReceive(ctx);
+    /* The template's members go out as they are, opening brace included */
+    shared = doc->base->shared;
+    sstream_push_chars(out, sstream_cstr(shared), sstream_length(shared));
+    bgDocumentWriteMembers(doc, out, 0, 0, sstream_length(shared) == 1);
+    sstream_push_char(out, '}');
   }
+  else
+  {
+    bgDocumentWriteObject(doc, out, 0, 0);
+  }
+
+  bgDocumentClearVisited(doc);
+
+  return 1;
 }
 
-void _HttpParseRequest(struct Http *ctx, char *url)
+struct bgDocument *bgDocumentFreeze(struct bgDocument *doc,
+  struct sstream *scratch)
 {
-  size_t i = 0;
-  size_t len = 0;
+  size_t length = 0;
+  char *text = NULL;
 
-  sstream_clear(ctx->host);
-  sstream_clear(ctx->path);
-  sstream_clear(ctx->query);
+  if(doc->isTemplate || doc->text)
+  {
+    return doc;
+  }
 
-  len = strlen(url);
+  sstream_clear(scratch);
+  bgDocumentSerialize(doc, scratch);
+  length = sstream_length(scratch);
+  text = (char *)_palloc_uninit(length + 1, "bgDocument text");
 
-  for(; i < len - 1; i++)
+  if(!text)
   {
-    if(url[i] == '/' && url[i+1] == '/')
-    {
-      i+=2;
-      break;
-    }
+    printf("Error: Failed to allocate\n");
+    return doc;
   }
 
-  for(; i < len; i++)
-  {
-    if(url[i] == '/')
-    {
-      break;
-    }
+  memcpy(text, sstream_cstr(scratch), length + 1);
 
-    sstream_push_char(ctx->host, url[i]);
+  if(doc->records)
+  {
+    pfree(doc->records);
   }
 
-  for(; i < len; i++)
-  {
-    if(url[i] == '?')
-    {
-      i++;
-      break;
-    }
+  doc->records = NULL;
+  doc->length = 0;
+  doc->capacity = 0;
+  doc->encoded = 0;
+  doc->base = NULL;
+  doc->text = text;
+  doc->textLength = length;
 
-    sstream_push_char(ctx->path, url[i]);
+  return doc;
+}
+
+/* Frozen on first use, its members are written as they are from now on */
+void bgDocumentLock(struct bgDocument *tmpl)
+{
+  if(tmpl->shared)
+  {
+    return;
   }
 
-  for(; i < len; i++)
+  tmpl->shared = sstream_new();
+  bgDocumentWriteObject(tmpl, tmpl->shared, 0, 0);
+  bgDocumentClearVisited(tmpl);
+
+  /* Documents carry on from the last member */
+  sstream_truncate(tmpl->shared, sstream_length(tmpl->shared) - 1);
+}
+
+struct bgDocument *bgDocumentCreateFromTemplate(struct bgDocument *tmpl)
+{
+  struct bgDocument *rtn = NULL;
+
+  if(!tmpl->isTemplate)
   {
-    sstream_push_char(ctx->query, url[i]);
+    printf("Error: Document is not a template\n");
+    return NULL;
   }
 
-  //printf("Host: %s\n", sstream_cstr(ctx->host));
-  //printf("Path: %s\n", sstream_cstr(ctx->path));
-  //printf("Query: %s\n", sstream_cstr(ctx->query));
+  bgDocumentLock(tmpl);
+
+  rtn = bgDocumentCreate();
+  rtn->base = tmpl;
+
+  return rtn;
 }
 
-void HttpRequest(struct Http *ctx, char *url, char *post)
+void bgDocumentAddCStr(struct bgDocument *doc, const char *path, const char *val)
 {
-  struct addrinfo hints = {0};
-  struct addrinfo *res = NULL;
-  struct addrinfo *ent = NULL;
-  int err = 0;
-  int flags = 0;
+  const char *keys[BG_PATH_MAX_DEPTH];
 
-  if(HttpState(ctx) != HTTP_COMPLETE) return;
+  bgDocumentPutCStr(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
 
-  sstream_clear(ctx->post);
+void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
 
-  if(post)
-  {
-    sstream_push_cstr(ctx->post, post);
-  }
+  bgDocumentPutNumber(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
 
-  _HttpParseRequest(ctx, url);
+void bgDocumentAddDouble(struct bgDocument *doc, const char *path, double val)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
 
-  sstream_clear(ctx->rawHeaders);
-  sstream_clear(ctx->rawContent);
-  vector_clear(ctx->raw);
-  ctx->status = 0;
+  bgDocumentPutNumber(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
 
-  hints.ai_family = AF_UNSPEC;
-  hints.ai_socktype = SOCK_STREAM;
+void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
 
-  err = getaddrinfo(sstream_cstr(ctx->host), "80", &hints, &res);
+  bgDocumentPutBool(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
 
-  if(err)
+void bgDocumentAddMany(struct bgDocument *doc, const struct bgValue *values,
+  size_t count)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+  const char *prev = NULL;
+  size_t depth = 0;
+  size_t i = 0;
+
+  if(!bgDocumentReserve(doc, count * BG_RECORD_ESTIMATE))
   {
-    ctx->status = -1;
     return;
   }
 
-  for(ent = res; ent != NULL; ent = ent->ai_next)
+  for(i = 0; i < count; i++)
   {
-    int sock = NULL_SOCKET;
+    depth = bgDocumentKeys(values[i].path, prev, keys, NULL);
+    prev = depth > 0 ? values[i].path : NULL;
 
-    if(ent->ai_family != AF_INET && ent->ai_family != AF_INET6)
+    switch(values[i].type)
     {
-      continue;
-    }
+      case BG_TYPE_CSTR:
+        bgDocumentPutCStr(doc, keys, depth, values[i].cstr);
+        break;
 
-    sock = socket(ent->ai_family, ent->ai_socktype, 0);
+      case BG_TYPE_INT:
+        bgDocumentPutNumber(doc, keys, depth, (int)values[i].number);
+        break;
 
-    if(sock == NULL_SOCKET)
-    {
-      continue;
+      case BG_TYPE_DOUBLE:
+        bgDocumentPutNumber(doc, keys, depth, values[i].number);
+        break;
+
+      case BG_TYPE_BOOL:
+        bgDocumentPutBool(doc, keys, depth, values[i].number != 0);
+        break;
+
+      default:
+        printf("Error: Unknown field type\n");
     }
+  }
 
-#ifdef USE_POSIX
-    flags = fcntl(sock, F_GETFL);
+  bgUpdate();
+}
 
-    if(fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1)
-    {
+void bgDocumentSetCStrByField(struct bgDocument *doc, struct bgField *field,
+  const char *val)
+{
+  bgDocumentPutCStr(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
 
-      close(sock);
-      continue;
-    }
-#endif
-#ifdef USE_WINSOCK
-    {
-    unsigned long nonblocking = 1;
-    ioctlsocket(sock, FIONBIO, &nonblocking);
-    }
-#endif
+void bgDocumentSetIntByField(struct bgDocument *doc, struct bgField *field,
+  int val)
+{
+  bgDocumentPutNumber(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
 
-    err = connect(sock, (struct sockaddr *)ent->ai_addr, ent->ai_addrlen);
+void bgDocumentSetDoubleByField(struct bgDocument *doc, struct bgField *field,
+  double val)
+{
+  bgDocumentPutNumber(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
 
-#ifdef USE_POSIX
-    if(err == -1)
-#endif
-#ifdef USE_WINSOCK
-    if(err == SOCKET_ERROR)
-#endif
-    {
-#ifdef USE_POSIX
-      if(errno == EINPROGRESS)
-#endif
-#ifdef USE_WINSOCK
-      if(WSAGetLastError() == WSAEWOULDBLOCK)
-#endif
-      {
-        vector_push_back(ctx->socks, sock);
-      }
-      else
-      {
-#ifdef USE_POSIX
-        close(sock);
+void bgDocumentSetBoolByField(struct bgDocument *doc, struct bgField *field,
+  int val)
+{
+  bgDocumentPutBool(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
 #endif
-#ifdef USE_WINSOCK
-        shutdown(sock, SD_BOTH);
-        closesocket(sock);
+
+#ifndef AMALGAMATION
+  #include "Field.h"
+  #include "State.h"
+
+  #include <palloc/palloc.h>
+  #include <palloc/intern.h>
+  #include <palloc/sstream.h>
 #endif
-      }
 
-      continue;
-    }
+#include <string.h>
 
-    ctx->sock = sock;
-    _HttpClearSocks(ctx);
+struct bgField *bgFieldCompile(const char *path)
+{
+  struct bgField *rtn = NULL;
+  struct bgField **it = NULL;
+  struct sstrview rest = sstrview_cstr(path);
+  struct sstrview key = {0};
+  const char *name = intern_cstr(path);
+  size_t depth = sstrview_split(rest, '.', NULL, 0);
+  int trailing = 0;
+
+  vector_foreach(it, bg->fields)
+  {
+    if((*it)->path == name)
+    {
+      return *it;
+    }
   }
 
-  if(ctx->sock == NULL_SOCKET && vector_size(ctx->socks) < 1)
+  /* An empty path is a single empty key and a trailing dot ends in one, as
+   * with bgDocumentAdd*
+   */
+  if(depth == 0 || path[strlen(path) - 1] == '.')
   {
-    ctx->status = -1;
+    trailing = 1;
+    depth++;
   }
 
-  freeaddrinfo(res);
-}
+  /* The keys are stored right behind the field */
+  rtn = (struct bgField *)_palloc(sizeof(*rtn) + depth * sizeof(const char *),
+    "struct bgField");
+  rtn->path = name;
+  rtn->depth = 0;
+  rtn->keys = (const char **)(rtn + 1);
 
-int HttpRequestComplete(struct Http *ctx)
-{
-  _HttpPoll(ctx);
+  while(sstrview_next(&rest, '.', &key))
+  {
+    rtn->keys[rtn->depth++] = intern_chars(key.s, key.len);
+  }
 
-  if(HttpState(ctx) == HTTP_COMPLETE)
+  if(trailing)
   {
-    return 1;
+    rtn->keys[rtn->depth++] = intern_chars(path, 0);
   }
 
-  return 0;
-}
+  vector_push_back(bg->fields, rtn);
 
-int HttpResponseStatus(struct Http *ctx)
-{
-  return ctx->status;
+  return rtn;
 }
 
-char *HttpResponseContent(struct Http *ctx)
+void bgFieldDestroy(struct bgField *field)
 {
-  return sstream_cstr(ctx->rawContent);
+  pfree(field);
 }
 
 #ifndef AMALGAMATION
-  #include "Collection.h"
+  #include "Schema.h"
   #include "Document.h"
+  #include "Field.h"
   #include "State.h"
-  #include "http/http.h"
-
-  #include "palloc/palloc.h"
-#endif
 
-#ifdef _WIN32
-  #include <windows.h>
-#else
-  #include <unistd.h>
+  #include <bg/analytics.h>
+  #include <palloc/number.h>
+  #include <palloc/palloc.h>
+  #include <palloc/sstream.h>
 #endif
 
 #include <stdio.h>
 #include <string.h>
 
-void bgUpdate();
+#define BG_COLUMNS_MIN_CAPACITY 16
 
-void bgCollectionCreate(const char *cln)
+/* Longest text of a formatted value */
+#define BG_INT_ENCODED 11
+#define BG_DOUBLE_ENCODED NUMBER_BUFFER_SIZE
+#define BG_BOOL_ENCODED 5
+
+struct bgSchema *bgSchemaCreate()
 {
-  struct bgCollection* newCln = NULL;
+  struct bgSchema *rtn = palloc(struct bgSchema);
 
-  newCln = palloc(struct bgCollection);
+  rtn->fields = vector_new(struct bgSchemaField *);
+  rtn->order = vector_new(size_t);
+  rtn->tail = sstream_new();
+  sstream_push_cstr(rtn->tail, "{}");
+  vector_push_back(bg->schemas, rtn);
 
-  newCln->name = sstream_new();
-  sstream_push_cstr(newCln->name, cln);
+  return rtn;
+}
 
-  newCln->documents = vector_new(struct bgDocument*);
-  vector_push_back(bg->collections, newCln);
+void bgSchemaDestroy(struct bgSchema *schema)
+{
+  struct bgSchemaField **it = NULL;
 
-  newCln->http = HttpCreate();
-  HttpAddCustomHeader(newCln->http, "AuthAccessKey", sstream_cstr(bg->guid));
-  HttpAddCustomHeader(newCln->http, "AuthAccessSecret", sstream_cstr(bg->key));
-  HttpAddCustomHeader(newCln->http, "Content-Type", "application/json;charset=utf-8");
+  vector_foreach(it, schema->fields)
+  {
+    sstream_delete((*it)->lead);
+    pfree(*it);
+  }
 
-  bgUpdate();
+  vector_delete(schema->fields);
+  vector_delete(schema->order);
+  sstream_delete(schema->tail);
+  pfree(schema);
 }
 
-void bgCollectionAdd(const char *cln, struct bgDocument *doc)
+/* Number of leading keys a and b have in common */
+static size_t bgSchemaCommon(struct bgField *a, struct bgField *b)
 {
-  struct bgCollection *col = bgCollectionGet(cln);
+  size_t rtn = 0;
 
-  if(!col)
+  while(rtn < a->depth && rtn < b->depth && a->keys[rtn] == b->keys[rtn])
   {
-    if(bg->errorFunc != NULL)
-    {
-      bg->errorFunc(cln, -1);
-    }
+    rtn++;
   }
 
-  vector_push_back(col->documents, doc);
-  bgUpdate();
+  return rtn;
 }
 
-void bgCollectionUpload(const char *cln)
+/* Rebuilds the text written between the values of a row */
+static void bgSchemaLayout(struct bgSchema *schema)
 {
-  /* For Serializing data */
-  sstream *ser = sstream_new();
-  sstream *url = sstream_new();
-  struct bgCollection* c = bgCollectionGet(cln);
+  struct bgField *prev = NULL;
   size_t i = 0;
-  int responseCode = 0;
-
-  sstream_push_cstr(ser, "{\"documents\":[");
+  size_t k = 0;
 
-  /* Concatenating c_str onto ser - dangerous? */
-  for(i = 0; i < vector_size(c->documents); i++)
+  for(i = 0; i < vector_size(schema->order); i++)
   {
-    JSON_Value* v = vector_at(c->documents,i)->rootVal;
-    char *serialized = json_serialize_to_string(v);
+    struct bgSchemaField *sf = vector_at(schema->fields,
+      vector_at(schema->order, i));
+    struct bgField *f = sf->field;
+    size_t common = 0;
 
-    sstream_push_cstr(ser, serialized);
-    free(serialized); serialized = NULL;
+    sstream_clear(sf->lead);
 
-    if(i < vector_size(c->documents)-1)
+    if(prev)
     {
-      sstream_push_char(ser, ',');
-    }
-  }
-
-  sstream_push_cstr(ser, "]}");
-
-  /* Sending request to server */
-  sstream_push_cstr(url, sstream_cstr(bg->fullUrl));
-  sstream_push_cstr(url, sstream_cstr(c->name));
-  sstream_push_cstr(url, "/documents");
-  HttpRequest(c->http, sstream_cstr(url), sstream_cstr(ser));
-
-  /* blocking while request pushes through */
-  while(!HttpRequestComplete(c->http))
-  {
-#ifdef _WIN32
-    Sleep(10);
-#else
-    usleep(1000);
-#endif
-  }
+      common = bgSchemaCommon(prev, f);
 
-  /* Handle response */
-  responseCode = HttpResponseStatus(c->http);
+      for(k = common + 1; k < prev->depth; k++)
+      {
+        sstream_push_char(sf->lead, '}');
+      }
 
-  if(responseCode != 200)
-  {
-    if(bg->errorFunc != NULL)
-    {
-      bg->errorFunc(sstream_cstr(c->name), responseCode);
+      sstream_push_char(sf->lead, ',');
     }
-  }
-  else
-  {
-    if(bg->successFunc != NULL)
+    else
     {
-      bg->successFunc(sstream_cstr(c->name), vector_size(c->documents));
+      sstream_push_char(sf->lead, '{');
     }
-  }
-
-  /* Cleanup */
-  sstream_delete(ser);
-  sstream_delete(url);
-
-  for(i = 0; i < vector_size(c->documents); i++)
-  {
-    bgDocumentDestroy(vector_at(c->documents, i));
-  }
 
-  /* Clearing vector for later use */
-  vector_clear(c->documents);
-}
-
-/* Destroys collection and containing documents w/o upload */
-void bgCollectionDestroy(struct bgCollection *cln)
-{
-  /* Document destruction is Possibly complex */
-  size_t i = 0;
-
-  if(cln->documents != NULL)
-  {
-    for(i = 0; i < vector_size(cln->documents); i++)
+    for(k = common; k < f->depth; k++)
     {
-      bgDocumentDestroy(vector_at(cln->documents, i));
+      if(!bgDocumentWriteString(sf->lead, f->keys[k]))
+      {
+        sstream_push_cstr(sf->lead, "\"\"");
+      }
+
+      sstream_push_cstr(sf->lead, k + 1 < f->depth ? ":{" : ":");
     }
 
-    vector_delete(cln->documents);
+    prev = f;
   }
 
-  sstream_delete(cln->name);
-  HttpDestroy(cln->http);
-
-  pfree(cln);
-}
-
-/*  Helper function to get the collection from the state by name
- *  returns NULL if no collection by cln exists
- */
-struct bgCollection *bgCollectionGet(const char *cln)
-{
-  /*
-   * TODO - Change to comparing char* directly
-   *  then fall back onto strcmp if failure
-   *
-   *  Although, would this still work as name
-   *  is a sstream?
-   */
-  size_t i = 0;
+  sstream_clear(schema->tail);
 
-  for(i = 0; i < vector_size(bg->collections); i++)
+  if(!prev)
   {
-    if(strcmp(cln, sstream_cstr(vector_at(bg->collections, i)->name)) == 0)
-    {
-      return vector_at(bg->collections, i);
-    }
+    sstream_push_cstr(schema->tail, "{}");
+    return;
   }
 
-  return NULL;
+  for(k = 0; k < prev->depth; k++)
+  {
+    sstream_push_char(schema->tail, '}');
+  }
 }
 
+void bgSchemaAddField(struct bgSchema *schema, const char *path, int type)
+{
+  struct bgField *field = NULL;
+  struct bgSchemaField *sf = NULL;
+  size_t index = vector_size(schema->fields);
+  size_t at = vector_size(schema->order);
+  size_t best = 0;
+  size_t i = 0;
 
-#ifndef AMALGAMATION
-  #include "Document.h"
-  #include "State.h"
-  #include "parson.h"
+  if(schema->locked)
+  {
+    printf("Error: Schema is already used by a collection\n");
+    return;
+  }
 
-  #include <palloc/palloc.h>
-  #include <palloc/sstream.h>
-#endif
+  if(type < BG_TYPE_CSTR || type > BG_TYPE_BOOL)
+  {
+    printf("Error: Unknown field type\n");
+    return;
+  }
 
-void bgUpdate();
+  field = bgFieldCompile(path);
 
-struct bgDocument *bgDocumentCreate()
-{
-  struct bgDocument *rtn = NULL;
+  /* Sits right after the last field it shares the most parents with */
+  for(i = 0; i < vector_size(schema->order); i++)
+  {
+    struct bgField *other = vector_at(schema->fields,
+      vector_at(schema->order, i))->field;
+    size_t common = bgSchemaCommon(other, field);
 
-  rtn = palloc(struct bgDocument);
+    if(common == other->depth || common == field->depth)
+    {
+      printf("Error: Field overlaps an existing field\n");
+      return;
+    }
 
-  rtn->rootVal = json_value_init_object();
-  rtn->rootObj = json_value_get_object(rtn->rootVal);
-  //rtn->rootArr = json_value_get_array(rtn->rootVal);
+    if(common > 0 && common >= best)
+    {
+      best = common;
+      at = i + 1;
+    }
+  }
 
-  return rtn;
+  sf = palloc(struct bgSchemaField);
+  sf->field = field;
+  sf->type = type;
+  sf->lead = sstream_new();
+
+  vector_push_back(schema->fields, sf);
+  vector_insert_range(schema->order, at, &index, 1);
+  bgSchemaLayout(schema);
 }
 
-void bgDocumentDestroy(struct bgDocument *doc)
+static size_t bgColumnSize(int type)
 {
-  /*unwinds json_val list structure and frees memory*/
-  json_value_free(doc->rootVal);
+  switch(type)
+  {
+    case BG_TYPE_CSTR:
+      return sizeof(size_t);
+    case BG_TYPE_INT:
+      return sizeof(int);
+    case BG_TYPE_DOUBLE:
+      return sizeof(double);
+  }
 
-  pfree(doc);
+  return sizeof(unsigned char);
 }
 
-void bgDocumentAddCStr(struct bgDocument *doc, const char *path, const char *val)
+struct bgColumns *bgColumnsCreate(struct bgSchema *schema)
 {
-  sstream* ctx = sstream_new();
-  vector(sstream *) *out = vector_new(sstream *);
+  struct bgColumns *rtn = palloc(struct bgColumns);
+  size_t count = vector_size(schema->fields);
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
+  schema->locked = 1;
+  rtn->schema = schema;
+  rtn->text = sstream_new();
 
-  if(vector_size(out) == 0)
-  {
-    json_object_set_string(doc->rootObj, path, val);
-  }
-  else
+  if(count > 0)
   {
-    json_object_dotset_string(doc->rootObj, path, val);
+    rtn->data = (void **)_palloc(count * sizeof(void *), "struct bgColumns");
   }
 
-  
-  if(vector_size(out) > 0)
-  {
-    size_t i = 0;
+  return rtn;
+}
+
+void bgColumnsDestroy(struct bgColumns *columns)
+{
+  size_t i = 0;
 
-    for(i = 0; i < vector_size(out); i++)
+  if(columns->data)
+  {
+    for(i = 0; i < vector_size(columns->schema->fields); i++)
     {
-      if(vector_at(out, i))
+      if(columns->data[i])
       {
-        sstream_delete(vector_at(out, i));
+        pfree(columns->data[i]);
       }
     }
+
+    pfree(columns->data);
   }
 
-  vector_delete(out);
-  bgUpdate();
+  sstream_delete(columns->text);
+  pfree(columns);
 }
 
-void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val)
+/* Doubles the capacity of every column */
+static int bgColumnsGrow(struct bgColumns *columns)
 {
-  sstream* ctx = sstream_new();
-  vector(sstream *) *out = vector_new(sstream *);
+  size_t capacity = columns->capacity * 2;
+  size_t i = 0;
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
-  
-  if(vector_size(out) == 0)
-  {
-    json_object_set_number(doc->rootObj, path, val);
-  }
-  else
+  if(capacity < BG_COLUMNS_MIN_CAPACITY)
   {
-    json_object_dotset_number(doc->rootObj, path, val);
+    capacity = BG_COLUMNS_MIN_CAPACITY;
   }
-  
-  if(vector_size(out) > 0)
+
+  for(i = 0; i < vector_size(columns->schema->fields); i++)
   {
-    size_t i = 0;
+    size_t size = bgColumnSize(vector_at(columns->schema->fields, i)->type);
+    void *data = _palloc_uninit(capacity * size, "bgColumn");
 
-    for(i = 0; i < vector_size(out); i++)
+    if(!data)
     {
-      if(vector_at(out, i))
-      {
-        sstream_delete(vector_at(out, i));
-      }
+      printf("Error: Failed to allocate\n");
+      return 0;
+    }
+
+    if(columns->data[i])
+    {
+      memcpy(data, columns->data[i], columns->rows * size);
+      pfree(columns->data[i]);
     }
+
+    columns->data[i] = data;
   }
 
-  vector_delete(out);
-  bgUpdate();
+  columns->capacity = capacity;
+
+  return 1;
 }
 
-void bgDocumentAddDouble(struct bgDocument *doc, const char *path, double val)
+int bgColumnsAdd(struct bgColumns *columns, va_list values, size_t *bytes,
+  size_t *encoded)
 {
-  sstream* ctx = sstream_new();
+  size_t textLength = sstream_length(columns->text);
+  size_t row = columns->rows;
   size_t i = 0;
-  vector(sstream *) *out = vector_new(sstream *);
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
+  *bytes = 0;
+  *encoded = 0;
 
-  if(vector_size(out) == 0)
+  if(row == columns->capacity && !bgColumnsGrow(columns))
   {
-    json_object_set_number(doc->rootObj, path, val);
+    return 0;
   }
-  else
-  {
-    json_object_dotset_number(doc->rootObj, path, val);
-  }  
-  
-  if(vector_size(out) > 0)
+
+  /* Separator and tail, strings are counted with the text */
+  *encoded = 1 + sstream_length(columns->schema->tail);
+
+  for(i = 0; i < vector_size(columns->schema->fields); i++)
   {
-    for(i = 0; i < vector_size(out); i++)
+    struct bgSchemaField *sf = vector_at(columns->schema->fields, i);
+    int type = sf->type;
+    const char *s = NULL;
+
+    *encoded += sstream_length(sf->lead);
+
+    switch(type)
     {
-      if(vector_at(out, i))
-      {
-        sstream_delete(vector_at(out, i));
-      }
+      case BG_TYPE_CSTR:
+        /* Strings parson would refuse are sent as null */
+        ((size_t *)columns->data[i])[row] = sstream_length(columns->text);
+        s = va_arg(values, const char *);
+
+        if(!s || !bgDocumentWriteString(columns->text, s))
+        {
+          sstream_push_cstr(columns->text, "null");
+        }
+
+        sstream_push_char(columns->text, '\0');
+        break;
+
+      case BG_TYPE_INT:
+        ((int *)columns->data[i])[row] = va_arg(values, int);
+        *encoded += BG_INT_ENCODED;
+        break;
+
+      case BG_TYPE_DOUBLE:
+        ((double *)columns->data[i])[row] = va_arg(values, double);
+        *encoded += BG_DOUBLE_ENCODED;
+        break;
+
+      case BG_TYPE_BOOL:
+        ((unsigned char *)columns->data[i])[row] = va_arg(values, int) != 0;
+        *encoded += BG_BOOL_ENCODED;
+        break;
     }
+
+    *bytes += bgColumnSize(type);
   }
 
-  vector_delete(out);
-  bgUpdate();
+  *bytes += sstream_length(columns->text) - textLength;
+  *encoded += sstream_length(columns->text) - textLength;
+  columns->rows++;
+  columns->bytes += *bytes;
+  columns->encoded += *encoded;
+
+  return 1;
 }
 
-void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
+void bgColumnsPop(struct bgColumns *columns, size_t bytes, size_t encoded)
 {
-  sstream* ctx = sstream_new();
-  vector(sstream *) *out = vector_new(sstream *);
+  size_t i = 0;
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
-  
-  if(vector_size(out) == 0)
+  if(columns->rows == 0)
   {
-    json_object_set_boolean(doc->rootObj, path, val);
+    return;
   }
-  else
+
+  columns->rows--;
+  columns->bytes -= bytes;
+  columns->encoded -= encoded;
+
+  /* The row's text starts at its first string */
+  for(i = 0; i < vector_size(columns->schema->fields); i++)
   {
-    json_object_dotset_boolean(doc->rootObj, path, val);
+    if(vector_at(columns->schema->fields, i)->type == BG_TYPE_CSTR)
+    {
+      sstream_truncate(columns->text,
+        ((size_t *)columns->data[i])[columns->rows]);
+      break;
+    }
   }
-  
-  if(vector_size(out) > 0)
+}
+
+size_t bgColumnsSerialize(struct bgColumns *columns, struct sstream *out,
+  size_t written)
+{
+  struct bgSchema *schema = columns->schema;
+  const char *text = sstream_cstr(columns->text);
+  size_t count = vector_size(schema->order);
+  size_t row = 0;
+  size_t i = 0;
+
+  for(row = 0; row < columns->rows; row++)
   {
-    size_t i = 0;
+    if(written > 0)
+    {
+      sstream_push_char(out, ',');
+    }
 
-    for(i = 0; i < vector_size(out); i++)
+    for(i = 0; i < count; i++)
     {
-      if(vector_at(out, i))
+      size_t index = vector_at(schema->order, i);
+      struct bgSchemaField *sf = vector_at(schema->fields, index);
+      void *data = columns->data[index];
+      char buff[NUMBER_BUFFER_SIZE] = {0};
+      size_t len = 0;
+
+      sstream_push_chars(out, sstream_cstr(sf->lead), sstream_length(sf->lead));
+
+      switch(sf->type)
       {
-        sstream_delete(vector_at(out, i));
+        case BG_TYPE_CSTR:
+          sstream_push_cstr(out, text + ((size_t *)data)[row]);
+          break;
+
+        case BG_TYPE_INT:
+          sstream_push_int(out, ((int *)data)[row]);
+          break;
+
+        case BG_TYPE_DOUBLE:
+          /* Same form as parson gives numbers */
+          len = number_format_json(buff, ((double *)data)[row]);
+          sstream_push_chars(out, buff, len);
+          break;
+
+        case BG_TYPE_BOOL:
+          sstream_push_cstr(out, ((unsigned char *)data)[row] ? "true" : "false");
+          break;
       }
     }
+
+    sstream_push_chars(out, sstream_cstr(schema->tail),
+      sstream_length(schema->tail));
+    written++;
   }
 
-  vector_delete(out);
-  bgUpdate();
+  return written;
 }
 
+void bgColumnsClear(struct bgColumns *columns)
+{
+  columns->rows = 0;
+  columns->bytes = 0;
+  columns->encoded = 0;
+  sstream_clear(columns->text);
+}
 
 /*
  Parson ( http://kgabis.github.com/parson/ )
@@ -1667,6 +5873,8 @@ void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
 
 #ifndef AMALGAMATION
   #include "parson.h"
+
+  #include <palloc/number.h>
 #endif
 
 #include <stdio.h>
@@ -1684,7 +5892,6 @@ void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
 #define ARRAY_MAX_CAPACITY    122880 /* 15*(2^13) */
 #define OBJECT_MAX_CAPACITY      960 /* 15*(2^6)  */
 #define MAX_NESTING               19
-#define DOUBLE_SERIALIZATION_FORMAT "%f"
 
 #define SIZEOF_TOKEN(a)       (sizeof(a) - 1)
 #define SKIP_CHAR(str)        ((*str)++)
@@ -1696,6 +5903,7 @@ void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
 
 static JSON_Malloc_Function parson_malloc = malloc;
 static JSON_Free_Function parson_free = free;
+static JSON_Intern_Function parson_intern = NULL;
 
 #define IS_CONT(b) (((unsigned char)(b) & 0xC0) == 0x80) /* is utf-8 continuation byte */
 
@@ -1735,6 +5943,8 @@ static char * read_file(const char *filename);
 static void   remove_comments(char *string, const char *start_token, const char *end_token);
 static char * parson_strndup(const char *string, size_t n);
 static char * parson_strdup(const char *string);
+static char * parson_key(const char *string, size_t n);
+static void   parson_free_key(char *key);
 static int    hex_char_to_int(char c);
 static int    parse_utf16_hex(const char *string, unsigned int *result);
 static int    num_bytes_in_utf8_sequence(unsigned char c);
@@ -1745,6 +5955,7 @@ static int    is_decimal(const char *string, size_t length);
 /* JSON Object */
 static JSON_Object * json_object_init(JSON_Value *wrapping_value);
 static JSON_Status   json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
+static JSON_Status   json_object_add_interned(JSON_Object *object, const char *key, JSON_Value *value);
 static JSON_Status   json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value  * json_object_nget_value(const JSON_Object *object, const char *name, size_t n);
 static void          json_object_free(JSON_Object *object);
@@ -1788,6 +5999,19 @@ static char * parson_strndup(const char *string, size_t n) {
     return output_string;
 }
 
+static char * parson_key(const char *string, size_t n) {
+    if (parson_intern != NULL) {
+        return (char*)parson_intern(string, n);
+    }
+    return parson_strndup(string, n);
+}
+
+static void parson_free_key(char *key) {
+    if (parson_intern == NULL) {
+        parson_free(key);
+    }
+}
+
 static char * parson_strdup(const char *string) {
     return parson_strndup(string, strlen(string));
 }
@@ -2003,7 +6227,7 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
         }
     }
     index = object->count;
-    object->names[index] = parson_strdup(name);
+    object->names[index] = parson_key(name, strlen(name));
     if (object->names[index] == NULL) {
         return JSONFailure;
     }
@@ -2046,6 +6270,9 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 static JSON_Value * json_object_nget_value(const JSON_Object *object, const char *name, size_t n) {
     size_t i, name_length;
     for (i = 0; i < json_object_get_count(object); i++) {
+        if (object->names[i] == name && name[n] == '\0') { /* interned key */
+            return object->values[i];
+        }
         name_length = strlen(object->names[i]);
         if (name_length != n) {
             continue;
@@ -2059,7 +6286,7 @@ static JSON_Value * json_object_nget_value(const JSON_Object *object, const char
 
 static void json_object_free(JSON_Object *object) {
     while(object->count--) {
-        parson_free(object->names[object->count]);
+        parson_free_key(object->names[object->count]);
         json_value_free(object->values[object->count]);
     }
     parson_free(object->names);
@@ -2557,13 +6784,8 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             if (buf != NULL) {
                 num_buf = buf;
             }
-            if (num == ((double)(int)num)) { /*  check if num is integer */
-                written = sprintf(num_buf, "%d", (int)num);
-	    } else if (num == ((double)(unsigned int)num)) {
-                written = sprintf(num_buf, "%u", (unsigned int)num);
-            } else {
-                written = sprintf(num_buf, DOUBLE_SERIALIZATION_FORMAT, num);
-            }
+            /* integers stay plain, others take a round-trip form */
+            written = (int)number_format_json(num_buf, num);
             if (written < 0) {
                 return -1;
             }
@@ -3072,6 +7294,26 @@ JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t
     return JSONSuccess;
 }
 
+size_t json_string_serialization_size(const char *string) {
+    int res = 0;
+    if (string == NULL || !is_valid_utf8(string, strlen(string))) {
+        return 0;
+    }
+    res = json_serialize_string(string, NULL);
+    return res < 0 ? 0 : (size_t)(res + 1);
+}
+
+JSON_Status json_serialize_string_to_buffer(const char *string, char *buf, size_t buf_size_in_bytes) {
+    size_t needed_size_in_bytes = json_string_serialization_size(string);
+    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
+        return JSONFailure;
+    }
+    if (json_serialize_string(string, buf) < 0) {
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename) {
     JSON_Status return_code = JSONSuccess;
     FILE *fp = NULL;
@@ -3370,26 +7612,83 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
     if (dot_pos == NULL) {
         return json_object_set_value(object, name, value);
     } else {
-        current_name = parson_strndup(name, dot_pos - name);
+        current_name = parson_key(name, dot_pos - name);
         temp_obj = json_object_get_object(object, current_name);
         if (temp_obj == NULL) {
             new_value = json_value_init_object();
             if (new_value == NULL) {
-                parson_free(current_name);
+                parson_free_key(current_name);
                 return JSONFailure;
             }
             if (json_object_add(object, current_name, new_value) == JSONFailure) {
                 json_value_free(new_value);
-                parson_free(current_name);
+                parson_free_key(current_name);
                 return JSONFailure;
             }
             temp_obj = json_object_get_object(object, current_name);
         }
-        parson_free(current_name);
+        parson_free_key(current_name);
         return json_object_dotset_value(temp_obj, dot_pos + 1, value);
     }
 }
 
+static JSON_Status json_object_add_interned(JSON_Object *object, const char *key, JSON_Value *value) {
+    if (object->count >= object->capacity) {
+        size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
+        if (new_capacity > OBJECT_MAX_CAPACITY) {
+            return JSONFailure;
+        }
+        if (json_object_resize(object, new_capacity) == JSONFailure) {
+            return JSONFailure;
+        }
+    }
+    object->names[object->count] = (char*)key;
+    object->values[object->count] = value;
+    value->parent = json_object_get_wrapping_value(object);
+    object->count++;
+    return JSONSuccess;
+}
+
+JSON_Status json_object_keyset_value(JSON_Object *object, const char * const *keys, size_t count, JSON_Value *value) {
+    JSON_Value *new_value = NULL;
+    size_t i = 0;
+    if (object == NULL || keys == NULL || count == 0 || value == NULL || value->parent != NULL || parson_intern == NULL) {
+        return JSONFailure;
+    }
+    for (; count > 1; keys++, count--) {
+        for (i = 0; i < object->count; i++) {
+            if (object->names[i] == *keys) {
+                break;
+            }
+        }
+        if (i < object->count) {
+            object = json_value_get_object(object->values[i]);
+            if (object == NULL) {
+                return JSONFailure;
+            }
+            continue;
+        }
+        new_value = json_value_init_object();
+        if (new_value == NULL) {
+            return JSONFailure;
+        }
+        if (json_object_add_interned(object, *keys, new_value) == JSONFailure) {
+            json_value_free(new_value);
+            return JSONFailure;
+        }
+        object = json_value_get_object(new_value);
+    }
+    for (i = 0; i < object->count; i++) {
+        if (object->names[i] == *keys) {
+            json_value_free(object->values[i]);
+            value->parent = json_object_get_wrapping_value(object);
+            object->values[i] = value;
+            return JSONSuccess;
+        }
+    }
+    return json_object_add_interned(object, *keys, value);
+}
+
 JSON_Status json_object_dotset_string(JSON_Object *object, const char *name, const char *string) {
     JSON_Value *value = json_value_init_string(string);
     if (value == NULL) {
@@ -3446,7 +7745,7 @@ JSON_Status json_object_remove(JSON_Object *object, const char *name) {
     last_item_index = json_object_get_count(object) - 1;
     for (i = 0; i < json_object_get_count(object); i++) {
         if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
+            parson_free_key(object->names[i]);
             json_value_free(object->values[i]);
             if (i != last_item_index) { /* Replace key value pair with one from the end */
                 object->names[i] = object->names[last_item_index];
@@ -3483,7 +7782,7 @@ JSON_Status json_object_clear(JSON_Object *object) {
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
+        parson_free_key(object->names[i]);
         json_value_free(object->values[i]);
     }
     object->count = 0;
@@ -3643,16 +7942,31 @@ void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Fu
     parson_free = free_fun;
 }
 
+void json_set_key_intern_function(JSON_Intern_Function intern_fun) {
+    parson_intern = intern_fun;
+}
+
+void json_node_sizes(size_t *value_size, size_t *object_size, size_t *array_size) {
+    *value_size = sizeof(JSON_Value);
+    *object_size = sizeof(JSON_Object);
+    *array_size = sizeof(JSON_Array);
+}
+
 #ifndef AMALGAMATION
   #include "config.h"
   #include "State.h"
   #include "Collection.h"
   #include "Document.h"
+  #include "Field.h"
+  #include "Schema.h"
+  #include "Memory.h"
   #include "parson.h"
   #include "http/http.h"
 
   #include "palloc/sstream.h"
   #include <palloc/palloc.h>
+  #include <palloc/intern.h>
+  #include <palloc/arena.h>
 #endif
 
 #include <time.h>
@@ -3660,13 +7974,23 @@ void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Fu
 
 struct bgState *bg;
 
+/* Called by every mutator, polls unless the application does it */
+void bgUpdate()
+{
+  if(bg->autoPoll)
+  {
+    bgPoll();
+  }
+}
+
 /* Find out where error/success callbacks should be called
  * in this particular function
  */
-void bgUpdate()
+void bgPoll()
 {
   /* For updating interval */
   size_t i = 0;
+  struct bgCollection **cit = NULL;
   time_t tNow = time(NULL);
 
   /* Updating Interval */
@@ -3674,9 +7998,9 @@ void bgUpdate()
   bg->t = tNow;
 
   /* Polling collections http connections to push through data */
-  for(i = 0; i < vector_size(bg->collections); i++)
+  vector_foreach(cit, bg->collections)
   {
-    HttpRequestComplete(vector_at(bg->collections, i)->http);
+    HttpRequestComplete((*cit)->http);
   }
 
   /* Pushing data if interval is done */
@@ -3686,15 +8010,14 @@ void bgUpdate()
     sstream *ser = sstream_new();
     sstream *url = sstream_new();
 
-    /* Upload collections */
+    /* Upload collections, indexed because callbacks may add collections */
     for(i = 0; i < vector_size(bg->collections); i++)
     {
-      JSON_Value* v = NULL;
-      size_t j = 0;
       struct bgCollection* c = vector_at(bg->collections, i);
 
       //TODO continue if no data to send
-      if(vector_size(c->documents) == 0)
+      if(ring_empty(c->documents) && !c->spillPending &&
+        (!c->columns || c->columns->rows == 0))
       {
         continue;
       }
@@ -3705,44 +8028,24 @@ void bgUpdate()
         {
           if(bg->successFunc)
           {
-            bg->successFunc(sstream_cstr(c->name), c->lastDocumentCount);
+            bg->successFunc(c->name, c->lastDocumentCount);
           }
         }
         else if(bg->errorFunc)
         {
-          bg->errorFunc(sstream_cstr(c->name), HttpResponseStatus(c->http));
-        }
-
-        sstream_push_cstr(ser, "{\"documents\":[");
-
-        /* Serializing documents of collection */
-        for(j = 0; j < vector_size(c->documents); j++)
-        {
-          v = vector_at(c->documents, j)->rootVal;
-          sstream_push_cstr(ser, json_serialize_to_string(v));
-          if(j < vector_size(c->documents)-1)
-          {
-            sstream_push_char(ser, ',');
-          }
+          bg->errorFunc(c->name, HttpResponseStatus(c->http));
         }
 
-        sstream_push_cstr(ser, "]}");
+        c->lastDocumentCount = bgCollectionSerialize(c, ser);
 
         sstream_clear(url);
         sstream_push_cstr(url, sstream_cstr(bg->fullUrl));
-        sstream_push_cstr(url, sstream_cstr(c->name));
+        sstream_push_cstr(url, c->name);
         sstream_push_cstr(url, "/documents");
         HttpRequest(c->http, sstream_cstr(url), sstream_cstr(ser));
         sstream_clear(ser);
 
-        c->lastDocumentCount = vector_size(c->documents);
-
-        for(j = 0; j < vector_size(c->documents); j++)
-        {
-          bgDocumentDestroy(vector_at(c->documents, j));
-        }
-
-        vector_clear(c->documents);
+        bgCollectionDrain(c, c->lastDocumentCount);
       }
     }
 
@@ -3757,9 +8060,15 @@ void bgUpdate()
 
 void bgAuth(const char *guid, const char *key)
 {
+  bgMemoryInit();
+
   bg = palloc(struct bgState);
   bg->collections = vector_new(struct bgCollection *);
+  bg->fields = vector_new(struct bgField *);
+  bg->schemas = vector_new(struct bgSchema *);
+  bg->templates = vector_new(struct bgDocument *);
   bg->interval = 2000;
+  bg->autoPoll = 1;
   bg->t = time(NULL);
 
   bg->url = sstream_new();
@@ -3789,23 +8098,62 @@ void bgCleanup()
    * Looping throough and calling 'destructor'
    * and then deleting remnants with vector_delete
    */
-  size_t i = 0;
+  struct bgCollection **it = NULL;
+  struct bgField **fit = NULL;
+  struct bgSchema **sit = NULL;
+  struct bgDocument **dit = NULL;
 
-  for(i = 0; i < vector_size(bg->collections); i ++)
+  vector_foreach(it, bg->collections)
   {
     /*NULLS pointer in function*/
-    bgCollectionDestroy(vector_at(bg->collections, i));
+    bgCollectionDestroy(*it);
   }
 
   vector_delete(bg->collections);
 
+  if(bg->collectionIndex.slots)
+  {
+    pfree(bg->collectionIndex.slots);
+  }
+
+  vector_foreach(fit, bg->fields)
+  {
+    bgFieldDestroy(*fit);
+  }
+
+  vector_delete(bg->fields);
+
+  vector_foreach(sit, bg->schemas)
+  {
+    bgSchemaDestroy(*sit);
+  }
+
+  vector_delete(bg->schemas);
+
+  /* After the collections, which may still have held them */
+  vector_foreach(dit, bg->templates)
+  {
+    bgDocumentTemplateDestroy(*dit);
+  }
+
+  vector_delete(bg->templates);
+
   sstream_delete(bg->url);
   sstream_delete(bg->path);
   sstream_delete(bg->fullUrl);
   sstream_delete(bg->guid);
   sstream_delete(bg->key);
 
+  if(bg->spillDir)
+  {
+    sstream_delete(bg->spillDir);
+  }
+
   pfree(bg);
+  bgMemoryShutdown();
+  intern_clear();
+  arena_trim();
+  palloc_trim();
 }
 
 void bgInterval(int milli)
@@ -3813,6 +8161,35 @@ void bgInterval(int milli)
   bg->interval = milli;
 }
 
+void bgAutoPoll(int enabled)
+{
+  bg->autoPoll = enabled;
+}
+
+void bgBudget(size_t maxDocuments, size_t maxBytes)
+{
+  bg->maxDocuments = maxDocuments;
+  bg->maxBytes = maxBytes;
+}
+
+void bgSpillDirectory(const char *path)
+{
+  struct bgCollection **it = NULL;
+
+  if(!bg->spillDir)
+  {
+    bg->spillDir = sstream_new();
+  }
+
+  sstream_clear(bg->spillDir);
+  sstream_push_cstr(bg->spillDir, path);
+
+  vector_foreach(it, bg->collections)
+  {
+    bgCollectionSpillCheck(*it);
+  }
+}
+
 void bgErrorFunc(void (*errorFunc)(const char *cln, int code))
 {
   bg->errorFunc = errorFunc;
@@ -15,6 +15,8 @@
 #ifndef BG_ANALYTICS_H
 #define BG_ANALYTICS_H
 
+#include <stddef.h>
+
 /******************************************************************************
  * bgDocument
  *
@@ -45,6 +47,20 @@ void bgAuth(const char *guid, const char *key);
  ******************************************************************************/
 void bgInterval(int milli);
 
+/******************************************************************************
+ * bgPoll / bgAutoPoll
+ *
+ * bgPoll does the network work: it checks on requests in flight and uploads
+ * collections once the interval is over. By default it runs at the end of
+ * every bgDocumentAdd*, bgCollectionAdd and bgCollectionCreate call, so
+ * building a document can wait on the network. Calling bgAutoPoll(0) leaves
+ * polling to the application, which should then call bgPoll regularly, for
+ * example once per frame.
+ *
+ ******************************************************************************/
+void bgPoll();
+void bgAutoPoll(int enabled);
+
 /******************************************************************************
  * bgDocumentCreate
  *
@@ -77,15 +93,131 @@ void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val);
 void bgDocumentAddDouble(struct bgDocument *doc, const char *path, double val);
 void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val);
 
+/******************************************************************************
+ * bgDocumentAddMany
+ *
+ * Set several fields in one call, the same as the matching bgDocumentAdd*
+ * calls in order. Integers and bools (non zero is true) are given in number.
+ * Entries are not reordered: only the path of the entry right before is
+ * reused, so order them by prefix with fields of the same object next to each
+ * other for their common parents to be looked up once.
+ *
+ *   struct bgValue values[] = {
+ *     {"device.type", BG_TYPE_CSTR, system_get_device_type_s(), 0},
+ *     {"device.name", BG_TYPE_CSTR, system_get_device_name(), 0},
+ *     {"age", BG_TYPE_INT, NULL, age},
+ *     {"gender", BG_TYPE_BOOL, NULL, gender}
+ *   };
+ *
+ *   bgDocumentAddMany(doc, values, sizeof(values) / sizeof(values[0]));
+ *
+ ******************************************************************************/
+#define BG_TYPE_CSTR 0
+#define BG_TYPE_INT 1
+#define BG_TYPE_DOUBLE 2
+#define BG_TYPE_BOOL 3
+
+struct bgValue
+{
+  const char *path;
+  int type;
+  const char *cstr;
+  double number;
+};
+
+void bgDocumentAddMany(struct bgDocument *doc, const struct bgValue *values,
+  size_t count);
+
+/******************************************************************************
+ * bgDocumentTemplateCreate / bgDocumentCreateFromTemplate
+ *
+ * Set the fields every document repeats, such as device, session or build
+ * details, once on a template with the bgDocumentAdd* functions. Documents
+ * created from the template start out with its fields, which are shared
+ * rather than copied and uploaded as they were escaped the first time.
+ * Setting one of the template's top level fields on such a document gives it
+ * a copy of the template's fields first.
+ *
+ * A template can not be changed once a document has been created from it or
+ * it has been added to a collection. Templates are released by bgCleanup,
+ * adding one to a collection uploads it without releasing it.
+ *
+ ******************************************************************************/
+struct bgDocument *bgDocumentTemplateCreate();
+struct bgDocument *bgDocumentCreateFromTemplate(struct bgDocument *tmpl);
+
+/******************************************************************************
+ * bgFieldCompile / bgDocumentSet*ByField
+ *
+ * Split a path once up front for paths that are set over and over. Setting a
+ * compiled field does the same as the matching bgDocumentAdd* without parsing
+ * the path again. Compiling the same path twice returns the same field. Fields
+ * are released by bgCleanup.
+ *
+ *   struct bgField *deviceType = bgFieldCompile("device.type");
+ *   bgDocumentSetCStrByField(doc, deviceType, system_get_device_type_s());
+ *
+ ******************************************************************************/
+struct bgField;
+
+struct bgField *bgFieldCompile(const char *path);
+void bgDocumentSetCStrByField(struct bgDocument *doc, struct bgField *field,
+  const char *val);
+void bgDocumentSetIntByField(struct bgDocument *doc, struct bgField *field,
+  int val);
+void bgDocumentSetDoubleByField(struct bgDocument *doc, struct bgField *field,
+  double val);
+void bgDocumentSetBoolByField(struct bgDocument *doc, struct bgField *field,
+  int val);
+
 /******************************************************************************
  * bgCollectionCreate
  *
  * Register a global collection to be used throughout the program. This can be
  * done at any point and as many times as needed. However it is an error to add
- * a collection if it already exists.
+ * a collection if it already exists, the existing collection is returned.
+ *
+ * The handle returned stays valid until bgCleanup. Passing it to the *H
+ * variants of the bgCollection calls saves looking the collection up by name
+ * every time.
+ *
+ ******************************************************************************/
+struct bgCollection;
+typedef struct bgCollection *bgCollectionHandle;
+
+bgCollectionHandle bgCollectionCreate(const char *cln);
+
+/******************************************************************************
+ * bgSchemaCreate / bgSchemaAddField / bgCollectionCreateWithSchema
+ *
+ * Declare the typed fields every document of a collection has, for telemetry
+ * of a fixed shape such as frame timings or position samples. Rows are added
+ * with bgCollectionAddRow, values given in the order the fields were added:
+ * const char * for BG_TYPE_CSTR, int for BG_TYPE_INT and BG_TYPE_BOOL and
+ * double for BG_TYPE_DOUBLE. A row is uploaded as a document with every field
+ * set. Fields can not be added once a collection uses the schema, one schema
+ * can be shared by several collections. Schemas are released by bgCleanup.
+ *
+ *   struct bgSchema *frame = bgSchemaCreate();
+ *   bgSchemaAddField(frame, "frame", BG_TYPE_INT);
+ *   bgSchemaAddField(frame, "pos.x", BG_TYPE_DOUBLE);
+ *   bgSchemaAddField(frame, "pos.y", BG_TYPE_DOUBLE);
+ *   bgCollectionCreateWithSchema("Frames", frame);
+ *
+ *   bgCollectionAddRow("Frames", frameNumber, player.x, player.y);
+ *
+ * Rows count against the collection's budget like documents do. A row that
+ * does not fit is always dropped, whatever the policy.
  *
  ******************************************************************************/
-void bgCollectionCreate(const char *cln);
+struct bgSchema;
+
+struct bgSchema *bgSchemaCreate();
+void bgSchemaAddField(struct bgSchema *schema, const char *path, int type);
+bgCollectionHandle bgCollectionCreateWithSchema(const char *cln,
+  struct bgSchema *schema);
+void bgCollectionAddRow(const char *cln, ...);
+void bgCollectionAddRowH(bgCollectionHandle cln, ...);
 
 /******************************************************************************
  * bgCollectionAdd
@@ -97,6 +229,7 @@ void bgCollectionCreate(const char *cln);
  *
  ******************************************************************************/
 void bgCollectionAdd(const char *cln, struct bgDocument *doc);
+void bgCollectionAddH(bgCollectionHandle cln, struct bgDocument *doc);
 
 /******************************************************************************
  * bgCollectionUpload
@@ -108,16 +241,140 @@ void bgCollectionAdd(const char *cln, struct bgDocument *doc);
 void bgCollectionUpload(const char *cln);
 /*void bgCollectionsUpload();*/
 
+/******************************************************************************
+ * bgCollectionBudget / bgBudget
+ *
+ * Limit the documents waiting for upload in a collection, or across all
+ * collections with bgBudget. A limit of 0 means no limit, although a single
+ * collection never holds more than 4096 documents. Bytes are the memory held
+ * by the queued documents. When adding a document would go over a limit, the
+ * collection's policy decides what gives:
+ *
+ *   BG_DROP_NEWEST: the new document is dropped (the default)
+ *   BG_DROP_OLDEST: queued documents are dropped oldest first to make room
+ *   BG_SAMPLE_DOWN: every other queued document is dropped and only one in
+ *     2, 4, 8... new documents is kept until the queue has been uploaded
+ *   BG_SPILL_TO_DISK: the new document is appended to a file in the directory
+ *     given to bgSpillDirectory and uploaded from there later, files left by
+ *     a previous run are picked up when the collection is created
+ *
+ * If the policy can not make room the new document is dropped. Dropped
+ * documents are reported to bgErrorFunc with code -2.
+ *
+ ******************************************************************************/
+#define BG_DROP_NEWEST 0
+#define BG_DROP_OLDEST 1
+#define BG_SAMPLE_DOWN 2
+#define BG_SPILL_TO_DISK 3
+
+void bgCollectionBudget(const char *cln, size_t maxDocuments, size_t maxBytes,
+  int policy);
+void bgCollectionBudgetH(bgCollectionHandle cln, size_t maxDocuments,
+  size_t maxBytes, int policy);
+void bgBudget(size_t maxDocuments, size_t maxBytes);
+void bgSpillDirectory(const char *path);
+
+/******************************************************************************
+ * bgCollectionEager
+ *
+ * Serialize documents as they are added to the collection and release
+ * everything else they held straight away, rather than when the collection
+ * is uploaded. Queued documents then take about the memory of their JSON,
+ * which is also what the budgets count, and the cost of serializing is
+ * spread over the bgCollectionAdd calls instead of landing on the upload.
+ * Off by default.
+ *
+ ******************************************************************************/
+void bgCollectionEager(const char *cln, int enabled);
+void bgCollectionEagerH(bgCollectionHandle cln, int enabled);
+
+/******************************************************************************
+ * bgCollectionCounters
+ *
+ * Running counts of what the budget policies did to a collection, or summed
+ * over all collections if cln is NULL. encodedBytes is an upper bound of the
+ * upload body for the queued documents, kept as they are added rather than
+ * measured.
+ *
+ ******************************************************************************/
+struct bgCounters
+{
+  size_t queuedDocuments;
+  size_t queuedBytes;
+  size_t encodedBytes;
+
+  size_t droppedNewest;
+  size_t droppedOldest;
+  size_t sampledOut;
+  size_t spilled;
+  size_t unspilled;
+};
+
+void bgCollectionCounters(const char *cln, struct bgCounters *counters);
+void bgCollectionCountersH(bgCollectionHandle cln, struct bgCounters *counters);
+
 /******************************************************************************
  * bg*Func
  *
  * Subscribe to actions in order to notify you of when a collection has been
- * uploaded successfully or if an error has occurred.
+ * uploaded successfully or if an error has occurred. The error code is the
+ * HTTP status of a failed upload or one of the following:
+ *
+ *   -1: the collection does not exist or the server could not be reached
+ *   -2: the collection is over its budget and a document was dropped
  *
  ******************************************************************************/
 void bgErrorFunc(void (*errorFunc)(const char *cln, int code));
 void bgSuccessFunc(void (*successFunc)(const char *cln, int count));
 
+/******************************************************************************
+ * bgMemoryStats
+ *
+ * Report the memory used by the SDK. Live bytes are what its objects, queues,
+ * strings and buffers take up, held bytes what it has taken from malloc to
+ * hold them including the unused part of its allocator's pages. The counters
+ * are always maintained and cost a few additions per allocation, so this can
+ * be called periodically in release builds to chart the footprint over a
+ * session. Counts and rates cover the time since the previous call (or
+ * bgAuth), rates are 0 if under a second has passed. The types array stays
+ * valid until the next call.
+ *
+ * Document hits are blocks a document reused after freeing them while it was
+ * built, misses blocks it had to take from its arena. They are only counted
+ * when documents are built as parson trees (BG_DOCUMENT_TREE) and stay 0
+ * otherwise.
+ *
+ ******************************************************************************/
+struct bgMemoryType
+{
+  const char *type;
+  size_t count;
+  size_t bytes;
+};
+
+struct bgMemoryStats
+{
+  size_t liveBytes;
+  size_t liveObjects;
+  size_t peakBytes;
+
+  size_t heldBytes;
+  size_t peakHeldBytes;
+
+  size_t allocs;
+  size_t frees;
+  double allocsPerSecond;
+  double freesPerSecond;
+
+  size_t documentHits;
+  size_t documentMisses;
+
+  size_t typeCount;
+  const struct bgMemoryType *types;
+};
+
+void bgMemoryStats(struct bgMemoryStats *stats);
+
 /******************************************************************************
  * bgCleanup
  *
@@ -131,6 +388,74 @@ void bgCleanup();
 
 #define BG_URL "http://bu-games.bmth.ac.uk"
 #define BG_PATH "/api/v1"
+
+/* Documents each collection can hold, whatever its budget */
+#define BG_QUEUE_CAPACITY 4096
+
+/* Spilled documents read back into a single upload */
+#define BG_SPILL_CHUNK 65536
+
+/*
+ * Documents are flat streams of records serialized straight to JSON. Define
+ * BG_DOCUMENT_TREE to build them as parson trees instead.
+ */
+/*#define BG_DOCUMENT_TREE*/
+
+/* Deepest dotted path bgDocumentAdd* accepts */
+#define BG_PATH_MAX_DEPTH 32
+
+#define BG_ERROR_UNKNOWN_COLLECTION -1
+#define BG_ERROR_QUEUE_FULL -2
+
+#ifndef PALLOC_HASH_H
+#define PALLOC_HASH_H
+
+#include <stdlib.h>
+
+/*
+ * Open addressed table of entry pointers with linear probing, kept at most
+ * half full. Entries are never removed one by one. The table does not
+ * allocate, callers provide the zeroed slots when it grows so it can be used
+ * beneath palloc as well as on top of it.
+ */
+struct hash_table
+{
+  void **slots;
+  size_t capacity;
+  size_t count;
+};
+
+/* Whether entry holds key */
+typedef int (*hash_match_fn)(const void *entry, const void *key);
+
+/* Hash of the key held by entry, as given to hash_slot when it was added */
+typedef size_t (*hash_entry_fn)(const void *entry);
+
+size_t hash_pointer(const void *ptr);
+size_t hash_bytes(const char *s, size_t len);
+
+/*
+ * Slot holding the entry that matches key, or the empty one it would go in.
+ * The table must have a capacity.
+ */
+void **hash_slot(struct hash_table *table, size_t hash, const void *key,
+  hash_match_fn match);
+
+/*
+ * Capacity the table needs before one more entry is added, at least min, or
+ * 0 if it has room.
+ */
+size_t hash_grow(struct hash_table *table, size_t min);
+
+/*
+ * Moves every entry into slots of the given capacity, zeroed by the caller.
+ * Returns the previous slots for the caller to free, NULL if there were none.
+ */
+void **hash_rehash(struct hash_table *table, void **slots, size_t capacity,
+  hash_entry_fn hash);
+
+#endif
+
 #ifndef PALLOC_H
 #define PALLOC_H
 
@@ -138,25 +463,127 @@ void bgCleanup();
 
 /*#define PALLOC_DEBUG*/
 /*#define PALLOC_ACTIVE*/
+/*#define PALLOC_VECTOR_CHECKED*/
 #define PALLOC_SENTINEL 1
 
+/*
+ * Allocation strategy, PALLOC_ACTIVE takes precedence and tracks every
+ * allocation for leak and use after free reports. PALLOC_SLAB serves small
+ * objects from per size class free lists. With neither, palloc is calloc.
+ */
+#define PALLOC_SLAB
+
+/*
+ * Counters kept in every mode. Each allocation is attributed to the address
+ * of its type string, the #T literal of palloc(T). Live bytes are what has
+ * been handed out, held bytes what has been taken from malloc to do so:
+ * slab pages whether or not they are full, large blocks and buffers with
+ * their headers, and debug pool entries waiting for reuse.
+ */
+struct palloc_stats
+{
+  size_t liveBytes;
+  size_t liveObjects;
+  size_t peakBytes;
+
+  size_t heldBytes;
+  size_t peakHeldBytes;
+
+  /* Running totals */
+  size_t allocs;
+  size_t frees;
+};
+
+struct palloc_tag
+{
+  const char *type;
+  size_t count;
+  size_t bytes;
+};
+
 void pfree(void *ptr);
 void *_palloc(size_t size, const char *type);
+void *_palloc_uninit(size_t size, const char *type);
+void palloc_trim();
+
+/*
+ * Buffers that grow in place live outside of the pools. Reallocates ptr from
+ * old bytes to size bytes, or frees it if size is 0, and counts it against
+ * type like any other allocation. Returns NULL and leaves ptr alone on
+ * failure.
+ */
+void *palloc_buffer(void *ptr, size_t old, size_t size, const char *type);
+
+void palloc_stats(struct palloc_stats *out);
+
+/* Copies up to max tags with live objects, returns how many there are */
+size_t palloc_tags(struct palloc_tag *out, size_t max);
 
 #define palloc(T) \
   (T*)_palloc(sizeof(T), #T)
 
+/* Same as palloc but the memory is not zeroed */
+#define palloc_uninit(T) \
+  (T*)_palloc_uninit(sizeof(T), #T)
+
+#endif
+
+#ifndef PALLOC_NUMBER_H
+#define PALLOC_NUMBER_H
+
+#include <stdlib.h>
+
+/*
+ * Largest output of any of the number_format_* functions including the
+ * null terminator, e.g. "-2.2250738585072014e-308".
+ */
+#define NUMBER_BUFFER_SIZE 32
+
+/*
+ * Write the decimal representation of val into buf and return the number of
+ * characters written, excluding the null terminator. Floating point values
+ * are written with Grisu2, which always parses back to the same value and is
+ * the shortest such digit string in the vast majority of cases, but may be a
+ * digit or so longer. They switch to exponent notation outside of 1e-6 to
+ * 1e21.
+ */
+size_t number_format_int(char *buf, int val);
+size_t number_format_uint(char *buf, unsigned int val);
+size_t number_format_float(char *buf, float val);
+size_t number_format_double(char *buf, double val);
+
+/*
+ * Write val as a JSON number: integral values in the range of int without a
+ * fraction, others as number_format_double, and null for NaN and infinities
+ * which JSON has no form for.
+ */
+size_t number_format_json(char *buf, double val);
+
 #endif
 
 #ifndef PALLOC_VECTOR_H
 #define PALLOC_VECTOR_H
 
+#ifndef AMALGAMATION
+  #include "palloc.h"
+#endif
+
+/*
+ * Element access is bounds checked when PALLOC_VECTOR_CHECKED is defined (or
+ * implied by PALLOC_ACTIVE). Otherwise vector_at, vector_set and vector_size
+ * compile down to plain indexing with no function call.
+ */
+#if defined(PALLOC_ACTIVE) && !defined(PALLOC_VECTOR_CHECKED)
+  #define PALLOC_VECTOR_CHECKED
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 
 struct _VectorHeader
 {
   size_t size;
+  size_t capacity;
   size_t entrySize;
 };
 
@@ -169,25 +596,45 @@ struct _Vector
 #define vector(T) \
   T*
 
-void *_VectorNew(size_t size, const char *type);
+void *_VectorNew(size_t size, const char *type, const char *headerType);
 int _VectorOobAssert(void *_vh, size_t idx);
 void _VectorErase(void *_vh, void *_v, size_t idx);
+void _VectorEraseRange(void *_vh, void *_v, size_t idx, size_t count);
+void _VectorInsertRange(void *_vh, void *_v, size_t idx, const void *src,
+  size_t count);
 void _VectorResize(void *_vh, void *_v, size_t size);
+void _VectorReserve(void *_vh, void *_v, size_t capacity);
+void _VectorShrinkToFit(void *_vh, void *_v);
 size_t _VectorSize(void *_vh);
+size_t _VectorCapacity(void *_vh);
 void _VectorDelete(void *_vh, void *_v);
 
 #define vector_new(T) \
-  (vector(T) *)_VectorNew(sizeof(T), #T)
+  (vector(T) *)_VectorNew(sizeof(T), "vector(" #T ")", \
+    "vector_header(" #T ")")
 
 #define vector_delete(V) \
   _VectorDelete(V[0], V)
 
+#define _vector_header(V) \
+  ((struct _VectorHeader *)(void *)V[0])
+
 #define vector_size(V) \
-  _VectorSize(V[0])
+  (_vector_header(V)->size)
 
 #define vector_resize(V, S) \
   _VectorResize(V[0], V, S)
 
+#define vector_capacity(V) \
+  (_vector_header(V)->capacity)
+
+#define vector_reserve(V, S) \
+  _VectorReserve(V[0], V, S)
+
+#define vector_shrink_to_fit(V) \
+  _VectorShrinkToFit(V[0], V)
+
+#ifdef PALLOC_VECTOR_CHECKED
 #define vector_set(V, I, D) \
   do { \
     if(vector_size(V) <= I) { \
@@ -198,6 +645,15 @@ void _VectorDelete(void *_vh, void *_v);
 
 #define vector_at(V, I) \
   (_VectorOobAssert(V[0], I) ? V[1][I] : V[1][I])
+#else
+#define vector_set(V, I, D) \
+  do { \
+    V[1][I] = D; \
+  } while(0)
+
+#define vector_at(V, I) \
+  (V[1][I])
+#endif
 
 #define vector_raw(V) \
   V[1]
@@ -205,18 +661,184 @@ void _VectorDelete(void *_vh, void *_v);
 #define vector_data(V) \
   V[1]
 
+/*
+ * Walk the entries with a pointer, IT must be declared as a pointer to the
+ * element type. The vector must not be resized while iterating.
+ *
+ *   struct bgCollection **it = NULL;
+ *   vector_foreach(it, bg->collections) { ... (*it)->name ... }
+ */
+#define vector_foreach(IT, V) \
+  for(IT = vector_raw(V); IT != vector_raw(V) + vector_size(V); IT++)
+
 #define vector_push_back(V, D) \
   do { \
     vector_resize(V, vector_size(V) + 1); \
     vector_set(V, vector_size(V) - 1, D); \
   } while(0)
 
+/* Keeps the capacity, use vector_shrink_to_fit to release it */
 #define vector_clear(V) \
   vector_resize(V, 0)
 
 #define vector_erase(V, I) \
   _VectorErase(V[0], V, I)
 
+/* Bulk operations, each moves the data with a single memcpy/memmove */
+#define vector_erase_range(V, I, C) \
+  _VectorEraseRange(V[0], V, I, C)
+
+#define vector_insert_range(V, I, P, C) \
+  _VectorInsertRange(V[0], V, I, P, C)
+
+#define vector_append(V, P, C) \
+  _VectorInsertRange(V[0], V, vector_size(V), P, C)
+
+#endif
+
+#ifndef PALLOC_RING_H
+#define PALLOC_RING_H
+
+#ifndef AMALGAMATION
+  #include "palloc.h"
+#endif
+
+#include <stdlib.h>
+
+/*
+ * Fixed capacity FIFO queue. The capacity is rounded up to a power of two so
+ * wrapping is a mask and the storage is allocated once in ring_new. The head
+ * and tail are free running counters, their difference is the size.
+ */
+struct _RingHeader
+{
+  size_t head;
+  size_t tail;
+  size_t mask;
+  size_t entrySize;
+};
+
+struct _Ring
+{
+  struct _RingHeader *rh;
+  void *data;
+};
+
+#define ring(T) \
+  T*
+
+void *_RingNew(size_t size, size_t capacity, const char *type,
+  const char *headerType);
+size_t _RingPeekBatch(void *_rh, void *_r, void *out, size_t max);
+void _RingDiscard(void *_rh, size_t count);
+void _RingDelete(void *_rh, void *_r);
+
+#define ring_new(T, C) \
+  (ring(T) *)_RingNew(sizeof(T), C, "ring(" #T ")", "ring_header(" #T ")")
+
+#define ring_delete(R) \
+  _RingDelete(R[0], R)
+
+#define _ring_header(R) \
+  ((struct _RingHeader *)(void *)R[0])
+
+#define ring_size(R) \
+  (_ring_header(R)->tail - _ring_header(R)->head)
+
+#define ring_capacity(R) \
+  (_ring_header(R)->mask + 1)
+
+#define ring_empty(R) \
+  (ring_size(R) == 0)
+
+#define ring_full(R) \
+  (ring_size(R) == ring_capacity(R))
+
+/* I-th oldest entry, I must be less than ring_size */
+#define ring_at(R, I) \
+  (R[1][(_ring_header(R)->head + (I)) & _ring_header(R)->mask])
+
+/* Evaluates to 1 if D was queued or 0 if the ring is full */
+#define ring_push(R, D) \
+  (ring_full(R) ? 0 : \
+    (R[1][_ring_header(R)->tail++ & _ring_header(R)->mask] = (D), 1))
+
+/* Evaluates to 1 and stores the oldest entry in OUT or 0 if empty */
+#define ring_pop(R, OUT) \
+  (ring_empty(R) ? 0 : \
+    ((OUT) = R[1][_ring_header(R)->head++ & _ring_header(R)->mask], 1))
+
+/*
+ * Copy up to MAX of the oldest entries into the array OUT without removing
+ * them and evaluate to the number copied. Entries pushed meanwhile are left
+ * alone by a following ring_discard of that count.
+ */
+#define ring_peek_batch(R, OUT, MAX) \
+  _RingPeekBatch(R[0], R, OUT, MAX)
+
+#define ring_discard(R, C) \
+  _RingDiscard(R[0], C)
+
+#define ring_clear(R) \
+  _RingDiscard(R[0], ring_size(R))
+
+#endif
+
+#ifndef PALLOC_INTERN_H
+#define PALLOC_INTERN_H
+
+#include <stdlib.h>
+
+/*
+ * Global table of immutable strings. Interning the same contents twice gives
+ * the same pointer so interned strings can be compared with ==. Pointers stay
+ * valid until intern_clear() is called.
+ */
+const char *intern_cstr(const char *s);
+const char *intern_chars(const char *s, size_t len);
+
+/* Returns the interned copy of s or NULL without adding it to the table */
+const char *intern_find(const char *s);
+
+size_t intern_count();
+void intern_clear();
+
+#endif
+
+#ifndef PALLOC_ARENA_H
+#define PALLOC_ARENA_H
+
+#include <stdlib.h>
+
+struct ArenaBlock;
+
+/*
+ * Region allocator. Allocations are bumped out of a chain of blocks and are
+ * never freed individually, arena_reset() releases all of them at once. A
+ * zeroed arena is empty and ready to use.
+ *
+ * Released blocks are kept in a global pool so refilling an arena after a
+ * reset usually does not touch malloc.
+ */
+struct arena
+{
+  struct ArenaBlock *blocks;
+  char *cursor;
+  size_t remaining;
+
+  /* Bytes held in blocks, headers included */
+  size_t size;
+};
+
+/* Memory is suitably aligned for any type but not zeroed */
+void *arena_alloc(struct arena *a, size_t size);
+
+/* Releases every allocation in the arena, leaving it empty */
+void arena_reset(struct arena *a);
+
+/* Frees the blocks held in the pool */
+void arena_trim();
+
 #endif
 
 #ifndef PALLOC_SSTREAM_H
@@ -228,26 +850,62 @@ void _VectorDelete(void *_vh, void *_v);
 
 #include <stdlib.h>
 
-struct Chunk
-{
-  struct Chunk *next;
-  char c;
-  char *s;
-  size_t len;
-};
+/* Bytes stored inline before a stream moves its contents to the heap */
+#define SSTREAM_LOCAL_SIZE 24
 
+/*
+ * Contiguous, always null terminated character buffer. The capacity grows
+ * geometrically so that appends are amortized O(1) and the length and
+ * c-string are available without any further work. Short strings (names,
+ * keys, url parts) live in the local buffer and need no extra allocation.
+ */
 struct sstream
 {
-  struct Chunk *first;
+  char *data;
+  size_t length;
+  size_t capacity;
+  char local[SSTREAM_LOCAL_SIZE];
 };
 
 typedef struct sstream sstream;
 
+/*
+ * Non-owning view of a run of characters, not necessarily null terminated.
+ * Views handed out by the functions below point into the source string and
+ * are only valid for as long as that string is left untouched.
+ */
+struct sstrview
+{
+  const char *s;
+  size_t len;
+};
+
+/*
+ * Writable view of the unused tail of a stream. Obtained through
+ * sstream_builder_begin() so that serializers can write straight into the
+ * stream. The remaining count includes the byte reserved for the null
+ * terminator so it can be passed to functions that write one. Once done,
+ * sstream_builder_commit() appends the written characters.
+ */
+struct sstream_builder
+{
+  struct sstream *ctx;
+  char *tail;
+  size_t remaining;
+};
+
 struct sstream *sstream_new();
 void sstream_delete(struct sstream *ctx);
 
 void sstream_clear(struct sstream *ctx);
+/* Drops everything past the first length characters */
+void sstream_truncate(struct sstream *ctx, size_t length);
 size_t sstream_length(struct sstream *ctx);
+size_t sstream_capacity(struct sstream *ctx);
+void sstream_reserve(struct sstream *ctx, size_t capacity);
+
+struct sstream_builder sstream_builder_begin(struct sstream *ctx, size_t count);
+void sstream_builder_commit(struct sstream_builder *builder, size_t count);
 
 void sstream_push_cstr(struct sstream *ctx, const char *s);
 void sstream_push_int(struct sstream *ctx, int val);
@@ -263,6 +921,16 @@ int sstream_int(struct sstream *ctx);
 void sstream_split(struct sstream *ctx, char token,
   vector(struct sstream*) *out);
 
+struct sstrview sstream_view(struct sstream *ctx);
+struct sstrview sstrview_cstr(const char *s);
+
+int sstrview_next(struct sstrview *rest, char token, struct sstrview *out);
+size_t sstrview_split(struct sstrview src, char token,
+  struct sstrview *out, size_t max);
+
+int sstrview_equals(struct sstrview view, const char *s);
+int sstrview_int(struct sstrview view);
+
 #endif
 
 /*
@@ -365,11 +1033,20 @@ typedef int JSON_Status;
 
 typedef void * (*JSON_Malloc_Function)(size_t);
 typedef void   (*JSON_Free_Function)(void *);
+typedef const char * (*JSON_Intern_Function)(const char *string, size_t n);
 
 /* Call only once, before calling any other function from parson API. If not called, malloc and free
    from stdlib will be used for all allocations */
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
+/* Call only once, before any object keys are created. Object keys are then obtained from intern_fun,
+   which must return the same stable pointer for equal strings, instead of being copied and they
+   are never freed by parson. Lookups compare interned keys by pointer first. */
+void json_set_key_intern_function(JSON_Intern_Function intern_fun);
+
+/* Sizes of the value, object and array nodes, so custom allocators can give them dedicated pools */
+void json_node_sizes(size_t *value_size, size_t *object_size, size_t *array_size);
+
 /* Parses first JSON value in a file, returns NULL in case of error */
 JSON_Value * json_parse_file(const char *filename);
 
@@ -387,6 +1064,11 @@ JSON_Value * json_parse_string_with_comments(const char *string);
 /* Serialization */
 size_t      json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
+
+/* A single string quoted and escaped as it would be in a serialized value. The size includes the null
+   terminator and is 0 if the string is not valid UTF-8. */
+size_t      json_string_serialization_size(const char *string);
+JSON_Status json_serialize_string_to_buffer(const char *string, char *buf, size_t buf_size_in_bytes);
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename);
 char *      json_serialize_to_string(const JSON_Value *value);
 
@@ -464,6 +1146,10 @@ JSON_Status json_object_dotset_number(JSON_Object *object, const char *name, dou
 JSON_Status json_object_dotset_boolean(JSON_Object *object, const char *name, int boolean);
 JSON_Status json_object_dotset_null(JSON_Object *object, const char *name);
 
+/* Same as json_object_dotset_value with the path already split into count keys. Keys must have been
+ * obtained from the function given to json_set_key_intern_function, they are compared by pointer only. */
+JSON_Status json_object_keyset_value(JSON_Object *object, const char * const *keys, size_t count, JSON_Value *value);
+
 /* Frees and removes name-value pair */
 JSON_Status json_object_remove(JSON_Object *object, const char *name);
 
@@ -543,49 +1229,315 @@ int             json_boolean(const JSON_Value *value);
 
 #endif
 
+#ifndef BG_MEMORY_H
+#define BG_MEMORY_H
+
+#ifndef AMALGAMATION
+  #include <palloc/arena.h>
+#endif
+
+enum bgMemoryClass
+{
+  /* Requests the size of a parson node */
+  BG_MEMORY_VALUE,
+  BG_MEMORY_OBJECT,
+  BG_MEMORY_ARRAY,
+
+  /* Strings and object/array tables, rounded up */
+  BG_MEMORY_SMALL16,
+  BG_MEMORY_SMALL32,
+  BG_MEMORY_SMALL64,
+  BG_MEMORY_SMALL128,
+
+  /* Anything bigger, never recycled */
+  BG_MEMORY_LARGE,
+  BG_MEMORY_CLASSES
+};
+
+/*
+ * Allocator behind parson for a single document. Memory is carved from the
+ * document's arena, blocks parson frees while the document is being built
+ * (replaced values, outgrown tables) go on per class free lists and are
+ * reused by the document's later allocations.
+ */
+struct bgMemory
+{
+  struct arena arena;
+  void *free[BG_MEMORY_LARGE];
+};
+
+struct bgMemoryCounters
+{
+  /* Served from a free list */
+  size_t hits[BG_MEMORY_CLASSES];
+  /* Carved from the arena */
+  size_t misses[BG_MEMORY_CLASSES];
+};
+
+/* Installs the allocator into parson when documents are parson trees,
+ * bgMemoryShutdown puts parson's own back.
+ */
+void bgMemoryInit();
+void bgMemoryShutdown();
+
+/* parson allocates from m and interns keys until bgMemoryEnd() */
+void bgMemoryBegin(struct bgMemory *m);
+void bgMemoryEnd();
+
+#endif
+
 #ifndef BG_COLLECTION_H
 #define BG_COLLECTION_H
 
 #ifndef AMALGAMATION
+  #include <bg/analytics.h>
   #include "palloc/vector.h"
+  #include "palloc/ring.h"
   #include "palloc/sstream.h"
 #endif
 
+#include <stdio.h>
+
 struct bgDocument;
+struct bgColumns;
 struct StringStream;
 struct Http;
 
 struct bgCollection
 {
-  struct sstream *name;
-  vector(struct bgDocument *) *documents;
+  /* Interned, collections can be compared by pointer */
+  const char *name;
+  ring(struct bgDocument *) *documents;
   int lastDocumentCount;
 
+  /* Documents are frozen as they are added, scratch is only there when
+   * eager is set.
+   */
+  int eager;
+  struct sstream *scratch;
+
+  /* Rows of a collection created with a schema, NULL otherwise */
+  struct bgColumns *columns;
+
+  /* Budget, a limit of 0 is unlimited */
+  size_t maxDocuments;
+  size_t maxBytes;
+  int policy;
+  struct bgCounters counters;
+
+  /* BG_SAMPLE_DOWN keeps one in sampleInterval new documents */
+  size_t sampleInterval;
+  size_t sampleCount;
+
+  /* BG_SPILL_TO_DISK, the file is read back from spillOffset */
+  FILE *spill;
+  long spillOffset;
+  int spillPending;
+
   struct Http *http;
 };
 
 void bgCollectionDestroy(struct bgCollection *cln);
+size_t bgCollectionSerialize(struct bgCollection *c, struct sstream *ser);
+void bgCollectionDrain(struct bgCollection *c, size_t count);
+void bgCollectionSpillCheck(struct bgCollection *c);
 struct bgCollection *bgCollectionGet(const char* cln);
 
 #endif
 
+#ifndef BG_FIELD_H
+#define BG_FIELD_H
+
+#include <stdlib.h>
+
+/*
+ * Dotted document path split once into interned keys, so setting it does no
+ * parsing or hashing. Fields are owned by the state and live until bgCleanup.
+ */
+struct bgField
+{
+  /* Interned, equal paths compile to the same field */
+  const char *path;
+  size_t depth;
+  const char **keys;
+};
+
+void bgFieldDestroy(struct bgField *field);
+
+#endif
+
+#ifndef BG_SCHEMA_H
+#define BG_SCHEMA_H
+
+#ifndef AMALGAMATION
+  #include <palloc/vector.h>
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+struct bgField;
+struct sstream;
+
+struct bgSchemaField
+{
+  struct bgField *field;
+  int type;
+
+  /* Written in front of the value: the separator, objects closed and opened
+   * since the previous field in serialization order, and the key.
+   */
+  struct sstream *lead;
+};
+
+/*
+ * Typed fields shared by every row of a collection, indexed in the order rows
+ * give their values. Fields with a common parent are serialized next to each
+ * other so each object is opened once. Schemas are owned by the state and
+ * live until bgCleanup.
+ */
+struct bgSchema
+{
+  vector(struct bgSchemaField *) *fields;
+  vector(size_t) *order;
+
+  /* Closes the row after the last field */
+  struct sstream *tail;
+
+  /* Fields can not be added once a collection uses the schema */
+  int locked;
+};
+
+/*
+ * Rows of a collection stored as one array per schema field. Strings are kept
+ * escaped in text, their column holds the offset of the quoted value.
+ */
+struct bgColumns
+{
+  struct bgSchema *schema;
+  void **data;
+  size_t rows;
+  size_t capacity;
+  struct sstream *text;
+
+  /* Held by the rows, as counted against the budgets */
+  size_t bytes;
+
+  /* Upper bound of the rows serialized, separators included */
+  size_t encoded;
+};
+
+void bgSchemaDestroy(struct bgSchema *schema);
+
+struct bgColumns *bgColumnsCreate(struct bgSchema *schema);
+void bgColumnsDestroy(struct bgColumns *columns);
+
+/* Appends a row from values in field order, sets bytes to what it holds and
+ * encoded to its serialized size. Returns 0 if the row could not be stored.
+ */
+int bgColumnsAdd(struct bgColumns *columns, va_list values, size_t *bytes,
+  size_t *encoded);
+
+/* Removes the last row, sizes as given by bgColumnsAdd */
+void bgColumnsPop(struct bgColumns *columns, size_t bytes, size_t encoded);
+
+/* Appends every row to an upload body holding written documents. Returns the
+ * new number of documents written.
+ */
+size_t bgColumnsSerialize(struct bgColumns *columns, struct sstream *out,
+  size_t written);
+
+void bgColumnsClear(struct bgColumns *columns);
+
+#endif
+
 #ifndef BG_DOCUMENT_H
 #define BG_DOCUMENT_H
 
 #ifndef AMALGAMATION
-  /*#include <palloc/sstream.h>*/
-  #include <palloc/vector.h>
+  #include "config.h"
+  #include <palloc/sstream.h>
+  #include "Memory.h"
   #include "parson.h"
 #endif
 
+#ifdef BG_DOCUMENT_TREE
 struct bgDocument
 {
+  /* Holds the document itself and all of its values */
+  struct bgMemory memory;
+
   JSON_Value  *rootVal;
   JSON_Object *rootObj;
   JSON_Array  *rootArr;
+
+  /* Templates are only released by bgDocumentTemplateDestroy, and can not
+   * change once locked.
+   */
+  int isTemplate;
+  int locked;
+
+  /* Set once frozen, the tree is gone and this is all that is left */
+  char *text;
+  size_t textLength;
+};
+#else
+struct bgDocument
+{
+  /* Records appended by the setters, laid out as described in Document.c */
+  char *records;
+  size_t length;
+  size_t capacity;
+
+  /* Running estimate of the serialized size of the records */
+  size_t encoded;
+
+  /* Template whose members are written ahead of the document's own */
+  struct bgDocument *base;
+
+  /* Templates only. Once a document has been created from the template its
+   * members are kept serialized here, without the braces, and it can no
+   * longer change.
+   */
+  int isTemplate;
+  struct sstream *shared;
+
+  /* Set once frozen, the records are gone and this is all that is left */
+  char *text;
+  size_t textLength;
 };
+#endif
 
+/* Does nothing for templates, they are owned by the state */
 void bgDocumentDestroy(struct bgDocument *doc);
+void bgDocumentTemplateDestroy(struct bgDocument *tmpl);
+
+/* Stops tmpl from changing, done when a document is created from it or it
+ * is queued, so what was counted stays what is uploaded.
+ */
+void bgDocumentLock(struct bgDocument *tmpl);
+
+/* Memory held by the document */
+size_t bgDocumentSize(struct bgDocument *doc);
+
+/* Length of the document serialized, an upper bound unless keys need
+ * escaping. Kept up to date by the setters, measured with BG_DOCUMENT_TREE.
+ */
+size_t bgDocumentEncodedSize(struct bgDocument *doc);
+
+/* Appends s as a JSON string, returns 0 and appends nothing if it is not
+ * valid UTF-8.
+ */
+int bgDocumentWriteString(struct sstream *out, const char *s);
+
+/* Appends doc as a JSON object, returns 0 if it could not be serialized */
+int bgDocumentSerialize(struct bgDocument *doc, struct sstream *out);
+
+/* Serializes doc through scratch and keeps nothing but the text, returns the
+ * frozen document which may have moved. Templates are left as they are.
+ */
+struct bgDocument *bgDocumentFreeze(struct bgDocument *doc,
+  struct sstream *scratch);
 
 #endif
 
@@ -593,12 +1545,16 @@ void bgDocumentDestroy(struct bgDocument *doc);
 #define BG_STATE_H
 
 #ifndef AMALGAMATION
+  #include <palloc/hash.h>
   #include <palloc/vector.h>
 #endif
 
 #include <time.h>
 
 struct bgCollection;
+struct bgDocument;
+struct bgField;
+struct bgSchema;
 struct sstream;
 
 struct bgState
@@ -607,6 +1563,9 @@ struct bgState
   int interval;
   int intervalTimer;
 
+  /* Unset when the application calls bgPoll itself */
+  int autoPoll;
+
   struct sstream *url;
   struct sstream *path;
   struct sstream *fullUrl;
@@ -615,7 +1574,23 @@ struct bgState
 
   time_t t;
 
+  /* Budget across all collections, a limit of 0 is unlimited */
+  size_t maxDocuments;
+  size_t maxBytes;
+  size_t queuedDocuments;
+  size_t queuedBytes;
+
+  /* NULL until bgSpillDirectory is called */
+  struct sstream *spillDir;
+
   vector(struct bgCollection *) *collections;
+
+  /* Keyed by the address of the interned names */
+  struct hash_table collectionIndex;
+
+  vector(struct bgField *) *fields;
+  vector(struct bgSchema *) *schemas;
+  vector(struct bgDocument *) *templates;
   void (*errorFunc)(const char *cln, int code);
   void (*successFunc)(const char *cln, int count);
 };
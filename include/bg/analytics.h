@@ -12,6 +12,8 @@
 #ifndef BG_ANALYTICS_H
 #define BG_ANALYTICS_H
 
+#include <stddef.h>
+
 /******************************************************************************
  * bgDocument
  *
@@ -42,6 +44,20 @@ void bgAuth(const char *guid, const char *key);
  ******************************************************************************/
 void bgInterval(int milli);
 
+/******************************************************************************
+ * bgPoll / bgAutoPoll
+ *
+ * bgPoll does the network work: it checks on requests in flight and uploads
+ * collections once the interval is over. By default it runs at the end of
+ * every bgDocumentAdd*, bgCollectionAdd and bgCollectionCreate call, so
+ * building a document can wait on the network. Calling bgAutoPoll(0) leaves
+ * polling to the application, which should then call bgPoll regularly, for
+ * example once per frame.
+ *
+ ******************************************************************************/
+void bgPoll();
+void bgAutoPoll(int enabled);
+
 /******************************************************************************
  * bgDocumentCreate
  *
@@ -74,15 +90,131 @@ void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val);
 void bgDocumentAddDouble(struct bgDocument *doc, const char *path, double val);
 void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val);
 
+/******************************************************************************
+ * bgDocumentAddMany
+ *
+ * Set several fields in one call, the same as the matching bgDocumentAdd*
+ * calls in order. Integers and bools (non zero is true) are given in number.
+ * Entries are not reordered: only the path of the entry right before is
+ * reused, so order them by prefix with fields of the same object next to each
+ * other for their common parents to be looked up once.
+ *
+ *   struct bgValue values[] = {
+ *     {"device.type", BG_TYPE_CSTR, system_get_device_type_s(), 0},
+ *     {"device.name", BG_TYPE_CSTR, system_get_device_name(), 0},
+ *     {"age", BG_TYPE_INT, NULL, age},
+ *     {"gender", BG_TYPE_BOOL, NULL, gender}
+ *   };
+ *
+ *   bgDocumentAddMany(doc, values, sizeof(values) / sizeof(values[0]));
+ *
+ ******************************************************************************/
+#define BG_TYPE_CSTR 0
+#define BG_TYPE_INT 1
+#define BG_TYPE_DOUBLE 2
+#define BG_TYPE_BOOL 3
+
+struct bgValue
+{
+  const char *path;
+  int type;
+  const char *cstr;
+  double number;
+};
+
+void bgDocumentAddMany(struct bgDocument *doc, const struct bgValue *values,
+  size_t count);
+
+/******************************************************************************
+ * bgDocumentTemplateCreate / bgDocumentCreateFromTemplate
+ *
+ * Set the fields every document repeats, such as device, session or build
+ * details, once on a template with the bgDocumentAdd* functions. Documents
+ * created from the template start out with its fields, which are shared
+ * rather than copied and uploaded as they were escaped the first time.
+ * Setting one of the template's top level fields on such a document gives it
+ * a copy of the template's fields first.
+ *
+ * A template can not be changed once a document has been created from it or
+ * it has been added to a collection. Templates are released by bgCleanup,
+ * adding one to a collection uploads it without releasing it.
+ *
+ ******************************************************************************/
+struct bgDocument *bgDocumentTemplateCreate();
+struct bgDocument *bgDocumentCreateFromTemplate(struct bgDocument *tmpl);
+
+/******************************************************************************
+ * bgFieldCompile / bgDocumentSet*ByField
+ *
+ * Split a path once up front for paths that are set over and over. Setting a
+ * compiled field does the same as the matching bgDocumentAdd* without parsing
+ * the path again. Compiling the same path twice returns the same field. Fields
+ * are released by bgCleanup.
+ *
+ *   struct bgField *deviceType = bgFieldCompile("device.type");
+ *   bgDocumentSetCStrByField(doc, deviceType, system_get_device_type_s());
+ *
+ ******************************************************************************/
+struct bgField;
+
+struct bgField *bgFieldCompile(const char *path);
+void bgDocumentSetCStrByField(struct bgDocument *doc, struct bgField *field,
+  const char *val);
+void bgDocumentSetIntByField(struct bgDocument *doc, struct bgField *field,
+  int val);
+void bgDocumentSetDoubleByField(struct bgDocument *doc, struct bgField *field,
+  double val);
+void bgDocumentSetBoolByField(struct bgDocument *doc, struct bgField *field,
+  int val);
+
 /******************************************************************************
  * bgCollectionCreate
  *
  * Register a global collection to be used throughout the program. This can be
  * done at any point and as many times as needed. However it is an error to add
- * a collection if it already exists.
+ * a collection if it already exists, the existing collection is returned.
+ *
+ * The handle returned stays valid until bgCleanup. Passing it to the *H
+ * variants of the bgCollection calls saves looking the collection up by name
+ * every time.
+ *
+ ******************************************************************************/
+struct bgCollection;
+typedef struct bgCollection *bgCollectionHandle;
+
+bgCollectionHandle bgCollectionCreate(const char *cln);
+
+/******************************************************************************
+ * bgSchemaCreate / bgSchemaAddField / bgCollectionCreateWithSchema
+ *
+ * Declare the typed fields every document of a collection has, for telemetry
+ * of a fixed shape such as frame timings or position samples. Rows are added
+ * with bgCollectionAddRow, values given in the order the fields were added:
+ * const char * for BG_TYPE_CSTR, int for BG_TYPE_INT and BG_TYPE_BOOL and
+ * double for BG_TYPE_DOUBLE. A row is uploaded as a document with every field
+ * set. Fields can not be added once a collection uses the schema, one schema
+ * can be shared by several collections. Schemas are released by bgCleanup.
+ *
+ *   struct bgSchema *frame = bgSchemaCreate();
+ *   bgSchemaAddField(frame, "frame", BG_TYPE_INT);
+ *   bgSchemaAddField(frame, "pos.x", BG_TYPE_DOUBLE);
+ *   bgSchemaAddField(frame, "pos.y", BG_TYPE_DOUBLE);
+ *   bgCollectionCreateWithSchema("Frames", frame);
+ *
+ *   bgCollectionAddRow("Frames", frameNumber, player.x, player.y);
+ *
+ * Rows count against the collection's budget like documents do. A row that
+ * does not fit is always dropped, whatever the policy.
  *
  ******************************************************************************/
-void bgCollectionCreate(const char *cln);
+struct bgSchema;
+
+struct bgSchema *bgSchemaCreate();
+void bgSchemaAddField(struct bgSchema *schema, const char *path, int type);
+bgCollectionHandle bgCollectionCreateWithSchema(const char *cln,
+  struct bgSchema *schema);
+void bgCollectionAddRow(const char *cln, ...);
+void bgCollectionAddRowH(bgCollectionHandle cln, ...);
 
 /******************************************************************************
  * bgCollectionAdd
@@ -94,6 +226,7 @@ void bgCollectionCreate(const char *cln);
  *
  ******************************************************************************/
 void bgCollectionAdd(const char *cln, struct bgDocument *doc);
+void bgCollectionAddH(bgCollectionHandle cln, struct bgDocument *doc);
 
 /******************************************************************************
  * bgCollectionUpload
@@ -105,16 +238,140 @@ void bgCollectionAdd(const char *cln, struct bgDocument *doc);
 void bgCollectionUpload(const char *cln);
 /*void bgCollectionsUpload();*/
 
+/******************************************************************************
+ * bgCollectionBudget / bgBudget
+ *
+ * Limit the documents waiting for upload in a collection, or across all
+ * collections with bgBudget. A limit of 0 means no limit, although a single
+ * collection never holds more than 4096 documents. Bytes are the memory held
+ * by the queued documents. When adding a document would go over a limit, the
+ * collection's policy decides what gives:
+ *
+ *   BG_DROP_NEWEST: the new document is dropped (the default)
+ *   BG_DROP_OLDEST: queued documents are dropped oldest first to make room
+ *   BG_SAMPLE_DOWN: every other queued document is dropped and only one in
+ *     2, 4, 8... new documents is kept until the queue has been uploaded
+ *   BG_SPILL_TO_DISK: the new document is appended to a file in the directory
+ *     given to bgSpillDirectory and uploaded from there later, files left by
+ *     a previous run are picked up when the collection is created
+ *
+ * If the policy can not make room the new document is dropped. Dropped
+ * documents are reported to bgErrorFunc with code -2.
+ *
+ ******************************************************************************/
+#define BG_DROP_NEWEST 0
+#define BG_DROP_OLDEST 1
+#define BG_SAMPLE_DOWN 2
+#define BG_SPILL_TO_DISK 3
+
+void bgCollectionBudget(const char *cln, size_t maxDocuments, size_t maxBytes,
+  int policy);
+void bgCollectionBudgetH(bgCollectionHandle cln, size_t maxDocuments,
+  size_t maxBytes, int policy);
+void bgBudget(size_t maxDocuments, size_t maxBytes);
+void bgSpillDirectory(const char *path);
+
+/******************************************************************************
+ * bgCollectionEager
+ *
+ * Serialize documents as they are added to the collection and release
+ * everything else they held straight away, rather than when the collection
+ * is uploaded. Queued documents then take about the memory of their JSON,
+ * which is also what the budgets count, and the cost of serializing is
+ * spread over the bgCollectionAdd calls instead of landing on the upload.
+ * Off by default.
+ *
+ ******************************************************************************/
+void bgCollectionEager(const char *cln, int enabled);
+void bgCollectionEagerH(bgCollectionHandle cln, int enabled);
+
+/******************************************************************************
+ * bgCollectionCounters
+ *
+ * Running counts of what the budget policies did to a collection, or summed
+ * over all collections if cln is NULL. encodedBytes is an upper bound of the
+ * upload body for the queued documents, kept as they are added rather than
+ * measured.
+ *
+ ******************************************************************************/
+struct bgCounters
+{
+  size_t queuedDocuments;
+  size_t queuedBytes;
+  size_t encodedBytes;
+
+  size_t droppedNewest;
+  size_t droppedOldest;
+  size_t sampledOut;
+  size_t spilled;
+  size_t unspilled;
+};
+
+void bgCollectionCounters(const char *cln, struct bgCounters *counters);
+void bgCollectionCountersH(bgCollectionHandle cln, struct bgCounters *counters);
+
 /******************************************************************************
  * bg*Func
  *
  * Subscribe to actions in order to notify you of when a collection has been
- * uploaded successfully or if an error has occurred.
+ * uploaded successfully or if an error has occurred. The error code is the
+ * HTTP status of a failed upload or one of the following:
+ *
+ *   -1: the collection does not exist or the server could not be reached
+ *   -2: the collection is over its budget and a document was dropped
  *
  ******************************************************************************/
 void bgErrorFunc(void (*errorFunc)(const char *cln, int code));
 void bgSuccessFunc(void (*successFunc)(const char *cln, int count));
 
+/******************************************************************************
+ * bgMemoryStats
+ *
+ * Report the memory used by the SDK. Live bytes are what its objects, queues,
+ * strings and buffers take up, held bytes what it has taken from malloc to
+ * hold them including the unused part of its allocator's pages. The counters
+ * are always maintained and cost a few additions per allocation, so this can
+ * be called periodically in release builds to chart the footprint over a
+ * session. Counts and rates cover the time since the previous call (or
+ * bgAuth), rates are 0 if under a second has passed. The types array stays
+ * valid until the next call.
+ *
+ * Document hits are blocks a document reused after freeing them while it was
+ * built, misses blocks it had to take from its arena. They are only counted
+ * when documents are built as parson trees (BG_DOCUMENT_TREE) and stay 0
+ * otherwise.
+ *
+ ******************************************************************************/
+struct bgMemoryType
+{
+  const char *type;
+  size_t count;
+  size_t bytes;
+};
+
+struct bgMemoryStats
+{
+  size_t liveBytes;
+  size_t liveObjects;
+  size_t peakBytes;
+
+  size_t heldBytes;
+  size_t peakHeldBytes;
+
+  size_t allocs;
+  size_t frees;
+  double allocsPerSecond;
+  double freesPerSecond;
+
+  size_t documentHits;
+  size_t documentMisses;
+
+  size_t typeCount;
+  const struct bgMemoryType *types;
+};
+
+void bgMemoryStats(struct bgMemoryStats *stats);
+
 /******************************************************************************
  * bgCleanup
  *
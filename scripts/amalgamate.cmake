@@ -12,24 +12,40 @@ file(APPEND ${HEADER_OUT} "#define BG_ANALYTICS_AMALGAMATION_H\n")
 file(APPEND ${HEADER_OUT} "#define AMALGAMATION\n")
 cat(include/bg/analytics.h ${HEADER_OUT})
 cat(src/bg/config.h ${HEADER_OUT})
+cat(src/palloc/hash.h ${HEADER_OUT})
 cat(src/palloc/palloc.h ${HEADER_OUT})
+cat(src/palloc/number.h ${HEADER_OUT})
 cat(src/palloc/vector.h ${HEADER_OUT})
+cat(src/palloc/ring.h ${HEADER_OUT})
+cat(src/palloc/intern.h ${HEADER_OUT})
+cat(src/palloc/arena.h ${HEADER_OUT})
 cat(src/palloc/sstream.h ${HEADER_OUT})
 cat(src/http/http.h ${HEADER_OUT})
 cat(src/bg/parson.h ${HEADER_OUT})
+cat(src/bg/Memory.h ${HEADER_OUT})
 cat(src/bg/Collection.h ${HEADER_OUT})
+cat(src/bg/Field.h ${HEADER_OUT})
+cat(src/bg/Schema.h ${HEADER_OUT})
 cat(src/bg/Document.h ${HEADER_OUT})
 cat(src/bg/State.h ${HEADER_OUT})
 file(APPEND ${HEADER_OUT} "#endif\n")
 
 file(REMOVE ${SOURCE_OUT})
 file(APPEND ${SOURCE_OUT} "#include \"bg_analytics.h\"\n")
+cat(src/palloc/hash.c ${SOURCE_OUT})
 cat(src/palloc/palloc.c ${SOURCE_OUT})
+cat(src/palloc/number.c ${SOURCE_OUT})
 cat(src/palloc/vector.c ${SOURCE_OUT})
+cat(src/palloc/ring.c ${SOURCE_OUT})
+cat(src/palloc/intern.c ${SOURCE_OUT})
+cat(src/palloc/arena.c ${SOURCE_OUT})
 cat(src/palloc/sstream.c ${SOURCE_OUT})
 cat(src/http/http.c ${SOURCE_OUT})
 cat(src/bg/Collection.c ${SOURCE_OUT})
+cat(src/bg/Memory.c ${SOURCE_OUT})
 cat(src/bg/Document.c ${SOURCE_OUT})
+cat(src/bg/Field.c ${SOURCE_OUT})
+cat(src/bg/Schema.c ${SOURCE_OUT})
 cat(src/bg/parson.c ${SOURCE_OUT})
 cat(src/bg/State.c ${SOURCE_OUT})
 
@@ -0,0 +1,141 @@
+#ifdef AMALGAMATION_EXAMPLE
+  #include "bg_analytics.h"
+#else
+  #include <palloc/number.h>
+  #include <palloc/sstream.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define SAMPLES 1000000
+
+static double values[SAMPLES];
+static int ints[SAMPLES];
+
+/* Accumulated so the compiler can not drop the formatting calls */
+static size_t sink;
+
+double seconds(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void report(const char *name, double base, double fast)
+{
+  printf("%-10s sprintf: %.3fs  number_format: %.3fs  speedup: %.1fx\n",
+    name, base, fast, base / fast);
+}
+
+void benchDouble()
+{
+  char buf[NUMBER_BUFFER_SIZE] = {0};
+  clock_t start = 0;
+  double base = 0;
+  double fast = 0;
+  size_t i = 0;
+
+  start = clock();
+
+  for(i = 0; i < SAMPLES; i++)
+  {
+    sink += sprintf(buf, "%.17g", values[i]);
+  }
+
+  base = seconds(start);
+  start = clock();
+
+  for(i = 0; i < SAMPLES; i++)
+  {
+    sink += number_format_double(buf, values[i]);
+  }
+
+  fast = seconds(start);
+  report("double", base, fast);
+}
+
+void benchInt()
+{
+  char buf[NUMBER_BUFFER_SIZE] = {0};
+  clock_t start = 0;
+  double base = 0;
+  double fast = 0;
+  size_t i = 0;
+
+  start = clock();
+
+  for(i = 0; i < SAMPLES; i++)
+  {
+    sink += sprintf(buf, "%d", ints[i]);
+  }
+
+  base = seconds(start);
+  start = clock();
+
+  for(i = 0; i < SAMPLES; i++)
+  {
+    sink += number_format_int(buf, ints[i]);
+  }
+
+  fast = seconds(start);
+  report("int", base, fast);
+}
+
+void benchStream()
+{
+  char buf[NUMBER_BUFFER_SIZE] = {0};
+  sstream *ctx = sstream_new();
+  clock_t start = 0;
+  double base = 0;
+  double fast = 0;
+  size_t i = 0;
+
+  start = clock();
+
+  for(i = 0; i < SAMPLES; i++)
+  {
+    sprintf(buf, "%.17g", values[i]);
+    sstream_push_cstr(ctx, buf);
+    sstream_push_char(ctx, ',');
+  }
+
+  base = seconds(start);
+  sink += sstream_length(ctx);
+  sstream_clear(ctx);
+  start = clock();
+
+  for(i = 0; i < SAMPLES; i++)
+  {
+    sstream_push_double(ctx, values[i]);
+    sstream_push_char(ctx, ',');
+  }
+
+  fast = seconds(start);
+  sink += sstream_length(ctx);
+  report("sstream", base, fast);
+
+  sstream_delete(ctx);
+}
+
+int main(void)
+{
+  size_t i = 0;
+
+  srand(1);
+
+  /* Telemetry style values, positions, timings and counters */
+  for(i = 0; i < SAMPLES; i++)
+  {
+    values[i] = (rand() - RAND_MAX / 2) / (double)(1 + rand() % 10000);
+    ints[i] = rand() - RAND_MAX / 2;
+  }
+
+  benchDouble();
+  benchInt();
+  benchStream();
+
+  printf("(%i)\n", (int)(sink & 1));
+
+  return 0;
+}
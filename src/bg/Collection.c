@@ -1,10 +1,14 @@
 #ifndef AMALGAMATION
+  #include "config.h"
   #include "Collection.h"
   #include "Document.h"
+  #include "Schema.h"
   #include "State.h"
   #include "http/http.h"
 
+  #include "palloc/hash.h"
   #include "palloc/palloc.h"
+  #include "palloc/intern.h"
 #endif
 
 #ifdef _WIN32
@@ -13,29 +17,371 @@
   #include <unistd.h>
 #endif
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
+#define BG_INDEX_MIN_CAPACITY 16
+
 void bgUpdate();
 
-void bgCollectionCreate(const char *cln)
+static int bgCollectionMatch(const void *entry, const void *name)
+{
+  return ((const struct bgCollection *)entry)->name == name;
+}
+
+static size_t bgCollectionHash(const void *entry)
+{
+  return hash_pointer(((const struct bgCollection *)entry)->name);
+}
+
+/* Slot holding the collection named name, or the empty one it would go in */
+static struct bgCollection **bgCollectionSlot(const char *name)
+{
+  return (struct bgCollection **)hash_slot(&bg->collectionIndex,
+    hash_pointer(name), name, bgCollectionMatch);
+}
+
+static int bgCollectionIndex(struct bgCollection *c)
+{
+  /* Collections are only removed all at once by bgCleanup, so only growth
+   * needs handling.
+   */
+  size_t capacity = hash_grow(&bg->collectionIndex, BG_INDEX_MIN_CAPACITY);
+
+  if(capacity)
+  {
+    void **slots = (void **)_palloc(capacity * sizeof(void *),
+      "bgCollection index");
+    void **old = NULL;
+
+    if(!slots)
+    {
+      printf("Error: Failed to allocate\n");
+      return 0;
+    }
+
+    old = hash_rehash(&bg->collectionIndex, slots, capacity, bgCollectionHash);
+
+    if(old)
+    {
+      pfree(old);
+    }
+  }
+
+  *bgCollectionSlot(c->name) = c;
+  bg->collectionIndex.count++;
+
+  return 1;
+}
+
+bgCollectionHandle bgCollectionCreate(const char *cln)
 {
-  struct bgCollection* newCln = NULL;
+  struct bgCollection* newCln = bgCollectionGet(cln);
+
+  if(newCln)
+  {
+    printf("Error: Collection already exists\n");
+    return newCln;
+  }
 
   newCln = palloc(struct bgCollection);
 
-  newCln->name = sstream_new();
-  sstream_push_cstr(newCln->name, cln);
+  newCln->name = intern_cstr(cln);
+
+  if(!bgCollectionIndex(newCln))
+  {
+    pfree(newCln);
+    return NULL;
+  }
 
-  newCln->documents = vector_new(struct bgDocument*);
+  newCln->documents = ring_new(struct bgDocument*, BG_QUEUE_CAPACITY);
+  newCln->policy = BG_DROP_NEWEST;
+  newCln->sampleInterval = 1;
   vector_push_back(bg->collections, newCln);
 
+  /* Pick up documents spilled by a previous run */
+  bgCollectionSpillCheck(newCln);
+
   newCln->http = HttpCreate();
   HttpAddCustomHeader(newCln->http, "AuthAccessKey", sstream_cstr(bg->guid));
   HttpAddCustomHeader(newCln->http, "AuthAccessSecret", sstream_cstr(bg->key));
   HttpAddCustomHeader(newCln->http, "Content-Type", "application/json;charset=utf-8");
 
   bgUpdate();
+
+  return newCln;
+}
+
+bgCollectionHandle bgCollectionCreateWithSchema(const char *cln,
+  struct bgSchema *schema)
+{
+  struct bgCollection *col = bgCollectionCreate(cln);
+
+  if(col && !col->columns)
+  {
+    col->columns = bgColumnsCreate(schema);
+  }
+
+  return col;
+}
+
+/* Path of the spill file of c, a spill directory must be set. Anything in the
+ * name but letters, digits, '-' and '_' is written as %XX so the file always
+ * stays in the directory and two names never share it.
+ */
+static void bgCollectionSpillPath(struct bgCollection *c, struct sstream *out)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  const unsigned char *it = NULL;
+
+  sstream_push_cstr(out, sstream_cstr(bg->spillDir));
+  sstream_push_char(out, '/');
+
+  for(it = (const unsigned char *)c->name; *it; it++)
+  {
+    if((*it >= 'a' && *it <= 'z') || (*it >= 'A' && *it <= 'Z') ||
+      (*it >= '0' && *it <= '9') || *it == '-' || *it == '_')
+    {
+      sstream_push_char(out, *it);
+    }
+    else
+    {
+      sstream_push_char(out, '%');
+      sstream_push_char(out, hex[*it >> 4]);
+      sstream_push_char(out, hex[*it & 15]);
+    }
+  }
+
+  sstream_push_cstr(out, ".spill");
+}
+
+void bgCollectionSpillCheck(struct bgCollection *c)
+{
+  sstream *path = NULL;
+  FILE *f = NULL;
+
+  if(!bg->spillDir || c->spillPending)
+  {
+    return;
+  }
+
+  path = sstream_new();
+  bgCollectionSpillPath(c, path);
+  f = fopen(sstream_cstr(path), "rb");
+
+  if(f)
+  {
+    c->spillPending = 1;
+    fclose(f);
+  }
+
+  sstream_delete(path);
+}
+
+/* Appends doc to the spill file as a line of JSON, returns 0 on failure */
+static int bgCollectionSpill(struct bgCollection *c, struct bgDocument *doc)
+{
+  sstream *line = NULL;
+  int rtn = 0;
+
+  if(!bg->spillDir)
+  {
+    return 0;
+  }
+
+  line = sstream_new();
+
+  if(!c->spill)
+  {
+    bgCollectionSpillPath(c, line);
+    c->spill = fopen(sstream_cstr(line), "ab");
+    sstream_clear(line);
+  }
+
+  if(c->spill && bgDocumentSerialize(doc, line))
+  {
+    sstream_push_char(line, '\n');
+
+    rtn = fwrite(sstream_cstr(line), 1, sstream_length(line), c->spill) ==
+      sstream_length(line);
+  }
+
+  sstream_delete(line);
+
+  if(rtn)
+  {
+    c->spillPending = 1;
+    c->counters.spilled++;
+  }
+
+  return rtn;
+}
+
+/* Appends about BG_SPILL_CHUNK bytes of spilled documents to an upload body
+ * holding written documents. Returns the new number of documents written.
+ */
+static size_t bgCollectionUnspill(struct bgCollection *c, struct sstream *ser,
+  size_t written)
+{
+  sstream *path = NULL;
+  sstream *line = NULL;
+  FILE *f = NULL;
+  char buff[256] = {0};
+  size_t consumed = 0;
+
+  if(!c->spillPending)
+  {
+    return written;
+  }
+
+  /* Flushes what has been appended so far */
+  if(c->spill)
+  {
+    fclose(c->spill);
+    c->spill = NULL;
+  }
+
+  path = sstream_new();
+  line = sstream_new();
+  bgCollectionSpillPath(c, path);
+  f = fopen(sstream_cstr(path), "rb");
+
+  if(f && fseek(f, c->spillOffset, SEEK_SET) == 0)
+  {
+    /* The limit is checked between lines, a single line may exceed it */
+    while((consumed < BG_SPILL_CHUNK || sstream_length(line) > 0) &&
+      fgets(buff, sizeof(buff), f))
+    {
+      size_t len = strlen(buff);
+
+      if(len == 0)
+      {
+        break;
+      }
+
+      consumed += len;
+
+      if(buff[len - 1] != '\n')
+      {
+        sstream_push_chars(line, buff, len);
+        continue;
+      }
+
+      sstream_push_chars(line, buff, len - 1);
+
+      if(written > 0)
+      {
+        sstream_push_char(ser, ',');
+      }
+
+      sstream_push_chars(ser, sstream_cstr(line), sstream_length(line));
+      sstream_clear(line);
+      c->spillOffset = ftell(f);
+      c->counters.unspilled++;
+      written++;
+    }
+
+    /* Fully read, a partly written last line is given up */
+    if(!fgets(buff, sizeof(buff), f))
+    {
+      fclose(f);
+      f = NULL;
+      remove(sstream_cstr(path));
+      c->spillOffset = 0;
+      c->spillPending = 0;
+    }
+  }
+  else
+  {
+    c->spillOffset = 0;
+    c->spillPending = 0;
+  }
+
+  if(f)
+  {
+    fclose(f);
+  }
+
+  sstream_delete(line);
+  sstream_delete(path);
+
+  return written;
+}
+
+static int bgCollectionFits(struct bgCollection *c, size_t bytes)
+{
+  size_t maxDocuments = ring_capacity(c->documents);
+
+  if(c->maxDocuments > 0 && c->maxDocuments < maxDocuments)
+  {
+    maxDocuments = c->maxDocuments;
+  }
+
+  /* Rows count as documents */
+  if(c->counters.queuedDocuments + 1 > maxDocuments)
+  {
+    return 0;
+  }
+
+  if(c->maxBytes > 0 && c->counters.queuedBytes + bytes > c->maxBytes)
+  {
+    return 0;
+  }
+
+  if(bg->maxDocuments > 0 && bg->queuedDocuments + 1 > bg->maxDocuments)
+  {
+    return 0;
+  }
+
+  if(bg->maxBytes > 0 && bg->queuedBytes + bytes > bg->maxBytes)
+  {
+    return 0;
+  }
+
+  return 1;
+}
+
+/* Destroys a document that has been taken off the queue */
+static void bgCollectionRelease(struct bgCollection *c, struct bgDocument *doc)
+{
+  size_t bytes = bgDocumentSize(doc);
+
+  c->counters.queuedDocuments--;
+  c->counters.queuedBytes -= bytes;
+  c->counters.encodedBytes -= bgDocumentEncodedSize(doc) + 1;
+  bg->queuedDocuments--;
+  bg->queuedBytes -= bytes;
+
+  bgDocumentDestroy(doc);
+}
+
+/* Drops every other queued document, oldest kept, and halves the rate new
+ * documents are accepted at.
+ */
+static void bgCollectionSampleDown(struct bgCollection *c)
+{
+  struct bgDocument *doc = NULL;
+  size_t count = ring_size(c->documents);
+  size_t i = 0;
+
+  for(i = 0; i < count; i++)
+  {
+    ring_pop(c->documents, doc);
+
+    if(i % 2 == 0)
+    {
+      ring_push(c->documents, doc);
+    }
+    else
+    {
+      bgCollectionRelease(c, doc);
+      c->counters.sampledOut++;
+    }
+  }
+
+  c->sampleInterval *= 2;
+  c->sampleCount = 0;
 }
 
 void bgCollectionAdd(const char *cln, struct bgDocument *doc)
@@ -46,48 +392,294 @@ void bgCollectionAdd(const char *cln, struct bgDocument *doc)
   {
     if(bg->errorFunc != NULL)
     {
-      bg->errorFunc(cln, -1);
+      bg->errorFunc(cln, BG_ERROR_UNKNOWN_COLLECTION);
     }
+
+    bgDocumentDestroy(doc);
+    return;
   }
 
-  vector_push_back(col->documents, doc);
+  bgCollectionAddH(col, doc);
+}
+
+void bgCollectionAddH(bgCollectionHandle col, struct bgDocument *doc)
+{
+  const char *cln = col->name;
+  struct bgDocument *oldest = NULL;
+  size_t bytes = 0;
+
+  if(col->sampleInterval > 1 && col->sampleCount++ % col->sampleInterval != 0)
+  {
+    col->counters.sampledOut++;
+    bgDocumentDestroy(doc);
+    bgUpdate();
+    return;
+  }
+
+  /* A queued template is counted as it is now, it must stay that way */
+  if(doc->isTemplate)
+  {
+    bgDocumentLock(doc);
+  }
+
+  /* Budgets then see the text rather than the document as it was built */
+  if(col->eager)
+  {
+    doc = bgDocumentFreeze(doc, col->scratch);
+  }
+
+  bytes = bgDocumentSize(doc);
+
+  if(!bgCollectionFits(col, bytes))
+  {
+    switch(col->policy)
+    {
+      case BG_DROP_OLDEST:
+        while(!bgCollectionFits(col, bytes) && ring_pop(col->documents, oldest))
+        {
+          bgCollectionRelease(col, oldest);
+          col->counters.droppedOldest++;
+
+          if(bg->errorFunc != NULL)
+          {
+            bg->errorFunc(cln, BG_ERROR_QUEUE_FULL);
+          }
+        }
+        break;
+
+      case BG_SAMPLE_DOWN:
+        bgCollectionSampleDown(col);
+        break;
+
+      case BG_SPILL_TO_DISK:
+        if(bgCollectionSpill(col, doc))
+        {
+          bgDocumentDestroy(doc);
+          bgUpdate();
+          return;
+        }
+        break;
+    }
+  }
+
+  if(!bgCollectionFits(col, bytes) || !ring_push(col->documents, doc))
+  {
+    col->counters.droppedNewest++;
+
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(cln, BG_ERROR_QUEUE_FULL);
+    }
+
+    bgDocumentDestroy(doc);
+    bgUpdate();
+    return;
+  }
+
+  col->counters.queuedDocuments++;
+  col->counters.queuedBytes += bytes;
+  col->counters.encodedBytes += bgDocumentEncodedSize(doc) + 1;
+  bg->queuedDocuments++;
+  bg->queuedBytes += bytes;
+
+  bgUpdate();
+}
+
+/* Adds a row to a collection with a schema */
+static void bgCollectionAddRowV(struct bgCollection *col, va_list values)
+{
+  size_t bytes = 0;
+  size_t encoded = 0;
+
+  if(!bgColumnsAdd(col->columns, values, &bytes, &encoded))
+  {
+    bgUpdate();
+    return;
+  }
+
+  /* Checked once the row is written, its strings are only measured then */
+  col->counters.queuedBytes += bytes;
+  bg->queuedBytes += bytes;
+
+  if(!bgCollectionFits(col, 0))
+  {
+    bgColumnsPop(col->columns, bytes, encoded);
+    col->counters.queuedBytes -= bytes;
+    bg->queuedBytes -= bytes;
+    col->counters.droppedNewest++;
+
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(col->name, BG_ERROR_QUEUE_FULL);
+    }
+
+    bgUpdate();
+    return;
+  }
+
+  col->counters.queuedDocuments++;
+  col->counters.encodedBytes += encoded;
+  bg->queuedDocuments++;
+
   bgUpdate();
 }
 
+void bgCollectionAddRow(const char *cln, ...)
+{
+  struct bgCollection *col = bgCollectionGet(cln);
+  va_list values;
+
+  if(!col || !col->columns)
+  {
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(cln, BG_ERROR_UNKNOWN_COLLECTION);
+    }
+
+    return;
+  }
+
+  va_start(values, cln);
+  bgCollectionAddRowV(col, values);
+  va_end(values);
+}
+
+void bgCollectionAddRowH(bgCollectionHandle col, ...)
+{
+  va_list values;
+
+  if(!col->columns)
+  {
+    if(bg->errorFunc != NULL)
+    {
+      bg->errorFunc(col->name, BG_ERROR_UNKNOWN_COLLECTION);
+    }
+
+    return;
+  }
+
+  va_start(values, col);
+  bgCollectionAddRowV(col, values);
+  va_end(values);
+}
+
+void bgCollectionBudget(const char *cln, size_t maxDocuments, size_t maxBytes,
+  int policy)
+{
+  struct bgCollection *col = bgCollectionGet(cln);
+
+  if(!col)
+  {
+    printf("Error: Collection does not exist\n");
+    return;
+  }
+
+  bgCollectionBudgetH(col, maxDocuments, maxBytes, policy);
+}
+
+void bgCollectionBudgetH(bgCollectionHandle col, size_t maxDocuments,
+  size_t maxBytes, int policy)
+{
+  col->maxDocuments = maxDocuments;
+  col->maxBytes = maxBytes;
+  col->policy = policy;
+}
+
+void bgCollectionEager(const char *cln, int enabled)
+{
+  struct bgCollection *col = bgCollectionGet(cln);
+
+  if(!col)
+  {
+    printf("Error: Collection does not exist\n");
+    return;
+  }
+
+  bgCollectionEagerH(col, enabled);
+}
+
+void bgCollectionEagerH(bgCollectionHandle col, int enabled)
+{
+  col->eager = enabled;
+
+  if(enabled && !col->scratch)
+  {
+    col->scratch = sstream_new();
+  }
+}
+
+void bgCollectionCounters(const char *cln, struct bgCounters *counters)
+{
+  struct bgCollection **it = NULL;
+  struct bgCollection *col = NULL;
+
+  memset(counters, 0, sizeof(*counters));
+
+  if(cln)
+  {
+    col = bgCollectionGet(cln);
+
+    if(col)
+    {
+      *counters = col->counters;
+    }
+
+    return;
+  }
+
+  vector_foreach(it, bg->collections)
+  {
+    counters->queuedDocuments += (*it)->counters.queuedDocuments;
+    counters->queuedBytes += (*it)->counters.queuedBytes;
+    counters->encodedBytes += (*it)->counters.encodedBytes;
+    counters->droppedNewest += (*it)->counters.droppedNewest;
+    counters->droppedOldest += (*it)->counters.droppedOldest;
+    counters->sampledOut += (*it)->counters.sampledOut;
+    counters->spilled += (*it)->counters.spilled;
+    counters->unspilled += (*it)->counters.unspilled;
+  }
+}
+
+void bgCollectionCountersH(bgCollectionHandle col, struct bgCounters *counters)
+{
+  *counters = col->counters;
+}
+
 void bgCollectionUpload(const char *cln)
 {
   /* For Serializing data */
-  sstream *ser = sstream_new();
-  sstream *url = sstream_new();
+  sstream *ser = NULL;
+  sstream *url = NULL;
   struct bgCollection* c = bgCollectionGet(cln);
-  size_t i = 0;
+  size_t count = 0;
   int responseCode = 0;
 
-  sstream_push_cstr(ser, "{\"documents\":[");
-
-  /* Concatenating c_str onto ser - dangerous? */
-  for(i = 0; i < vector_size(c->documents); i++)
+  if(!c)
   {
-    JSON_Value* v = vector_at(c->documents,i)->rootVal;
-    char *serialized = json_serialize_to_string(v);
-
-    sstream_push_cstr(ser, serialized);
-    free(serialized); serialized = NULL;
-
-    if(i < vector_size(c->documents)-1)
+    if(bg->errorFunc != NULL)
     {
-      sstream_push_char(ser, ',');
+      bg->errorFunc(cln, BG_ERROR_UNKNOWN_COLLECTION);
     }
+
+    return;
   }
 
-  sstream_push_cstr(ser, "]}");
+  ser = sstream_new();
+  url = sstream_new();
+
+  count = bgCollectionSerialize(c, ser);
 
   /* Sending request to server */
   sstream_push_cstr(url, sstream_cstr(bg->fullUrl));
-  sstream_push_cstr(url, sstream_cstr(c->name));
+  sstream_push_cstr(url, c->name);
   sstream_push_cstr(url, "/documents");
   HttpRequest(c->http, sstream_cstr(url), sstream_cstr(ser));
 
+  /* The request holds its own copy of the body. Draining now keeps the
+   * budget policies run by callbacks from touching the sent documents.
+   */
+  bgCollectionDrain(c, count);
+
   /* blocking while request pushes through */
   while(!HttpRequestComplete(c->http))
   {
@@ -105,47 +697,146 @@ void bgCollectionUpload(const char *cln)
   {
     if(bg->errorFunc != NULL)
     {
-      bg->errorFunc(sstream_cstr(c->name), responseCode);
+      bg->errorFunc(c->name, responseCode);
     }
   }
   else
   {
     if(bg->successFunc != NULL)
     {
-      bg->successFunc(sstream_cstr(c->name), vector_size(c->documents));
+      bg->successFunc(c->name, count);
     }
   }
 
   /* Cleanup */
   sstream_delete(ser);
   sstream_delete(url);
+}
 
-  for(i = 0; i < vector_size(c->documents); i++)
+/* Appends the upload body of all pending documents to ser. Each document is
+ * serialized straight into the stream rather than through a temporary string.
+ * Returns the number of documents sent, queued, rows and spilled, to be passed
+ * on to bgCollectionDrain once they are no longer needed.
+ */
+size_t bgCollectionSerialize(struct bgCollection *c, struct sstream *ser)
+{
+  size_t count = ring_size(c->documents);
+  size_t written = 0;
+  size_t unspilled = 0;
+  size_t i = 0;
+
+  /* Sized up front, the documents never make the stream grow */
+  sstream_reserve(ser, sstream_length(ser) + c->counters.encodedBytes + 32);
+  sstream_push_cstr(ser, "{\"documents\":[");
+
+  for(i = 0; i < count; i++)
   {
-    bgDocumentDestroy(vector_at(c->documents, i));
+    size_t length = sstream_length(ser);
+
+    if(written > 0)
+    {
+      sstream_push_char(ser, ',');
+    }
+
+    if(bgDocumentSerialize(ring_at(c->documents, i), ser))
+    {
+      written++;
+    }
+    else
+    {
+      /* Take the separator back */
+      sstream_truncate(ser, length);
+    }
+  }
+
+  if(c->columns)
+  {
+    written = bgColumnsSerialize(c->columns, ser, written);
+    count += c->columns->rows;
   }
 
-  /* Clearing vector for later use */
-  vector_clear(c->documents);
+  /* Spilled documents ride along, they are already serialized */
+  unspilled = bgCollectionUnspill(c, ser, written) - written;
+  count += unspilled;
+
+  sstream_push_cstr(ser, "]}");
+
+  return count;
 }
 
-/* Destroys collection and containing documents w/o upload */
-void bgCollectionDestroy(struct bgCollection *cln)
+/* Destroys the count oldest documents and removes them from the queue. Each
+ * document is released as a whole, its values are never walked. A count past
+ * the queued documents covers the rows, anything beyond that was read back
+ * from the spill file and is already gone.
+ */
+void bgCollectionDrain(struct bgCollection *c, size_t count)
 {
-  /* Document destruction is Possibly complex */
-  size_t i = 0;
+  struct bgDocument *batch[64] = {0};
+  size_t documents = ring_size(c->documents);
 
-  if(cln->documents != NULL)
+  /* Rows follow the documents and are always serialized together */
+  if(count > documents && c->columns)
+  {
+    c->counters.queuedDocuments -= c->columns->rows;
+    c->counters.queuedBytes -= c->columns->bytes;
+    c->counters.encodedBytes -= c->columns->encoded;
+    bg->queuedDocuments -= c->columns->rows;
+    bg->queuedBytes -= c->columns->bytes;
+    bgColumnsClear(c->columns);
+  }
+
+  if(count > documents)
   {
-    for(i = 0; i < vector_size(cln->documents); i++)
+    count = documents;
+  }
+
+  while(count > 0)
+  {
+    size_t n = ring_peek_batch(c->documents, batch,
+      count < 64 ? count : 64);
+    size_t i = 0;
+
+    for(i = 0; i < n; i++)
     {
-      bgDocumentDestroy(vector_at(cln->documents, i));
+      bgCollectionRelease(c, batch[i]);
     }
 
-    vector_delete(cln->documents);
+    ring_discard(c->documents, n);
+    count -= n;
+  }
+
+  /* The queue has been uploaded, stop sampling */
+  c->sampleInterval = 1;
+  c->sampleCount = 0;
+}
+
+/* Destroys collection and containing documents w/o upload, spilled documents
+ * stay on disk for the next run.
+ */
+void bgCollectionDestroy(struct bgCollection *cln)
+{
+  if(cln->documents != NULL)
+  {
+    bgCollectionDrain(cln, ring_size(cln->documents) +
+      (cln->columns ? cln->columns->rows : 0));
+    ring_delete(cln->documents);
+  }
+
+  if(cln->columns)
+  {
+    bgColumnsDestroy(cln->columns);
+  }
+
+  if(cln->scratch)
+  {
+    sstream_delete(cln->scratch);
+  }
+
+  if(cln->spill)
+  {
+    fclose(cln->spill);
   }
 
-  sstream_delete(cln->name);
   HttpDestroy(cln->http);
 
   pfree(cln);
@@ -156,23 +847,16 @@ void bgCollectionDestroy(struct bgCollection *cln)
  */
 struct bgCollection *bgCollectionGet(const char *cln)
 {
-  /*
-   * TODO - Change to comparing char* directly
-   *  then fall back onto strcmp if failure
-   *
-   *  Although, would this still work as name
-   *  is a sstream?
+  /* Names are interned so the index is keyed by pointer. A name that was
+   * never interned can not be a collection.
    */
-  size_t i = 0;
+  const char *name = intern_find(cln);
 
-  for(i = 0; i < vector_size(bg->collections); i++)
+  if(!name || bg->collectionIndex.count == 0)
   {
-    if(strcmp(cln, sstream_cstr(vector_at(bg->collections, i)->name)) == 0)
-    {
-      return vector_at(bg->collections, i);
-    }
+    return NULL;
   }
 
-  return NULL;
+  return *bgCollectionSlot(name);
 }
 
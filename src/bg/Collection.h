@@ -2,24 +2,57 @@
 #define BG_COLLECTION_H
 
 #ifndef AMALGAMATION
+  #include <bg/analytics.h>
   #include "palloc/vector.h"
+  #include "palloc/ring.h"
   #include "palloc/sstream.h"
 #endif
 
+#include <stdio.h>
+
 struct bgDocument;
+struct bgColumns;
 struct StringStream;
 struct Http;
 
 struct bgCollection
 {
-  struct sstream *name;
-  vector(struct bgDocument *) *documents;
+  /* Interned, collections can be compared by pointer */
+  const char *name;
+  ring(struct bgDocument *) *documents;
   int lastDocumentCount;
 
+  /* Documents are frozen as they are added, scratch is only there when
+   * eager is set.
+   */
+  int eager;
+  struct sstream *scratch;
+
+  /* Rows of a collection created with a schema, NULL otherwise */
+  struct bgColumns *columns;
+
+  /* Budget, a limit of 0 is unlimited */
+  size_t maxDocuments;
+  size_t maxBytes;
+  int policy;
+  struct bgCounters counters;
+
+  /* BG_SAMPLE_DOWN keeps one in sampleInterval new documents */
+  size_t sampleInterval;
+  size_t sampleCount;
+
+  /* BG_SPILL_TO_DISK, the file is read back from spillOffset */
+  FILE *spill;
+  long spillOffset;
+  int spillPending;
+
   struct Http *http;
 };
 
 void bgCollectionDestroy(struct bgCollection *cln);
+size_t bgCollectionSerialize(struct bgCollection *c, struct sstream *ser);
+void bgCollectionDrain(struct bgCollection *c, size_t count);
+void bgCollectionSpillCheck(struct bgCollection *c);
 struct bgCollection *bgCollectionGet(const char* cln);
 
 #endif
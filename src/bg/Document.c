@@ -1,81 +1,335 @@
 #ifndef AMALGAMATION
+  #include "config.h"
   #include "Document.h"
+  #include "Field.h"
   #include "State.h"
+  #include "Memory.h"
   #include "parson.h"
 
+  #include <bg/analytics.h>
+  #include <palloc/arena.h>
+  #include <palloc/intern.h>
+  #include <palloc/number.h>
   #include <palloc/palloc.h>
   #include <palloc/sstream.h>
 #endif
 
+#include <stdio.h>
+#include <string.h>
+
 void bgUpdate();
 
+/* Splits path into interned keys, returns how many or 0 if it is too deep.
+ * Keys of the leading segments path has in common with prev are taken from
+ * keys as left by splitting prev, so a run of paths under the same object
+ * interns the object's key once. shared receives how many were reused.
+ */
+static size_t bgDocumentKeys(const char *path, const char *prev,
+  const char **keys, size_t *shared)
+{
+  struct sstrview rest = {0};
+  struct sstrview key = {0};
+  size_t rtn = 0;
+  size_t from = 0;
+  size_t i = 0;
+
+  for(i = 0; prev && path[i] && path[i] == prev[i]; i++)
+  {
+    if(path[i] == '.')
+    {
+      rtn++;
+      from = i + 1;
+    }
+  }
+
+  if(shared)
+  {
+    *shared = rtn;
+  }
+
+  rest = sstrview_cstr(path + from);
+
+  while(sstrview_next(&rest, '.', &key))
+  {
+    if(rtn == BG_PATH_MAX_DEPTH)
+    {
+      printf("Error: Path is too deep\n");
+      return 0;
+    }
+
+    keys[rtn++] = intern_chars(key.s, key.len);
+  }
+
+  /* An empty path is a single empty key, a trailing dot ends in one as it
+   * does with parson's dotted setters.
+   */
+  if(rtn == 0 || path[strlen(path) - 1] == '.')
+  {
+    if(rtn == BG_PATH_MAX_DEPTH)
+    {
+      printf("Error: Path is too deep\n");
+      return 0;
+    }
+
+    keys[rtn++] = intern_chars(path, 0);
+  }
+
+  return rtn;
+}
+
+int bgDocumentWriteString(struct sstream *out, const char *s)
+{
+  size_t size = json_string_serialization_size(s);
+  struct sstream_builder b = {0};
+
+  if(size == 0)
+  {
+    return 0;
+  }
+
+  b = sstream_builder_begin(out, size);
+  json_serialize_string_to_buffer(s, b.tail, b.remaining);
+  sstream_builder_commit(&b, size - 1);
+
+  return 1;
+}
+
+#ifdef BG_DOCUMENT_TREE
 struct bgDocument *bgDocumentCreate()
 {
+  struct bgMemory memory = {0};
   struct bgDocument *rtn = NULL;
 
-  rtn = palloc(struct bgDocument);
+  /* The document lives in its own arena alongside its values */
+  rtn = (struct bgDocument *)arena_alloc(&memory.arena, sizeof(struct bgDocument));
+
+  if(!rtn)
+  {
+    return NULL;
+  }
+
+  rtn->memory = memory;
+  rtn->rootArr = NULL;
+  rtn->isTemplate = 0;
+  rtn->locked = 0;
+  rtn->text = NULL;
+  rtn->textLength = 0;
 
+  bgMemoryBegin(&rtn->memory);
   rtn->rootVal = json_value_init_object();
   rtn->rootObj = json_value_get_object(rtn->rootVal);
   //rtn->rootArr = json_value_get_array(rtn->rootVal);
+  bgMemoryEnd();
 
   return rtn;
 }
 
 void bgDocumentDestroy(struct bgDocument *doc)
 {
-  /*unwinds json_val list structure and frees memory*/
-  json_value_free(doc->rootVal);
+  /* The arena is stored in memory it owns */
+  struct arena arena = doc->memory.arena;
 
-  pfree(doc);
+  if(doc->isTemplate)
+  {
+    return;
+  }
+
+  if(doc->text)
+  {
+    pfree(doc);
+    return;
+  }
+
+  arena_reset(&arena);
 }
 
-void bgDocumentAddCStr(struct bgDocument *doc, const char *path, const char *val)
+struct bgDocument *bgDocumentTemplateCreate()
 {
-  sstream* ctx = sstream_new();
-  vector(sstream *) *out = vector_new(sstream *);
+  struct bgDocument *rtn = bgDocumentCreate();
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
+  rtn->isTemplate = 1;
+  vector_push_back(bg->templates, rtn);
 
-  if(vector_size(out) == 0)
+  return rtn;
+}
+
+void bgDocumentLock(struct bgDocument *tmpl)
+{
+  tmpl->locked = 1;
+}
+
+/* Setters refuse a template once it has been used */
+static int bgDocumentLocked(struct bgDocument *doc)
+{
+  if(doc->locked)
   {
-    json_object_set_string(doc->rootObj, path, val);
+    printf("Error: Template has already been used\n");
+    return 1;
   }
-  else
+
+  return 0;
+}
+
+/* Trees can not share values, the template is copied */
+struct bgDocument *bgDocumentCreateFromTemplate(struct bgDocument *tmpl)
+{
+  struct bgDocument *rtn = NULL;
+
+  if(!tmpl->isTemplate)
   {
-    json_object_dotset_string(doc->rootObj, path, val);
+    printf("Error: Document is not a template\n");
+    return NULL;
   }
 
-  
-  if(vector_size(out) > 0)
+  bgDocumentLock(tmpl);
+
+  rtn = bgDocumentCreate();
+  bgMemoryBegin(&rtn->memory);
+  json_value_free(rtn->rootVal);
+  rtn->rootVal = json_value_deep_copy(tmpl->rootVal);
+  rtn->rootObj = json_value_get_object(rtn->rootVal);
+  bgMemoryEnd();
+
+  return rtn;
+}
+
+void bgDocumentTemplateDestroy(struct bgDocument *tmpl)
+{
+  tmpl->isTemplate = 0;
+  bgDocumentDestroy(tmpl);
+}
+
+size_t bgDocumentSize(struct bgDocument *doc)
+{
+  if(doc->text)
   {
-    size_t i = 0;
+    return sizeof(*doc) + doc->textLength + 1;
+  }
 
-    for(i = 0; i < vector_size(out); i++)
-    {
-      if(vector_at(out, i))
-      {
-        sstream_delete(vector_at(out, i));
-      }
-    }
+  return doc->memory.arena.size;
+}
+
+/* parson keeps no running size, this is a dry run */
+size_t bgDocumentEncodedSize(struct bgDocument *doc)
+{
+  size_t size = 0;
+
+  if(doc->text)
+  {
+    return doc->textLength;
+  }
+
+  size = json_serialization_size(doc->rootVal);
+
+  return size > 0 ? size - 1 : 0;
+}
+
+int bgDocumentSerialize(struct bgDocument *doc, struct sstream *out)
+{
+  size_t size = 0;
+  struct sstream_builder b = {0};
+
+  if(doc->text)
+  {
+    sstream_push_chars(out, doc->text, doc->textLength);
+    return 1;
+  }
+
+  size = json_serialization_size(doc->rootVal);
+
+  if(size == 0)
+  {
+    return 0;
+  }
+
+  /* size includes the null terminator written by parson */
+  b = sstream_builder_begin(out, size);
+  json_serialize_to_buffer(doc->rootVal, b.tail, b.remaining);
+  sstream_builder_commit(&b, size - 1);
+
+  return 1;
+}
+
+struct bgDocument *bgDocumentFreeze(struct bgDocument *doc,
+  struct sstream *scratch)
+{
+  struct bgDocument *rtn = NULL;
+  size_t length = 0;
+
+  if(doc->isTemplate || doc->text)
+  {
+    return doc;
+  }
+
+  sstream_clear(scratch);
+
+  if(!bgDocumentSerialize(doc, scratch))
+  {
+    return doc;
+  }
+
+  /* Arena blocks would be mostly empty, the text sits right behind the
+   * document in a single allocation instead.
+   */
+  length = sstream_length(scratch);
+  rtn = (struct bgDocument *)_palloc(sizeof(struct bgDocument) + length + 1,
+    "struct bgDocument");
+
+  if(!rtn)
+  {
+    printf("Error: Failed to allocate\n");
+    return doc;
+  }
+
+  rtn->text = (char *)(rtn + 1);
+  rtn->textLength = length;
+  memcpy(rtn->text, sstream_cstr(scratch), length + 1);
+
+  bgDocumentDestroy(doc);
+
+  return rtn;
+}
+
+/* Number of segments in a dotted path, an empty path has none and is set
+ * directly rather than through the dotted setters.
+ */
+static size_t bgDocumentPathDepth(const char *path)
+{
+  return sstrview_split(sstrview_cstr(path), '.', NULL, 0);
+}
+
+void bgDocumentAddCStr(struct bgDocument *doc, const char *path, const char *val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+
+  if(bgDocumentPathDepth(path) == 0)
+  {
+    json_object_set_string(doc->rootObj, path, val);
+  }
+  else
+  {
+    json_object_dotset_string(doc->rootObj, path, val);
   }
 
-  vector_delete(out);
+  bgMemoryEnd();
   bgUpdate();
 }
 
 void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val)
 {
-  sstream* ctx = sstream_new();
-  vector(sstream *) *out = vector_new(sstream *);
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
-  
-  if(vector_size(out) == 0)
+  if(bgDocumentPathDepth(path) == 0)
   {
     json_object_set_number(doc->rootObj, path, val);
   }
@@ -83,68 +337,43 @@ void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val)
   {
     json_object_dotset_number(doc->rootObj, path, val);
   }
-  
-  if(vector_size(out) > 0)
-  {
-    size_t i = 0;
-
-    for(i = 0; i < vector_size(out); i++)
-    {
-      if(vector_at(out, i))
-      {
-        sstream_delete(vector_at(out, i));
-      }
-    }
-  }
 
-  vector_delete(out);
+  bgMemoryEnd();
   bgUpdate();
 }
 
 void bgDocumentAddDouble(struct bgDocument *doc, const char *path, double val)
 {
-  sstream* ctx = sstream_new();
-  size_t i = 0;
-  vector(sstream *) *out = vector_new(sstream *);
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
+  bgMemoryBegin(&doc->memory);
 
-  if(vector_size(out) == 0)
+  if(bgDocumentPathDepth(path) == 0)
   {
     json_object_set_number(doc->rootObj, path, val);
   }
   else
   {
     json_object_dotset_number(doc->rootObj, path, val);
-  }  
-  
-  if(vector_size(out) > 0)
-  {
-    for(i = 0; i < vector_size(out); i++)
-    {
-      if(vector_at(out, i))
-      {
-        sstream_delete(vector_at(out, i));
-      }
-    }
   }
 
-  vector_delete(out);
+  bgMemoryEnd();
   bgUpdate();
 }
 
 void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
 {
-  sstream* ctx = sstream_new();
-  vector(sstream *) *out = vector_new(sstream *);
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
 
-  sstream_push_cstr(ctx, path);
-  sstream_split(ctx, '.', out);
-  sstream_delete(ctx);
-  
-  if(vector_size(out) == 0)
+  if(bgDocumentPathDepth(path) == 0)
   {
     json_object_set_boolean(doc->rootObj, path, val);
   }
@@ -152,21 +381,844 @@ void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
   {
     json_object_dotset_boolean(doc->rootObj, path, val);
   }
-  
-  if(vector_size(out) > 0)
+
+  bgMemoryEnd();
+  bgUpdate();
+}
+
+void bgDocumentAddMany(struct bgDocument *doc, const struct bgValue *values,
+  size_t count)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+  const char *prev = NULL;
+  JSON_Object *parent = NULL;
+  JSON_Value *val = NULL;
+  size_t prevDepth = 0;
+  size_t depth = 0;
+  size_t shared = 0;
+  size_t i = 0;
+  size_t k = 0;
+
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+
+  for(i = 0; i < count; i++)
   {
-    size_t i = 0;
+    depth = bgDocumentKeys(values[i].path, prev, keys, &shared);
+    prev = depth > 0 ? values[i].path : NULL;
+
+    switch(values[i].type)
+    {
+      case BG_TYPE_CSTR:
+        val = json_value_init_string(values[i].cstr);
+        break;
+
+      case BG_TYPE_INT:
+        val = json_value_init_number((int)values[i].number);
+        break;
+
+      case BG_TYPE_DOUBLE:
+        val = json_value_init_number(values[i].number);
+        break;
+
+      case BG_TYPE_BOOL:
+        val = json_value_init_boolean(values[i].number != 0);
+        break;
+
+      default:
+        printf("Error: Unknown field type\n");
+        val = NULL;
+    }
+
+    if(depth == 0 || !val)
+    {
+      json_value_free(val);
+      parent = NULL;
+      continue;
+    }
 
-    for(i = 0; i < vector_size(out); i++)
+    /* A sibling of the previous value goes straight into the same object */
+    if(parent && depth == prevDepth && shared + 1 >= depth)
     {
-      if(vector_at(out, i))
+      if(json_object_keyset_value(parent, keys + depth - 1, 1, val) ==
+        JSONFailure)
       {
-        sstream_delete(vector_at(out, i));
+        json_value_free(val);
       }
+
+      continue;
+    }
+
+    if(json_object_keyset_value(doc->rootObj, keys, depth, val) == JSONFailure)
+    {
+      json_value_free(val);
+      parent = NULL;
+      continue;
+    }
+
+    parent = doc->rootObj;
+    prevDepth = depth;
+
+    for(k = 0; parent && k + 1 < depth; k++)
+    {
+      parent = json_object_get_object(parent, keys[k]);
     }
   }
 
-  vector_delete(out);
+  bgMemoryEnd();
+  bgUpdate();
+}
+
+/* Takes ownership of val */
+static void bgDocumentSetField(struct bgDocument *doc, struct bgField *field,
+  JSON_Value *val)
+{
+  if(json_object_keyset_value(doc->rootObj, field->keys, field->depth, val)
+    == JSONFailure)
+  {
+    json_value_free(val);
+  }
+}
+
+void bgDocumentSetCStrByField(struct bgDocument *doc, struct bgField *field,
+  const char *val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_string(val));
+  bgMemoryEnd();
+
+  bgUpdate();
+}
+
+void bgDocumentSetIntByField(struct bgDocument *doc, struct bgField *field,
+  int val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_number(val));
+  bgMemoryEnd();
+
+  bgUpdate();
+}
+
+void bgDocumentSetDoubleByField(struct bgDocument *doc, struct bgField *field,
+  double val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_number(val));
+  bgMemoryEnd();
+
+  bgUpdate();
+}
+
+void bgDocumentSetBoolByField(struct bgDocument *doc, struct bgField *field,
+  int val)
+{
+  if(bgDocumentLocked(doc))
+  {
+    return;
+  }
+
+  bgMemoryBegin(&doc->memory);
+  bgDocumentSetField(doc, field, json_value_init_boolean(val));
+  bgMemoryEnd();
+
   bgUpdate();
 }
+#else
+/*
+ * A document is a buffer of records, one per value set. Each record is
+ * followed by the interned keys of its path and the value already in its JSON
+ * form. Setting a path again, or a parent of it, marks the older records dead
+ * so the live records always describe a tree; setting a path below a value
+ * fails like it does in parson. Serializing groups the live records by their
+ * keys, members appear in the order they were first set.
+ */
+struct bgRecord
+{
+  size_t size;
+  size_t valueLength;
+  unsigned short depth;
+  unsigned char dead;
+  unsigned char visited;
+};
+
+union bgRecordAlign
+{
+  size_t s;
+  void *p;
+};
+
+#define BG_RECORD_ALIGN(S) \
+  (((S) + sizeof(union bgRecordAlign) - 1) & ~(sizeof(union bgRecordAlign) - 1))
+
+#define BG_RECORD_KEYS(R) \
+  ((const char **)((R) + 1))
+
+#define BG_RECORD_VALUE(R) \
+  ((char *)(BG_RECORD_KEYS(R) + (R)->depth))
+
+#define BG_DOCUMENT_MIN_CAPACITY 128
+
+/* Typical record with a two key path and a short value */
+#define BG_RECORD_ESTIMATE \
+  (sizeof(struct bgRecord) + 2 * sizeof(const char *) + 16)
+
+struct bgDocument *bgDocumentCreate()
+{
+  /* Records are allocated by the first setter */
+  return palloc(struct bgDocument);
+}
+
+void bgDocumentDestroy(struct bgDocument *doc)
+{
+  if(doc->isTemplate)
+  {
+    return;
+  }
+
+  if(doc->records)
+  {
+    pfree(doc->records);
+  }
+
+  if(doc->text)
+  {
+    pfree(doc->text);
+  }
+
+  pfree(doc);
+}
 
+struct bgDocument *bgDocumentTemplateCreate()
+{
+  struct bgDocument *rtn = bgDocumentCreate();
+
+  rtn->isTemplate = 1;
+  vector_push_back(bg->templates, rtn);
+
+  return rtn;
+}
+
+void bgDocumentTemplateDestroy(struct bgDocument *tmpl)
+{
+  if(tmpl->shared)
+  {
+    sstream_delete(tmpl->shared);
+  }
+
+  tmpl->isTemplate = 0;
+  bgDocumentDestroy(tmpl);
+}
+
+size_t bgDocumentSize(struct bgDocument *doc)
+{
+  if(doc->text)
+  {
+    return sizeof(*doc) + doc->textLength + 1;
+  }
+
+  return sizeof(*doc) + doc->capacity;
+}
+
+size_t bgDocumentEncodedSize(struct bgDocument *doc)
+{
+  if(doc->text)
+  {
+    return doc->textLength;
+  }
+
+  /* Records count a comma each, one more than needed. The shared text has
+   * the opening brace.
+   */
+  if(doc->base)
+  {
+    return sstream_length(doc->base->shared) + doc->encoded + 1;
+  }
+
+  return doc->encoded + 2;
+}
+
+/* Makes sure size more bytes fit, growing the records geometrically */
+static int bgDocumentReserve(struct bgDocument *doc, size_t size)
+{
+  size_t capacity = doc->capacity * 2;
+  char *records = NULL;
+
+  if(doc->capacity - doc->length >= size)
+  {
+    return 1;
+  }
+
+  if(capacity < BG_DOCUMENT_MIN_CAPACITY)
+  {
+    capacity = BG_DOCUMENT_MIN_CAPACITY;
+  }
+
+  while(capacity - doc->length < size)
+  {
+    capacity *= 2;
+  }
+
+  records = (char *)_palloc_uninit(capacity, "struct bgRecord");
+
+  if(!records)
+  {
+    printf("Error: Failed to allocate\n");
+    return 0;
+  }
+
+  if(doc->records)
+  {
+    memcpy(records, doc->records, doc->length);
+    pfree(doc->records);
+  }
+
+  doc->records = records;
+  doc->capacity = capacity;
+
+  return 1;
+}
+
+/* Appends size bytes to the records */
+static char *bgDocumentGrow(struct bgDocument *doc, size_t size)
+{
+  char *rtn = NULL;
+
+  if(!bgDocumentReserve(doc, size))
+  {
+    return NULL;
+  }
+
+  rtn = doc->records + doc->length;
+  doc->length += size;
+
+  return rtn;
+}
+
+static int bgRecordPrefix(struct bgRecord *rec, const char * const *keys,
+  size_t count)
+{
+  const char **recKeys = BG_RECORD_KEYS(rec);
+  size_t i = 0;
+
+  for(i = 0; i < count; i++)
+  {
+    if(recKeys[i] != keys[i])
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Bytes the record adds to the serialized document. Parent objects are
+ * counted for every record under them, so this overestimates documents with
+ * nested members.
+ */
+static size_t bgRecordEncoded(struct bgRecord *rec)
+{
+  const char **keys = BG_RECORD_KEYS(rec);
+  size_t rtn = rec->valueLength + 1;
+  size_t i = 0;
+
+  /* Quotes and colon per key, braces per parent */
+  for(i = 0; i < rec->depth; i++)
+  {
+    rtn += strlen(keys[i]) + 3;
+  }
+
+  return rtn + 2 * (rec->depth - 1);
+}
+
+/* Takes a copy of the template's records, ahead of the document's own, so
+ * members shared with the template can be changed.
+ */
+static int bgDocumentUnshare(struct bgDocument *doc)
+{
+  struct bgDocument *base = doc->base;
+  char *records = doc->records;
+  size_t length = doc->length;
+  char *dst = NULL;
+
+  doc->records = NULL;
+  doc->length = 0;
+  doc->capacity = 0;
+  dst = bgDocumentGrow(doc, base->length + length);
+
+  if(!dst)
+  {
+    doc->records = records;
+    doc->length = length;
+    return 0;
+  }
+
+  if(base->length > 0)
+  {
+    memcpy(dst, base->records, base->length);
+  }
+
+  if(records)
+  {
+    memcpy(dst + base->length, records, length);
+    pfree(records);
+  }
+
+  doc->encoded += base->encoded;
+  doc->base = NULL;
+
+  return 1;
+}
+
+/* Whether the template has a member named key */
+static int bgDocumentShares(struct bgDocument *base, const char *key)
+{
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
+
+  for(offset = 0; offset < base->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(base->records + offset);
+
+    if(!rec->dead && BG_RECORD_KEYS(rec)[0] == key)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Makes room for a value of valueLength bytes, plus a null terminator, at
+ * the path keys. Returns NULL if the path can not be set.
+ */
+static char *bgDocumentRecord(struct bgDocument *doc, const char * const *keys,
+  size_t depth, size_t valueLength)
+{
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
+  size_t size = 0;
+
+  if(depth == 0)
+  {
+    return NULL;
+  }
+
+  if(doc->shared)
+  {
+    printf("Error: Template has already been used\n");
+    return NULL;
+  }
+
+  if(doc->base && bgDocumentShares(doc->base, keys[0]) &&
+    !bgDocumentUnshare(doc))
+  {
+    return NULL;
+  }
+
+  /* Nothing can be set below a value */
+  for(offset = 0; offset < doc->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(doc->records + offset);
+
+    if(!rec->dead && rec->depth < depth && bgRecordPrefix(rec, keys, rec->depth))
+    {
+      return NULL;
+    }
+  }
+
+  /* Replace the path and anything below it, a value of the same path is
+   * overwritten in place if it fits.
+   */
+  for(offset = 0; offset < doc->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(doc->records + offset);
+
+    if(rec->dead || rec->depth < depth || !bgRecordPrefix(rec, keys, depth))
+    {
+      continue;
+    }
+
+    if(rec->depth == depth && BG_RECORD_VALUE(rec) + valueLength <
+      (char *)rec + rec->size)
+    {
+      doc->encoded += valueLength;
+      doc->encoded -= rec->valueLength;
+      rec->valueLength = valueLength;
+
+      return BG_RECORD_VALUE(rec);
+    }
+
+    rec->dead = 1;
+    doc->encoded -= bgRecordEncoded(rec);
+  }
+
+  size = BG_RECORD_ALIGN(sizeof(*rec) + depth * sizeof(const char *) +
+    valueLength + 1);
+  rec = (struct bgRecord *)bgDocumentGrow(doc, size);
+
+  if(!rec)
+  {
+    return NULL;
+  }
+
+  rec->size = size;
+  rec->valueLength = valueLength;
+  rec->depth = (unsigned short)depth;
+  rec->dead = 0;
+  rec->visited = 0;
+  memcpy(BG_RECORD_KEYS(rec), keys, depth * sizeof(const char *));
+  doc->encoded += bgRecordEncoded(rec);
+
+  return BG_RECORD_VALUE(rec);
+}
+
+static void bgDocumentPutCStr(struct bgDocument *doc, const char * const *keys,
+  size_t depth, const char *val)
+{
+  /* Invalid strings are refused, as parson does */
+  size_t size = json_string_serialization_size(val);
+  char *value = NULL;
+
+  if(size == 0)
+  {
+    return;
+  }
+
+  value = bgDocumentRecord(doc, keys, depth, size - 1);
+
+  if(value)
+  {
+    json_serialize_string_to_buffer(val, value, size);
+  }
+}
+
+static void bgDocumentPutNumber(struct bgDocument *doc,
+  const char * const *keys, size_t depth, double val)
+{
+  char buff[NUMBER_BUFFER_SIZE] = {0};
+  size_t len = 0;
+  char *value = NULL;
+
+  /* Same form as parson gives numbers */
+  len = number_format_json(buff, val);
+
+  value = bgDocumentRecord(doc, keys, depth, len);
+
+  if(value)
+  {
+    memcpy(value, buff, len + 1);
+  }
+}
+
+static void bgDocumentPutBool(struct bgDocument *doc, const char * const *keys,
+  size_t depth, int val)
+{
+  const char *literal = val ? "true" : "false";
+  size_t len = strlen(literal);
+  char *value = bgDocumentRecord(doc, keys, depth, len);
+
+  if(value)
+  {
+    memcpy(value, literal, len + 1);
+  }
+}
+
+static void bgDocumentWriteObject(struct bgDocument *doc, struct sstream *out,
+  size_t from, size_t depth);
+
+/* Writes the members whose paths start with the first depth keys of the
+ * record at from, separated by commas and with one in front unless first is
+ * set. Every record written is marked visited so later records of an object
+ * already written are skipped.
+ */
+static void bgDocumentWriteMembers(struct bgDocument *doc, struct sstream *out,
+  size_t from, size_t depth, int first)
+{
+  const char **prefix = NULL;
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
+
+  if(depth > 0)
+  {
+    prefix = BG_RECORD_KEYS((struct bgRecord *)(doc->records + from));
+  }
+
+  for(offset = from; offset < doc->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(doc->records + offset);
+
+    if(rec->dead || rec->visited || !bgRecordPrefix(rec, prefix, depth))
+    {
+      continue;
+    }
+
+    if(!first)
+    {
+      sstream_push_char(out, ',');
+    }
+
+    first = 0;
+    if(!bgDocumentWriteString(out, BG_RECORD_KEYS(rec)[depth]))
+    {
+      sstream_push_cstr(out, "\"\"");
+    }
+    sstream_push_char(out, ':');
+
+    if(rec->depth == depth + 1)
+    {
+      sstream_push_chars(out, BG_RECORD_VALUE(rec), rec->valueLength);
+      rec->visited = 1;
+    }
+    else
+    {
+      bgDocumentWriteObject(doc, out, offset, depth + 1);
+    }
+  }
+}
+
+static void bgDocumentWriteObject(struct bgDocument *doc, struct sstream *out,
+  size_t from, size_t depth)
+{
+  sstream_push_char(out, '{');
+  bgDocumentWriteMembers(doc, out, from, depth, 1);
+  sstream_push_char(out, '}');
+}
+
+static void bgDocumentClearVisited(struct bgDocument *doc)
+{
+  struct bgRecord *rec = NULL;
+  size_t offset = 0;
+
+  for(offset = 0; offset < doc->length; offset += rec->size)
+  {
+    rec = (struct bgRecord *)(doc->records + offset);
+    rec->visited = 0;
+  }
+}
+
+int bgDocumentSerialize(struct bgDocument *doc, struct sstream *out)
+{
+  struct sstream *shared = NULL;
+
+  if(doc->text)
+  {
+    sstream_push_chars(out, doc->text, doc->textLength);
+    return 1;
+  }
+
+  if(doc->base)
+  {
+    /* The template's members go out as they are, opening brace included */
+    shared = doc->base->shared;
+    sstream_push_chars(out, sstream_cstr(shared), sstream_length(shared));
+    bgDocumentWriteMembers(doc, out, 0, 0, sstream_length(shared) == 1);
+    sstream_push_char(out, '}');
+  }
+  else
+  {
+    bgDocumentWriteObject(doc, out, 0, 0);
+  }
+
+  bgDocumentClearVisited(doc);
+
+  return 1;
+}
+
+struct bgDocument *bgDocumentFreeze(struct bgDocument *doc,
+  struct sstream *scratch)
+{
+  size_t length = 0;
+  char *text = NULL;
+
+  if(doc->isTemplate || doc->text)
+  {
+    return doc;
+  }
+
+  sstream_clear(scratch);
+  bgDocumentSerialize(doc, scratch);
+  length = sstream_length(scratch);
+  text = (char *)_palloc_uninit(length + 1, "bgDocument text");
+
+  if(!text)
+  {
+    printf("Error: Failed to allocate\n");
+    return doc;
+  }
+
+  memcpy(text, sstream_cstr(scratch), length + 1);
+
+  if(doc->records)
+  {
+    pfree(doc->records);
+  }
+
+  doc->records = NULL;
+  doc->length = 0;
+  doc->capacity = 0;
+  doc->encoded = 0;
+  doc->base = NULL;
+  doc->text = text;
+  doc->textLength = length;
+
+  return doc;
+}
+
+/* Frozen on first use, its members are written as they are from now on */
+void bgDocumentLock(struct bgDocument *tmpl)
+{
+  if(tmpl->shared)
+  {
+    return;
+  }
+
+  tmpl->shared = sstream_new();
+  bgDocumentWriteObject(tmpl, tmpl->shared, 0, 0);
+  bgDocumentClearVisited(tmpl);
+
+  /* Documents carry on from the last member */
+  sstream_truncate(tmpl->shared, sstream_length(tmpl->shared) - 1);
+}
+
+struct bgDocument *bgDocumentCreateFromTemplate(struct bgDocument *tmpl)
+{
+  struct bgDocument *rtn = NULL;
+
+  if(!tmpl->isTemplate)
+  {
+    printf("Error: Document is not a template\n");
+    return NULL;
+  }
+
+  bgDocumentLock(tmpl);
+
+  rtn = bgDocumentCreate();
+  rtn->base = tmpl;
+
+  return rtn;
+}
+
+void bgDocumentAddCStr(struct bgDocument *doc, const char *path, const char *val)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+
+  bgDocumentPutCStr(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
+
+void bgDocumentAddInt(struct bgDocument *doc, const char *path, int val)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+
+  bgDocumentPutNumber(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
+
+void bgDocumentAddDouble(struct bgDocument *doc, const char *path, double val)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+
+  bgDocumentPutNumber(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
+
+void bgDocumentAddBool(struct bgDocument *doc, const char *path, int val)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+
+  bgDocumentPutBool(doc, keys, bgDocumentKeys(path, NULL, keys, NULL), val);
+  bgUpdate();
+}
+
+void bgDocumentAddMany(struct bgDocument *doc, const struct bgValue *values,
+  size_t count)
+{
+  const char *keys[BG_PATH_MAX_DEPTH];
+  const char *prev = NULL;
+  size_t depth = 0;
+  size_t i = 0;
+
+  if(!bgDocumentReserve(doc, count * BG_RECORD_ESTIMATE))
+  {
+    return;
+  }
+
+  for(i = 0; i < count; i++)
+  {
+    depth = bgDocumentKeys(values[i].path, prev, keys, NULL);
+    prev = depth > 0 ? values[i].path : NULL;
+
+    switch(values[i].type)
+    {
+      case BG_TYPE_CSTR:
+        bgDocumentPutCStr(doc, keys, depth, values[i].cstr);
+        break;
+
+      case BG_TYPE_INT:
+        bgDocumentPutNumber(doc, keys, depth, (int)values[i].number);
+        break;
+
+      case BG_TYPE_DOUBLE:
+        bgDocumentPutNumber(doc, keys, depth, values[i].number);
+        break;
+
+      case BG_TYPE_BOOL:
+        bgDocumentPutBool(doc, keys, depth, values[i].number != 0);
+        break;
+
+      default:
+        printf("Error: Unknown field type\n");
+    }
+  }
+
+  bgUpdate();
+}
+
+void bgDocumentSetCStrByField(struct bgDocument *doc, struct bgField *field,
+  const char *val)
+{
+  bgDocumentPutCStr(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
+
+void bgDocumentSetIntByField(struct bgDocument *doc, struct bgField *field,
+  int val)
+{
+  bgDocumentPutNumber(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
+
+void bgDocumentSetDoubleByField(struct bgDocument *doc, struct bgField *field,
+  double val)
+{
+  bgDocumentPutNumber(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
+
+void bgDocumentSetBoolByField(struct bgDocument *doc, struct bgField *field,
+  int val)
+{
+  bgDocumentPutBool(doc, field->keys, field->depth, val);
+  bgUpdate();
+}
+#endif
@@ -2,18 +2,88 @@
 #define BG_DOCUMENT_H
 
 #ifndef AMALGAMATION
-  /*#include <palloc/sstream.h>*/
-  #include <palloc/vector.h>
+  #include "config.h"
+  #include <palloc/sstream.h>
+  #include "Memory.h"
   #include "parson.h"
 #endif
 
+#ifdef BG_DOCUMENT_TREE
 struct bgDocument
 {
+  /* Holds the document itself and all of its values */
+  struct bgMemory memory;
+
   JSON_Value  *rootVal;
   JSON_Object *rootObj;
   JSON_Array  *rootArr;
+
+  /* Templates are only released by bgDocumentTemplateDestroy, and can not
+   * change once locked.
+   */
+  int isTemplate;
+  int locked;
+
+  /* Set once frozen, the tree is gone and this is all that is left */
+  char *text;
+  size_t textLength;
 };
+#else
+struct bgDocument
+{
+  /* Records appended by the setters, laid out as described in Document.c */
+  char *records;
+  size_t length;
+  size_t capacity;
 
+  /* Running estimate of the serialized size of the records */
+  size_t encoded;
+
+  /* Template whose members are written ahead of the document's own */
+  struct bgDocument *base;
+
+  /* Templates only. Once a document has been created from the template its
+   * members are kept serialized here, without the braces, and it can no
+   * longer change.
+   */
+  int isTemplate;
+  struct sstream *shared;
+
+  /* Set once frozen, the records are gone and this is all that is left */
+  char *text;
+  size_t textLength;
+};
+#endif
+
+/* Does nothing for templates, they are owned by the state */
 void bgDocumentDestroy(struct bgDocument *doc);
+void bgDocumentTemplateDestroy(struct bgDocument *tmpl);
+
+/* Stops tmpl from changing, done when a document is created from it or it
+ * is queued, so what was counted stays what is uploaded.
+ */
+void bgDocumentLock(struct bgDocument *tmpl);
+
+/* Memory held by the document */
+size_t bgDocumentSize(struct bgDocument *doc);
+
+/* Length of the document serialized, an upper bound unless keys need
+ * escaping. Kept up to date by the setters, measured with BG_DOCUMENT_TREE.
+ */
+size_t bgDocumentEncodedSize(struct bgDocument *doc);
+
+/* Appends s as a JSON string, returns 0 and appends nothing if it is not
+ * valid UTF-8.
+ */
+int bgDocumentWriteString(struct sstream *out, const char *s);
+
+/* Appends doc as a JSON object, returns 0 if it could not be serialized */
+int bgDocumentSerialize(struct bgDocument *doc, struct sstream *out);
+
+/* Serializes doc through scratch and keeps nothing but the text, returns the
+ * frozen document which may have moved. Templates are left as they are.
+ */
+struct bgDocument *bgDocumentFreeze(struct bgDocument *doc,
+  struct sstream *scratch);
 
 #endif
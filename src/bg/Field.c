@@ -0,0 +1,64 @@
+#ifndef AMALGAMATION
+  #include "Field.h"
+  #include "State.h"
+
+  #include <palloc/palloc.h>
+  #include <palloc/intern.h>
+  #include <palloc/sstream.h>
+#endif
+
+#include <string.h>
+
+struct bgField *bgFieldCompile(const char *path)
+{
+  struct bgField *rtn = NULL;
+  struct bgField **it = NULL;
+  struct sstrview rest = sstrview_cstr(path);
+  struct sstrview key = {0};
+  const char *name = intern_cstr(path);
+  size_t depth = sstrview_split(rest, '.', NULL, 0);
+  int trailing = 0;
+
+  vector_foreach(it, bg->fields)
+  {
+    if((*it)->path == name)
+    {
+      return *it;
+    }
+  }
+
+  /* An empty path is a single empty key and a trailing dot ends in one, as
+   * with bgDocumentAdd*
+   */
+  if(depth == 0 || path[strlen(path) - 1] == '.')
+  {
+    trailing = 1;
+    depth++;
+  }
+
+  /* The keys are stored right behind the field */
+  rtn = (struct bgField *)_palloc(sizeof(*rtn) + depth * sizeof(const char *),
+    "struct bgField");
+  rtn->path = name;
+  rtn->depth = 0;
+  rtn->keys = (const char **)(rtn + 1);
+
+  while(sstrview_next(&rest, '.', &key))
+  {
+    rtn->keys[rtn->depth++] = intern_chars(key.s, key.len);
+  }
+
+  if(trailing)
+  {
+    rtn->keys[rtn->depth++] = intern_chars(path, 0);
+  }
+
+  vector_push_back(bg->fields, rtn);
+
+  return rtn;
+}
+
+void bgFieldDestroy(struct bgField *field)
+{
+  pfree(field);
+}
@@ -0,0 +1,20 @@
+#ifndef BG_FIELD_H
+#define BG_FIELD_H
+
+#include <stdlib.h>
+
+/*
+ * Dotted document path split once into interned keys, so setting it does no
+ * parsing or hashing. Fields are owned by the state and live until bgCleanup.
+ */
+struct bgField
+{
+  /* Interned, equal paths compile to the same field */
+  const char *path;
+  size_t depth;
+  const char **keys;
+};
+
+void bgFieldDestroy(struct bgField *field);
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef AMALGAMATION
+  #include "config.h"
+  #include "Memory.h"
+  #include "parson.h"
+
+  #include <bg/analytics.h>
+  #include <palloc/arena.h>
+  #include <palloc/intern.h>
+  #include <palloc/palloc.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Enough for every palloc tag */
+#define BG_MEMORY_TYPES 65
+
+/* Every block records its class just in front of the memory handed out */
+union bgMemoryHeader
+{
+  size_t cls;
+  double align;
+};
+
+static struct bgMemory *bgMemoryCurrent;
+static struct bgMemoryCounters bgMemoryCount;
+
+/* Totals at the previous bgMemoryStats call, to derive the rates */
+static struct palloc_stats bgMemoryLast;
+static struct bgMemoryCounters bgMemoryLastCount;
+static time_t bgMemoryLastTime;
+static struct bgMemoryType bgMemoryTypes[BG_MEMORY_TYPES];
+
+#ifdef BG_DOCUMENT_TREE
+/* Node sizes are filled in by bgMemoryInit */
+static size_t bgMemorySize[BG_MEMORY_LARGE] = {0, 0, 0, 16, 32, 64, 128};
+
+static size_t bgMemoryClassOf(size_t size)
+{
+  size_t rtn = 0;
+
+  for(rtn = BG_MEMORY_VALUE; rtn <= BG_MEMORY_ARRAY; rtn++)
+  {
+    if(size == bgMemorySize[rtn])
+    {
+      return rtn;
+    }
+  }
+
+  for(rtn = BG_MEMORY_SMALL16; rtn < BG_MEMORY_LARGE; rtn++)
+  {
+    if(size <= bgMemorySize[rtn])
+    {
+      return rtn;
+    }
+  }
+
+  return BG_MEMORY_LARGE;
+}
+
+static void *bgMemoryMalloc(size_t size)
+{
+  union bgMemoryHeader *header = NULL;
+  size_t cls = bgMemoryClassOf(size);
+  void *rtn = NULL;
+
+  /* Anyone else using parson gets ordinary heap memory */
+  if(!bgMemoryCurrent)
+  {
+    return malloc(size);
+  }
+
+  if(cls != BG_MEMORY_LARGE)
+  {
+    rtn = bgMemoryCurrent->free[cls];
+
+    if(rtn)
+    {
+      bgMemoryCurrent->free[cls] = *(void **)rtn;
+      bgMemoryCount.hits[cls]++;
+
+      return rtn;
+    }
+
+    size = bgMemorySize[cls];
+  }
+
+  header = (union bgMemoryHeader *)arena_alloc(&bgMemoryCurrent->arena,
+    sizeof(union bgMemoryHeader) + size);
+
+  if(!header)
+  {
+    return NULL;
+  }
+
+  header->cls = cls;
+  bgMemoryCount.misses[cls]++;
+
+  return header + 1;
+}
+
+static void bgMemoryFree(void *ptr)
+{
+  union bgMemoryHeader *header = NULL;
+
+  /* Documents only free between bgMemoryBegin and bgMemoryEnd, anything
+   * freed outside of one came from malloc.
+   */
+  if(!bgMemoryCurrent)
+  {
+    free(ptr);
+    return;
+  }
+
+  if(!ptr)
+  {
+    return;
+  }
+
+  header = (union bgMemoryHeader *)ptr - 1;
+
+  if(header->cls == BG_MEMORY_LARGE)
+  {
+    return;
+  }
+
+  *(void **)ptr = bgMemoryCurrent->free[header->cls];
+  bgMemoryCurrent->free[header->cls] = ptr;
+}
+#endif
+
+void bgMemoryInit()
+{
+#ifdef BG_DOCUMENT_TREE
+  json_node_sizes(&bgMemorySize[BG_MEMORY_VALUE],
+    &bgMemorySize[BG_MEMORY_OBJECT], &bgMemorySize[BG_MEMORY_ARRAY]);
+
+  json_set_allocation_functions(bgMemoryMalloc, bgMemoryFree);
+#endif
+
+  palloc_stats(&bgMemoryLast);
+  bgMemoryLastCount = bgMemoryCount;
+  bgMemoryLastTime = time(NULL);
+}
+
+void bgMemoryShutdown()
+{
+#ifdef BG_DOCUMENT_TREE
+  json_set_allocation_functions(malloc, free);
+#endif
+
+  bgMemoryEnd();
+}
+
+void bgMemoryBegin(struct bgMemory *m)
+{
+  bgMemoryCurrent = m;
+
+  /* Document keys share the table with collection names, keys parsed by
+   * anyone else stay their own.
+   */
+  json_set_key_intern_function(intern_chars);
+}
+
+void bgMemoryEnd()
+{
+  bgMemoryCurrent = NULL;
+  json_set_key_intern_function(NULL);
+}
+
+void bgMemoryStats(struct bgMemoryStats *stats)
+{
+  struct palloc_stats now = {0};
+  struct palloc_tag tags[BG_MEMORY_TYPES];
+  size_t tagCount = palloc_tags(tags, BG_MEMORY_TYPES);
+  time_t tNow = time(NULL);
+  double elapsed = difftime(tNow, bgMemoryLastTime);
+  size_t i = 0;
+
+  palloc_stats(&now);
+
+  stats->liveBytes = now.liveBytes;
+  stats->liveObjects = now.liveObjects;
+  stats->peakBytes = now.peakBytes;
+  stats->heldBytes = now.heldBytes;
+  stats->peakHeldBytes = now.peakHeldBytes;
+  stats->allocs = now.allocs - bgMemoryLast.allocs;
+  stats->frees = now.frees - bgMemoryLast.frees;
+  stats->allocsPerSecond = 0;
+  stats->freesPerSecond = 0;
+
+  if(elapsed >= 1)
+  {
+    stats->allocsPerSecond = stats->allocs / elapsed;
+    stats->freesPerSecond = stats->frees / elapsed;
+  }
+
+  stats->documentHits = 0;
+  stats->documentMisses = 0;
+
+  for(i = 0; i < BG_MEMORY_CLASSES; i++)
+  {
+    stats->documentHits += bgMemoryCount.hits[i] - bgMemoryLastCount.hits[i];
+    stats->documentMisses += bgMemoryCount.misses[i] -
+      bgMemoryLastCount.misses[i];
+  }
+
+  bgMemoryLast = now;
+  bgMemoryLastCount = bgMemoryCount;
+  bgMemoryLastTime = tNow;
+
+  /* Identical type names from different translation units are separate tags,
+   * fold them together.
+   */
+  stats->typeCount = 0;
+
+  if(tagCount > BG_MEMORY_TYPES)
+  {
+    tagCount = BG_MEMORY_TYPES;
+  }
+
+  for(i = 0; i < tagCount; i++)
+  {
+    struct bgMemoryType *type = NULL;
+    size_t j = 0;
+
+    for(j = 0; j < stats->typeCount; j++)
+    {
+      if(strcmp(bgMemoryTypes[j].type, tags[i].type) == 0)
+      {
+        type = &bgMemoryTypes[j];
+        break;
+      }
+    }
+
+    if(!type)
+    {
+      type = &bgMemoryTypes[stats->typeCount];
+      type->type = tags[i].type;
+      type->count = 0;
+      type->bytes = 0;
+      stats->typeCount++;
+    }
+
+    type->count += tags[i].count;
+    type->bytes += tags[i].bytes;
+  }
+
+  stats->types = bgMemoryTypes;
+}
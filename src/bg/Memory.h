@@ -0,0 +1,56 @@
+#ifndef BG_MEMORY_H
+#define BG_MEMORY_H
+
+#ifndef AMALGAMATION
+  #include <palloc/arena.h>
+#endif
+
+enum bgMemoryClass
+{
+  /* Requests the size of a parson node */
+  BG_MEMORY_VALUE,
+  BG_MEMORY_OBJECT,
+  BG_MEMORY_ARRAY,
+
+  /* Strings and object/array tables, rounded up */
+  BG_MEMORY_SMALL16,
+  BG_MEMORY_SMALL32,
+  BG_MEMORY_SMALL64,
+  BG_MEMORY_SMALL128,
+
+  /* Anything bigger, never recycled */
+  BG_MEMORY_LARGE,
+  BG_MEMORY_CLASSES
+};
+
+/*
+ * Allocator behind parson for a single document. Memory is carved from the
+ * document's arena, blocks parson frees while the document is being built
+ * (replaced values, outgrown tables) go on per class free lists and are
+ * reused by the document's later allocations.
+ */
+struct bgMemory
+{
+  struct arena arena;
+  void *free[BG_MEMORY_LARGE];
+};
+
+struct bgMemoryCounters
+{
+  /* Served from a free list */
+  size_t hits[BG_MEMORY_CLASSES];
+  /* Carved from the arena */
+  size_t misses[BG_MEMORY_CLASSES];
+};
+
+/* Installs the allocator into parson when documents are parson trees,
+ * bgMemoryShutdown puts parson's own back.
+ */
+void bgMemoryInit();
+void bgMemoryShutdown();
+
+/* parson allocates from m and interns keys until bgMemoryEnd() */
+void bgMemoryBegin(struct bgMemory *m);
+void bgMemoryEnd();
+
+#endif
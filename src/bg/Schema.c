@@ -0,0 +1,422 @@
+#ifndef AMALGAMATION
+  #include "Schema.h"
+  #include "Document.h"
+  #include "Field.h"
+  #include "State.h"
+
+  #include <bg/analytics.h>
+  #include <palloc/number.h>
+  #include <palloc/palloc.h>
+  #include <palloc/sstream.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#define BG_COLUMNS_MIN_CAPACITY 16
+
+/* Longest text of a formatted value */
+#define BG_INT_ENCODED 11
+#define BG_DOUBLE_ENCODED NUMBER_BUFFER_SIZE
+#define BG_BOOL_ENCODED 5
+
+struct bgSchema *bgSchemaCreate()
+{
+  struct bgSchema *rtn = palloc(struct bgSchema);
+
+  rtn->fields = vector_new(struct bgSchemaField *);
+  rtn->order = vector_new(size_t);
+  rtn->tail = sstream_new();
+  sstream_push_cstr(rtn->tail, "{}");
+  vector_push_back(bg->schemas, rtn);
+
+  return rtn;
+}
+
+void bgSchemaDestroy(struct bgSchema *schema)
+{
+  struct bgSchemaField **it = NULL;
+
+  vector_foreach(it, schema->fields)
+  {
+    sstream_delete((*it)->lead);
+    pfree(*it);
+  }
+
+  vector_delete(schema->fields);
+  vector_delete(schema->order);
+  sstream_delete(schema->tail);
+  pfree(schema);
+}
+
+/* Number of leading keys a and b have in common */
+static size_t bgSchemaCommon(struct bgField *a, struct bgField *b)
+{
+  size_t rtn = 0;
+
+  while(rtn < a->depth && rtn < b->depth && a->keys[rtn] == b->keys[rtn])
+  {
+    rtn++;
+  }
+
+  return rtn;
+}
+
+/* Rebuilds the text written between the values of a row */
+static void bgSchemaLayout(struct bgSchema *schema)
+{
+  struct bgField *prev = NULL;
+  size_t i = 0;
+  size_t k = 0;
+
+  for(i = 0; i < vector_size(schema->order); i++)
+  {
+    struct bgSchemaField *sf = vector_at(schema->fields,
+      vector_at(schema->order, i));
+    struct bgField *f = sf->field;
+    size_t common = 0;
+
+    sstream_clear(sf->lead);
+
+    if(prev)
+    {
+      common = bgSchemaCommon(prev, f);
+
+      for(k = common + 1; k < prev->depth; k++)
+      {
+        sstream_push_char(sf->lead, '}');
+      }
+
+      sstream_push_char(sf->lead, ',');
+    }
+    else
+    {
+      sstream_push_char(sf->lead, '{');
+    }
+
+    for(k = common; k < f->depth; k++)
+    {
+      if(!bgDocumentWriteString(sf->lead, f->keys[k]))
+      {
+        sstream_push_cstr(sf->lead, "\"\"");
+      }
+
+      sstream_push_cstr(sf->lead, k + 1 < f->depth ? ":{" : ":");
+    }
+
+    prev = f;
+  }
+
+  sstream_clear(schema->tail);
+
+  if(!prev)
+  {
+    sstream_push_cstr(schema->tail, "{}");
+    return;
+  }
+
+  for(k = 0; k < prev->depth; k++)
+  {
+    sstream_push_char(schema->tail, '}');
+  }
+}
+
+void bgSchemaAddField(struct bgSchema *schema, const char *path, int type)
+{
+  struct bgField *field = NULL;
+  struct bgSchemaField *sf = NULL;
+  size_t index = vector_size(schema->fields);
+  size_t at = vector_size(schema->order);
+  size_t best = 0;
+  size_t i = 0;
+
+  if(schema->locked)
+  {
+    printf("Error: Schema is already used by a collection\n");
+    return;
+  }
+
+  if(type < BG_TYPE_CSTR || type > BG_TYPE_BOOL)
+  {
+    printf("Error: Unknown field type\n");
+    return;
+  }
+
+  field = bgFieldCompile(path);
+
+  /* Sits right after the last field it shares the most parents with */
+  for(i = 0; i < vector_size(schema->order); i++)
+  {
+    struct bgField *other = vector_at(schema->fields,
+      vector_at(schema->order, i))->field;
+    size_t common = bgSchemaCommon(other, field);
+
+    if(common == other->depth || common == field->depth)
+    {
+      printf("Error: Field overlaps an existing field\n");
+      return;
+    }
+
+    if(common > 0 && common >= best)
+    {
+      best = common;
+      at = i + 1;
+    }
+  }
+
+  sf = palloc(struct bgSchemaField);
+  sf->field = field;
+  sf->type = type;
+  sf->lead = sstream_new();
+
+  vector_push_back(schema->fields, sf);
+  vector_insert_range(schema->order, at, &index, 1);
+  bgSchemaLayout(schema);
+}
+
+static size_t bgColumnSize(int type)
+{
+  switch(type)
+  {
+    case BG_TYPE_CSTR:
+      return sizeof(size_t);
+    case BG_TYPE_INT:
+      return sizeof(int);
+    case BG_TYPE_DOUBLE:
+      return sizeof(double);
+  }
+
+  return sizeof(unsigned char);
+}
+
+struct bgColumns *bgColumnsCreate(struct bgSchema *schema)
+{
+  struct bgColumns *rtn = palloc(struct bgColumns);
+  size_t count = vector_size(schema->fields);
+
+  schema->locked = 1;
+  rtn->schema = schema;
+  rtn->text = sstream_new();
+
+  if(count > 0)
+  {
+    rtn->data = (void **)_palloc(count * sizeof(void *), "struct bgColumns");
+  }
+
+  return rtn;
+}
+
+void bgColumnsDestroy(struct bgColumns *columns)
+{
+  size_t i = 0;
+
+  if(columns->data)
+  {
+    for(i = 0; i < vector_size(columns->schema->fields); i++)
+    {
+      if(columns->data[i])
+      {
+        pfree(columns->data[i]);
+      }
+    }
+
+    pfree(columns->data);
+  }
+
+  sstream_delete(columns->text);
+  pfree(columns);
+}
+
+/* Doubles the capacity of every column */
+static int bgColumnsGrow(struct bgColumns *columns)
+{
+  size_t capacity = columns->capacity * 2;
+  size_t i = 0;
+
+  if(capacity < BG_COLUMNS_MIN_CAPACITY)
+  {
+    capacity = BG_COLUMNS_MIN_CAPACITY;
+  }
+
+  for(i = 0; i < vector_size(columns->schema->fields); i++)
+  {
+    size_t size = bgColumnSize(vector_at(columns->schema->fields, i)->type);
+    void *data = _palloc_uninit(capacity * size, "bgColumn");
+
+    if(!data)
+    {
+      printf("Error: Failed to allocate\n");
+      return 0;
+    }
+
+    if(columns->data[i])
+    {
+      memcpy(data, columns->data[i], columns->rows * size);
+      pfree(columns->data[i]);
+    }
+
+    columns->data[i] = data;
+  }
+
+  columns->capacity = capacity;
+
+  return 1;
+}
+
+int bgColumnsAdd(struct bgColumns *columns, va_list values, size_t *bytes,
+  size_t *encoded)
+{
+  size_t textLength = sstream_length(columns->text);
+  size_t row = columns->rows;
+  size_t i = 0;
+
+  *bytes = 0;
+  *encoded = 0;
+
+  if(row == columns->capacity && !bgColumnsGrow(columns))
+  {
+    return 0;
+  }
+
+  /* Separator and tail, strings are counted with the text */
+  *encoded = 1 + sstream_length(columns->schema->tail);
+
+  for(i = 0; i < vector_size(columns->schema->fields); i++)
+  {
+    struct bgSchemaField *sf = vector_at(columns->schema->fields, i);
+    int type = sf->type;
+    const char *s = NULL;
+
+    *encoded += sstream_length(sf->lead);
+
+    switch(type)
+    {
+      case BG_TYPE_CSTR:
+        /* Strings parson would refuse are sent as null */
+        ((size_t *)columns->data[i])[row] = sstream_length(columns->text);
+        s = va_arg(values, const char *);
+
+        if(!s || !bgDocumentWriteString(columns->text, s))
+        {
+          sstream_push_cstr(columns->text, "null");
+        }
+
+        sstream_push_char(columns->text, '\0');
+        break;
+
+      case BG_TYPE_INT:
+        ((int *)columns->data[i])[row] = va_arg(values, int);
+        *encoded += BG_INT_ENCODED;
+        break;
+
+      case BG_TYPE_DOUBLE:
+        ((double *)columns->data[i])[row] = va_arg(values, double);
+        *encoded += BG_DOUBLE_ENCODED;
+        break;
+
+      case BG_TYPE_BOOL:
+        ((unsigned char *)columns->data[i])[row] = va_arg(values, int) != 0;
+        *encoded += BG_BOOL_ENCODED;
+        break;
+    }
+
+    *bytes += bgColumnSize(type);
+  }
+
+  *bytes += sstream_length(columns->text) - textLength;
+  *encoded += sstream_length(columns->text) - textLength;
+  columns->rows++;
+  columns->bytes += *bytes;
+  columns->encoded += *encoded;
+
+  return 1;
+}
+
+void bgColumnsPop(struct bgColumns *columns, size_t bytes, size_t encoded)
+{
+  size_t i = 0;
+
+  if(columns->rows == 0)
+  {
+    return;
+  }
+
+  columns->rows--;
+  columns->bytes -= bytes;
+  columns->encoded -= encoded;
+
+  /* The row's text starts at its first string */
+  for(i = 0; i < vector_size(columns->schema->fields); i++)
+  {
+    if(vector_at(columns->schema->fields, i)->type == BG_TYPE_CSTR)
+    {
+      sstream_truncate(columns->text,
+        ((size_t *)columns->data[i])[columns->rows]);
+      break;
+    }
+  }
+}
+
+size_t bgColumnsSerialize(struct bgColumns *columns, struct sstream *out,
+  size_t written)
+{
+  struct bgSchema *schema = columns->schema;
+  const char *text = sstream_cstr(columns->text);
+  size_t count = vector_size(schema->order);
+  size_t row = 0;
+  size_t i = 0;
+
+  for(row = 0; row < columns->rows; row++)
+  {
+    if(written > 0)
+    {
+      sstream_push_char(out, ',');
+    }
+
+    for(i = 0; i < count; i++)
+    {
+      size_t index = vector_at(schema->order, i);
+      struct bgSchemaField *sf = vector_at(schema->fields, index);
+      void *data = columns->data[index];
+      char buff[NUMBER_BUFFER_SIZE] = {0};
+      size_t len = 0;
+
+      sstream_push_chars(out, sstream_cstr(sf->lead), sstream_length(sf->lead));
+
+      switch(sf->type)
+      {
+        case BG_TYPE_CSTR:
+          sstream_push_cstr(out, text + ((size_t *)data)[row]);
+          break;
+
+        case BG_TYPE_INT:
+          sstream_push_int(out, ((int *)data)[row]);
+          break;
+
+        case BG_TYPE_DOUBLE:
+          /* Same form as parson gives numbers */
+          len = number_format_json(buff, ((double *)data)[row]);
+          sstream_push_chars(out, buff, len);
+          break;
+
+        case BG_TYPE_BOOL:
+          sstream_push_cstr(out, ((unsigned char *)data)[row] ? "true" : "false");
+          break;
+      }
+    }
+
+    sstream_push_chars(out, sstream_cstr(schema->tail),
+      sstream_length(schema->tail));
+    written++;
+  }
+
+  return written;
+}
+
+void bgColumnsClear(struct bgColumns *columns)
+{
+  columns->rows = 0;
+  columns->bytes = 0;
+  columns->encoded = 0;
+  sstream_clear(columns->text);
+}
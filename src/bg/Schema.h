@@ -0,0 +1,84 @@
+#ifndef BG_SCHEMA_H
+#define BG_SCHEMA_H
+
+#ifndef AMALGAMATION
+  #include <palloc/vector.h>
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+
+struct bgField;
+struct sstream;
+
+struct bgSchemaField
+{
+  struct bgField *field;
+  int type;
+
+  /* Written in front of the value: the separator, objects closed and opened
+   * since the previous field in serialization order, and the key.
+   */
+  struct sstream *lead;
+};
+
+/*
+ * Typed fields shared by every row of a collection, indexed in the order rows
+ * give their values. Fields with a common parent are serialized next to each
+ * other so each object is opened once. Schemas are owned by the state and
+ * live until bgCleanup.
+ */
+struct bgSchema
+{
+  vector(struct bgSchemaField *) *fields;
+  vector(size_t) *order;
+
+  /* Closes the row after the last field */
+  struct sstream *tail;
+
+  /* Fields can not be added once a collection uses the schema */
+  int locked;
+};
+
+/*
+ * Rows of a collection stored as one array per schema field. Strings are kept
+ * escaped in text, their column holds the offset of the quoted value.
+ */
+struct bgColumns
+{
+  struct bgSchema *schema;
+  void **data;
+  size_t rows;
+  size_t capacity;
+  struct sstream *text;
+
+  /* Held by the rows, as counted against the budgets */
+  size_t bytes;
+
+  /* Upper bound of the rows serialized, separators included */
+  size_t encoded;
+};
+
+void bgSchemaDestroy(struct bgSchema *schema);
+
+struct bgColumns *bgColumnsCreate(struct bgSchema *schema);
+void bgColumnsDestroy(struct bgColumns *columns);
+
+/* Appends a row from values in field order, sets bytes to what it holds and
+ * encoded to its serialized size. Returns 0 if the row could not be stored.
+ */
+int bgColumnsAdd(struct bgColumns *columns, va_list values, size_t *bytes,
+  size_t *encoded);
+
+/* Removes the last row, sizes as given by bgColumnsAdd */
+void bgColumnsPop(struct bgColumns *columns, size_t bytes, size_t encoded);
+
+/* Appends every row to an upload body holding written documents. Returns the
+ * new number of documents written.
+ */
+size_t bgColumnsSerialize(struct bgColumns *columns, struct sstream *out,
+  size_t written);
+
+void bgColumnsClear(struct bgColumns *columns);
+
+#endif
@@ -3,11 +3,16 @@
   #include "State.h"
   #include "Collection.h"
   #include "Document.h"
+  #include "Field.h"
+  #include "Schema.h"
+  #include "Memory.h"
   #include "parson.h"
   #include "http/http.h"
 
   #include "palloc/sstream.h"
   #include <palloc/palloc.h>
+  #include <palloc/intern.h>
+  #include <palloc/arena.h>
 #endif
 
 #include <time.h>
@@ -15,13 +20,23 @@
 
 struct bgState *bg;
 
+/* Called by every mutator, polls unless the application does it */
+void bgUpdate()
+{
+  if(bg->autoPoll)
+  {
+    bgPoll();
+  }
+}
+
 /* Find out where error/success callbacks should be called
  * in this particular function
  */
-void bgUpdate()
+void bgPoll()
 {
   /* For updating interval */
   size_t i = 0;
+  struct bgCollection **cit = NULL;
   time_t tNow = time(NULL);
 
   /* Updating Interval */
@@ -29,9 +44,9 @@ void bgUpdate()
   bg->t = tNow;
 
   /* Polling collections http connections to push through data */
-  for(i = 0; i < vector_size(bg->collections); i++)
+  vector_foreach(cit, bg->collections)
   {
-    HttpRequestComplete(vector_at(bg->collections, i)->http);
+    HttpRequestComplete((*cit)->http);
   }
 
   /* Pushing data if interval is done */
@@ -41,15 +56,14 @@ void bgUpdate()
     sstream *ser = sstream_new();
     sstream *url = sstream_new();
 
-    /* Upload collections */
+    /* Upload collections, indexed because callbacks may add collections */
     for(i = 0; i < vector_size(bg->collections); i++)
     {
-      JSON_Value* v = NULL;
-      size_t j = 0;
       struct bgCollection* c = vector_at(bg->collections, i);
 
       //TODO continue if no data to send
-      if(vector_size(c->documents) == 0)
+      if(ring_empty(c->documents) && !c->spillPending &&
+        (!c->columns || c->columns->rows == 0))
       {
         continue;
       }
@@ -60,44 +74,24 @@ void bgUpdate()
         {
           if(bg->successFunc)
           {
-            bg->successFunc(sstream_cstr(c->name), c->lastDocumentCount);
+            bg->successFunc(c->name, c->lastDocumentCount);
           }
         }
         else if(bg->errorFunc)
         {
-          bg->errorFunc(sstream_cstr(c->name), HttpResponseStatus(c->http));
+          bg->errorFunc(c->name, HttpResponseStatus(c->http));
         }
 
-        sstream_push_cstr(ser, "{\"documents\":[");
-
-        /* Serializing documents of collection */
-        for(j = 0; j < vector_size(c->documents); j++)
-        {
-          v = vector_at(c->documents, j)->rootVal;
-          sstream_push_cstr(ser, json_serialize_to_string(v));
-          if(j < vector_size(c->documents)-1)
-          {
-            sstream_push_char(ser, ',');
-          }
-        }
-
-        sstream_push_cstr(ser, "]}");
+        c->lastDocumentCount = bgCollectionSerialize(c, ser);
 
         sstream_clear(url);
         sstream_push_cstr(url, sstream_cstr(bg->fullUrl));
-        sstream_push_cstr(url, sstream_cstr(c->name));
+        sstream_push_cstr(url, c->name);
         sstream_push_cstr(url, "/documents");
         HttpRequest(c->http, sstream_cstr(url), sstream_cstr(ser));
         sstream_clear(ser);
 
-        c->lastDocumentCount = vector_size(c->documents);
-
-        for(j = 0; j < vector_size(c->documents); j++)
-        {
-          bgDocumentDestroy(vector_at(c->documents, j));
-        }
-
-        vector_clear(c->documents);
+        bgCollectionDrain(c, c->lastDocumentCount);
       }
     }
 
@@ -112,9 +106,15 @@ void bgUpdate()
 
 void bgAuth(const char *guid, const char *key)
 {
+  bgMemoryInit();
+
   bg = palloc(struct bgState);
   bg->collections = vector_new(struct bgCollection *);
+  bg->fields = vector_new(struct bgField *);
+  bg->schemas = vector_new(struct bgSchema *);
+  bg->templates = vector_new(struct bgDocument *);
   bg->interval = 2000;
+  bg->autoPoll = 1;
   bg->t = time(NULL);
 
   bg->url = sstream_new();
@@ -144,23 +144,62 @@ void bgCleanup()
    * Looping throough and calling 'destructor'
    * and then deleting remnants with vector_delete
    */
-  size_t i = 0;
+  struct bgCollection **it = NULL;
+  struct bgField **fit = NULL;
+  struct bgSchema **sit = NULL;
+  struct bgDocument **dit = NULL;
 
-  for(i = 0; i < vector_size(bg->collections); i ++)
+  vector_foreach(it, bg->collections)
   {
     /*NULLS pointer in function*/
-    bgCollectionDestroy(vector_at(bg->collections, i));
+    bgCollectionDestroy(*it);
   }
 
   vector_delete(bg->collections);
 
+  if(bg->collectionIndex.slots)
+  {
+    pfree(bg->collectionIndex.slots);
+  }
+
+  vector_foreach(fit, bg->fields)
+  {
+    bgFieldDestroy(*fit);
+  }
+
+  vector_delete(bg->fields);
+
+  vector_foreach(sit, bg->schemas)
+  {
+    bgSchemaDestroy(*sit);
+  }
+
+  vector_delete(bg->schemas);
+
+  /* After the collections, which may still have held them */
+  vector_foreach(dit, bg->templates)
+  {
+    bgDocumentTemplateDestroy(*dit);
+  }
+
+  vector_delete(bg->templates);
+
   sstream_delete(bg->url);
   sstream_delete(bg->path);
   sstream_delete(bg->fullUrl);
   sstream_delete(bg->guid);
   sstream_delete(bg->key);
 
+  if(bg->spillDir)
+  {
+    sstream_delete(bg->spillDir);
+  }
+
   pfree(bg);
+  bgMemoryShutdown();
+  intern_clear();
+  arena_trim();
+  palloc_trim();
 }
 
 void bgInterval(int milli)
@@ -168,6 +207,35 @@ void bgInterval(int milli)
   bg->interval = milli;
 }
 
+void bgAutoPoll(int enabled)
+{
+  bg->autoPoll = enabled;
+}
+
+void bgBudget(size_t maxDocuments, size_t maxBytes)
+{
+  bg->maxDocuments = maxDocuments;
+  bg->maxBytes = maxBytes;
+}
+
+void bgSpillDirectory(const char *path)
+{
+  struct bgCollection **it = NULL;
+
+  if(!bg->spillDir)
+  {
+    bg->spillDir = sstream_new();
+  }
+
+  sstream_clear(bg->spillDir);
+  sstream_push_cstr(bg->spillDir, path);
+
+  vector_foreach(it, bg->collections)
+  {
+    bgCollectionSpillCheck(*it);
+  }
+}
+
 void bgErrorFunc(void (*errorFunc)(const char *cln, int code))
 {
   bg->errorFunc = errorFunc;
@@ -2,12 +2,16 @@
 #define BG_STATE_H
 
 #ifndef AMALGAMATION
+  #include <palloc/hash.h>
   #include <palloc/vector.h>
 #endif
 
 #include <time.h>
 
 struct bgCollection;
+struct bgDocument;
+struct bgField;
+struct bgSchema;
 struct sstream;
 
 struct bgState
@@ -16,6 +20,9 @@ struct bgState
   int interval;
   int intervalTimer;
 
+  /* Unset when the application calls bgPoll itself */
+  int autoPoll;
+
   struct sstream *url;
   struct sstream *path;
   struct sstream *fullUrl;
@@ -24,7 +31,23 @@ struct bgState
 
   time_t t;
 
+  /* Budget across all collections, a limit of 0 is unlimited */
+  size_t maxDocuments;
+  size_t maxBytes;
+  size_t queuedDocuments;
+  size_t queuedBytes;
+
+  /* NULL until bgSpillDirectory is called */
+  struct sstream *spillDir;
+
   vector(struct bgCollection *) *collections;
+
+  /* Keyed by the address of the interned names */
+  struct hash_table collectionIndex;
+
+  vector(struct bgField *) *fields;
+  vector(struct bgSchema *) *schemas;
+  vector(struct bgDocument *) *templates;
   void (*errorFunc)(const char *cln, int code);
   void (*successFunc)(const char *cln, int count);
 };
@@ -1,2 +1,20 @@
 #define BG_URL "http://bu-games.bmth.ac.uk"
-#define BG_PATH "/api/v1"
\ No newline at end of file
+#define BG_PATH "/api/v1"
+
+/* Documents each collection can hold, whatever its budget */
+#define BG_QUEUE_CAPACITY 4096
+
+/* Spilled documents read back into a single upload */
+#define BG_SPILL_CHUNK 65536
+
+/*
+ * Documents are flat streams of records serialized straight to JSON. Define
+ * BG_DOCUMENT_TREE to build them as parson trees instead.
+ */
+/*#define BG_DOCUMENT_TREE*/
+
+/* Deepest dotted path bgDocumentAdd* accepts */
+#define BG_PATH_MAX_DEPTH 32
+
+#define BG_ERROR_UNKNOWN_COLLECTION -1
+#define BG_ERROR_QUEUE_FULL -2
@@ -28,6 +28,8 @@
 
 #ifndef AMALGAMATION
   #include "parson.h"
+
+  #include <palloc/number.h>
 #endif
 
 #include <stdio.h>
@@ -45,7 +47,6 @@
 #define ARRAY_MAX_CAPACITY    122880 /* 15*(2^13) */
 #define OBJECT_MAX_CAPACITY      960 /* 15*(2^6)  */
 #define MAX_NESTING               19
-#define DOUBLE_SERIALIZATION_FORMAT "%f"
 
 #define SIZEOF_TOKEN(a)       (sizeof(a) - 1)
 #define SKIP_CHAR(str)        ((*str)++)
@@ -57,6 +58,7 @@
 
 static JSON_Malloc_Function parson_malloc = malloc;
 static JSON_Free_Function parson_free = free;
+static JSON_Intern_Function parson_intern = NULL;
 
 #define IS_CONT(b) (((unsigned char)(b) & 0xC0) == 0x80) /* is utf-8 continuation byte */
 
@@ -96,6 +98,8 @@ static char * read_file(const char *filename);
 static void   remove_comments(char *string, const char *start_token, const char *end_token);
 static char * parson_strndup(const char *string, size_t n);
 static char * parson_strdup(const char *string);
+static char * parson_key(const char *string, size_t n);
+static void   parson_free_key(char *key);
 static int    hex_char_to_int(char c);
 static int    parse_utf16_hex(const char *string, unsigned int *result);
 static int    num_bytes_in_utf8_sequence(unsigned char c);
@@ -106,6 +110,7 @@ static int    is_decimal(const char *string, size_t length);
 /* JSON Object */
 static JSON_Object * json_object_init(JSON_Value *wrapping_value);
 static JSON_Status   json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
+static JSON_Status   json_object_add_interned(JSON_Object *object, const char *key, JSON_Value *value);
 static JSON_Status   json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value  * json_object_nget_value(const JSON_Object *object, const char *name, size_t n);
 static void          json_object_free(JSON_Object *object);
@@ -149,6 +154,19 @@ static char * parson_strndup(const char *string, size_t n) {
     return output_string;
 }
 
+static char * parson_key(const char *string, size_t n) {
+    if (parson_intern != NULL) {
+        return (char*)parson_intern(string, n);
+    }
+    return parson_strndup(string, n);
+}
+
+static void parson_free_key(char *key) {
+    if (parson_intern == NULL) {
+        parson_free(key);
+    }
+}
+
 static char * parson_strdup(const char *string) {
     return parson_strndup(string, strlen(string));
 }
@@ -364,7 +382,7 @@ static JSON_Status json_object_add(JSON_Object *object, const char *name, JSON_V
         }
     }
     index = object->count;
-    object->names[index] = parson_strdup(name);
+    object->names[index] = parson_key(name, strlen(name));
     if (object->names[index] == NULL) {
         return JSONFailure;
     }
@@ -407,6 +425,9 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 static JSON_Value * json_object_nget_value(const JSON_Object *object, const char *name, size_t n) {
     size_t i, name_length;
     for (i = 0; i < json_object_get_count(object); i++) {
+        if (object->names[i] == name && name[n] == '\0') { /* interned key */
+            return object->values[i];
+        }
         name_length = strlen(object->names[i]);
         if (name_length != n) {
             continue;
@@ -420,7 +441,7 @@ static JSON_Value * json_object_nget_value(const JSON_Object *object, const char
 
 static void json_object_free(JSON_Object *object) {
     while(object->count--) {
-        parson_free(object->names[object->count]);
+        parson_free_key(object->names[object->count]);
         json_value_free(object->values[object->count]);
     }
     parson_free(object->names);
@@ -918,13 +939,8 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
             if (buf != NULL) {
                 num_buf = buf;
             }
-            if (num == ((double)(int)num)) { /*  check if num is integer */
-                written = sprintf(num_buf, "%d", (int)num);
-	    } else if (num == ((double)(unsigned int)num)) {
-                written = sprintf(num_buf, "%u", (unsigned int)num);
-            } else {
-                written = sprintf(num_buf, DOUBLE_SERIALIZATION_FORMAT, num);
-            }
+            /* integers stay plain, others take a round-trip form */
+            written = (int)number_format_json(num_buf, num);
             if (written < 0) {
                 return -1;
             }
@@ -1433,6 +1449,26 @@ JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t
     return JSONSuccess;
 }
 
+size_t json_string_serialization_size(const char *string) {
+    int res = 0;
+    if (string == NULL || !is_valid_utf8(string, strlen(string))) {
+        return 0;
+    }
+    res = json_serialize_string(string, NULL);
+    return res < 0 ? 0 : (size_t)(res + 1);
+}
+
+JSON_Status json_serialize_string_to_buffer(const char *string, char *buf, size_t buf_size_in_bytes) {
+    size_t needed_size_in_bytes = json_string_serialization_size(string);
+    if (needed_size_in_bytes == 0 || buf_size_in_bytes < needed_size_in_bytes) {
+        return JSONFailure;
+    }
+    if (json_serialize_string(string, buf) < 0) {
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename) {
     JSON_Status return_code = JSONSuccess;
     FILE *fp = NULL;
@@ -1731,26 +1767,83 @@ JSON_Status json_object_dotset_value(JSON_Object *object, const char *name, JSON
     if (dot_pos == NULL) {
         return json_object_set_value(object, name, value);
     } else {
-        current_name = parson_strndup(name, dot_pos - name);
+        current_name = parson_key(name, dot_pos - name);
         temp_obj = json_object_get_object(object, current_name);
         if (temp_obj == NULL) {
             new_value = json_value_init_object();
             if (new_value == NULL) {
-                parson_free(current_name);
+                parson_free_key(current_name);
                 return JSONFailure;
             }
             if (json_object_add(object, current_name, new_value) == JSONFailure) {
                 json_value_free(new_value);
-                parson_free(current_name);
+                parson_free_key(current_name);
                 return JSONFailure;
             }
             temp_obj = json_object_get_object(object, current_name);
         }
-        parson_free(current_name);
+        parson_free_key(current_name);
         return json_object_dotset_value(temp_obj, dot_pos + 1, value);
     }
 }
 
+static JSON_Status json_object_add_interned(JSON_Object *object, const char *key, JSON_Value *value) {
+    if (object->count >= object->capacity) {
+        size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
+        if (new_capacity > OBJECT_MAX_CAPACITY) {
+            return JSONFailure;
+        }
+        if (json_object_resize(object, new_capacity) == JSONFailure) {
+            return JSONFailure;
+        }
+    }
+    object->names[object->count] = (char*)key;
+    object->values[object->count] = value;
+    value->parent = json_object_get_wrapping_value(object);
+    object->count++;
+    return JSONSuccess;
+}
+
+JSON_Status json_object_keyset_value(JSON_Object *object, const char * const *keys, size_t count, JSON_Value *value) {
+    JSON_Value *new_value = NULL;
+    size_t i = 0;
+    if (object == NULL || keys == NULL || count == 0 || value == NULL || value->parent != NULL || parson_intern == NULL) {
+        return JSONFailure;
+    }
+    for (; count > 1; keys++, count--) {
+        for (i = 0; i < object->count; i++) {
+            if (object->names[i] == *keys) {
+                break;
+            }
+        }
+        if (i < object->count) {
+            object = json_value_get_object(object->values[i]);
+            if (object == NULL) {
+                return JSONFailure;
+            }
+            continue;
+        }
+        new_value = json_value_init_object();
+        if (new_value == NULL) {
+            return JSONFailure;
+        }
+        if (json_object_add_interned(object, *keys, new_value) == JSONFailure) {
+            json_value_free(new_value);
+            return JSONFailure;
+        }
+        object = json_value_get_object(new_value);
+    }
+    for (i = 0; i < object->count; i++) {
+        if (object->names[i] == *keys) {
+            json_value_free(object->values[i]);
+            value->parent = json_object_get_wrapping_value(object);
+            object->values[i] = value;
+            return JSONSuccess;
+        }
+    }
+    return json_object_add_interned(object, *keys, value);
+}
+
 JSON_Status json_object_dotset_string(JSON_Object *object, const char *name, const char *string) {
     JSON_Value *value = json_value_init_string(string);
     if (value == NULL) {
@@ -1807,7 +1900,7 @@ JSON_Status json_object_remove(JSON_Object *object, const char *name) {
     last_item_index = json_object_get_count(object) - 1;
     for (i = 0; i < json_object_get_count(object); i++) {
         if (strcmp(object->names[i], name) == 0) {
-            parson_free(object->names[i]);
+            parson_free_key(object->names[i]);
             json_value_free(object->values[i]);
             if (i != last_item_index) { /* Replace key value pair with one from the end */
                 object->names[i] = object->names[last_item_index];
@@ -1844,7 +1937,7 @@ JSON_Status json_object_clear(JSON_Object *object) {
         return JSONFailure;
     }
     for (i = 0; i < json_object_get_count(object); i++) {
-        parson_free(object->names[i]);
+        parson_free_key(object->names[i]);
         json_value_free(object->values[i]);
     }
     object->count = 0;
@@ -2003,3 +2096,13 @@ void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Fu
     parson_malloc = malloc_fun;
     parson_free = free_fun;
 }
+
+void json_set_key_intern_function(JSON_Intern_Function intern_fun) {
+    parson_intern = intern_fun;
+}
+
+void json_node_sizes(size_t *value_size, size_t *object_size, size_t *array_size) {
+    *value_size = sizeof(JSON_Value);
+    *object_size = sizeof(JSON_Object);
+    *array_size = sizeof(JSON_Array);
+}
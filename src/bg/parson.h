@@ -55,11 +55,20 @@ typedef int JSON_Status;
 
 typedef void * (*JSON_Malloc_Function)(size_t);
 typedef void   (*JSON_Free_Function)(void *);
+typedef const char * (*JSON_Intern_Function)(const char *string, size_t n);
 
 /* Call only once, before calling any other function from parson API. If not called, malloc and free
    from stdlib will be used for all allocations */
 void json_set_allocation_functions(JSON_Malloc_Function malloc_fun, JSON_Free_Function free_fun);
 
+/* Call only once, before any object keys are created. Object keys are then obtained from intern_fun,
+   which must return the same stable pointer for equal strings, instead of being copied and they
+   are never freed by parson. Lookups compare interned keys by pointer first. */
+void json_set_key_intern_function(JSON_Intern_Function intern_fun);
+
+/* Sizes of the value, object and array nodes, so custom allocators can give them dedicated pools */
+void json_node_sizes(size_t *value_size, size_t *object_size, size_t *array_size);
+
 /* Parses first JSON value in a file, returns NULL in case of error */
 JSON_Value * json_parse_file(const char *filename);
 
@@ -77,6 +86,11 @@ JSON_Value * json_parse_string_with_comments(const char *string);
 /* Serialization */
 size_t      json_serialization_size(const JSON_Value *value); /* returns 0 on fail */
 JSON_Status json_serialize_to_buffer(const JSON_Value *value, char *buf, size_t buf_size_in_bytes);
+
+/* A single string quoted and escaped as it would be in a serialized value. The size includes the null
+   terminator and is 0 if the string is not valid UTF-8. */
+size_t      json_string_serialization_size(const char *string);
+JSON_Status json_serialize_string_to_buffer(const char *string, char *buf, size_t buf_size_in_bytes);
 JSON_Status json_serialize_to_file(const JSON_Value *value, const char *filename);
 char *      json_serialize_to_string(const JSON_Value *value);
 
@@ -154,6 +168,10 @@ JSON_Status json_object_dotset_number(JSON_Object *object, const char *name, dou
 JSON_Status json_object_dotset_boolean(JSON_Object *object, const char *name, int boolean);
 JSON_Status json_object_dotset_null(JSON_Object *object, const char *name);
 
+/* Same as json_object_dotset_value with the path already split into count keys. Keys must have been
+ * obtained from the function given to json_set_key_intern_function, they are compared by pointer only. */
+JSON_Status json_object_keyset_value(JSON_Object *object, const char * const *keys, size_t count, JSON_Value *value);
+
 /* Frees and removes name-value pair */
 JSON_Status json_object_remove(JSON_Object *object, const char *name);
 
@@ -33,6 +33,15 @@ void multiDocTest()
     struct bgDocument *doc = bgDocumentCreate();
     struct bgDocument *docX = bgDocumentCreate();
     struct bgDocument *docY = bgDocumentCreate();
+    struct bgValue xValues[] = {
+      {"String", BG_TYPE_CSTR, "X", 0},
+      {"boop.test", BG_TYPE_CSTR, "X", 0},
+      {"beep.floop", BG_TYPE_CSTR, "X", 0},
+      {"Val.a", BG_TYPE_INT, NULL, 32},
+      {"Val.b", BG_TYPE_INT, NULL, 35},
+      {"double", BG_TYPE_DOUBLE, NULL, 3.14159265789},
+      {"int", BG_TYPE_BOOL, NULL, 1}
+    };
   
     /*  Bunch of data to test  */
     bgDocumentAddCStr(doc, "String", "lotsaString and whitespace too\t and some \n backslash");
@@ -43,13 +52,7 @@ void multiDocTest()
     bgDocumentAddDouble(doc, "double", 3.14159265789);
     bgDocumentAddBool(doc, "int", 1);
 
-    bgDocumentAddCStr(docX, "String", "X");
-    bgDocumentAddCStr(docX, "boop.test", "X");
-    bgDocumentAddCStr(docX, "beep.floop", "X");
-    bgDocumentAddInt(docX, "Val.a", 32);
-    bgDocumentAddInt(docX, "Val.b", 35);
-    bgDocumentAddDouble(docX, "double", 3.14159265789);
-    bgDocumentAddBool(docX, "int", 1);
+    bgDocumentAddMany(docX, xValues, sizeof(xValues) / sizeof(xValues[0]));
 
     bgDocumentAddCStr(docY, "String", "y");
     bgDocumentAddCStr(docY, "boop.test", "y");
@@ -186,6 +186,7 @@ void _HttpPollConnect(struct Http *ctx)
 {
   size_t i = 0;
   sstream *content = NULL;
+  struct CustomHeader *header = NULL;
 
   //printf("polling connect\n");
 
@@ -295,16 +296,11 @@ void _HttpPollConnect(struct Http *ctx)
   sstream_push_cstr(content, sstream_cstr(ctx->host));
   sstream_push_cstr(content, "\r\n");
 
-  for(i = 0; i < vector_size(ctx->customHeaders); i++)
+  vector_foreach(header, ctx->customHeaders)
   {
-    sstream_push_cstr(content,
-      sstream_cstr(vector_at(ctx->customHeaders, i).variable));
-
+    sstream_push_cstr(content, sstream_cstr(header->variable));
     sstream_push_cstr(content, ": ");
-
-    sstream_push_cstr(content,
-      sstream_cstr(vector_at(ctx->customHeaders, i).value));
-
+    sstream_push_cstr(content, sstream_cstr(header->value));
     sstream_push_cstr(content, "\r\n");
   }
 
@@ -334,46 +330,21 @@ void _HttpPollConnect(struct Http *ctx)
 
 void _HttpProcessHeaders(struct Http *ctx)
 {
-  vector(sstream *) *lines = NULL;
-  vector(sstream *) *line = NULL;
-  size_t i = 0;
-  size_t j = 0;
-
-  lines = vector_new(sstream *);
-  line = vector_new(sstream *);
-  sstream_split(ctx->rawHeaders, '\n', lines);
+  struct sstrview rest = sstream_view(ctx->rawHeaders);
+  struct sstrview line = {0};
+  struct sstrview parts[2] = {{0}};
 
-  for(i = 0; i < vector_size(lines); i++)
+  while(sstrview_next(&rest, '\n', &line))
   {
-    sstream_split(vector_at(lines, i), ' ', line);
-
-    if(vector_size(line) >= 2)
+    if(sstrview_split(line, ' ', parts, 2) >= 2)
     {
-      if(strcmp(sstream_cstr(vector_at(line, 0)), "HTTP/1.1") == 0 ||
-        strcmp(sstream_cstr(vector_at(line, 0)), "HTTP/1.0") == 0)
+      if(sstrview_equals(parts[0], "HTTP/1.1") ||
+        sstrview_equals(parts[0], "HTTP/1.0"))
       {
-        //printf("Status: %s\n", sstream_cstr(vector_at(line, 1)));
-        ctx->status = atoi(sstream_cstr(vector_at(line, 1)));
+        ctx->status = sstrview_int(parts[1]);
       }
     }
-
-    for(j = 0; j < vector_size(line); j++)
-    {
-      sstream_delete(vector_at(line, j));
-    }
-
-    vector_clear(line);
-  }
-
-  //printf("%i %s\n", (int)vector_size(lines), sstream_cstr(ctx->rawHeaders));
-
-  for(i = 0; i < vector_size(lines); i++)
-  {
-    sstream_delete(vector_at(lines, i));
   }
-
-  vector_delete(lines);
-  vector_delete(line);
 }
 
 void _HttpProcessRaw(struct Http *ctx)
@@ -392,13 +363,7 @@ void _HttpProcessRaw(struct Http *ctx)
 
       if(strcmp(last, "\r\n\r\n") == 0)
       {
-        size_t c = 0;
-
-        for(c = 0; c < i-3; c++)
-        {
-          sstream_push_char(ctx->rawHeaders, vector_at(ctx->raw, c));
-        }
-
+        sstream_push_chars(ctx->rawHeaders, vector_raw(ctx->raw), i - 3);
         _HttpProcessHeaders(ctx);
         break;
       }
@@ -409,12 +374,10 @@ void _HttpProcessRaw(struct Http *ctx)
 
   if(ctx->sock == NULL_SOCKET)
   {
-    size_t i = 0;
+    size_t offset = sstream_length(ctx->rawHeaders) + 4;
 
-    for(i = sstream_length(ctx->rawHeaders) + 4; i < vector_size(ctx->raw); i++)
-    {
-      sstream_push_char(ctx->rawContent, vector_at(ctx->raw, i));
-    }
+    sstream_push_chars(ctx->rawContent, vector_raw(ctx->raw) + offset,
+      vector_size(ctx->raw) - offset);
 
     //printf("Content: %s\n", sstream_cstr(ctx->rawContent));
   }
@@ -451,7 +414,6 @@ void _HttpPollReceive(struct Http *ctx)
   else
   {
     char buff[BUFFER_SIZE] = {0};
-    size_t i = 0;
 #ifdef USE_POSIX
     ssize_t n = 0;
 
@@ -466,10 +428,7 @@ void _HttpPollReceive(struct Http *ctx)
     if(n != SOCKET_ERROR && n != 0)
 #endif
     {
-      for(i = 0; i < n; i++)
-      {
-        vector_push_back(ctx->raw, buff[i]);
-      }
+      vector_append(ctx->raw, buff, n);
 
       //printf("Data waiting: %s\n", buff);
     }
@@ -0,0 +1,165 @@
+#ifndef AMALGAMATION
+  #include "arena.h"
+  #include "palloc.h"
+#endif
+
+#include <stdio.h>
+
+/* Size of a pooled block including its header */
+#define ARENA_BLOCK_SIZE 1024
+#define ARENA_POOL_MAX 1024
+
+union ArenaAlign
+{
+  double d;
+  void *p;
+  size_t s;
+};
+
+#define ARENA_ALIGN(S) \
+  (((S) + sizeof(union ArenaAlign) - 1) & ~(sizeof(union ArenaAlign) - 1))
+
+/*
+ * Blocks bigger than ARENA_BLOCK_SIZE hold a single oversized allocation and
+ * are handed straight back to palloc when released.
+ */
+struct ArenaBlock
+{
+  struct ArenaBlock *next;
+  size_t size;
+  union ArenaAlign align;
+};
+
+#define ARENA_HEADER_SIZE ARENA_ALIGN(sizeof(struct ArenaBlock))
+
+static struct ArenaBlock *arenaPool;
+static size_t arenaPoolCount;
+
+static struct ArenaBlock *arena_block(size_t size)
+{
+  struct ArenaBlock *rtn = NULL;
+
+  if(size == ARENA_BLOCK_SIZE && arenaPool)
+  {
+    rtn = arenaPool;
+    arenaPool = rtn->next;
+    arenaPoolCount--;
+
+    return rtn;
+  }
+
+  rtn = (struct ArenaBlock *)_palloc_uninit(size, "arena_block");
+
+  if(!rtn)
+  {
+    printf("Error: Failed to allocate\n");
+    return NULL;
+  }
+
+  rtn->size = size;
+
+  return rtn;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+  struct ArenaBlock *block = NULL;
+  void *rtn = NULL;
+
+  size = ARENA_ALIGN(size);
+
+  if(size <= a->remaining)
+  {
+    rtn = a->cursor;
+    a->cursor += size;
+    a->remaining -= size;
+
+    return rtn;
+  }
+
+  /* Oversized requests get their own block behind the current one so the
+   * space left in it is not lost.
+   */
+  if(size > ARENA_BLOCK_SIZE - ARENA_HEADER_SIZE)
+  {
+    block = arena_block(ARENA_HEADER_SIZE + size);
+
+    if(!block)
+    {
+      return NULL;
+    }
+
+    a->size += block->size;
+
+    if(a->blocks)
+    {
+      block->next = a->blocks->next;
+      a->blocks->next = block;
+    }
+    else
+    {
+      block->next = NULL;
+      a->blocks = block;
+    }
+
+    return (char *)block + ARENA_HEADER_SIZE;
+  }
+
+  block = arena_block(ARENA_BLOCK_SIZE);
+
+  if(!block)
+  {
+    return NULL;
+  }
+
+  block->next = a->blocks;
+  a->blocks = block;
+  a->size += block->size;
+
+  rtn = (char *)block + ARENA_HEADER_SIZE;
+  a->cursor = (char *)rtn + size;
+  a->remaining = ARENA_BLOCK_SIZE - ARENA_HEADER_SIZE - size;
+
+  return rtn;
+}
+
+void arena_reset(struct arena *a)
+{
+  struct ArenaBlock *block = a->blocks;
+
+  while(block)
+  {
+    struct ArenaBlock *next = block->next;
+
+    if(block->size == ARENA_BLOCK_SIZE && arenaPoolCount < ARENA_POOL_MAX)
+    {
+      block->next = arenaPool;
+      arenaPool = block;
+      arenaPoolCount++;
+    }
+    else
+    {
+      pfree(block);
+    }
+
+    block = next;
+  }
+
+  a->blocks = NULL;
+  a->cursor = NULL;
+  a->remaining = 0;
+  a->size = 0;
+}
+
+void arena_trim()
+{
+  while(arenaPool)
+  {
+    struct ArenaBlock *next = arenaPool->next;
+
+    pfree(arenaPool);
+    arenaPool = next;
+  }
+
+  arenaPoolCount = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef PALLOC_ARENA_H
+#define PALLOC_ARENA_H
+
+#include <stdlib.h>
+
+struct ArenaBlock;
+
+/*
+ * Region allocator. Allocations are bumped out of a chain of blocks and are
+ * never freed individually, arena_reset() releases all of them at once. A
+ * zeroed arena is empty and ready to use.
+ *
+ * Released blocks are kept in a global pool so refilling an arena after a
+ * reset usually does not touch malloc.
+ */
+struct arena
+{
+  struct ArenaBlock *blocks;
+  char *cursor;
+  size_t remaining;
+
+  /* Bytes held in blocks, headers included */
+  size_t size;
+};
+
+/* Memory is suitably aligned for any type but not zeroed */
+void *arena_alloc(struct arena *a, size_t size);
+
+/* Releases every allocation in the arena, leaving it empty */
+void arena_reset(struct arena *a);
+
+/* Frees the blocks held in the pool */
+void arena_trim();
+
+#endif
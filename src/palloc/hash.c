@@ -0,0 +1,87 @@
+#ifndef AMALGAMATION
+  #include "hash.h"
+#endif
+
+size_t hash_pointer(const void *ptr)
+{
+  return ((size_t)ptr >> 3) * 2654435761u;
+}
+
+size_t hash_bytes(const char *s, size_t len)
+{
+  size_t rtn = 2166136261u;
+  size_t i = 0;
+
+  for(i = 0; i < len; i++)
+  {
+    rtn ^= (unsigned char)s[i];
+    rtn *= 16777619u;
+  }
+
+  return rtn;
+}
+
+void **hash_slot(struct hash_table *table, size_t hash, const void *key,
+  hash_match_fn match)
+{
+  size_t mask = table->capacity - 1;
+  size_t i = hash & mask;
+
+  while(table->slots[i] && !match(table->slots[i], key))
+  {
+    i = (i + 1) & mask;
+  }
+
+  return &table->slots[i];
+}
+
+size_t hash_grow(struct hash_table *table, size_t min)
+{
+  size_t rtn = table->capacity * 2;
+
+  if((table->count + 1) * 2 <= table->capacity)
+  {
+    return 0;
+  }
+
+  if(rtn < min)
+  {
+    rtn = min;
+  }
+
+  return rtn;
+}
+
+void **hash_rehash(struct hash_table *table, void **slots, size_t capacity,
+  hash_entry_fn hash)
+{
+  void **old = table->slots;
+  size_t oldCapacity = table->capacity;
+  size_t mask = capacity - 1;
+  size_t i = 0;
+
+  table->slots = slots;
+  table->capacity = capacity;
+
+  /* Entries are distinct so the first empty slot will do */
+  for(i = 0; i < oldCapacity; i++)
+  {
+    size_t j = 0;
+
+    if(!old[i])
+    {
+      continue;
+    }
+
+    j = hash(old[i]) & mask;
+
+    while(slots[j])
+    {
+      j = (j + 1) & mask;
+    }
+
+    slots[j] = old[i];
+  }
+
+  return old;
+}
@@ -0,0 +1,48 @@
+#ifndef PALLOC_HASH_H
+#define PALLOC_HASH_H
+
+#include <stdlib.h>
+
+/*
+ * Open addressed table of entry pointers with linear probing, kept at most
+ * half full. Entries are never removed one by one. The table does not
+ * allocate, callers provide the zeroed slots when it grows so it can be used
+ * beneath palloc as well as on top of it.
+ */
+struct hash_table
+{
+  void **slots;
+  size_t capacity;
+  size_t count;
+};
+
+/* Whether entry holds key */
+typedef int (*hash_match_fn)(const void *entry, const void *key);
+
+/* Hash of the key held by entry, as given to hash_slot when it was added */
+typedef size_t (*hash_entry_fn)(const void *entry);
+
+size_t hash_pointer(const void *ptr);
+size_t hash_bytes(const char *s, size_t len);
+
+/*
+ * Slot holding the entry that matches key, or the empty one it would go in.
+ * The table must have a capacity.
+ */
+void **hash_slot(struct hash_table *table, size_t hash, const void *key,
+  hash_match_fn match);
+
+/*
+ * Capacity the table needs before one more entry is added, at least min, or
+ * 0 if it has room.
+ */
+size_t hash_grow(struct hash_table *table, size_t min);
+
+/*
+ * Moves every entry into slots of the given capacity, zeroed by the caller.
+ * Returns the previous slots for the caller to free, NULL if there were none.
+ */
+void **hash_rehash(struct hash_table *table, void **slots, size_t capacity,
+  hash_entry_fn hash);
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef AMALGAMATION
+  #include "intern.h"
+  #include "hash.h"
+  #include "palloc.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#define INTERN_MIN_CAPACITY 64
+#define INTERN_BLOCK_SIZE 4096
+
+/* Stored right in front of the characters of each string */
+struct InternEntry
+{
+  size_t hash;
+  size_t len;
+};
+
+/* What a string is looked up by */
+struct InternKey
+{
+  size_t hash;
+  size_t len;
+  const char *s;
+};
+
+/*
+ * Strings are packed into blocks that are never moved or freed before
+ * intern_clear() so their addresses are stable while the table rehashes.
+ */
+struct InternBlock
+{
+  struct InternBlock *next;
+  size_t used;
+  size_t size;
+};
+
+static struct hash_table internTable;
+static struct InternBlock *internBlocks;
+
+static int intern_match(const void *entry, const void *key)
+{
+  const struct InternEntry *e = (const struct InternEntry *)entry;
+  const struct InternKey *k = (const struct InternKey *)key;
+
+  return e->hash == k->hash && e->len == k->len &&
+    memcmp(e + 1, k->s, k->len) == 0;
+}
+
+static size_t intern_entry_hash(const void *entry)
+{
+  return ((const struct InternEntry *)entry)->hash;
+}
+
+static int intern_rehash(size_t capacity)
+{
+  void **slots = (void **)_palloc(capacity * sizeof(void *), "intern table");
+  void **old = NULL;
+
+  if(!slots)
+  {
+    printf("Error: Failed to allocate\n");
+    return 0;
+  }
+
+  old = hash_rehash(&internTable, slots, capacity, intern_entry_hash);
+
+  if(old)
+  {
+    pfree(old);
+  }
+
+  return 1;
+}
+
+static struct InternEntry *intern_store(const struct InternKey *key)
+{
+  struct InternBlock *block = internBlocks;
+  struct InternEntry *rtn = NULL;
+
+  /* Entries stay aligned for their header */
+  size_t size = sizeof(*rtn) + key->len + 1;
+  size = (size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+
+  if(!block || block->size - block->used < size)
+  {
+    size_t blockSize = INTERN_BLOCK_SIZE;
+
+    if(blockSize < size)
+    {
+      blockSize = size;
+    }
+
+    block = (struct InternBlock *)_palloc_uninit(sizeof(*block) + blockSize,
+      "intern block");
+
+    if(!block)
+    {
+      printf("Error: Failed to allocate\n");
+      return NULL;
+    }
+
+    block->used = 0;
+    block->size = blockSize;
+    block->next = internBlocks;
+    internBlocks = block;
+  }
+
+  rtn = (struct InternEntry *)((char *)(block + 1) + block->used);
+  rtn->hash = key->hash;
+  rtn->len = key->len;
+  memcpy(rtn + 1, key->s, key->len);
+  ((char *)(rtn + 1))[key->len] = '\0';
+  block->used += size;
+
+  return rtn;
+}
+
+const char *intern_chars(const char *s, size_t len)
+{
+  struct InternKey key = {0};
+  void **slot = NULL;
+  size_t capacity = hash_grow(&internTable, INTERN_MIN_CAPACITY);
+
+  if(capacity && !intern_rehash(capacity))
+  {
+    return NULL;
+  }
+
+  key.hash = hash_bytes(s, len);
+  key.len = len;
+  key.s = s;
+  slot = hash_slot(&internTable, key.hash, &key, intern_match);
+
+  if(!*slot)
+  {
+    *slot = intern_store(&key);
+
+    if(!*slot)
+    {
+      return NULL;
+    }
+
+    internTable.count++;
+  }
+
+  return (const char *)((struct InternEntry *)*slot + 1);
+}
+
+const char *intern_cstr(const char *s)
+{
+  return intern_chars(s, strlen(s));
+}
+
+const char *intern_find(const char *s)
+{
+  struct InternKey key = {0};
+  void *entry = NULL;
+
+  if(internTable.count == 0)
+  {
+    return NULL;
+  }
+
+  key.len = strlen(s);
+  key.hash = hash_bytes(s, key.len);
+  key.s = s;
+  entry = *hash_slot(&internTable, key.hash, &key, intern_match);
+
+  if(!entry)
+  {
+    return NULL;
+  }
+
+  return (const char *)((struct InternEntry *)entry + 1);
+}
+
+size_t intern_count()
+{
+  return internTable.count;
+}
+
+void intern_clear()
+{
+  while(internBlocks)
+  {
+    struct InternBlock *tmp = internBlocks;
+
+    internBlocks = internBlocks->next;
+    pfree(tmp);
+  }
+
+  if(internTable.slots)
+  {
+    pfree(internTable.slots);
+  }
+
+  internTable.slots = NULL;
+  internTable.capacity = 0;
+  internTable.count = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef PALLOC_INTERN_H
+#define PALLOC_INTERN_H
+
+#include <stdlib.h>
+
+/*
+ * Global table of immutable strings. Interning the same contents twice gives
+ * the same pointer so interned strings can be compared with ==. Pointers stay
+ * valid until intern_clear() is called.
+ */
+const char *intern_cstr(const char *s);
+const char *intern_chars(const char *s, size_t len);
+
+/* Returns the interned copy of s or NULL without adding it to the table */
+const char *intern_find(const char *s);
+
+size_t intern_count();
+void intern_clear();
+
+#endif
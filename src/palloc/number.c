@@ -0,0 +1,543 @@
+#ifndef AMALGAMATION
+  #include "number.h"
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NUMBER_U64(H, L) \
+  (((uint64_t)(H) << 32) | (uint64_t)(L))
+
+/*
+ * Floating point value f * 2^e with a full 64 bit significand. This is the
+ * "do it yourself floating point" type the Grisu algorithm is built on.
+ */
+struct NumberFp
+{
+  uint64_t f;
+  int e;
+};
+
+/* Normalized powers of ten 10^-348, 10^-340, ..., 10^340 */
+static const uint64_t numberPowersF[] =
+{
+  NUMBER_U64(0xfa8fd5a0, 0x081c0288), NUMBER_U64(0xbaaee17f, 0xa23ebf76), NUMBER_U64(0x8b16fb20, 0x3055ac76),
+  NUMBER_U64(0xcf42894a, 0x5dce35ea), NUMBER_U64(0x9a6bb0aa, 0x55653b2d), NUMBER_U64(0xe61acf03, 0x3d1a45df),
+  NUMBER_U64(0xab70fe17, 0xc79ac6ca), NUMBER_U64(0xff77b1fc, 0xbebcdc4f), NUMBER_U64(0xbe5691ef, 0x416bd60c),
+  NUMBER_U64(0x8dd01fad, 0x907ffc3c), NUMBER_U64(0xd3515c28, 0x31559a83), NUMBER_U64(0x9d71ac8f, 0xada6c9b5),
+  NUMBER_U64(0xea9c2277, 0x23ee8bcb), NUMBER_U64(0xaecc4991, 0x4078536d), NUMBER_U64(0x823c1279, 0x5db6ce57),
+  NUMBER_U64(0xc2109436, 0x4dfb5637), NUMBER_U64(0x9096ea6f, 0x3848984f), NUMBER_U64(0xd77485cb, 0x25823ac7),
+  NUMBER_U64(0xa086cfcd, 0x97bf97f4), NUMBER_U64(0xef340a98, 0x172aace5), NUMBER_U64(0xb23867fb, 0x2a35b28e),
+  NUMBER_U64(0x84c8d4df, 0xd2c63f3b), NUMBER_U64(0xc5dd4427, 0x1ad3cdba), NUMBER_U64(0x936b9fce, 0xbb25c996),
+  NUMBER_U64(0xdbac6c24, 0x7d62a584), NUMBER_U64(0xa3ab6658, 0x0d5fdaf6), NUMBER_U64(0xf3e2f893, 0xdec3f126),
+  NUMBER_U64(0xb5b5ada8, 0xaaff80b8), NUMBER_U64(0x87625f05, 0x6c7c4a8b), NUMBER_U64(0xc9bcff60, 0x34c13053),
+  NUMBER_U64(0x964e858c, 0x91ba2655), NUMBER_U64(0xdff97724, 0x70297ebd), NUMBER_U64(0xa6dfbd9f, 0xb8e5b88f),
+  NUMBER_U64(0xf8a95fcf, 0x88747d94), NUMBER_U64(0xb9447093, 0x8fa89bcf), NUMBER_U64(0x8a08f0f8, 0xbf0f156b),
+  NUMBER_U64(0xcdb02555, 0x653131b6), NUMBER_U64(0x993fe2c6, 0xd07b7fac), NUMBER_U64(0xe45c10c4, 0x2a2b3b06),
+  NUMBER_U64(0xaa242499, 0x697392d3), NUMBER_U64(0xfd87b5f2, 0x8300ca0e), NUMBER_U64(0xbce50864, 0x92111aeb),
+  NUMBER_U64(0x8cbccc09, 0x6f5088cc), NUMBER_U64(0xd1b71758, 0xe219652c), NUMBER_U64(0x9c400000, 0x00000000),
+  NUMBER_U64(0xe8d4a510, 0x00000000), NUMBER_U64(0xad78ebc5, 0xac620000), NUMBER_U64(0x813f3978, 0xf8940984),
+  NUMBER_U64(0xc097ce7b, 0xc90715b3), NUMBER_U64(0x8f7e32ce, 0x7bea5c70), NUMBER_U64(0xd5d238a4, 0xabe98068),
+  NUMBER_U64(0x9f4f2726, 0x179a2245), NUMBER_U64(0xed63a231, 0xd4c4fb27), NUMBER_U64(0xb0de6538, 0x8cc8ada8),
+  NUMBER_U64(0x83c7088e, 0x1aab65db), NUMBER_U64(0xc45d1df9, 0x42711d9a), NUMBER_U64(0x924d692c, 0xa61be758),
+  NUMBER_U64(0xda01ee64, 0x1a708dea), NUMBER_U64(0xa26da399, 0x9aef774a), NUMBER_U64(0xf209787b, 0xb47d6b85),
+  NUMBER_U64(0xb454e4a1, 0x79dd1877), NUMBER_U64(0x865b8692, 0x5b9bc5c2), NUMBER_U64(0xc83553c5, 0xc8965d3d),
+  NUMBER_U64(0x952ab45c, 0xfa97a0b3), NUMBER_U64(0xde469fbd, 0x99a05fe3), NUMBER_U64(0xa59bc234, 0xdb398c25),
+  NUMBER_U64(0xf6c69a72, 0xa3989f5c), NUMBER_U64(0xb7dcbf53, 0x54e9bece), NUMBER_U64(0x88fcf317, 0xf22241e2),
+  NUMBER_U64(0xcc20ce9b, 0xd35c78a5), NUMBER_U64(0x98165af3, 0x7b2153df), NUMBER_U64(0xe2a0b5dc, 0x971f303a),
+  NUMBER_U64(0xa8d9d153, 0x5ce3b396), NUMBER_U64(0xfb9b7cd9, 0xa4a7443c), NUMBER_U64(0xbb764c4c, 0xa7a44410),
+  NUMBER_U64(0x8bab8eef, 0xb6409c1a), NUMBER_U64(0xd01fef10, 0xa657842c), NUMBER_U64(0x9b10a4e5, 0xe9913129),
+  NUMBER_U64(0xe7109bfb, 0xa19c0c9d), NUMBER_U64(0xac2820d9, 0x623bf429), NUMBER_U64(0x80444b5e, 0x7aa7cf85),
+  NUMBER_U64(0xbf21e440, 0x03acdd2d), NUMBER_U64(0x8e679c2f, 0x5e44ff8f), NUMBER_U64(0xd433179d, 0x9c8cb841),
+  NUMBER_U64(0x9e19db92, 0xb4e31ba9), NUMBER_U64(0xeb96bf6e, 0xbadf77d9), NUMBER_U64(0xaf87023b, 0x9bf0ee6b)
+};
+
+static const short numberPowersE[] =
+{
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint32_t numberPow10[] =
+{
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static const char numberDigits[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+static struct NumberFp number_fp_normalize(struct NumberFp v)
+{
+#ifdef __GNUC__
+  int shift = __builtin_clzll(v.f);
+
+  v.f <<= shift;
+  v.e -= shift;
+#else
+  while(!(v.f & NUMBER_U64(0x80000000, 0x00000000)))
+  {
+    v.f <<= 1;
+    v.e--;
+  }
+#endif
+
+  return v;
+}
+
+/* Product of two values, rounded to the upper 64 bits of the significand */
+static struct NumberFp number_fp_multiply(struct NumberFp x, struct NumberFp y)
+{
+  struct NumberFp rtn = {0};
+  uint64_t m32 = 0xFFFFFFFF;
+  uint64_t a = x.f >> 32;
+  uint64_t b = x.f & m32;
+  uint64_t c = y.f >> 32;
+  uint64_t d = y.f & m32;
+  uint64_t ac = a * c;
+  uint64_t bc = b * c;
+  uint64_t ad = a * d;
+  uint64_t bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+
+  tmp += (uint64_t)1 << 31;
+  rtn.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  rtn.e = x.e + y.e + 64;
+
+  return rtn;
+}
+
+/* Cached power of ten c so that c * 2^e has its exponent in [-60, -32] */
+static struct NumberFp number_cached_power(int e, int *K)
+{
+  struct NumberFp rtn = {0};
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int k = (int)dk;
+  int index = 0;
+
+  if(dk - k > 0.0)
+  {
+    k++;
+  }
+
+  index = (k >> 3) + 1;
+  *K = -(-348 + index * 8);
+
+  rtn.f = numberPowersF[index];
+  rtn.e = numberPowersE[index];
+
+  return rtn;
+}
+
+static int number_count_digits(uint32_t n)
+{
+  int rtn = 1;
+
+  while(rtn < 10 && n >= numberPow10[rtn])
+  {
+    rtn++;
+  }
+
+  return rtn;
+}
+
+static void number_grisu_round(char *buf, int len, uint64_t delta,
+  uint64_t rest, uint64_t tenKappa, uint64_t wpw)
+{
+  while(rest < wpw && delta - rest >= tenKappa &&
+    (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw))
+  {
+    buf[len - 1]--;
+    rest += tenKappa;
+  }
+}
+
+static void number_digit_gen(struct NumberFp W, struct NumberFp Mp,
+  uint64_t delta, char *buf, int *len, int *K)
+{
+  struct NumberFp one = {0};
+  uint64_t wpw = Mp.f - W.f;
+  uint32_t p1 = 0;
+  uint64_t p2 = 0;
+  int kappa = 0;
+
+  one.f = (uint64_t)1 << -Mp.e;
+  one.e = Mp.e;
+  p1 = (uint32_t)(Mp.f >> -one.e);
+  p2 = Mp.f & (one.f - 1);
+  kappa = number_count_digits(p1);
+  *len = 0;
+
+  /* Integral part */
+  while(kappa > 0)
+  {
+    uint32_t d = p1 / numberPow10[kappa - 1];
+    uint64_t rest = 0;
+
+    p1 %= numberPow10[kappa - 1];
+
+    if(d || *len)
+    {
+      buf[(*len)++] = (char)('0' + d);
+    }
+
+    kappa--;
+    rest = ((uint64_t)p1 << -one.e) + p2;
+
+    if(rest <= delta)
+    {
+      *K += kappa;
+      number_grisu_round(buf, *len, delta, rest,
+        (uint64_t)numberPow10[kappa] << -one.e, wpw);
+
+      return;
+    }
+  }
+
+  /* Fractional part */
+  for(;;)
+  {
+    char d = 0;
+    int index = 0;
+
+    p2 *= 10;
+    delta *= 10;
+    d = (char)(p2 >> -one.e);
+
+    if(d || *len)
+    {
+      buf[(*len)++] = (char)('0' + d);
+    }
+
+    p2 &= one.f - 1;
+    kappa--;
+
+    if(p2 < delta)
+    {
+      *K += kappa;
+      index = -kappa;
+      number_grisu_round(buf, *len, delta, p2, one.f,
+        wpw * (index < 10 ? numberPow10[index] : 0));
+
+      return;
+    }
+  }
+}
+
+/*
+ * Round-trip digits for the positive value f * 2^e, usually but not always
+ * the shortest, where closer is set if the lower neighbour is half as far
+ * away as the upper one (f is a power of two).
+ * The result is digits[0..len) * 10^K.
+ */
+static void number_grisu2(uint64_t f, int e, int closer, char *digits,
+  int *len, int *K)
+{
+  struct NumberFp v = {0};
+  struct NumberFp mp = {0};
+  struct NumberFp mm = {0};
+  struct NumberFp c = {0};
+  struct NumberFp W = {0};
+  struct NumberFp Wp = {0};
+  struct NumberFp Wm = {0};
+
+  v.f = f;
+  v.e = e;
+
+  mp.f = (f << 1) + 1;
+  mp.e = e - 1;
+  mp = number_fp_normalize(mp);
+
+  if(closer)
+  {
+    mm.f = (f << 2) - 1;
+    mm.e = e - 2;
+  }
+  else
+  {
+    mm.f = (f << 1) - 1;
+    mm.e = e - 1;
+  }
+
+  mm.f <<= mm.e - mp.e;
+  mm.e = mp.e;
+
+  c = number_cached_power(mp.e, K);
+  W = number_fp_multiply(number_fp_normalize(v), c);
+  Wp = number_fp_multiply(mp, c);
+  Wm = number_fp_multiply(mm, c);
+  Wm.f++;
+  Wp.f--;
+
+  number_digit_gen(W, Wp, Wp.f - Wm.f, digits, len, K);
+}
+
+static size_t number_write_u32(char *buf, uint32_t val)
+{
+  char tmp[10] = {0};
+  char *p = tmp + sizeof(tmp);
+  size_t len = 0;
+
+  while(val >= 100)
+  {
+    size_t i = (val % 100) * 2;
+
+    val /= 100;
+    *--p = numberDigits[i + 1];
+    *--p = numberDigits[i];
+  }
+
+  if(val >= 10)
+  {
+    size_t i = val * 2;
+
+    *--p = numberDigits[i + 1];
+    *--p = numberDigits[i];
+  }
+  else
+  {
+    *--p = (char)('0' + val);
+  }
+
+  len = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+
+  return len;
+}
+
+/*
+ * Lay out digits[0..len) * 10^K in the same style as JavaScript, plain
+ * notation for decimal exponents in [-6, 21) and exponent notation outside.
+ */
+static size_t number_prettify(char *buf, const char *digits, int len, int K)
+{
+  char *p = buf;
+  int kk = len + K;
+  int i = 0;
+
+  if(K >= 0 && kk <= 21)
+  {
+    memcpy(p, digits, len);
+    p += len;
+
+    for(i = len; i < kk; i++)
+    {
+      *p++ = '0';
+    }
+  }
+  else if(kk > 0 && kk <= 21)
+  {
+    memcpy(p, digits, kk);
+    p += kk;
+    *p++ = '.';
+    memcpy(p, digits + kk, len - kk);
+    p += len - kk;
+  }
+  else if(kk > -6 && kk <= 0)
+  {
+    *p++ = '0';
+    *p++ = '.';
+
+    for(i = kk; i < 0; i++)
+    {
+      *p++ = '0';
+    }
+
+    memcpy(p, digits, len);
+    p += len;
+  }
+  else
+  {
+    int exp = kk - 1;
+
+    *p++ = digits[0];
+
+    if(len > 1)
+    {
+      *p++ = '.';
+      memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
+
+    *p++ = 'e';
+
+    if(exp < 0)
+    {
+      *p++ = '-';
+      exp = -exp;
+    }
+    else
+    {
+      *p++ = '+';
+    }
+
+    return (p - buf) + number_write_u32(p, (uint32_t)exp);
+  }
+
+  *p = '\0';
+
+  return p - buf;
+}
+
+static size_t number_special(char *buf, int negative, int nan)
+{
+  if(nan)
+  {
+    strcpy(buf, "nan");
+  }
+  else if(negative)
+  {
+    strcpy(buf, "-inf");
+  }
+  else
+  {
+    strcpy(buf, "inf");
+  }
+
+  return strlen(buf);
+}
+
+size_t number_format_uint(char *buf, unsigned int val)
+{
+  return number_write_u32(buf, (uint32_t)val);
+}
+
+size_t number_format_int(char *buf, int val)
+{
+  if(val < 0)
+  {
+    buf[0] = '-';
+
+    return 1 + number_write_u32(buf + 1, (uint32_t)0 - (uint32_t)val);
+  }
+
+  return number_write_u32(buf, (uint32_t)val);
+}
+
+size_t number_format_double(char *buf, double val)
+{
+  uint64_t bits = 0;
+  uint64_t significand = 0;
+  int biased = 0;
+  char digits[20] = {0};
+  int len = 0;
+  int K = 0;
+  char *p = buf;
+
+  memcpy(&bits, &val, sizeof(bits));
+  biased = (int)((bits >> 52) & 0x7FF);
+  significand = bits & NUMBER_U64(0x000FFFFF, 0xFFFFFFFF);
+
+  if(biased == 0x7FF)
+  {
+    return number_special(buf, (int)(bits >> 63), significand != 0);
+  }
+
+  if(bits >> 63)
+  {
+    *p++ = '-';
+  }
+
+  if(biased == 0 && significand == 0)
+  {
+    *p++ = '0';
+    *p = '\0';
+
+    return p - buf;
+  }
+
+  if(biased != 0)
+  {
+    number_grisu2(significand | NUMBER_U64(0x00100000, 0x00000000),
+      biased - 1075, significand == 0 && biased > 1, digits, &len, &K);
+  }
+  else
+  {
+    number_grisu2(significand, -1074, 0, digits, &len, &K);
+  }
+
+  return (p - buf) + number_prettify(p, digits, len, K);
+}
+
+size_t number_format_float(char *buf, float val)
+{
+  uint32_t bits = 0;
+  uint32_t significand = 0;
+  int biased = 0;
+  char digits[20] = {0};
+  int len = 0;
+  int K = 0;
+  char *p = buf;
+
+  memcpy(&bits, &val, sizeof(bits));
+  biased = (int)((bits >> 23) & 0xFF);
+  significand = bits & 0x007FFFFF;
+
+  if(biased == 0xFF)
+  {
+    return number_special(buf, (int)(bits >> 31), significand != 0);
+  }
+
+  if(bits >> 31)
+  {
+    *p++ = '-';
+  }
+
+  if(biased == 0 && significand == 0)
+  {
+    *p++ = '0';
+    *p = '\0';
+
+    return p - buf;
+  }
+
+  if(biased != 0)
+  {
+    number_grisu2(significand | 0x00800000, biased - 150,
+      significand == 0 && biased > 1, digits, &len, &K);
+  }
+  else
+  {
+    number_grisu2(significand, -149, 0, digits, &len, &K);
+  }
+
+  return (p - buf) + number_prettify(p, digits, len, K);
+}
+
+size_t number_format_json(char *buf, double val)
+{
+  /* NaN and the infinities have no JSON form */
+  if(val != val || val - val != 0)
+  {
+    strcpy(buf, "null");
+
+    return 4;
+  }
+
+  /* Checked against the range first, converting anything outside of it to
+   * int is undefined.
+   */
+  if(val >= INT_MIN && val <= INT_MAX && val == (double)(int)val)
+  {
+    return number_format_int(buf, (int)val);
+  }
+
+  return number_format_double(buf, val);
+}
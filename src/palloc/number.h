@@ -0,0 +1,32 @@
+#ifndef PALLOC_NUMBER_H
+#define PALLOC_NUMBER_H
+
+#include <stdlib.h>
+
+/*
+ * Largest output of any of the number_format_* functions including the
+ * null terminator, e.g. "-2.2250738585072014e-308".
+ */
+#define NUMBER_BUFFER_SIZE 32
+
+/*
+ * Write the decimal representation of val into buf and return the number of
+ * characters written, excluding the null terminator. Floating point values
+ * are written with Grisu2, which always parses back to the same value and is
+ * the shortest such digit string in the vast majority of cases, but may be a
+ * digit or so longer. They switch to exponent notation outside of 1e-6 to
+ * 1e21.
+ */
+size_t number_format_int(char *buf, int val);
+size_t number_format_uint(char *buf, unsigned int val);
+size_t number_format_float(char *buf, float val);
+size_t number_format_double(char *buf, double val);
+
+/*
+ * Write val as a JSON number: integral values in the range of int without a
+ * fraction, others as number_format_double, and null for NaN and infinities
+ * which JSON has no form for.
+ */
+size_t number_format_json(char *buf, double val);
+
+#endif
@@ -1,26 +1,193 @@
 #ifndef AMALGAMATION
   #include "palloc.h"
+  #include "hash.h"
 #endif
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 
 static int registered;
 
+/*
+ * Statistics. Type strings are hashed by address into a fixed table, the
+ * index is kept with each allocation so frees are attributed in O(1). Types
+ * beyond the table's capacity share the last entry.
+ */
+#define PALLOC_TAGS 64
+#define PALLOC_TAG_OTHER PALLOC_TAGS
+
+static struct palloc_tag pallocTags[PALLOC_TAGS + 1];
+static struct palloc_stats pallocStats;
+
+static size_t palloc_tag(const char *type)
+{
+  size_t i = hash_pointer(type) & (PALLOC_TAGS - 1);
+  size_t n = 0;
+
+  for(n = 0; n < PALLOC_TAGS; n++)
+  {
+    if(pallocTags[i].type == type)
+    {
+      return i;
+    }
+
+    if(!pallocTags[i].type)
+    {
+      pallocTags[i].type = type;
+      return i;
+    }
+
+    i = (i + 1) & (PALLOC_TAGS - 1);
+  }
+
+  pallocTags[PALLOC_TAG_OTHER].type = "(other)";
+
+  return PALLOC_TAG_OTHER;
+}
+
+static void palloc_count_alloc(size_t tag, size_t size)
+{
+  pallocStats.liveBytes += size;
+  pallocStats.liveObjects++;
+  pallocStats.allocs++;
+
+  if(pallocStats.liveBytes > pallocStats.peakBytes)
+  {
+    pallocStats.peakBytes = pallocStats.liveBytes;
+  }
+
+  pallocTags[tag].count++;
+  pallocTags[tag].bytes += size;
+}
+
+static void palloc_count_free(size_t tag, size_t size)
+{
+  pallocStats.liveBytes -= size;
+  pallocStats.liveObjects--;
+  pallocStats.frees++;
+
+  pallocTags[tag].count--;
+  pallocTags[tag].bytes -= size;
+}
+
+static void palloc_count_hold(size_t size)
+{
+  pallocStats.heldBytes += size;
+
+  if(pallocStats.heldBytes > pallocStats.peakHeldBytes)
+  {
+    pallocStats.peakHeldBytes = pallocStats.heldBytes;
+  }
+}
+
+static void palloc_count_release(size_t size)
+{
+  pallocStats.heldBytes -= size;
+}
+
+void *palloc_buffer(void *ptr, size_t old, size_t size, const char *type)
+{
+  size_t tag = palloc_tag(type);
+  void *rtn = NULL;
+
+  if(size == 0)
+  {
+    if(ptr)
+    {
+      free(ptr);
+      palloc_count_free(tag, old);
+      palloc_count_release(old);
+    }
+
+    return NULL;
+  }
+
+  rtn = realloc(ptr, size);
+
+  if(!rtn)
+  {
+    return NULL;
+  }
+
+  if(ptr)
+  {
+    palloc_count_free(tag, old);
+    palloc_count_release(old);
+  }
+
+  palloc_count_alloc(tag, size);
+  palloc_count_hold(size);
+
+  return rtn;
+}
+
+void palloc_stats(struct palloc_stats *out)
+{
+  *out = pallocStats;
+}
+
+size_t palloc_tags(struct palloc_tag *out, size_t max)
+{
+  size_t rtn = 0;
+  size_t i = 0;
+
+  for(i = 0; i <= PALLOC_TAG_OTHER; i++)
+  {
+    if(pallocTags[i].count == 0)
+    {
+      continue;
+    }
+
+    if(rtn < max)
+    {
+      out[rtn] = pallocTags[i];
+    }
+
+    rtn++;
+  }
+
+  return rtn;
+}
+
+/*
+ * Debug pool. Entries are found by pointer through an open addressed index
+ * and freed entries wait for reuse in a bucket per (type, size), so both
+ * palloc and pfree are O(1) however many allocations have been made.
+ */
+#define POOL_MIN_CAPACITY 256
+#define POOL_BUCKETS 256
+
+struct PoolBucket
+{
+  char *type;
+  size_t size;
+  size_t hash;
+  struct PoolEntry *free;
+  struct PoolBucket *next;
+};
+
 struct PoolEntry
 {
   void *ptr;
   size_t size;
   char *type;
+  size_t tag;
   int used;
+  struct PoolBucket *bucket;
+  struct PoolEntry *nextFree;
   struct PoolEntry *next;
 };
 
 struct PoolEntry *poolHead;
 
+static struct hash_table poolIndex;
+static struct PoolBucket *poolBuckets[POOL_BUCKETS];
+
 void pool_cleanup()
 {
   struct PoolEntry *curr = poolHead;
+  size_t i = 0;
 
   printf("[palloc]Evaluating memory...\n");
 
@@ -37,7 +204,6 @@ void pool_cleanup()
     }
     else
     {
-      size_t i = 0;
       char *ptr = (char*)curr->ptr;
       int dirty = 0;
 
@@ -61,52 +227,299 @@ void pool_cleanup()
 
     curr = curr->next;
 
+    palloc_count_release(sizeof(*tmp) + tmp->size);
     free(tmp->ptr);
-    free(tmp->type);
     free(tmp);
   }
 
   poolHead = NULL;
+
+  for(i = 0; i < POOL_BUCKETS; i++)
+  {
+    while(poolBuckets[i])
+    {
+      struct PoolBucket *tmp = poolBuckets[i];
+
+      poolBuckets[i] = tmp->next;
+      free(tmp->type);
+      free(tmp);
+    }
+  }
+
+  free(poolIndex.slots);
+  poolIndex.slots = NULL;
+  poolIndex.capacity = 0;
+  poolIndex.count = 0;
 }
 
+#ifndef PALLOC_ACTIVE
+#define PALLOC_LARGE 0xff
+#define PALLOC_CLASS_MASK 0xff
+#define PALLOC_TAG_SHIFT 8
+
+union PallocHeader
+{
+  size_t cls;
+  void *next;
+  double align;
+};
+
+/* Large blocks carry their size in front of the class header */
+static void *palloc_large(size_t size, const char *type)
+{
+  union PallocHeader *header = NULL;
+  size_t tag = palloc_tag(type);
+
+  header = (union PallocHeader *)malloc(sizeof(*header) * 2 + size);
+  if(!header) return NULL;
+
+  header[0].cls = size;
+  header[1].cls = PALLOC_LARGE | tag << PALLOC_TAG_SHIFT;
+  palloc_count_alloc(tag, size);
+  palloc_count_hold(sizeof(*header) * 2 + size);
+
+  return header + 2;
+}
+
+static void palloc_large_free(union PallocHeader *header)
+{
+  header--;
+  palloc_count_free(header[1].cls >> PALLOC_TAG_SHIFT, header[0].cls);
+  palloc_count_release(sizeof(*header) * 2 + header[0].cls);
+  free(header);
+}
+#endif
+
 #ifdef PALLOC_ACTIVE
-void pfree(void *ptr)
+static int pool_match(const void *entry, const void *ptr)
+{
+  return ((const struct PoolEntry *)entry)->ptr == ptr;
+}
+
+static size_t pool_entry_hash(const void *entry)
+{
+  return hash_pointer(((const struct PoolEntry *)entry)->ptr);
+}
+
+static struct PoolEntry *pool_find(const void *ptr)
+{
+  if(poolIndex.count == 0)
+  {
+    return NULL;
+  }
+
+  return (struct PoolEntry *)*hash_slot(&poolIndex, hash_pointer(ptr), ptr,
+    pool_match);
+}
+
+static int pool_index(struct PoolEntry *entry)
 {
-  struct PoolEntry *entry = poolHead;
+  /* The index itself can not come from the pool */
+  size_t capacity = hash_grow(&poolIndex, POOL_MIN_CAPACITY);
 
-  while(entry)
+  if(capacity)
   {
-    if(entry->ptr == ptr)
+    void **slots = (void **)calloc(capacity, sizeof(void *));
+
+    if(!slots)
     {
-      if(!entry->used)
-      {
-        printf("Error: Memory already freed\n");
-      }
+      printf("Error: Failed to allocate\n");
+      return 0;
+    }
+
+    free(hash_rehash(&poolIndex, slots, capacity, pool_entry_hash));
+  }
+
+  *hash_slot(&poolIndex, hash_pointer(entry->ptr), entry->ptr, pool_match) =
+    entry;
+  poolIndex.count++;
+
+  return 1;
+}
+
+static struct PoolBucket *pool_bucket(const char *type, size_t size)
+{
+  struct PoolBucket *rtn = NULL;
+  size_t hash = 2166136261u;
+  const char *c = type;
+
+  for(c = type; *c; c++)
+  {
+    hash ^= (unsigned char)*c;
+    hash *= 16777619u;
+  }
+
+  hash ^= size;
+
+  for(rtn = poolBuckets[hash % POOL_BUCKETS]; rtn; rtn = rtn->next)
+  {
+    if(rtn->hash == hash && rtn->size == size && strcmp(rtn->type, type) == 0)
+    {
+      return rtn;
+    }
+  }
+
+  rtn = (struct PoolBucket *)calloc(1, sizeof(*rtn));
+  if(!rtn) return NULL;
+
+  rtn->type = (char *)calloc(strlen(type) + 1, sizeof(char));
+
+  if(!rtn->type)
+  {
+    free(rtn);
+    return NULL;
+  }
+
+  strcpy(rtn->type, type);
+  rtn->size = size;
+  rtn->hash = hash;
+  rtn->next = poolBuckets[hash % POOL_BUCKETS];
+  poolBuckets[hash % POOL_BUCKETS] = rtn;
+
+  return rtn;
+}
+
+void pfree(void *ptr)
+{
+  struct PoolEntry *entry = pool_find(ptr);
+
+  if(!entry)
+  {
+    printf("Error: Memory not managed by pool\n");
+    return;
+  }
+
+  if(!entry->used)
+  {
+    printf("Error: Memory already freed\n");
+    return;
+  }
 
 #ifdef PALLOC_DEBUG
-      printf("Freeing: %s\n", entry->type);
+  printf("Freeing: %s\n", entry->type);
 #endif
-      memset(entry->ptr, PALLOC_SENTINEL, entry->size);
-      entry->used = 0;
-      return;
-    }
+  palloc_count_free(entry->tag, entry->size);
+
+  memset(entry->ptr, PALLOC_SENTINEL, entry->size);
+  entry->used = 0;
+
+  entry->nextFree = entry->bucket->free;
+  entry->bucket->free = entry;
+}
+#elif defined(PALLOC_SLAB)
+/*
+ * Size class allocator. Every block is preceded by a header holding its class
+ * and statistics tag so pfree can push it back onto the matching free list in
+ * O(1). Each class carves its blocks out of its own pages. Blocks larger than
+ * the biggest class go straight to malloc with their size in a second header.
+ */
+#define PALLOC_PAGE_SIZE 65536
+#define PALLOC_CLASSES 12
+#define PALLOC_GRANULE 16
+#define PALLOC_MAX_SMALL 1024
+
+static const size_t pallocClassSize[PALLOC_CLASSES] =
+{
+  16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024
+};
 
-    entry = entry->next;
+/* Class for each size rounded up to the granule, indexed by size / granule */
+static const unsigned char pallocClassIndex[] =
+{
+  0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7,
+  7, 8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9,
+  9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+  10, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+  11
+};
+
+static void *pallocFree[PALLOC_CLASSES];
+static char *pallocCursor[PALLOC_CLASSES];
+static char *pallocEnd[PALLOC_CLASSES];
+static union PallocHeader *pallocPages;
+static size_t pallocLive;
+
+static int palloc_new_page(size_t cls)
+{
+  union PallocHeader *page = NULL;
+
+  page = (union PallocHeader *)malloc(PALLOC_PAGE_SIZE);
+
+  if(!page)
+  {
+    return 0;
+  }
+
+  page->next = pallocPages;
+  pallocPages = page;
+  palloc_count_hold(PALLOC_PAGE_SIZE);
+
+  pallocCursor[cls] = (char *)(page + 1);
+  pallocEnd[cls] = (char *)page + PALLOC_PAGE_SIZE;
+
+  return 1;
+}
+
+void pfree(void *ptr)
+{
+  union PallocHeader *header = NULL;
+  size_t cls = 0;
+
+  if(!ptr) return;
+
+  header = (union PallocHeader *)ptr - 1;
+  cls = header->cls & PALLOC_CLASS_MASK;
+
+  if(cls == PALLOC_LARGE)
+  {
+    palloc_large_free(header);
+    return;
+  }
+
+  palloc_count_free(header->cls >> PALLOC_TAG_SHIFT, pallocClassSize[cls]);
+
+  /* The link lives in the user part, the header keeps the class */
+  *(void **)ptr = pallocFree[cls];
+  pallocFree[cls] = ptr;
+  pallocLive--;
+}
+
+/* Release every page, only possible once no small block is in use */
+void palloc_trim()
+{
+  if(pallocLive > 0) return;
+
+  while(pallocPages)
+  {
+    union PallocHeader *tmp = pallocPages;
+
+    pallocPages = (union PallocHeader *)pallocPages->next;
+    free(tmp);
+    palloc_count_release(PALLOC_PAGE_SIZE);
   }
 
-  printf("Error: Memory not managed by pool\n");
+  memset(pallocFree, 0, sizeof(pallocFree));
+  memset(pallocCursor, 0, sizeof(pallocCursor));
+  memset(pallocEnd, 0, sizeof(pallocEnd));
 }
 #else
 void pfree(void *ptr)
 {
-  free(ptr);
+  if(!ptr) return;
+
+  palloc_large_free((union PallocHeader *)ptr - 1);
+}
+
+void palloc_trim()
+{
 }
 #endif
 
 #ifdef PALLOC_ACTIVE
 void *_palloc(size_t size, const char *type)
 {
-  struct PoolEntry *entry = poolHead;
+  struct PoolBucket *bucket = NULL;
+  struct PoolEntry *entry = NULL;
 
   if(!registered)
   {
@@ -115,47 +528,51 @@ void *_palloc(size_t size, const char *type)
     atexit(pool_cleanup);
   }
 
-  while(entry)
+  bucket = pool_bucket(type, size);
+  if(!bucket) return NULL;
+
+  entry = bucket->free;
+
+  if(entry)
   {
-    if(!entry->used && strcmp(type, entry->type) == 0)
-    {
-      char *ptr = (char *)entry->ptr;
-      size_t i = 0;
-      int dirty = 0;
+    char *ptr = (char *)entry->ptr;
+    size_t i = 0;
+    int dirty = 0;
 
 #ifdef PALLOC_DEBUG
-      printf("Reusing: %s\n", type);
+    printf("Reusing: %s\n", type);
 #endif
 
-      for(i = 0; i < entry->size; i++)
+    for(i = 0; i < entry->size; i++)
+    {
+      if(*ptr != PALLOC_SENTINEL)
       {
-        if(*ptr != PALLOC_SENTINEL)
-        {
-          dirty = 1;
-          break;
-        }
-
-        ptr++;
+        dirty = 1;
+        break;
       }
 
-      if(dirty)
-      {
-        printf("[palloc]Use after free\n");
-        printf("  Type: %s\n", entry->type);
-        printf("  Size: %i\n", (int)entry->size);
-      }
+      ptr++;
+    }
 
-      entry->used = 1;
+    if(dirty)
+    {
+      printf("[palloc]Use after free\n");
+      printf("  Type: %s\n", entry->type);
+      printf("  Size: %i\n", (int)entry->size);
+    }
 
-      if(PALLOC_SENTINEL != 0)
-      {
-        memset(entry->ptr, 0, entry->size);
-      }
+    bucket->free = entry->nextFree;
+    entry->nextFree = NULL;
+    entry->used = 1;
+    entry->tag = palloc_tag(type);
+    palloc_count_alloc(entry->tag, size);
 
-      return entry->ptr;
+    if(PALLOC_SENTINEL != 0)
+    {
+      memset(entry->ptr, 0, entry->size);
     }
 
-    entry = entry->next;
+    return entry->ptr;
   }
 
 #ifdef PALLOC_DEBUG
@@ -172,23 +589,105 @@ void *_palloc(size_t size, const char *type)
     return NULL;
   }
 
+  if(!pool_index(entry))
+  {
+    free(entry->ptr);
+    free(entry);
+    return NULL;
+  }
+
   entry->size = size;
-  entry->type = (char *)calloc(strlen(type) + 1, sizeof(char));
-  strcpy(entry->type, type);
+  entry->bucket = bucket;
+  entry->type = bucket->type;
   entry->used = 1;
+  entry->tag = palloc_tag(type);
+  palloc_count_alloc(entry->tag, size);
+  palloc_count_hold(sizeof(*entry) + size);
 
   entry->next = poolHead;
   poolHead = entry;
 
   return entry->ptr;
 }
+
+void *_palloc_uninit(size_t size, const char *type)
+{
+  return _palloc(size, type);
+}
+
+void palloc_trim()
+{
+}
+#elif defined(PALLOC_SLAB)
+void *_palloc_uninit(size_t size, const char *type)
+{
+  union PallocHeader *header = NULL;
+  size_t cls = 0;
+  size_t tag = 0;
+  size_t stride = 0;
+
+  if(size > PALLOC_MAX_SMALL)
+  {
+    return palloc_large(size, type);
+  }
+
+  cls = pallocClassIndex[(size + PALLOC_GRANULE - 1) / PALLOC_GRANULE];
+  tag = palloc_tag(type);
+
+  if(pallocFree[cls])
+  {
+    void *rtn = pallocFree[cls];
+
+    pallocFree[cls] = *(void **)rtn;
+    ((union PallocHeader *)rtn - 1)->cls = cls | tag << PALLOC_TAG_SHIFT;
+    palloc_count_alloc(tag, pallocClassSize[cls]);
+    pallocLive++;
+
+    return rtn;
+  }
+
+  stride = sizeof(*header) + pallocClassSize[cls];
+
+  if(pallocEnd[cls] - pallocCursor[cls] < (ptrdiff_t)stride)
+  {
+    if(!palloc_new_page(cls)) return NULL;
+  }
+
+  header = (union PallocHeader *)pallocCursor[cls];
+  pallocCursor[cls] += stride;
+  header->cls = cls | tag << PALLOC_TAG_SHIFT;
+  palloc_count_alloc(tag, pallocClassSize[cls]);
+  pallocLive++;
+
+  return header + 1;
+}
+
+void *_palloc(size_t size, const char *type)
+{
+  void *rtn = _palloc_uninit(size, type);
+
+  if(rtn)
+  {
+    memset(rtn, 0, size);
+  }
+
+  return rtn;
+}
 #else
 void *_palloc(size_t size, const char *type)
 {
-  void *rtn = NULL;
+  void *rtn = palloc_large(size, type);
 
-  rtn = calloc(1, size);
+  if(rtn)
+  {
+    memset(rtn, 0, size);
+  }
 
   return rtn;
 }
+
+void *_palloc_uninit(size_t size, const char *type)
+{
+  return palloc_large(size, type);
+}
 #endif
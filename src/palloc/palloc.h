@@ -5,12 +5,67 @@
 
 /*#define PALLOC_DEBUG*/
 /*#define PALLOC_ACTIVE*/
+/*#define PALLOC_VECTOR_CHECKED*/
 #define PALLOC_SENTINEL 1
 
+/*
+ * Allocation strategy, PALLOC_ACTIVE takes precedence and tracks every
+ * allocation for leak and use after free reports. PALLOC_SLAB serves small
+ * objects from per size class free lists. With neither, palloc is calloc.
+ */
+#define PALLOC_SLAB
+
+/*
+ * Counters kept in every mode. Each allocation is attributed to the address
+ * of its type string, the #T literal of palloc(T). Live bytes are what has
+ * been handed out, held bytes what has been taken from malloc to do so:
+ * slab pages whether or not they are full, large blocks and buffers with
+ * their headers, and debug pool entries waiting for reuse.
+ */
+struct palloc_stats
+{
+  size_t liveBytes;
+  size_t liveObjects;
+  size_t peakBytes;
+
+  size_t heldBytes;
+  size_t peakHeldBytes;
+
+  /* Running totals */
+  size_t allocs;
+  size_t frees;
+};
+
+struct palloc_tag
+{
+  const char *type;
+  size_t count;
+  size_t bytes;
+};
+
 void pfree(void *ptr);
 void *_palloc(size_t size, const char *type);
+void *_palloc_uninit(size_t size, const char *type);
+void palloc_trim();
+
+/*
+ * Buffers that grow in place live outside of the pools. Reallocates ptr from
+ * old bytes to size bytes, or frees it if size is 0, and counts it against
+ * type like any other allocation. Returns NULL and leaves ptr alone on
+ * failure.
+ */
+void *palloc_buffer(void *ptr, size_t old, size_t size, const char *type);
+
+void palloc_stats(struct palloc_stats *out);
+
+/* Copies up to max tags with live objects, returns how many there are */
+size_t palloc_tags(struct palloc_tag *out, size_t max);
 
 #define palloc(T) \
   (T*)_palloc(sizeof(T), #T)
 
+/* Same as palloc but the memory is not zeroed */
+#define palloc_uninit(T) \
+  (T*)_palloc_uninit(sizeof(T), #T)
+
 #endif
@@ -0,0 +1,98 @@
+#ifndef AMALGAMATION
+  #include "ring.h"
+  #include "palloc.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+/* The type strings are literals built by ring_new, palloc keys its
+ * statistics on their addresses.
+ */
+void *_RingNew(size_t size, size_t capacity, const char *type,
+  const char *headerType)
+{
+  struct _Ring *rtn = NULL;
+  size_t actual = 1;
+
+  while(actual < capacity)
+  {
+    actual *= 2;
+  }
+
+  rtn = (struct _Ring *)_palloc(sizeof(*rtn), type);
+  rtn->rh = (struct _RingHeader *)_palloc(sizeof(*rtn->rh), headerType);
+  rtn->rh->entrySize = size;
+  rtn->rh->mask = actual - 1;
+
+  rtn->data = _palloc(actual * size, "ring data");
+
+  if(!rtn->data)
+  {
+    printf("Error: Failed to allocate\n");
+  }
+
+  return rtn;
+}
+
+size_t _RingPeekBatch(void *_rh, void *_r, void *out, size_t max)
+{
+  struct _RingHeader *rh = (struct _RingHeader *)_rh;
+  struct _Ring *r = (struct _Ring *)_r;
+  size_t count = rh->tail - rh->head;
+  size_t start = rh->head & rh->mask;
+  size_t first = 0;
+
+  if(count > max)
+  {
+    count = max;
+  }
+
+  /* The batch may wrap around the end of the storage */
+  first = rh->mask + 1 - start;
+
+  if(first > count)
+  {
+    first = count;
+  }
+
+  memcpy(out, (char *)r->data + start * rh->entrySize,
+    first * rh->entrySize);
+
+  memcpy((char *)out + first * rh->entrySize, r->data,
+    (count - first) * rh->entrySize);
+
+  return count;
+}
+
+void _RingDiscard(void *_rh, size_t count)
+{
+  struct _RingHeader *rh = (struct _RingHeader *)_rh;
+
+  if(count > rh->tail - rh->head)
+  {
+    printf("Error: Index out of bounds\n");
+    count = rh->tail - rh->head;
+  }
+
+  rh->head += count;
+}
+
+void _RingDelete(void *_rh, void *_r)
+{
+  struct _Ring *r = (struct _Ring *)_r;
+  struct _RingHeader *rh = (struct _RingHeader *)_rh;
+
+  if(r->rh != rh)
+  {
+    printf("Error: Invalid ring\n");
+  }
+
+  if(r->data)
+  {
+    pfree(r->data);
+  }
+
+  pfree(rh);
+  pfree(r);
+}
@@ -0,0 +1,87 @@
+#ifndef PALLOC_RING_H
+#define PALLOC_RING_H
+
+#ifndef AMALGAMATION
+  #include "palloc.h"
+#endif
+
+#include <stdlib.h>
+
+/*
+ * Fixed capacity FIFO queue. The capacity is rounded up to a power of two so
+ * wrapping is a mask and the storage is allocated once in ring_new. The head
+ * and tail are free running counters, their difference is the size.
+ */
+struct _RingHeader
+{
+  size_t head;
+  size_t tail;
+  size_t mask;
+  size_t entrySize;
+};
+
+struct _Ring
+{
+  struct _RingHeader *rh;
+  void *data;
+};
+
+#define ring(T) \
+  T*
+
+void *_RingNew(size_t size, size_t capacity, const char *type,
+  const char *headerType);
+size_t _RingPeekBatch(void *_rh, void *_r, void *out, size_t max);
+void _RingDiscard(void *_rh, size_t count);
+void _RingDelete(void *_rh, void *_r);
+
+#define ring_new(T, C) \
+  (ring(T) *)_RingNew(sizeof(T), C, "ring(" #T ")", "ring_header(" #T ")")
+
+#define ring_delete(R) \
+  _RingDelete(R[0], R)
+
+#define _ring_header(R) \
+  ((struct _RingHeader *)(void *)R[0])
+
+#define ring_size(R) \
+  (_ring_header(R)->tail - _ring_header(R)->head)
+
+#define ring_capacity(R) \
+  (_ring_header(R)->mask + 1)
+
+#define ring_empty(R) \
+  (ring_size(R) == 0)
+
+#define ring_full(R) \
+  (ring_size(R) == ring_capacity(R))
+
+/* I-th oldest entry, I must be less than ring_size */
+#define ring_at(R, I) \
+  (R[1][(_ring_header(R)->head + (I)) & _ring_header(R)->mask])
+
+/* Evaluates to 1 if D was queued or 0 if the ring is full */
+#define ring_push(R, D) \
+  (ring_full(R) ? 0 : \
+    (R[1][_ring_header(R)->tail++ & _ring_header(R)->mask] = (D), 1))
+
+/* Evaluates to 1 and stores the oldest entry in OUT or 0 if empty */
+#define ring_pop(R, OUT) \
+  (ring_empty(R) ? 0 : \
+    ((OUT) = R[1][_ring_header(R)->head++ & _ring_header(R)->mask], 1))
+
+/*
+ * Copy up to MAX of the oldest entries into the array OUT without removing
+ * them and evaluate to the number copied. Entries pushed meanwhile are left
+ * alone by a following ring_discard of that count.
+ */
+#define ring_peek_batch(R, OUT, MAX) \
+  _RingPeekBatch(R[0], R, OUT, MAX)
+
+#define ring_discard(R, C) \
+  _RingDiscard(R[0], C)
+
+#define ring_clear(R) \
+  _RingDiscard(R[0], ring_size(R))
+
+#endif
@@ -1,263 +1,343 @@
 #ifndef AMALGAMATION
   #include "sstream.h"
+  #include "number.h"
   #include "palloc.h"
 #endif
 
 #include <string.h>
 #include <stdio.h>
 
+/*
+ * Ensure there is room for extra characters plus the null terminator. The
+ * capacity is doubled until it fits so repeated appends stay linear overall.
+ */
+static void sstream_grow(struct sstream *ctx, size_t extra)
+{
+  size_t needed = ctx->length + extra + 1;
+  size_t capacity = ctx->capacity;
+  char *data = NULL;
+
+  if(needed <= capacity) return;
+
+  while(capacity < needed)
+  {
+    capacity *= 2;
+  }
+
+  if(ctx->data == ctx->local)
+  {
+    data = (char *)palloc_buffer(NULL, 0, capacity, "sstream data");
+
+    if(data)
+    {
+      memcpy(data, ctx->local, ctx->length + 1);
+    }
+  }
+  else
+  {
+    data = (char *)palloc_buffer(ctx->data, ctx->capacity, capacity,
+      "sstream data");
+  }
+
+  if(!data)
+  {
+    printf("Error: Failed to reallocate\n");
+    abort();
+  }
+
+  ctx->data = data;
+  ctx->capacity = capacity;
+}
+
 struct sstream *sstream_new()
 {
   struct sstream *rtn = NULL;
 
-  rtn = palloc(struct sstream);
+  rtn = palloc_uninit(struct sstream);
+  rtn->data = rtn->local;
+  rtn->length = 0;
+  rtn->capacity = SSTREAM_LOCAL_SIZE;
+  rtn->local[0] = '\0';
 
   return rtn;
 }
 
 void sstream_clear(struct sstream *ctx)
 {
-  struct Chunk *curr = ctx->first;
+  /* Keep the buffer around, streams are usually refilled */
+  ctx->length = 0;
+  ctx->data[0] = '\0';
+}
 
-  while(curr)
+void sstream_truncate(struct sstream *ctx, size_t length)
+{
+  if(length < ctx->length)
   {
-    struct Chunk *tmp = curr;
-
-    curr = curr->next;
-    if(tmp->s) free(tmp->s);
-    pfree(tmp);
+    ctx->length = length;
+    ctx->data[length] = '\0';
   }
-
-  ctx->first = NULL;
 }
 
 void sstream_delete(struct sstream *ctx)
 {
-  sstream_clear(ctx);
+  if(ctx->data != ctx->local)
+  {
+    palloc_buffer(ctx->data, ctx->capacity, 0, "sstream data");
+  }
+
   pfree(ctx);
 }
 
 void sstream_push_int(struct sstream *ctx, int val)
 {
-  char buffer[128] = {0};
+  size_t len = 0;
 
-  sprintf(buffer, "%i", val);
-  sstream_push_cstr(ctx, buffer);
+  sstream_grow(ctx, NUMBER_BUFFER_SIZE);
+  len = number_format_int(ctx->data + ctx->length, val);
+  ctx->length += len;
 }
 
 void sstream_push_float(struct sstream *ctx, float val)
 {
-  char buffer[128] = {0};
+  size_t len = 0;
 
-  sprintf(buffer, "%f", val);
-  sstream_push_cstr(ctx, buffer);
+  sstream_grow(ctx, NUMBER_BUFFER_SIZE);
+  len = number_format_float(ctx->data + ctx->length, val);
+  ctx->length += len;
 }
 
 void sstream_push_double(struct sstream *ctx, double val)
 {
-  char buffer[128] = {0};
+  size_t len = 0;
 
-  sprintf(buffer, "%f", val);
-  sstream_push_cstr(ctx, buffer);
+  sstream_grow(ctx, NUMBER_BUFFER_SIZE);
+  len = number_format_double(ctx->data + ctx->length, val);
+  ctx->length += len;
 }
 
 void sstream_push_char(struct sstream *ctx, char val)
 {
-/*
-  char buffer[2] = {0};
+  sstream_grow(ctx, 1);
+  ctx->data[ctx->length] = val;
+  ctx->length++;
+  ctx->data[ctx->length] = '\0';
+}
 
-  buffer[0] = val;
-  sstream_push_cstr(ctx, buffer);
-*/
+void sstream_push_cstr(struct sstream *ctx, const char *s)
+{
+  size_t len = strlen(s);
 
-  struct Chunk *nc = NULL;
-  struct Chunk *curr = NULL;
+  if(len < 1) return;
 
-  nc = palloc(struct Chunk);
-  nc->c = val;
-  nc->len = 1;
+  sstream_grow(ctx, len);
+  memcpy(ctx->data + ctx->length, s, len + 1);
+  ctx->length += len;
+}
 
-  if(!ctx->first)
-  {
-    ctx->first = nc;
-    return;
-  }
+char *sstream_cstr(struct sstream *ctx)
+{
+  return ctx->data;
+}
 
-  curr = ctx->first;
+size_t sstream_length(struct sstream *ctx)
+{
+  return ctx->length;
+}
 
-  while(curr->next)
-  {
-    curr = curr->next;
-  }
+size_t sstream_capacity(struct sstream *ctx)
+{
+  return ctx->capacity - 1;
+}
+
+void sstream_reserve(struct sstream *ctx, size_t capacity)
+{
+  if(capacity <= ctx->length) return;
 
-  curr->next = nc;
+  sstream_grow(ctx, capacity - ctx->length);
 }
 
-void sstream_push_cstr(struct sstream *ctx, const char *s)
+struct sstream_builder sstream_builder_begin(struct sstream *ctx, size_t count)
 {
-  struct Chunk *nc = NULL;
-  struct Chunk *curr = NULL;
-  size_t len = strlen(s);
+  struct sstream_builder rtn = {0};
 
-  if(len < 1) return;
+  sstream_grow(ctx, count);
+  ctx->data[ctx->length] = '\0';
 
-  nc = palloc(struct Chunk);
-  nc->s = (char *)malloc(sizeof(char) * (len + 1));
-  strcpy(nc->s, s);
-  nc->len = len;
+  rtn.ctx = ctx;
+  rtn.tail = ctx->data + ctx->length;
+  rtn.remaining = ctx->capacity - ctx->length;
 
-  if(!ctx->first)
-  {
-    ctx->first = nc;
-    return;
-  }
+  return rtn;
+}
 
-  curr = ctx->first;
+void sstream_builder_commit(struct sstream_builder *builder, size_t count)
+{
+  struct sstream *ctx = builder->ctx;
 
-  while(curr->next)
+  if(count >= builder->remaining)
   {
-    curr = curr->next;
+    printf("Error: Builder overflow\n");
+    abort();
   }
 
-  curr->next = nc;
+  ctx->length += count;
+  ctx->data[ctx->length] = '\0';
+
+  builder->tail = ctx->data + ctx->length;
+  builder->remaining -= count;
 }
 
-void sstream_collate(struct sstream *ctx)
+int sstream_int(struct sstream *ctx)
 {
-  size_t allocSize = 0;
-  struct Chunk *curr = ctx->first;
-  char *ns = NULL;
-
-  if(!curr) return;
+  return atoi(ctx->data);
+}
 
-  if(curr->s)
+char sstream_at(struct sstream *ctx, size_t i)
+{
+  if(ctx->length == 0)
   {
-    if(!curr->next) return;
+    printf("Error: Stream is empty\n");
+    abort();
   }
 
-  while(curr)
+  if(i >= ctx->length)
   {
-    allocSize += curr->len;
-    curr = curr->next;
+    printf("Error: Index out of bounds\n");
+    abort();
   }
 
-  allocSize++;
-  ns = (char *)malloc(allocSize * sizeof(char));
-  ns[0] = '\0';
-  curr = ctx->first;
+  return ctx->data[i];
+}
 
-  while(curr)
-  {
-    struct Chunk *tmp = curr;
+void sstream_push_chars(struct sstream *ctx, char *values, size_t count)
+{
+  if(count < 1) return;
 
-    if(!curr->s)
-    {
-      char cs[2] = {0};
+  sstream_grow(ctx, count);
+  memcpy(ctx->data + ctx->length, values, count);
+  ctx->length += count;
+  ctx->data[ctx->length] = '\0';
+}
 
-      cs[0] = curr->c;
-      strcat(ns, cs);
-    }
-    else
-    {
-      strcat(ns, curr->s);
-    }
+void sstream_split(struct sstream *ctx, char token,
+  vector(struct sstream*) *out)
+{
+  struct sstrview rest = sstream_view(ctx);
+  struct sstrview part = {0};
 
-    curr = curr->next;
-    if(tmp->s) free(tmp->s);
-    pfree(tmp);
-  }
+  while(sstrview_next(&rest, token, &part))
+  {
+    struct sstream *curr = sstream_new();
 
-  ctx->first = palloc(struct Chunk);
-  ctx->first->s = ns;
-  ctx->first->len = allocSize - 1;
+    sstream_push_chars(curr, (char *)part.s, part.len);
+    vector_push_back(out, curr);
+  }
 }
 
-char *sstream_cstr(struct sstream *ctx)
+struct sstrview sstream_view(struct sstream *ctx)
 {
-  sstream_collate(ctx);
+  struct sstrview rtn = {0};
 
-  /* TODO */
-  if(!ctx->first) return (char *)"";
+  rtn.s = sstream_cstr(ctx);
+  rtn.len = ctx->length;
 
-  return ctx->first->s;
+  return rtn;
 }
 
-size_t sstream_length(struct sstream *ctx)
+struct sstrview sstrview_cstr(const char *s)
 {
-  sstream_collate(ctx);
+  struct sstrview rtn = {0};
 
-  if(!ctx->first) return 0;
+  rtn.s = s;
+  rtn.len = strlen(s);
 
-  return ctx->first->len;
+  return rtn;
 }
 
-int sstream_int(struct sstream *ctx)
+/*
+ * Take the next token off the front of rest. Follows the same rules as
+ * sstream_split, empty tokens between separators are kept but a trailing
+ * empty token is not. Returns 0 once rest is exhausted.
+ */
+int sstrview_next(struct sstrview *rest, char token, struct sstrview *out)
 {
-  sstream_collate(ctx);
+  const char *found = NULL;
 
-  if(!ctx->first) return 0;
+  if(rest->len == 0) return 0;
 
-  return atoi(ctx->first->s);
+  found = (const char *)memchr(rest->s, token, rest->len);
+  out->s = rest->s;
+
+  if(!found)
+  {
+    out->len = rest->len;
+    rest->s += rest->len;
+    rest->len = 0;
+
+    return 1;
+  }
+
+  out->len = found - rest->s;
+  rest->len -= out->len + 1;
+  rest->s = found + 1;
+
+  return 1;
 }
 
-char sstream_at(struct sstream *ctx, size_t i)
+/*
+ * Fill out with up to max tokens of src. The return value is the total number
+ * of tokens which may be larger than max, in which case the remaining tokens
+ * were counted but not stored.
+ */
+size_t sstrview_split(struct sstrview src, char token,
+  struct sstrview *out, size_t max)
 {
-  sstream_collate(ctx);
+  struct sstrview part = {0};
+  size_t rtn = 0;
 
-  if(!ctx->first)
+  while(sstrview_next(&src, token, &part))
   {
-    printf("Error: Stream is empty\n");
-    abort();
-  }
+    if(rtn < max)
+    {
+      out[rtn] = part;
+    }
 
-  if(i >= ctx->first->len)
-  {
-    printf("Error: Index out of bounds\n");
-    abort();
+    rtn++;
   }
 
-  return ctx->first->s[i];
+  return rtn;
 }
 
-void sstream_push_chars(struct sstream *ctx, char *values, size_t count)
+int sstrview_equals(struct sstrview view, const char *s)
 {
-  char *tmp = NULL;
+  size_t len = strlen(s);
 
-  tmp = (char *)malloc(sizeof(char) * (count + 1));
-  tmp[count] = 0;
-  memcpy(tmp, values, sizeof(char) * count);
-  sstream_push_cstr(ctx, tmp);
+  if(len != view.len) return 0;
 
-  free(tmp);
+  return memcmp(view.s, s, len) == 0;
 }
 
-void sstream_split(struct sstream *ctx, char token,
-  vector(struct sstream*) *out)
+int sstrview_int(struct sstrview view)
 {
   size_t i = 0;
-  struct sstream *curr = NULL;
+  int negative = 0;
+  int rtn = 0;
 
-  curr = sstream_new();
-
-  for(i = 0; i < sstream_length(ctx); i++)
+  while(i < view.len && (view.s[i] == ' ' || view.s[i] == '\t'))
   {
-    if(sstream_at(ctx, i) == token)
-    {
-      vector_push_back(out, curr);
-      curr = sstream_new();
-    }
-    else
-    {
-      sstream_push_char(curr, sstream_at(ctx, i));
-    }
+    i++;
   }
 
-  if(sstream_length(curr) > 0)
+  if(i < view.len && (view.s[i] == '-' || view.s[i] == '+'))
   {
-    vector_push_back(out, curr);
+    negative = view.s[i] == '-';
+    i++;
   }
-  else
+
+  for(; i < view.len && view.s[i] >= '0' && view.s[i] <= '9'; i++)
   {
-    sstream_delete(curr);
+    rtn = rtn * 10 + (view.s[i] - '0');
   }
+
+  return negative ? -rtn : rtn;
 }
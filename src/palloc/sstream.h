@@ -7,26 +7,62 @@
 
 #include <stdlib.h>
 
-struct Chunk
-{
-  struct Chunk *next;
-  char c;
-  char *s;
-  size_t len;
-};
+/* Bytes stored inline before a stream moves its contents to the heap */
+#define SSTREAM_LOCAL_SIZE 24
 
+/*
+ * Contiguous, always null terminated character buffer. The capacity grows
+ * geometrically so that appends are amortized O(1) and the length and
+ * c-string are available without any further work. Short strings (names,
+ * keys, url parts) live in the local buffer and need no extra allocation.
+ */
 struct sstream
 {
-  struct Chunk *first;
+  char *data;
+  size_t length;
+  size_t capacity;
+  char local[SSTREAM_LOCAL_SIZE];
 };
 
 typedef struct sstream sstream;
 
+/*
+ * Non-owning view of a run of characters, not necessarily null terminated.
+ * Views handed out by the functions below point into the source string and
+ * are only valid for as long as that string is left untouched.
+ */
+struct sstrview
+{
+  const char *s;
+  size_t len;
+};
+
+/*
+ * Writable view of the unused tail of a stream. Obtained through
+ * sstream_builder_begin() so that serializers can write straight into the
+ * stream. The remaining count includes the byte reserved for the null
+ * terminator so it can be passed to functions that write one. Once done,
+ * sstream_builder_commit() appends the written characters.
+ */
+struct sstream_builder
+{
+  struct sstream *ctx;
+  char *tail;
+  size_t remaining;
+};
+
 struct sstream *sstream_new();
 void sstream_delete(struct sstream *ctx);
 
 void sstream_clear(struct sstream *ctx);
+/* Drops everything past the first length characters */
+void sstream_truncate(struct sstream *ctx, size_t length);
 size_t sstream_length(struct sstream *ctx);
+size_t sstream_capacity(struct sstream *ctx);
+void sstream_reserve(struct sstream *ctx, size_t capacity);
+
+struct sstream_builder sstream_builder_begin(struct sstream *ctx, size_t count);
+void sstream_builder_commit(struct sstream_builder *builder, size_t count);
 
 void sstream_push_cstr(struct sstream *ctx, const char *s);
 void sstream_push_int(struct sstream *ctx, int val);
@@ -42,4 +78,14 @@ int sstream_int(struct sstream *ctx);
 void sstream_split(struct sstream *ctx, char token,
   vector(struct sstream*) *out);
 
+struct sstrview sstream_view(struct sstream *ctx);
+struct sstrview sstrview_cstr(const char *s);
+
+int sstrview_next(struct sstrview *rest, char token, struct sstrview *out);
+size_t sstrview_split(struct sstrview src, char token,
+  struct sstrview *out, size_t max);
+
+int sstrview_equals(struct sstrview view, const char *s);
+int sstrview_int(struct sstrview view);
+
 #endif
@@ -5,20 +5,15 @@
 
 #include <string.h>
 
-void *_VectorNew(size_t size, const char *type)
+/* The type strings are literals built by vector_new, palloc keys its
+ * statistics on their addresses.
+ */
+void *_VectorNew(size_t size, const char *type, const char *headerType)
 {
   struct _Vector *rtn = NULL;
-  char typeStr[256] = {0};
 
-  strcpy(typeStr, "vector(");
-  strcat(typeStr, type);
-  strcat(typeStr, ")");
-  rtn = (struct _Vector *)_palloc(sizeof(*rtn), typeStr);
-
-  strcpy(typeStr, "vector_header(");
-  strcat(typeStr, type);
-  strcat(typeStr, ")");
-  rtn->vh = (struct _VectorHeader *)_palloc(sizeof(*rtn->vh), typeStr);
+  rtn = (struct _Vector *)_palloc(sizeof(*rtn), type);
+  rtn->vh = (struct _VectorHeader *)_palloc(sizeof(*rtn->vh), headerType);
   rtn->vh->entrySize = size;
 
   return rtn;
@@ -38,76 +33,175 @@ int _VectorOobAssert(void *_vh, size_t idx)
 }
 
 void _VectorErase(void *_vh, void *_v, size_t idx)
+{
+  _VectorOobAssert(_vh, idx);
+  _VectorEraseRange(_vh, _v, idx, 1);
+}
+
+void _VectorEraseRange(void *_vh, void *_v, size_t idx, size_t count)
 {
   struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
   struct _Vector *v = (struct _Vector *)_v;
-  size_t restSize = (vh->size - (idx + 1)) * vh->entrySize;
+  size_t restSize = 0;
 
-  _VectorOobAssert(_vh, idx);
+  if(idx > vh->size || count > vh->size - idx)
+  {
+    printf("Error: Index out of bounds\n");
+    return;
+  }
+
+  restSize = (vh->size - (idx + count)) * vh->entrySize;
 
   if(restSize > 0)
   {
     char *element = (char *)v->data + idx * vh->entrySize;
-    char *rest = element + vh->entrySize;
+    char *rest = element + count * vh->entrySize;
     memmove(element, rest, restSize);
   }
 
-  vh->size --;
+  vh->size -= count;
+}
+
+#define VECTOR_MIN_CAPACITY 4
+
+/* Reallocate storage to exactly capacity entries */
+static int _VectorRealloc(struct _VectorHeader *vh, struct _Vector *v,
+  size_t capacity)
+{
+  void *data = NULL;
+
+  data = palloc_buffer(v->data, vh->capacity * vh->entrySize,
+    capacity * vh->entrySize, "vector data");
+
+  if(capacity == 0)
+  {
+    v->data = NULL;
+    vh->capacity = 0;
+
+    return 1;
+  }
+
+  if(!data)
+  {
+    printf("Error: Failed to reallocate\n");
+    return 0;
+  }
+
+  v->data = data;
+  vh->capacity = capacity;
+
+  return 1;
+}
+
+/* Make room for size entries, at least doubling the capacity if it grows */
+static int _VectorGrow(struct _VectorHeader *vh, struct _Vector *v,
+  size_t size)
+{
+  size_t capacity = vh->capacity * 2;
+
+  if(size <= vh->capacity)
+  {
+    return 1;
+  }
+
+  if(capacity < VECTOR_MIN_CAPACITY)
+  {
+    capacity = VECTOR_MIN_CAPACITY;
+  }
+
+  if(capacity < size)
+  {
+    capacity = size;
+  }
+
+  return _VectorRealloc(vh, v, capacity);
 }
 
+/*
+ * Shrinking only adjusts the size so the storage can be reused by the next
+ * batch. Growing past the capacity at least doubles it which keeps
+ * vector_push_back amortized O(1). New entries are zeroed.
+ */
 void _VectorResize(void *_vh, void *_v, size_t size)
 {
   struct _Vector *v = (struct _Vector *)_v;
   struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
 
-  if(vh->size == size)
+  if(!_VectorGrow(vh, v, size))
   {
     return;
   }
-  else if(size == 0)
+
+  if(size > vh->size)
   {
-    if(v->data)
-    {
-      free(v->data);
-      v->data = NULL;
-    }
+    memset((char *)v->data + vh->size * vh->entrySize, 0,
+      (size - vh->size) * vh->entrySize);
   }
-  else if(vh->size > size)
+
+  vh->size = size;
+}
+
+void _VectorInsertRange(void *_vh, void *_v, size_t idx, const void *src,
+  size_t count)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+  char *element = NULL;
+
+  if(idx > vh->size)
   {
-    v->data = realloc(v->data, size * vh->entrySize);
+    printf("Error: Index out of bounds\n");
+    return;
+  }
 
-    if(!v->data)
-    {
-      /* TODO: Should cache and revert */
-      printf("Error: Failed to reallocate\n");
-    }
+  if(count == 0 || !_VectorGrow(vh, v, vh->size + count))
+  {
+    return;
   }
-  else if(vh->size < size)
+
+  element = (char *)v->data + idx * vh->entrySize;
+
+  if(idx < vh->size)
   {
-    char *cur = NULL;
-    char *last = NULL;
+    memmove(element + count * vh->entrySize, element,
+      (vh->size - idx) * vh->entrySize);
+  }
+
+  memcpy(element, src, count * vh->entrySize);
+  vh->size += count;
+}
+
+void _VectorReserve(void *_vh, void *_v, size_t capacity)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
 
-    v->data = realloc(v->data, size * vh->entrySize);
+  if(capacity <= vh->capacity)
+  {
+    return;
+  }
 
-    if(!v->data)
-    {
-      /* TODO: Should cache and revert */
-      printf("Error: Failed to reallocate\n");
-    }
+  _VectorRealloc(vh, v, capacity);
+}
 
-    cur = (char *)v->data;
-    cur += vh->size * vh->entrySize;
-    last = (char *)v->data;
-    last += size * vh->entrySize;
+void _VectorShrinkToFit(void *_vh, void *_v)
+{
+  struct _Vector *v = (struct _Vector *)_v;
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
 
-    while(cur != last)
-    {
-      *cur = 0;
-      cur++;
-    }
+  if(vh->capacity == vh->size)
+  {
+    return;
   }
 
-  vh->size = size;
+  _VectorRealloc(vh, v, vh->size);
+}
+
+size_t _VectorCapacity(void *_vh)
+{
+  struct _VectorHeader *vh = (struct _VectorHeader *)_vh;
+
+  return vh->capacity;
 }
 
 size_t _VectorSize(void *_vh)
@@ -127,10 +221,7 @@ void _VectorDelete(void *_vh, void *_v)
     printf("Error: Invalid vector\n");
   }
 
-  if(v->data)
-  {
-    free(v->data);
-  }
+  palloc_buffer(v->data, vh->capacity * vh->entrySize, 0, "vector data");
 
   pfree(vh);
   pfree(v);
@@ -1,12 +1,26 @@
 #ifndef PALLOC_VECTOR_H
 #define PALLOC_VECTOR_H
 
+#ifndef AMALGAMATION
+  #include "palloc.h"
+#endif
+
+/*
+ * Element access is bounds checked when PALLOC_VECTOR_CHECKED is defined (or
+ * implied by PALLOC_ACTIVE). Otherwise vector_at, vector_set and vector_size
+ * compile down to plain indexing with no function call.
+ */
+#if defined(PALLOC_ACTIVE) && !defined(PALLOC_VECTOR_CHECKED)
+  #define PALLOC_VECTOR_CHECKED
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 
 struct _VectorHeader
 {
   size_t size;
+  size_t capacity;
   size_t entrySize;
 };
 
@@ -19,25 +33,45 @@ struct _Vector
 #define vector(T) \
   T*
 
-void *_VectorNew(size_t size, const char *type);
+void *_VectorNew(size_t size, const char *type, const char *headerType);
 int _VectorOobAssert(void *_vh, size_t idx);
 void _VectorErase(void *_vh, void *_v, size_t idx);
+void _VectorEraseRange(void *_vh, void *_v, size_t idx, size_t count);
+void _VectorInsertRange(void *_vh, void *_v, size_t idx, const void *src,
+  size_t count);
 void _VectorResize(void *_vh, void *_v, size_t size);
+void _VectorReserve(void *_vh, void *_v, size_t capacity);
+void _VectorShrinkToFit(void *_vh, void *_v);
 size_t _VectorSize(void *_vh);
+size_t _VectorCapacity(void *_vh);
 void _VectorDelete(void *_vh, void *_v);
 
 #define vector_new(T) \
-  (vector(T) *)_VectorNew(sizeof(T), #T)
+  (vector(T) *)_VectorNew(sizeof(T), "vector(" #T ")", \
+    "vector_header(" #T ")")
 
 #define vector_delete(V) \
   _VectorDelete(V[0], V)
 
+#define _vector_header(V) \
+  ((struct _VectorHeader *)(void *)V[0])
+
 #define vector_size(V) \
-  _VectorSize(V[0])
+  (_vector_header(V)->size)
 
 #define vector_resize(V, S) \
   _VectorResize(V[0], V, S)
 
+#define vector_capacity(V) \
+  (_vector_header(V)->capacity)
+
+#define vector_reserve(V, S) \
+  _VectorReserve(V[0], V, S)
+
+#define vector_shrink_to_fit(V) \
+  _VectorShrinkToFit(V[0], V)
+
+#ifdef PALLOC_VECTOR_CHECKED
 #define vector_set(V, I, D) \
   do { \
     if(vector_size(V) <= I) { \
@@ -48,6 +82,15 @@ void _VectorDelete(void *_vh, void *_v);
 
 #define vector_at(V, I) \
   (_VectorOobAssert(V[0], I) ? V[1][I] : V[1][I])
+#else
+#define vector_set(V, I, D) \
+  do { \
+    V[1][I] = D; \
+  } while(0)
+
+#define vector_at(V, I) \
+  (V[1][I])
+#endif
 
 #define vector_raw(V) \
   V[1]
@@ -55,16 +98,37 @@ void _VectorDelete(void *_vh, void *_v);
 #define vector_data(V) \
   V[1]
 
+/*
+ * Walk the entries with a pointer, IT must be declared as a pointer to the
+ * element type. The vector must not be resized while iterating.
+ *
+ *   struct bgCollection **it = NULL;
+ *   vector_foreach(it, bg->collections) { ... (*it)->name ... }
+ */
+#define vector_foreach(IT, V) \
+  for(IT = vector_raw(V); IT != vector_raw(V) + vector_size(V); IT++)
+
 #define vector_push_back(V, D) \
   do { \
     vector_resize(V, vector_size(V) + 1); \
     vector_set(V, vector_size(V) - 1, D); \
   } while(0)
 
+/* Keeps the capacity, use vector_shrink_to_fit to release it */
 #define vector_clear(V) \
   vector_resize(V, 0)
 
 #define vector_erase(V, I) \
   _VectorErase(V[0], V, I)
 
+/* Bulk operations, each moves the data with a single memcpy/memmove */
+#define vector_erase_range(V, I, C) \
+  _VectorEraseRange(V[0], V, I, C)
+
+#define vector_insert_range(V, I, P, C) \
+  _VectorInsertRange(V[0], V, I, P, C)
+
+#define vector_append(V, P, C) \
+  _VectorInsertRange(V[0], V, vector_size(V), P, C)
+
 #endif